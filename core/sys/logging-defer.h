@@ -0,0 +1,78 @@
+#ifndef LOGGING_DEFER_H
+#define LOGGING_DEFER_H
+
+#include <stdint.h>
+#include "contiki-conf.h"
+
+/*
+ * Deferred logging.
+ *
+ * LOG_DEFER(format, ...) does not print: it stores the address of the format
+ * string and the raw arguments in a lock-free ring buffer, which is safe to
+ * use from interrupt context. The logging process drains the buffer when the
+ * system is idle, either printing the text or, with LOGGING_CONF_BINARY,
+ * writing binary records that tools/logdecode.py turns back into text using
+ * the ELF file of the application.
+ *
+ * Arguments are stored as logging_arg_t (pointer-sized) words, so only
+ * integer arguments up to that size, characters and constant strings (%s
+ * of literals) are supported, at most LOGGING_MAX_ARGS of them. Use the
+ * printf mode for 64-bit integers, floating point and non-constant strings.
+ *
+ * The ERR/WARN/INFO/DBG macros of logging.h use LOG_DEFER() when LOG_DEFERRED
+ * is set, globally through LOGGING_CONF_DEFERRED or before including
+ * logging.h. The platform starts the logging process with logging_init().
+ */
+#ifdef LOGGING_CONF_DEFERRED
+#define LOGGING_DEFERRED LOGGING_CONF_DEFERRED
+#else
+#define LOGGING_DEFERRED 0
+#endif
+
+// size of the ring buffer in words (power of two)
+#ifdef LOGGING_CONF_BUF_LEN
+#define LOGGING_BUF_LEN LOGGING_CONF_BUF_LEN
+#else
+#define LOGGING_BUF_LEN 256
+#endif
+
+#if (LOGGING_BUF_LEN & (LOGGING_BUF_LEN - 1)) != 0
+#error LOGGING_BUF_LEN must be a power of two
+#endif
+
+#define LOGGING_MAX_ARGS 8
+
+typedef uintptr_t logging_arg_t;
+
+/* Start the logging process draining the deferred records */
+void logging_init(void);
+
+/* Print all the pending deferred records (blocking) */
+void logging_flush(void);
+
+/* Store a record; called by LOG_DEFER() */
+void logging_defer(const char *format, unsigned int n_args, const logging_arg_t *args);
+
+#define __LOGGING_N(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define __LOGGING_NARGS(...) __LOGGING_N(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, __LOGGING_TOO_MANY_ARGS)
+#define __LOGGING_CAT(a, b) a ## b
+#define __LOGGING_XCAT(a, b) __LOGGING_CAT(a, b)
+#define __LOGGING_A(x) (logging_arg_t)(x)
+#define __LOGGING_ARGS1(a) __LOGGING_A(a)
+#define __LOGGING_ARGS2(a, ...) __LOGGING_A(a), __LOGGING_ARGS1(__VA_ARGS__)
+#define __LOGGING_ARGS3(a, ...) __LOGGING_A(a), __LOGGING_ARGS2(__VA_ARGS__)
+#define __LOGGING_ARGS4(a, ...) __LOGGING_A(a), __LOGGING_ARGS3(__VA_ARGS__)
+#define __LOGGING_ARGS5(a, ...) __LOGGING_A(a), __LOGGING_ARGS4(__VA_ARGS__)
+#define __LOGGING_ARGS6(a, ...) __LOGGING_A(a), __LOGGING_ARGS5(__VA_ARGS__)
+#define __LOGGING_ARGS7(a, ...) __LOGGING_A(a), __LOGGING_ARGS6(__VA_ARGS__)
+#define __LOGGING_ARGS8(a, ...) __LOGGING_A(a), __LOGGING_ARGS7(__VA_ARGS__)
+#define __LOGGING_ARGS(...) __LOGGING_XCAT(__LOGGING_ARGS, __LOGGING_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+// Deferred printf: the format string is printed as is
+#define LOG_DEFER(format, ...) do { \
+    static const char __logging_fmt[] = format; \
+    const logging_arg_t __logging_args[] = {0 __VA_OPT__(, __LOGGING_ARGS(__VA_ARGS__))}; \
+    logging_defer(__logging_fmt, sizeof(__logging_args) / sizeof(logging_arg_t) - 1, __logging_args + 1); \
+  } while(0)
+
+#endif //LOGGING_DEFER_H
@@ -1,4 +1,175 @@
+#include "contiki.h"
 #include "logging.h"
 
+#include <stdio.h>
+
 uint32_t logging_context;
 
+/*
+ * Deferred logging ring buffer.
+ *
+ * A record takes 2 + n_args words: a header (magic and number of arguments),
+ * the format string address and the arguments. Producers (any context,
+ * interrupts included) reserve space by atomically advancing the head, fill
+ * in the record and publish it by writing the header last. The logging
+ * process is the only consumer: it stops at the first record that is not
+ * published yet and clears the records it consumes.
+ */
+
+#ifdef LOGGING_CONF_BINARY
+#define LOGGING_BINARY LOGGING_CONF_BINARY
+#else
+#define LOGGING_BINARY 0
+#endif
+
+// records printed before yielding to the other processes
+#ifdef LOGGING_CONF_DRAIN_BATCH
+#define LOGGING_DRAIN_BATCH LOGGING_CONF_DRAIN_BATCH
+#else
+#define LOGGING_DRAIN_BATCH 4
+#endif
+
+#define LOGGING_HDR_MAGIC   0x4C470000UL
+#define LOGGING_HDR_MASK    0xFFFF0000UL
+
+// binary records: LOGGING_BIN_SYNC, n_args (0xFF: dropped records),
+// format address and arguments as 32-bit little-endian words
+#define LOGGING_BIN_SYNC    "\x1bL"
+#define LOGGING_BIN_DROPPED 0xFF
+
+#define LOGGING_MASK        (LOGGING_BUF_LEN - 1)
+
+static logging_arg_t ring[LOGGING_BUF_LEN];
+static uint32_t head;     // next word to reserve
+static uint32_t tail;     // next word to consume
+static uint32_t dropped;  // records lost because the buffer was full
+static uint32_t dropped_reported;
+
+PROCESS(logging_process, "Deferred logging");
+/*---------------------------------------------------------------------------*/
+void
+logging_defer(const char *format, unsigned int n_args, const logging_arg_t *args)
+{
+  uint32_t h, n = n_args + 2;
+  unsigned int i;
+
+  h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+  do {
+    if(h + n - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) > LOGGING_BUF_LEN) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while(!__atomic_compare_exchange_n(&head, &h, h + n, 1,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  ring[(h + 1) & LOGGING_MASK] = (logging_arg_t)format;
+  for(i = 0; i < n_args; i++) {
+    ring[(h + 2 + i) & LOGGING_MASK] = args[i];
+  }
+  __atomic_store_n(&ring[h & LOGGING_MASK], LOGGING_HDR_MAGIC | n_args, __ATOMIC_RELEASE);
+
+  process_poll(&logging_process);
+}
+/*---------------------------------------------------------------------------*/
+#if LOGGING_BINARY
+static void
+put_word(uint32_t w)
+{
+  putchar(w & 0xFF);
+  putchar((w >> 8) & 0xFF);
+  putchar((w >> 16) & 0xFF);
+  putchar((w >> 24) & 0xFF);
+}
+#endif
+/*---------------------------------------------------------------------------*/
+static void
+report_dropped(void)
+{
+  uint32_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+
+  if(d == dropped_reported) {
+    return;
+  }
+#if LOGGING_BINARY
+  fputs(LOGGING_BIN_SYNC, stdout);
+  putchar(LOGGING_BIN_DROPPED);
+  put_word(d - dropped_reported);
+#else
+  printf("[logging]WARN:%lu records dropped\n", (unsigned long)(d - dropped_reported));
+#endif
+  dropped_reported = d;
+}
+/*---------------------------------------------------------------------------*/
+/* Print the record at the tail, return 0 if there is none */
+static int
+drain_one(void)
+{
+  logging_arg_t a[LOGGING_MAX_ARGS] = {0};
+  const char *format;
+  uint32_t t = tail;
+  unsigned int i, n;
+  logging_arg_t hdr = __atomic_load_n(&ring[t & LOGGING_MASK], __ATOMIC_ACQUIRE);
+
+  if((hdr & LOGGING_HDR_MASK) != LOGGING_HDR_MAGIC) {
+    return 0;
+  }
+  n = hdr & ~LOGGING_HDR_MASK;
+  format = (const char *)ring[(t + 1) & LOGGING_MASK];
+  for(i = 0; i < n && i < LOGGING_MAX_ARGS; i++) {
+    a[i] = ring[(t + 2 + i) & LOGGING_MASK];
+  }
+  // clear the whole record: a stale word must never look like a header
+  for(i = 0; i < n + 2; i++) {
+    ring[(t + i) & LOGGING_MASK] = 0;
+  }
+  __atomic_store_n(&tail, t + n + 2, __ATOMIC_RELEASE);
+
+#if LOGGING_BINARY
+  fputs(LOGGING_BIN_SYNC, stdout);
+  putchar(n);
+  put_word((uint32_t)(uintptr_t)format);
+  for(i = 0; i < n; i++) {
+    put_word((uint32_t)a[i]);
+  }
+#else
+  printf(format, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+#endif
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+logging_flush(void)
+{
+  while(drain_one());
+  report_dropped();
+}
+/*---------------------------------------------------------------------------*/
+void
+logging_init(void)
+{
+  process_start(&logging_process, NULL);
+  // print what was logged before starting
+  process_poll(&logging_process);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(logging_process, ev, data)
+{
+  int i;
+
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+
+    for(i = 0; i < LOGGING_DRAIN_BATCH && drain_one(); i++);
+    report_dropped();
+
+    if(__atomic_load_n(&ring[tail & LOGGING_MASK], __ATOMIC_ACQUIRE) != 0) {
+      // let the other processes run before printing the rest
+      process_poll(&logging_process);
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
@@ -39,10 +39,24 @@
 
 extern uint32_t logging_context;
 
+// LOG_DEFERRED: store the log records in a buffer drained at idle time
+// instead of printing them right away (see logging-defer.h)
+#include "logging-defer.h"
+
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED LOGGING_DEFERRED
+#endif
+
+#if LOG_DEFERRED
+#define __LOG_OUT(...) LOG_DEFER(__VA_ARGS__)
+#else
+#define __LOG_OUT(...) LOG_PRINTF(__VA_ARGS__)
+#endif
+
 #if LOG_PRINT_CONTEXT
-#define __LOG_PRINT(format, level, ...) do {LOG_PRINTF("[" LOG_PREFIX " %lx]" level format "\n", logging_context __VA_OPT__(,) __VA_ARGS__);} while(0)
+#define __LOG_PRINT(format, level, ...) do {__LOG_OUT("[" LOG_PREFIX " %lx]" level format "\n", logging_context __VA_OPT__(,) __VA_ARGS__);} while(0)
 #else
-#define __LOG_PRINT(format, level, ...) do {LOG_PRINTF("[" LOG_PREFIX "]" level format "\n" __VA_OPT__(,) __VA_ARGS__);} while(0)
+#define __LOG_PRINT(format, level, ...) do {__LOG_OUT("[" LOG_PREFIX "]" level format "\n" __VA_OPT__(,) __VA_ARGS__);} while(0)
 #endif
 
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Contiki clock for the native-uwb CPU, based on CLOCK_MONOTONIC
+ */
+
+#include "contiki.h"
+#include "sys/clock.h"
+#include "sys/etimer.h"
+#include "native-irq.h"
+/*---------------------------------------------------------------------------*/
+#define PS_PER_TICK (1000000000000ULL / CLOCK_SECOND)
+/*---------------------------------------------------------------------------*/
+static clock_time_t polled_for;
+static int polled;
+/*---------------------------------------------------------------------------*/
+/* Tick interrupt emulation: poll the etimer process when the next etimer
+ * expires, once per expiration time. */
+static uint64_t
+etimer_deadline(void)
+{
+  clock_time_t t;
+
+  if(!etimer_pending()) {
+    return NATIVE_TIME_NEVER;
+  }
+  t = etimer_next_expiration_time();
+  if(polled && t == polled_for) {
+    return NATIVE_TIME_NEVER;
+  }
+  return (uint64_t)t * PS_PER_TICK;
+}
+/*---------------------------------------------------------------------------*/
+static void
+etimer_service(void)
+{
+  polled_for = etimer_next_expiration_time();
+  polled = 1;
+  etimer_request_poll();
+}
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source etimer_source = {
+  NULL, etimer_deadline, etimer_service, 0
+};
+/*---------------------------------------------------------------------------*/
+void
+clock_init(void)
+{
+  native_irq_init();
+  native_irq_add(&etimer_source);
+}
+/*---------------------------------------------------------------------------*/
+CCIF clock_time_t
+clock_time(void)
+{
+  return (clock_time_t)(native_time_ps() / PS_PER_TICK);
+}
+/*---------------------------------------------------------------------------*/
+CCIF unsigned long
+clock_seconds(void)
+{
+  return (unsigned long)(native_time_ps() / 1000000000000ULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+clock_set_seconds(unsigned long sec)
+{
+  /* Not supported */
+}
+/*---------------------------------------------------------------------------*/
+void
+clock_wait(clock_time_t t)
+{
+  native_time_wait_until(((uint64_t)clock_time() + t) * PS_PER_TICK);
+}
+/*---------------------------------------------------------------------------*/
+void
+clock_delay_usec(uint16_t dt)
+{
+  native_time_wait_until(native_time_ps() + dt * NATIVE_PS_PER_US);
+}
+/*---------------------------------------------------------------------------*/
+void
+clock_update(void)
+{
+  /* the event queue is empty: the etimer process has served the poll */
+  polled = 0;
+  native_irq_update();
+}
+/*---------------------------------------------------------------------------*/
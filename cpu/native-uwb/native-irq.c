@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Emulated interrupts for the native-uwb CPU.
+ *
+ *      In real-time mode the time is CLOCK_MONOTONIC and interrupts are
+ *      delivered by SIGALRM. In virtual-time mode (set by a scheduler,
+ *      e.g. the multi-node simulator) the CPU executes in zero time:
+ *      time only advances when the code consumes it explicitly (SPI
+ *      transactions, busy waits) or when the CPU is idle, and interrupts
+ *      are served synchronously at those points.
+ */
+
+#define _GNU_SOURCE
+#include "native-irq.h"
+#include "contiki.h"
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+/*---------------------------------------------------------------------------*/
+/* Reads of the virtual clock without time passing in between that are
+ * considered a busy-wait loop; each further read then costs SPIN_STEP. */
+#define SPIN_LIMIT    64
+#define SPIN_STEP_PS  NATIVE_PS_PER_US
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source *sources;
+static struct timespec boot;
+static timer_t timer;
+static volatile int in_dispatch;
+
+static const struct native_irq_scheduler *sched;
+static uint64_t vnow;
+static uint64_t horizon;
+static int vmasked;
+static unsigned spin;
+static int quiet;
+/*---------------------------------------------------------------------------*/
+static void advance(uint64_t t);
+/*---------------------------------------------------------------------------*/
+uint64_t
+native_time_ps(void)
+{
+  struct timespec ts;
+
+  if(sched != NULL) {
+    if(!in_dispatch && !quiet && ++spin > SPIN_LIMIT) {
+      advance(vnow + SPIN_STEP_PS);
+    }
+    return vnow;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)(ts.tv_sec - boot.tv_sec) * 1000000000000ULL
+         + (int64_t)(ts.tv_nsec - boot.tv_nsec) * 1000;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t
+native_time_peek(void)
+{
+  uint64_t t;
+
+  quiet++;
+  t = native_time_ps();
+  quiet--;
+  return t;
+}
+/*---------------------------------------------------------------------------*/
+static void
+arm(uint64_t deadline)
+{
+  struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+  if(sched != NULL) {
+    /* the scheduler asks for the deadline when the CPU yields */
+    return;
+  }
+  if(deadline != NATIVE_TIME_NEVER) {
+    uint64_t ns = deadline / 1000 + (deadline % 1000 ? 1 : 0);
+    its.it_value.tv_sec = boot.tv_sec + ns / 1000000000ULL;
+    its.it_value.tv_nsec = boot.tv_nsec + ns % 1000000000ULL;
+    if(its.it_value.tv_nsec >= 1000000000L) {
+      its.it_value.tv_sec++;
+      its.it_value.tv_nsec -= 1000000000L;
+    }
+  }
+  timer_settime(timer, TIMER_ABSTIME, &its, NULL);
+}
+/*---------------------------------------------------------------------------*/
+/* Serve all the sources that are due, then arm the timer for the earliest
+ * deadline. Must be called with interrupts masked. */
+static void
+dispatch(void)
+{
+  struct native_irq_source *s;
+  uint64_t next;
+  int served;
+
+  if(in_dispatch) {
+    /* a service routine changed a deadline, the loop below takes care */
+    return;
+  }
+  in_dispatch = 1;
+  do {
+    uint64_t now = native_time_ps();
+    served = 0;
+    next = NATIVE_TIME_NEVER;
+    for(s = sources; s != NULL; s = s->next) {
+      uint64_t d = s->deadline();
+      if(d <= now) {
+        s->service();
+        served = 1;
+      } else if(d < next) {
+        next = d;
+      }
+    }
+  } while(served);
+  arm(next);
+  in_dispatch = 0;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t
+native_irq_next_deadline(int all)
+{
+  struct native_irq_source *s;
+  uint64_t next = NATIVE_TIME_NEVER;
+
+  quiet++;
+  for(s = sources; s != NULL; s = s->next) {
+    if(all || s->background) {
+      uint64_t d = s->deadline();
+      if(d < next) {
+        next = d;
+      }
+    }
+  }
+  quiet--;
+  return next;
+}
+/*---------------------------------------------------------------------------*/
+/* Virtual time, interrupts masked: serve the background sources only */
+static void
+serve_background(void)
+{
+  struct native_irq_source *s;
+  int served;
+
+  do {
+    served = 0;
+    for(s = sources; s != NULL; s = s->next) {
+      if(s->background && s->deadline() <= vnow) {
+        s->service();
+        served = 1;
+      }
+    }
+  } while(served);
+}
+/*---------------------------------------------------------------------------*/
+/* Virtual time: move the clock to t, serving the interrupts that become
+ * due on the way if they are not masked. */
+static void
+advance(uint64_t t)
+{
+  spin = 0;
+  while(vnow < t) {
+    uint64_t step = t;
+    int preemptible = !vmasked && !in_dispatch;
+    uint64_t d = native_irq_next_deadline(preemptible);
+
+    if(d > vnow && d < step) {
+      step = d;
+    }
+    if(step >= horizon) {
+      vnow = sched->yield(step, preemptible, &horizon);
+    } else {
+      vnow = step;
+    }
+    if(preemptible) {
+      vmasked = 1;
+      dispatch();
+      vmasked = 0;
+    } else {
+      quiet++;
+      serve_background();
+      quiet--;
+    }
+  }
+  spin = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+sigalrm_handler(int sig)
+{
+  (void)sig;
+  ENERGEST_ON(ENERGEST_TYPE_IRQ);
+  dispatch();
+  ENERGEST_OFF(ENERGEST_TYPE_IRQ);
+}
+/*---------------------------------------------------------------------------*/
+int
+native_irq_disable(void)
+{
+  sigset_t set, old;
+  int state;
+
+  if(sched != NULL) {
+    state = !vmasked;
+    vmasked = 1;
+    return state;
+  }
+  sigemptyset(&set);
+  sigaddset(&set, SIGALRM);
+  sigprocmask(SIG_BLOCK, &set, &old);
+  return !sigismember(&old, SIGALRM);
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_restore(int state)
+{
+  sigset_t set;
+
+  if(!state) {
+    return;
+  }
+  if(sched != NULL) {
+    vmasked = 0;
+    if(!in_dispatch && native_irq_next_deadline(1) <= vnow) {
+      vmasked = 1;
+      dispatch();
+      vmasked = 0;
+    }
+    return;
+  }
+  sigemptyset(&set);
+  sigaddset(&set, SIGALRM);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_update(void)
+{
+  int state = native_irq_disable();
+  if(sched == NULL || state) {
+    dispatch();
+  }
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_wait(void)
+{
+  sigset_t set;
+
+  if(sched != NULL) {
+    uint64_t d = native_irq_next_deadline(1);
+    spin = 0;
+    if(d > vnow) {
+      vnow = sched->yield(d, 1, &horizon);
+    }
+    dispatch();
+  } else {
+    sigprocmask(SIG_SETMASK, NULL, &set);
+    sigdelset(&set, SIGALRM);
+    sigsuspend(&set);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_idle(void)
+{
+  int state = native_irq_disable();
+
+  if(process_nevents() == 0) {
+    native_irq_wait();
+  }
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+void
+native_time_consume(uint64_t ps)
+{
+  if(sched != NULL) {
+    advance(vnow + ps);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+native_time_wait_until(uint64_t t)
+{
+  if(sched != NULL) {
+    advance(t);
+    return;
+  }
+  while(native_time_ps() < t) {
+    if(t - native_time_ps() > 100 * NATIVE_PS_PER_US) {
+      struct timespec ts = { 0, 50000 };
+      nanosleep(&ts, NULL);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_set_horizon(uint64_t h)
+{
+  if(h < horizon) {
+    horizon = h;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_add(struct native_irq_source *source)
+{
+  int state = native_irq_disable();
+
+  source->next = sources;
+  sources = source;
+  native_irq_restore(state);
+  native_irq_update();
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_set_scheduler(const struct native_irq_scheduler *scheduler,
+                         uint64_t now, uint64_t h)
+{
+  sched = scheduler;
+  vnow = now;
+  horizon = h;
+}
+/*---------------------------------------------------------------------------*/
+void
+native_irq_init(void)
+{
+  struct sigaction sa;
+  struct sigevent sev;
+
+  clock_gettime(CLOCK_MONOTONIC, &boot);
+  if(sched != NULL) {
+    return;
+  }
+
+  sa.sa_handler = sigalrm_handler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+
+  sev.sigev_notify = SIGEV_SIGNAL;
+  sev.sigev_signo = SIGALRM;
+  sev.sigev_value.sival_ptr = &timer;
+  if(timer_create(CLOCK_MONOTONIC, &sev, &timer) != 0) {
+    perror("timer_create");
+    exit(EXIT_FAILURE);
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Emulated interrupts for the native-uwb CPU.
+ *
+ *      Peripherals (clock, rtimer, radio) register an interrupt source
+ *      with the time of their next event. A single POSIX timer raising
+ *      SIGALRM is armed at the earliest deadline; its handler runs the
+ *      service routine of every source that is due. Masking interrupts
+ *      means blocking SIGALRM.
+ *
+ *      An external scheduler can take over the time base (virtual time):
+ *      the CPU then runs in zero time and hands control back to the
+ *      scheduler whenever it needs the time to advance past the horizon
+ *      the scheduler granted.
+ *
+ *      All times are in picoseconds since boot.
+ */
+
+#ifndef NATIVE_IRQ_H_
+#define NATIVE_IRQ_H_
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+/*---------------------------------------------------------------------------*/
+#define NATIVE_TIME_NEVER   UINT64_MAX
+#define NATIVE_PS_PER_US    1000000ULL
+#define NATIVE_PS_PER_MS    1000000000ULL
+/*---------------------------------------------------------------------------*/
+struct native_irq_source {
+  struct native_irq_source *next;
+  /* Next time the service routine must run, NATIVE_TIME_NEVER if none */
+  uint64_t (*deadline)(void);
+  /* Interrupt service routine, called with interrupts masked */
+  void (*service)(void);
+  /* Not an interrupt but a peripheral activity (e.g. the radio state
+   * machine): in virtual time it is served even with interrupts masked */
+  int background;
+};
+struct native_irq_scheduler {
+  /* Let the rest of the system run until the given time. Returns the time
+   * at which the CPU resumes (at most deadline, earlier if a new event
+   * made an interrupt due and preemptible is set) and the new horizon. */
+  uint64_t (*yield)(uint64_t deadline, int preemptible, uint64_t *horizon);
+};
+/*---------------------------------------------------------------------------*/
+void native_irq_init(void);
+void native_irq_add(struct native_irq_source *source);
+
+/* Mask all the interrupts, returning the previous state */
+int native_irq_disable(void);
+void native_irq_restore(int state);
+
+/* A deadline has changed: serve what is due and re-arm the timer */
+void native_irq_update(void);
+
+/* Sleep until an interrupt occurs, unless there are pending events */
+void native_irq_idle(void);
+
+/* Sleep until an interrupt occurs and serve it. Call it with interrupts
+ * disabled (native_irq_disable()) after checking the wake-up condition, so
+ * that an interrupt in between is not missed. */
+void native_irq_wait(void);
+
+/* Re-arm the etimer tick, called by the main loop before idling */
+void clock_update(void);
+
+/* Time since boot */
+uint64_t native_time_ps(void);
+
+/* Same, but never accounted as a busy-wait iteration */
+uint64_t native_time_peek(void);
+
+/* The CPU is busy for the given time (virtual time only) */
+void native_time_consume(uint64_t ps);
+
+/* Busy-wait until the given time, serving interrupts */
+void native_time_wait_until(uint64_t t);
+
+/* Switch to virtual time, before native_irq_init() */
+void native_irq_set_scheduler(const struct native_irq_scheduler *scheduler,
+                              uint64_t now, uint64_t horizon);
+
+/* Restrict the horizon granted by the scheduler */
+void native_irq_set_horizon(uint64_t horizon);
+
+/* Earliest deadline of all the sources, or of the background ones only */
+uint64_t native_irq_next_deadline(int all);
+/*---------------------------------------------------------------------------*/
+#endif /* NATIVE_IRQ_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      native-uwb rtimer code, 1 us resolution
+ */
+
+#include "contiki.h"
+#include "sys/rtimer.h"
+#include "native-irq.h"
+/*---------------------------------------------------------------------------*/
+#define PS_PER_RTIMER_TICK (1000000000000ULL / RTIMER_ARCH_SECOND)
+/*---------------------------------------------------------------------------*/
+static rtimer_clock_t next;
+static int scheduled;
+/*---------------------------------------------------------------------------*/
+static uint64_t
+rtimer_deadline(void)
+{
+  uint64_t now;
+  int32_t delta;
+
+  if(!scheduled) {
+    return NATIVE_TIME_NEVER;
+  }
+  now = native_time_ps();
+  delta = (int32_t)(next - (rtimer_clock_t)(now / PS_PER_RTIMER_TICK));
+  if(delta <= 0) {
+    return now;
+  }
+  return (now / PS_PER_RTIMER_TICK + delta) * PS_PER_RTIMER_TICK;
+}
+/*---------------------------------------------------------------------------*/
+static void
+rtimer_service(void)
+{
+  scheduled = 0;
+  /* Call the rtimer callback function and schedule the next rtimer task */
+  rtimer_run_next();
+}
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source rtimer_source = {
+  NULL, rtimer_deadline, rtimer_service, 0
+};
+/*---------------------------------------------------------------------------*/
+void
+rtimer_arch_init(void)
+{
+  native_irq_add(&rtimer_source);
+}
+/*---------------------------------------------------------------------------*/
+void
+rtimer_arch_schedule(rtimer_clock_t t)
+{
+  next = t;
+  scheduled = 1;
+  native_irq_update();
+}
+/*---------------------------------------------------------------------------*/
+rtimer_clock_t
+rtimer_arch_now(void)
+{
+  return (rtimer_clock_t)(native_time_ps() / PS_PER_RTIMER_TICK);
+}
+/*---------------------------------------------------------------------------*/
@@ -39,6 +39,18 @@
 #include "stm32f10x_rcc.h"
 #include "stm32f10x_spi.h"
 #include "stm32f10x_gpio.h"
+#include "stm32f10x_dma.h"
+#include <stddef.h>
+/*---------------------------------------------------------------------------*/
+/* DMA1 channels of the SPIx requests */
+#define DMA_RX_CH(spix)     ((spix) == SPI1 ? DMA1_Channel2 : DMA1_Channel4)
+#define DMA_TX_CH(spix)     ((spix) == SPI1 ? DMA1_Channel3 : DMA1_Channel5)
+/* DMA1 ISR/IFCR bit position of the channels */
+#define DMA_RX_SHIFT(spix)  ((spix) == SPI1 ? 4 : 12)
+#define DMA_TX_SHIFT(spix)  ((spix) == SPI1 ? 8 : 16)
+
+static const uint8_t dma_ones = 0xFF; /* sent when there is no TX data */
+static uint8_t dma_sink; /* discarded RX data */
 /*---------------------------------------------------------------------------*/
 void
 spix_init(SPI_TypeDef *SPIx, SPI_InitTypeDef *spix_conf)
@@ -108,3 +120,62 @@ spix_change_speed(SPI_TypeDef *SPIx, uint16_t speed)
   SPIx->CR1 = reg_status;
 }
 /*---------------------------------------------------------------------------*/
+void
+spix_dma_init(SPI_TypeDef *SPIx)
+{
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+  DMA_RX_CH(SPIx)->CCR = 0;
+  DMA_RX_CH(SPIx)->CPAR = (uint32_t)&SPIx->DR;
+  DMA_TX_CH(SPIx)->CCR = 0;
+  DMA_TX_CH(SPIx)->CPAR = (uint32_t)&SPIx->DR;
+}
+/*---------------------------------------------------------------------------*/
+void
+spix_dma_start(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx,
+               uint16_t len, bool irq)
+{
+  DMA_Channel_TypeDef *rx_ch = DMA_RX_CH(SPIx);
+  DMA_Channel_TypeDef *tx_ch = DMA_TX_CH(SPIx);
+
+  /* Byte-sized transfers are the reset value of PSIZE and MSIZE. The RX
+   * channel has the higher priority so that it never overruns. */
+  rx_ch->CMAR = (uint32_t)(rx != NULL ? rx : &dma_sink);
+  rx_ch->CNDTR = len;
+  rx_ch->CCR = DMA_Priority_VeryHigh | (rx != NULL ? DMA_MemoryInc_Enable : 0) |
+    (irq ? DMA_IT_TC : 0) | DMA_CCR1_EN;
+
+  tx_ch->CMAR = (uint32_t)(tx != NULL ? tx : &dma_ones);
+  tx_ch->CNDTR = len;
+  tx_ch->CCR = DMA_Priority_High | DMA_DIR_PeripheralDST |
+    (tx != NULL ? DMA_MemoryInc_Enable : 0) | DMA_CCR1_EN;
+
+  /* The TX request starts the transfer */
+  SPIx->CR2 |= SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx;
+}
+/*---------------------------------------------------------------------------*/
+bool
+spix_dma_done(SPI_TypeDef *SPIx)
+{
+  /* TC flag of the RX channel */
+  return (DMA1->ISR & (0x2 << DMA_RX_SHIFT(SPIx))) != 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+spix_dma_stop(SPI_TypeDef *SPIx)
+{
+  SPIx->CR2 &= ~(SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx);
+  DMA_RX_CH(SPIx)->CCR = 0;
+  DMA_TX_CH(SPIx)->CCR = 0;
+  DMA1->IFCR = (0xF << DMA_RX_SHIFT(SPIx)) | (0xF << DMA_TX_SHIFT(SPIx));
+}
+/*---------------------------------------------------------------------------*/
+void
+spix_dma_transfer(SPI_TypeDef *SPIx, const uint8_t *tx, uint8_t *rx,
+                  uint16_t len)
+{
+  spix_dma_start(SPIx, tx, rx, len, false);
+  while(!spix_dma_done(SPIx));
+  spix_dma_stop(SPIx);
+}
+/*---------------------------------------------------------------------------*/
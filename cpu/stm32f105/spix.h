@@ -36,7 +36,22 @@
 
 #include "stm32f10x.h"
 #include "stm32f10x_spi.h"
+#include <stdbool.h>
 /*---------------------------------------------------------------------------*/
 void spix_init(SPI_TypeDef *spix, SPI_InitTypeDef *spix_conf);
 void spix_change_speed(SPI_TypeDef *spix, uint16_t speed);
 /*---------------------------------------------------------------------------*/
+/* Full-duplex DMA transfers (SPI1: DMA1 channels 2 and 3, SPI2: DMA1
+ * channels 4 and 5). With tx NULL, 0xFF is sent; with rx NULL, the
+ * received bytes are discarded. The RX channel completes last: its
+ * transfer complete interrupt (DMA1_Channel2_IRQn or DMA1_Channel4_IRQn)
+ * is enabled if irq is set, the handler must call spix_dma_stop(). */
+void spix_dma_init(SPI_TypeDef *spix);
+void spix_dma_start(SPI_TypeDef *spix, const uint8_t *tx, uint8_t *rx,
+                    uint16_t len, bool irq);
+bool spix_dma_done(SPI_TypeDef *spix);
+void spix_dma_stop(SPI_TypeDef *spix);
+/* Blocking transfer */
+void spix_dma_transfer(SPI_TypeDef *spix, const uint8_t *tx, uint8_t *rx,
+                       uint16_t len);
+/*---------------------------------------------------------------------------*/
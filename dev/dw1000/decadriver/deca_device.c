@@ -915,6 +915,24 @@ void dwt_readaccdata(uint8 *buffer, uint16 len, uint16 accOffset)
     _dwt_enableclocks(READ_ACC_OFF); // Revert clocks back
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dwt_enableaccclocks()
+ *
+ * @brief This is used to force the accumulator clocks on before reading the Accumulator buffer with raw SPI transfers
+ *        (e.g., asynchronous ones), and back off afterwards. dwt_readaccdata() does it by itself.
+ *
+ * input parameters
+ * @param enable - 1 to force the clocks on, 0 to revert them back
+ *
+ * output parameters
+ *
+ * no return value
+ */
+void dwt_enableaccclocks(int enable)
+{
+    _dwt_enableclocks(enable ? READ_ACC_ON : READ_ACC_OFF);
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @fn dwt_readcarrierintegrator()
  *
@@ -1420,6 +1420,21 @@ void dwt_readrxdata(uint8 *buffer, uint16 length, uint16 rxBufferOffset);
  */
 void dwt_readaccdata(uint8 *buffer, uint16 length, uint16 rxBufferOffset);
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn dwt_enableaccclocks()
+ *
+ * @brief This is used to force the accumulator clocks on before reading the Accumulator buffer with raw SPI transfers
+ *        (e.g., asynchronous ones), and back off afterwards. dwt_readaccdata() does it by itself.
+ *
+ * input parameters
+ * @param enable - 1 to force the clocks on, 0 to revert them back
+ *
+ * output parameters
+ *
+ * no return value
+ */
+void dwt_enableaccclocks(int enable);
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * @fn dwt_readcarrierintegrator()
  *
@@ -15,6 +15,7 @@
 #include "deca_device_api.h"
 #include "deca_param_types.h"
 #include "deca_range_tables.h"
+#include "deca_range_bias.h"        // generated at build time by tools/gen_range_bias.py
 
 #define NUM_16M_OFFSET  (37)
 #define NUM_16M_OFFSETWB  (68)
@@ -26,6 +27,8 @@ const uint8 chan_idxwb[NUM_CH_SUPPORTED] = {0, 0, 0, 0, 0, 0, 0, 1}; //only chan
 
 //---------------------------------------------------------------------------------------------------------------------------
 // Range Bias Correction TABLES of range values in integer units of 25 CM, for 8-bit unsigned storage, MUST END IN 255 !!!!!!
+//
+// These are the source of the direct-index tables of deca_range_bias.h and are not compiled.
 //---------------------------------------------------------------------------------------------------------------------------
 
 // offsets to nearest centimeter for index 0, all rest are +1 cm per value
@@ -35,6 +38,7 @@ const uint8 chan_idxwb[NUM_CH_SUPPORTED] = {0, 0, 0, 0, 0, 0, 0, 1}; //only chan
 #define CM_OFFSET_64M_NB    (-17)   // for normal band channels at 64 MHz PRF
 #define CM_OFFSET_64M_WB    (-30)   // for wider  band channels at 64 MHz PRF
 
+#ifdef DECA_RANGE_TABLES_SOURCE
 
 //---------------------------------------------------------------------------------------------------------------------------
 // range25cm16PRFnb: Range Bias Correction table for narrow band channels at 16 MHz PRF, NB: !!!! each MUST END IN 255 !!!!
@@ -618,8 +622,28 @@ const uint8 range25cm64PRFwb[2][NUM_64M_OFFSETWB] =
          255
     }
 }; // end range25cm64PRFwb
+#endif // DECA_RANGE_TABLES_SOURCE
 
 
+/* Row of the direct-index bias table (cm per 25 cm of range) for the given channel and PRF */
+static const int8 *getbiasrow(uint8 chan, uint8 prf)
+{
+    if (chan >= NUM_CH_SUPPORTED) chan = 5 ;
+
+    if (prf == DWT_PRF_16M)
+    {
+        if (chan == 4 || chan == 7)
+            return rangebias16PRFwb[chan_idxwb[chan]] ;
+        return rangebias16PRFnb[chan_idxnb[chan]] ;
+    }
+    else // 64M PRF
+    {
+        if (chan == 4 || chan == 7)
+            return rangebias64PRFwb[chan_idxwb[chan]] ;
+        return rangebias64PRFnb[chan_idxnb[chan]] ;
+    }
+}
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * Function: dwt_getrangebias()
  *
@@ -636,64 +660,41 @@ const uint8 range25cm64PRFwb[2][NUM_64M_OFFSETWB] =
  */
 double dwt_getrangebias(uint8 chan, float range, uint8 prf)
 {
-    //first get the lookup index that corresponds to given range for a particular channel at 16M PRF
-    int i = 0 ;
-    int chanIdx ;
-    int cmoffseti ;                                 // integer number of CM offset
-
-    double mOffset ;                                // final offset result in metres
-
     // NB: note we may get some small negitive values e.g. up to -50 cm.
 
     int rangeint25cm = (int) (range * 4.00) ;       // convert range to integer number of 25cm values.
 
-    if (rangeint25cm > 255) rangeint25cm = 255 ;    // make sure it matches largest value in table (all tables end in 255 !!!!)
+    if (rangeint25cm < 0) rangeint25cm = 0 ;
+    if (rangeint25cm >= RANGE_BIAS_ENTRIES) rangeint25cm = RANGE_BIAS_ENTRIES - 1 ;
 
-    if (prf == DWT_PRF_16M)
-    {
-        switch(chan)
-        {
-            case 4:
-            case 7:
-            {
-                chanIdx = chan_idxwb[chan];
-                while (rangeint25cm > range25cm16PRFwb[chanIdx][i]) i++ ;       // find index in table corresponding to range
-                cmoffseti = i + CM_OFFSET_16M_WB ;                              // nearest centimeter correction
-            }
-            break;
-            default:
-            {
-                chanIdx = chan_idxnb[chan];
-                while (rangeint25cm > range25cm16PRFnb[chanIdx][i]) i++ ;       // find index in table corresponding to range
-                cmoffseti = i + CM_OFFSET_16M_NB ;                              // nearest centimeter correction
-            }
-        }//end of switch
-    }
-    else // 64M PRF
-    {
-        switch(chan)
-        {
-            case 4:
-            case 7:
-            {
-                chanIdx = chan_idxwb[chan];
-                while (rangeint25cm > range25cm64PRFwb[chanIdx][i]) i++ ;       // find index in table corresponding to range
-                cmoffseti = i + CM_OFFSET_64M_WB ;                              // nearest centimeter correction
-            }
-            break;
-            default:
-            {
-                chanIdx = chan_idxnb[chan];
-                while (rangeint25cm > range25cm64PRFnb[chanIdx][i]) i++ ;       // find index in table corresponding to range
-                cmoffseti = i + CM_OFFSET_64M_NB ;                              // nearest centimeter correction
-            }
-        }//end of switch
-    } // end else
-
-
-    mOffset = (float) cmoffseti ;                                       // offset result in centimmetres
-
-    mOffset *= 0.01 ;                                                   // convert to metres
-
-    return (mOffset) ;
+    return getbiasrow(chan, prf)[rangeint25cm] * 0.01 ;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: dwt_getrangebias_mm()
+ *
+ * Description: Integer version of dwt_getrangebias(), for MCUs without an FPU. The bias is linearly
+ * interpolated between the 25 cm steps of the table.
+ *
+ * input parameters:
+ * @param chan     - specifies the operating channel (e.g. 1, 2, 3, 4, 5, 6 or 7)
+ * @param range_mm - the calculated distance before correction, in millimetres
+ * @param prf      - this is the PRF e.g. DWT_PRF_16M or DWT_PRF_64M
+ *
+ * output parameters
+ *
+ * returns correction needed in millimetres
+ */
+int32 dwt_getrangebias_mm(uint8 chan, int32 range_mm, uint8 prf)
+{
+    const int8 *row = getbiasrow(chan, prf) ;
+    int32 idx, frac ;
+
+    if (range_mm <= 0) return 10 * row[0] ;
+
+    idx = range_mm / 250 ;
+    if (idx >= RANGE_BIAS_ENTRIES - 1) return 10 * row[RANGE_BIAS_ENTRIES - 1] ;
+
+    frac = range_mm - idx * 250 ;                   // mm above the 25 cm step, the table is non-decreasing
+    return 10 * row[idx] + (10 * (row[idx + 1] - row[idx]) * frac + 125) / 250 ;
 }
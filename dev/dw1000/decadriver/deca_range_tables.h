@@ -1,4 +1,5 @@
 #ifndef DECA_RANGE_TABLES_H
 #define DECA_RANGE_TABLES_H
 double dwt_getrangebias(uint8 chan, float range, uint8 prf);
+int32 dwt_getrangebias_mm(uint8 chan, int32 range_mm, uint8 prf);
 #endif // DECA_RANGE_TABLES_H
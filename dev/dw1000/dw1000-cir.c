@@ -45,6 +45,7 @@
 #include "deca_regs.h"
 #include "deca_device_api.h"
 #include "watchdog.h"
+#include "lib/crc16.h"
 /*---------------------------------------------------------------------------*/
 #if PRINTF_OVER_RTT
 #include "SEGGER_RTT.h"
@@ -52,6 +53,7 @@
 #include "deca_usb.h"
 #endif
 #include <stdio.h>
+#include <string.h>
 /*---------------------------------------------------------------------------*/
 
 #define LOG_LEVEL LOG_ERR
@@ -61,6 +63,21 @@
 #define SPI_READ_LIMIT 0 // on some platforms SPI cannot read all CIR at once. Zero means no limit.
 #define CIR_PRINT_STEP 128 // printing in small portions to avoid creating huge buffers
 
+/* Samples per chunk of dw1000_read_cir_chunked() */
+#ifdef DW1000_CIR_CONF_CHUNK
+#define DW1000_CIR_CHUNK DW1000_CIR_CONF_CHUNK
+#else
+#define DW1000_CIR_CHUNK 32
+#endif
+
+/* The platform can read the accumulator while the CPU analyses a chunk */
+#if CONTIKI_TARGET_EVB1000
+#define CIR_PIPELINED 1
+#include "dw1000-arch.h"
+#else
+#define CIR_PIPELINED 0
+#endif
+
 /*---------------------------------------------------------------------------*/
 
 /* Read max n_samples samples from the CIR accumulator, starting at index s1.
@@ -126,6 +143,287 @@ uint16_t dw1000_read_cir(uint16_t s1, uint16_t n_samples, dw1000_cir_sample_t* s
   return n_samples;
 }
 
+/* Chunk buffers of dw1000_read_cir_chunked(). The dummy byte the accumulator
+ * returns first goes to the end of sample 0. */
+static dw1000_cir_sample_t chunk_buf[2][DW1000_CIR_CHUNK + 1];
+
+/* Start reading n samples from index s1 into buf[1..n] */
+static void
+chunk_read_start(uint16_t s1, uint16_t n, dw1000_cir_sample_t* buf)
+{
+  uint8_t* dst = (uint8_t*)&buf[1] - 1;
+  uint16_t offset = s1 * DW1000_CIR_SAMPLE_SIZE;
+#if CIR_PIPELINED
+  // the header dwt_readfromdevice() would send
+  uint8_t hdr[3];
+  uint16_t hdr_len = 2;
+
+  hdr[0] = 0x40 | ACC_MEM_ID;
+  if (offset <= 127) {
+    hdr[1] = offset;
+  }
+  else {
+    hdr[1] = 0x80 | (offset & 0x7F);
+    hdr[2] = offset >> 7;
+    hdr_len = 3;
+  }
+  dw1000_spi_read_async(hdr_len, hdr, n * DW1000_CIR_SAMPLE_SIZE + 1, dst, NULL);
+#else
+  dwt_readaccdata(dst, n * DW1000_CIR_SAMPLE_SIZE + 1, offset);
+#endif
+}
+
+/* Read max n_samples samples from the CIR accumulator in chunks, see dw1000-cir.h */
+uint16_t dw1000_read_cir_chunked(uint16_t s1, uint16_t n_samples, dw1000_cir_chunk_cb_t cb, void* arg) {
+  uint16_t max_samples = (dw1000_get_current_cfg()->prf == DWT_PRF_64M) ?
+                           DW1000_CIR_LEN_PRF64 :
+                           DW1000_CIR_LEN_PRF16;
+
+  if (s1 >= max_samples) {
+    ERR("Invalid index");
+    return 0;
+  }
+
+  if (s1 + n_samples >= max_samples) {
+    n_samples = max_samples - s1;
+  }
+  if (n_samples == 0) {
+    return 0;
+  }
+
+#if CIR_PIPELINED
+  // the reads are raw SPI transfers, dwt_readaccdata() is not involved
+  dwt_enableaccclocks(1);
+#endif
+
+  uint16_t done = 0;
+  uint16_t n = (n_samples < DW1000_CIR_CHUNK) ? n_samples : DW1000_CIR_CHUNK;
+  uint8_t cur = 0;
+
+  chunk_read_start(s1, n, chunk_buf[cur]);
+  while (n > 0) {
+    uint16_t n_next = n_samples - done - n;
+    if (n_next > DW1000_CIR_CHUNK) {
+      n_next = DW1000_CIR_CHUNK;
+    }
+#if CIR_PIPELINED
+    while (dw1000_spi_busy());
+#endif
+    if (n_next > 0) {
+      chunk_read_start(s1 + done + n, n_next, chunk_buf[cur ^ 1]);
+    }
+    bool go_on = cb(&chunk_buf[cur][1], s1 + done, n, arg);
+    done += n;
+    if (!go_on) {
+      break;
+    }
+    n = n_next;
+    cur ^= 1;
+  }
+
+#if CIR_PIPELINED
+  // also waits for the transfer started before a stop, if any
+  dwt_enableaccclocks(0);
+#endif
+  return done;
+}
+
+/* Peak and energy of the CIR, see dw1000-cir.h */
+bool dw1000_cir_stats_chunk(const dw1000_cir_sample_t* samples, uint16_t idx, uint16_t n_samples, void* arg) {
+  dw1000_cir_stats_t* st = arg;
+
+  for (uint16_t i=0; i<n_samples; i++) {
+    uint32_t m = dw1000_cir_magsq(&samples[i]);
+    st->energy += m;
+    if (m > st->peak_magsq) {
+      st->peak_magsq = m;
+      st->peak_idx = idx + i;
+    }
+  }
+  return true;
+}
+
+/* Upsampling kernel of dw1000_cir_first_path(): Hann-windowed sinc, Q14.
+ * Row t interpolates at t/8 after sample i from samples i-3 to i+4. */
+#define FP_UPSAMPLE   8
+#define FP_TAPS       8
+#define FP_TAPS_PRE   3   // taps before the interpolated sample
+#define FP_KERNEL_Q   14
+
+static const int16_t fp_kernel[FP_UPSAMPLE][FP_TAPS] = {
+  {     0,      0,      0,  16384,      0,      0,      0,      0 },
+  {  -136,    511,  -1515,  15943,   2076,   -670,    200,    -24 },
+  {  -203,    820,  -2424,  14641,   4588,  -1414,    441,    -66 },
+  {  -209,    926,  -2756,  12626,   7346,  -2108,    680,   -120 },
+  {  -174,    862,  -2606,  10111,  10111,  -2606,    862,   -174 },
+  {  -120,    680,  -2108,   7346,  12626,  -2756,    926,   -209 },
+  {   -66,    441,  -1414,   4588,  14641,  -2424,    820,   -203 },
+  {   -24,    200,   -670,   2076,  15943,  -1515,    511,   -136 },
+};
+
+/* CIR interpolated at i + t/8 */
+static void
+cir_interp(const dw1000_cir_sample_t* cir, uint16_t i, uint8_t t, int32_t* re, int32_t* im)
+{
+  const int16_t* h = fp_kernel[t];
+  const dw1000_cir_sample_t* x = &cir[i - FP_TAPS_PRE];
+  int32_t r = 0, q = 0;
+
+  for (uint8_t k=0; k<FP_TAPS; k++) {
+    r += h[k] * x[k].compl.real;
+    q += h[k] * x[k].compl.imag;
+  }
+  *re = r >> FP_KERNEL_Q;
+  *im = q >> FP_KERNEL_Q;
+}
+
+/* Squared magnitude of the CIR interpolated at i + t/8 */
+static uint64_t
+fp_interp_magsq(const dw1000_cir_sample_t* cir, uint16_t i, uint8_t t)
+{
+  int32_t re, im;
+
+  cir_interp(cir, i, t, &re, &im);
+  return (uint64_t)((int64_t)re * re) + (uint64_t)((int64_t)im * im);
+}
+
+/* Find the leading edge of the first path, see dw1000-cir.h */
+bool dw1000_cir_first_path(const dw1000_cir_sample_t* cir, uint16_t s1, uint16_t n_samples, uint32_t noise_thr, uint32_t* fp) {
+  uint32_t peak = 0, thr;
+  uint16_t i, k;
+
+  for (i=0; i<n_samples; i++) {
+    uint32_t m = dw1000_cir_magsq(&cir[i]);
+    if (m > peak) {
+      peak = m;
+    }
+  }
+  if (peak < noise_thr) {
+    return false;
+  }
+  thr = peak >> DW1000_CIR_FP_PEAK_SHIFT;
+  if (thr < noise_thr) {
+    thr = noise_thr;
+  }
+  for (k=0; dw1000_cir_magsq(&cir[k]) < thr; k++);
+
+  // the interpolated CIR may cross the threshold up to two samples earlier
+  if (k < 2 + FP_TAPS_PRE || k + FP_TAPS - FP_TAPS_PRE >= n_samples) {
+    return false;
+  }
+
+  uint64_t m_prev = dw1000_cir_magsq(&cir[k - 2]);
+  for (uint16_t u=1; u<=2*FP_UPSAMPLE; u++) {
+    i = k - 2 + u / FP_UPSAMPLE;
+    uint64_t m = fp_interp_magsq(cir, i, u % FP_UPSAMPLE);
+    if (m >= thr) {
+      // linear interpolation between the upsampled points, in 1/64 sample
+      uint32_t frac = ((thr - m_prev) * (64 / FP_UPSAMPLE)) / (m - m_prev);
+      *fp = ((uint32_t)(s1 + k - 2) << 6) + (u - 1) * (64 / FP_UPSAMPLE) + frac;
+      return true;
+    }
+    m_prev = m;
+  }
+  return false; // cannot happen: sample k is above the threshold
+}
+
+/* Integer square root */
+static uint32_t
+isqrt(uint32_t x)
+{
+  uint32_t r = 0, b = 1UL << 30;
+
+  while (b > x) {
+    b >>= 2;
+  }
+  while (b != 0) {
+    if (x >= r + b) {
+      x -= r + b;
+      r = (r >> 1) + b;
+    }
+    else {
+      r >>= 1;
+    }
+    b >>= 2;
+  }
+  return r;
+}
+
+void dw1000_cir_avg_reset(dw1000_cir_avg_t* a) {
+  memset(a, 0, sizeof(*a));
+}
+
+/* Add a CIR window to the average, see dw1000-cir.h */
+bool dw1000_cir_avg_add(dw1000_cir_avg_t* a, const dw1000_cir_sample_t* cir, uint16_t s1, uint16_t n_samples, uint32_t fp) {
+  int32_t re[DW1000_CIR_AVG_LEN], im[DW1000_CIR_AVG_LEN];
+  int32_t start = (int32_t)fp - (DW1000_CIR_AVG_PRE << 6);
+  int32_t i0 = (start >> 6) - s1;
+  uint8_t t = ((start & 63) + 4) >> 3;  // nearest 1/8 sample
+  uint16_t j, n;
+
+  if (t == FP_UPSAMPLE) {
+    t = 0;
+    i0++;
+  }
+  if (i0 < FP_TAPS_PRE || i0 + DW1000_CIR_AVG_LEN + FP_TAPS - FP_TAPS_PRE > n_samples) {
+    return false;
+  }
+
+  // resample the window so that the first path is at DW1000_CIR_AVG_PRE
+  for (j=0; j<DW1000_CIR_AVG_LEN; j++) {
+    cir_interp(cir, i0 + j, t, &re[j], &im[j]);
+  }
+
+  if (a->n_frames > 0) {
+    /* The carrier phase changes from frame to frame: rotate the window by
+     * the phase of its correlation with the average, S = sum(x conj(avg)) */
+    int64_t sr = 0, si = 0;
+    for (j=0; j<DW1000_CIR_AVG_LEN; j++) {
+      sr += (int64_t)re[j] * a->real[j] + (int64_t)im[j] * a->imag[j];
+      si += (int64_t)im[j] * a->real[j] - (int64_t)re[j] * a->imag[j];
+    }
+    // scale S to 14 bits, enough for the rotation
+    while (sr >= (1 << 14) || sr <= -(1 << 14) || si >= (1 << 14) || si <= -(1 << 14)) {
+      sr >>= 1;
+      si >>= 1;
+    }
+    int32_t mag = isqrt((uint32_t)(sr * sr + si * si));
+    if (mag > (1 << 12)) {
+      for (j=0; j<DW1000_CIR_AVG_LEN; j++) {
+        int32_t r = re[j], q = im[j];
+        re[j] = ((int64_t)r * sr + (int64_t)q * si) / mag;
+        im[j] = ((int64_t)q * sr - (int64_t)r * si) / mag;
+      }
+    }
+  }
+
+  // running mean over the first 2^DW1000_CIR_AVG_SHIFT frames, exponential after
+  n = a->n_frames + 1;
+  if (n > (1 << DW1000_CIR_AVG_SHIFT)) {
+    n = 1 << DW1000_CIR_AVG_SHIFT;
+  }
+  for (j=0; j<DW1000_CIR_AVG_LEN; j++) {
+    a->real[j] += (re[j] * (1 << DW1000_CIR_AVG_Q) - a->real[j]) / n;
+    a->imag[j] += (im[j] * (1 << DW1000_CIR_AVG_Q) - a->imag[j]) / n;
+  }
+  if (a->n_frames < UINT16_MAX) {
+    a->n_frames++;
+  }
+  return true;
+}
+
+/* Averaged CIR, see dw1000-cir.h */
+uint16_t dw1000_cir_avg_get(const dw1000_cir_avg_t* a, dw1000_cir_sample_t* samples) {
+  if (a->n_frames == 0) {
+    return 0;
+  }
+  for (uint16_t j=0; j<DW1000_CIR_AVG_LEN; j++) {
+    samples[j].compl.real = (a->real[j] + (1 << (DW1000_CIR_AVG_Q - 1))) >> DW1000_CIR_AVG_Q;
+    samples[j].compl.imag = (a->imag[j] + (1 << (DW1000_CIR_AVG_Q - 1))) >> DW1000_CIR_AVG_Q;
+  }
+  return DW1000_CIR_AVG_LEN;
+}
+
 /* Print max n_samples samples from the CIR accumulator, starting at index s1.
  * Call after packet reception and before re-enabling listening.
  *
@@ -188,6 +486,34 @@ uint16_t dw1000_print_cir_from_radio() {
   return dw1000_print_cir_samples_from_radio(0, DW1000_CIR_MAX_LEN);
 }
 
+/* Write raw bytes to the output, busy waiting if the USB buffer is full.
+ * Returns false if the output failed. */
+static bool
+cir_write(const uint8_t* buf, uint16_t len)
+{
+#if PRINTF_OVER_RTT
+  int res, bytes_written;
+  bytes_written = 0;
+  do {
+    res = SEGGER_RTT_Write(0, buf + bytes_written, len - bytes_written);
+    bytes_written += res;
+  } while (bytes_written < len && res >= 0);
+  return res >= 0;
+#elif CONTIKI_TARGET_EVB1000
+  uint16_t res;
+  do {
+    res = DW_VCP_DataTx((uint8_t*)buf, len);
+    if (res != USBD_OK) clock_wait(1); // 1 ms
+  } while (res != USBD_OK);
+  return true;
+#else
+  for (uint16_t i=0; i<len; i++) {
+    putchar(buf[i]);
+  }
+  return true;
+#endif
+}
+
 /* Print CIR buffer in hex.
  *
  * NB! This is a blocking function. If USB output is used, it will block
@@ -203,7 +529,7 @@ void dw1000_print_cir_hex(dw1000_cir_sample_t* cir, uint16_t n_samples) {
   fflush(0); // flush printf buffer to avoid data reordering
 #endif
 
-  char buf[9];
+  uint8_t buf[8];
   for (int i=0; i<n_samples; i++) {
     uint8_t *p = (uint8_t*)(cir+i);
     buf[0] = t[*p >> 4];
@@ -217,36 +543,151 @@ void dw1000_print_cir_hex(dw1000_cir_sample_t* cir, uint16_t n_samples) {
     p++;
     buf[6] = t[*p >> 4];
     buf[7] = t[*p & 0xf];
-    buf[8] = 0; // terminating zero
-#if PRINTF_OVER_RTT
-    int res, bytes_written;
-    bytes_written = 0;
-    do {
-      res = SEGGER_RTT_Write(0, buf + bytes_written, 8 - bytes_written);
-      bytes_written += res;
-    } while (bytes_written < 8 && res >= 0);
-    if (res < 0) {
+    if (!cir_write(buf, 8)) {
       break;
     }
-#elif CONTIKI_TARGET_EVB1000
-    uint16_t res;
-    do {
-      res = DW_VCP_DataTx((uint8_t*)buf, 8);
-      if (res != USBD_OK) clock_wait(1); // 1 ms
-    } while (res != USBD_OK);
-#else
-    printf(buf);
-#endif
   }
-#if PRINTF_OVER_RTT
-  SEGGER_RTT_Write(0, "\n", 1);
-#elif CONTIKI_TARGET_EVB1000
-  uint16_t res;
-  do {
-    res = DW_VCP_DataTx((uint8_t*)"\n", 1);
-    if (res != USBD_OK) clock_wait(1); // 1 ms
-  } while (res != USBD_OK);
-#else
-  printf("\n");
+  cir_write((const uint8_t*)"\n", 1);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Binary CIR frames.
+ *
+ * A frame is DW1000_CIR_BIN_SYNC, the frame sequence number, the start index
+ * and the number of samples (16-bit little-endian), the samples and the
+ * CRC-16 (lib/crc16) of everything after the sync, little-endian.
+ *
+ * Each real and imaginary value is sent as the difference from the same
+ * component of the previous sample (the first one from zero), zigzag-encoded
+ * (0, -1, 1, -2, ... become 0, 1, 2, 3, ...) and written 7 bits per byte,
+ * least significant first, with the top bit set on all bytes but the last.
+ * A sample therefore takes 2 to 6 bytes instead of the 8 hex characters.
+ */
+#define CIR_BIN_CHUNK 64 // bytes passed at once to the output
+
+static struct {
+  uint16_t crc;
+  int16_t prev_real;
+  int16_t prev_imag;
+  uint8_t len;
+  uint8_t buf[CIR_BIN_CHUNK];
+} bin;
+static uint16_t bin_seqn;
+
+static void
+bin_flush(void)
+{
+  if (bin.len > 0) {
+    cir_write(bin.buf, bin.len);
+    bin.len = 0;
+  }
+}
+
+static inline void
+bin_put(uint8_t b)
+{
+  bin.crc = crc16_add(b, bin.crc);
+  bin.buf[bin.len++] = b;
+  if (bin.len == CIR_BIN_CHUNK) {
+    bin_flush();
+  }
+}
+
+static void
+bin_put_u16(uint16_t v)
+{
+  bin_put(v & 0xFF);
+  bin_put(v >> 8);
+}
+
+static inline void
+bin_put_value(int16_t v, int16_t* prev)
+{
+  int32_t d = (int32_t)v - *prev;
+  uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+
+  *prev = v;
+  while (z >= 0x80) {
+    bin_put((z & 0x7F) | 0x80);
+    z >>= 7;
+  }
+  bin_put(z);
+}
+
+static void
+bin_begin(uint16_t s1, uint16_t n_samples)
+{
+#if CONTIKI_TARGET_EVB1000
+  fflush(0); // flush printf buffer to avoid data reordering
 #endif
+  cir_write((const uint8_t*)DW1000_CIR_BIN_SYNC, 2);
+  bin.crc = 0;
+  bin.prev_real = 0;
+  bin.prev_imag = 0;
+  bin.len = 0;
+  bin_put_u16(bin_seqn++);
+  bin_put_u16(s1);
+  bin_put_u16(n_samples);
+}
+
+static void
+bin_add(const dw1000_cir_sample_t* cir, uint16_t n_samples)
+{
+  for (uint16_t i=0; i<n_samples; i++) {
+    bin_put_value(cir[i].compl.real, &bin.prev_real);
+    bin_put_value(cir[i].compl.imag, &bin.prev_imag);
+  }
+}
+
+static bool
+bin_chunk(const dw1000_cir_sample_t* samples, uint16_t idx, uint16_t n_samples, void* arg)
+{
+  watchdog_periodic();
+  bin_add(samples, n_samples);
+  return true;
+}
+
+static void
+bin_end(void)
+{
+  uint16_t crc = bin.crc;
+  bin_put_u16(crc);
+  bin_flush();
+}
+
+/* Print CIR buffer as a binary frame (see above).
+ * s1 is only reported in the frame header.
+ *
+ * NB! Blocking like dw1000_print_cir_hex(). tools/cirdecode.py
+ * turns the frames back into the output of dw1000_print_cir_hex().
+ */
+void dw1000_print_cir_bin(const dw1000_cir_sample_t* cir, uint16_t s1, uint16_t n_samples) {
+  bin_begin(s1, n_samples);
+  bin_add(cir, n_samples);
+  bin_end();
+}
+
+/* Print max n_samples samples from the CIR accumulator, starting at index s1,
+ * as a binary frame. Call after packet reception and before re-enabling listening.
+ *
+ * Returns the actual number of samples printed.
+ */
+uint16_t dw1000_print_cir_bin_samples_from_radio(int16_t s1, uint16_t n_samples) {
+  uint16_t max_samples = (dw1000_get_current_cfg()->prf == DWT_PRF_64M) ?
+                           DW1000_CIR_LEN_PRF64 :
+                           DW1000_CIR_LEN_PRF16;
+
+  if (s1 >= max_samples) {
+    ERR("Invalid index");
+    return 0;
+  }
+
+  if (s1 + n_samples >= max_samples) {
+    n_samples = max_samples - s1;
+  }
+
+  bin_begin(s1, n_samples);
+  dw1000_read_cir_chunked(s1, n_samples, bin_chunk, NULL);
+  bin_end();
+  return n_samples;
 }
@@ -64,8 +64,123 @@ typedef union dw1000_cir_sample
 #define DW1000_CIR_SAMPLE_SIZE (sizeof(dw1000_cir_sample_t))
 _Static_assert (DW1000_CIR_SAMPLE_SIZE == 4, "Wrong CIR sample size");
 
+/* Squared magnitude of a CIR sample (it needs 31 bits) */
+static inline uint32_t
+dw1000_cir_magsq(const dw1000_cir_sample_t* s)
+{
+  int32_t re = s->compl.real;
+  int32_t im = s->compl.imag;
+
+  return (uint32_t)(re * re) + (uint32_t)(im * im);
+}
+
 /*---------------------------------------------------------------------------*/
 uint16_t dw1000_read_cir(uint16_t s1, uint16_t n_samples, dw1000_cir_sample_t* samples);
+
+/* Analysis of a chunk of CIR samples read by dw1000_read_cir_chunked().
+ * idx is the accumulator index of samples[0]. Return false to stop the
+ * reading. */
+typedef bool (*dw1000_cir_chunk_cb_t)(const dw1000_cir_sample_t* samples,
+                                      uint16_t idx, uint16_t n_samples, void* arg);
+
+/* Read max n_samples samples from the CIR accumulator, starting at index s1,
+ * in chunks of DW1000_CIR_CHUNK samples, calling cb on each of them. Where
+ * the SPI transfers are asynchronous (EVB1000), the next chunk is read while
+ * cb runs on the current one, so the analysis costs little more than the
+ * transfer. The chunks are only valid during the callback. Call after packet
+ * reception and before re-enabling listening, not from interrupt context.
+ *
+ * Returns the number of samples passed to cb.
+ */
+uint16_t dw1000_read_cir_chunked(uint16_t s1, uint16_t n_samples,
+                                 dw1000_cir_chunk_cb_t cb, void* arg);
+
+/* The first path found by dw1000_cir_first_path() is where the CIR
+ * magnitude reaches the peak magnitude >> DW1000_CIR_FP_PEAK_SHIFT / 2
+ * (-12 dB by default) or the noise threshold, whichever is higher */
+#ifdef DW1000_CIR_CONF_FP_PEAK_SHIFT
+#define DW1000_CIR_FP_PEAK_SHIFT DW1000_CIR_CONF_FP_PEAK_SHIFT
+#else
+#define DW1000_CIR_FP_PEAK_SHIFT 4
+#endif
+
+/* Find the leading edge of the first path in a CIR window with sub-sample
+ * resolution. The window is upsampled by 8 with a fixed-point band-limited
+ * (windowed sinc) kernel around the first sample above the threshold, and
+ * the crossing is interpolated between the two upsampled points around it.
+ * The interpolation assumes a signal band within the CIR sampling rate
+ * (998.4 MHz), as on the 500 MHz channels; the 900 MHz ones gain less.
+ *
+ * Params
+ *  - cir [in]        the CIR window
+ *  - s1 [in]         accumulator index of cir[0]
+ *  - n_samples [in]  length of the window
+ *  - noise_thr [in]  noise threshold on the squared magnitude
+ *  - fp [out]        first path index, 10.6 fixed point like rxdiag.firstPath
+ *
+ * Returns false if the window has nothing above the noise or does not
+ * contain the leading edge with a few samples before and after it.
+ */
+bool dw1000_cir_first_path(const dw1000_cir_sample_t* cir, uint16_t s1, uint16_t n_samples,
+                           uint32_t noise_thr, uint32_t* fp);
+
+/* Length of the averaged CIR windows and number of samples before the
+ * first path (the window of dw1000_nlos()) */
+#ifdef DW1000_CIR_CONF_AVG_LEN
+#define DW1000_CIR_AVG_LEN DW1000_CIR_CONF_AVG_LEN
+#else
+#define DW1000_CIR_AVG_LEN 32
+#endif
+#ifdef DW1000_CIR_CONF_AVG_PRE
+#define DW1000_CIR_AVG_PRE DW1000_CIR_CONF_AVG_PRE
+#else
+#define DW1000_CIR_AVG_PRE 16
+#endif
+
+/* The average is the mean of the first 2^DW1000_CIR_AVG_SHIFT windows, then
+ * an exponential average with that weight */
+#ifdef DW1000_CIR_CONF_AVG_SHIFT
+#define DW1000_CIR_AVG_SHIFT DW1000_CIR_CONF_AVG_SHIFT
+#else
+#define DW1000_CIR_AVG_SHIFT 3
+#endif
+#define DW1000_CIR_AVG_Q 4  /* fractional bits of the average */
+
+/* Running complex average of CIR windows aligned on the first path */
+typedef struct {
+  int32_t real[DW1000_CIR_AVG_LEN];
+  int32_t imag[DW1000_CIR_AVG_LEN];
+  uint16_t n_frames;
+} dw1000_cir_avg_t;
+
+void dw1000_cir_avg_reset(dw1000_cir_avg_t* a);
+
+/* Add a CIR window to the average. The window is resampled (to 1/8 sample,
+ * with the kernel of dw1000_cir_first_path()) so that the first path fp
+ * (10.6 fixed point, e.g., rxdiag.firstPath) falls on sample
+ * DW1000_CIR_AVG_PRE, and rotated to the carrier phase of the average.
+ * cir[0] is at accumulator index s1. Returns false if the window does not
+ * cover the averaged one with a few samples around it.
+ */
+bool dw1000_cir_avg_add(dw1000_cir_avg_t* a, const dw1000_cir_sample_t* cir, uint16_t s1,
+                        uint16_t n_samples, uint32_t fp);
+
+/* Get the averaged CIR: DW1000_CIR_AVG_LEN samples with the first path at
+ * DW1000_CIR_AVG_PRE, e.g., for dw1000_nlos() with the DW1000_CIR_AVG_PRE
+ * samples before it. Returns the number of samples, 0 if nothing was added.
+ */
+uint16_t dw1000_cir_avg_get(const dw1000_cir_avg_t* a, dw1000_cir_sample_t* samples);
+
+/* Peak and energy of the CIR, a dw1000_cir_chunk_cb_t taking a
+ * dw1000_cir_stats_t, to be zeroed before the reading */
+typedef struct {
+  uint16_t peak_idx;    /* accumulator index of the strongest sample */
+  uint32_t peak_magsq;  /* its squared magnitude */
+  uint64_t energy;      /* sum of the squared magnitudes */
+} dw1000_cir_stats_t;
+
+bool dw1000_cir_stats_chunk(const dw1000_cir_sample_t* samples,
+                            uint16_t idx, uint16_t n_samples, void* arg);
 uint16_t dw1000_print_cir_from_radio();
 uint16_t dw1000_print_cir_samples_from_radio(int16_t s1, uint16_t n_samples);
 /*---------------------------------------------------------------------------*/
@@ -79,4 +194,15 @@ uint16_t dw1000_print_cir_samples_from_radio(int16_t s1, uint16_t n_samples);
  */
 void dw1000_print_cir_hex(dw1000_cir_sample_t* cir, uint16_t n_samples);
 
+/* Sync bytes starting a binary CIR frame */
+#define DW1000_CIR_BIN_SYNC "\x1b" "C"
+
+/* Print CIR buffer (or read and print the accumulator) as a binary frame
+ * with delta/varint compressed samples, a sequence number and a CRC,
+ * about three times shorter than the hex output. Decode the output with
+ * tools/cirdecode.py. Blocking like dw1000_print_cir_hex().
+ */
+void dw1000_print_cir_bin(const dw1000_cir_sample_t* cir, uint16_t s1, uint16_t n_samples);
+uint16_t dw1000_print_cir_bin_samples_from_radio(int16_t s1, uint16_t n_samples);
+
 #endif // DW1000_CIR_H
@@ -44,6 +44,8 @@
 #include "dw1000-arch.h"
 #include "dw1000-shared-state.h"
 #include "dw1000-config-struct.h"
+#include "dw1000.h"
+#include "dw1000-ranging.h"
 
 #define DEBUG 0
 #if DEBUG
@@ -110,6 +112,9 @@ dw1000_configure(const dwt_config_t *cfg) {
   dwt_forcetrxoff();
   CUR_CFG.cfg = *cfg;
   dwt_configure(&CUR_CFG.cfg);
+#if DW1000_RANGING_ENABLED
+  dw1000_ranging_update_conf();
+#endif
   
   dw1000_enable_interrupt(irq_status);
 
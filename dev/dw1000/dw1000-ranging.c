@@ -51,6 +51,7 @@
 #include "dw1000-shared-state.h"
 #include "dw1000-util.h"
 #include "dw1000-cir.h"
+#include "dw1000-time.h"
 #include "process.h"
 #include "deca_range_tables.h"
 #include "frame802154.h"
@@ -98,16 +99,40 @@
 #define PRINTF_INT(...) do {} while(0)
 #endif
 
-/* UWB microsecond (uus) to device time unit (dtu, around 15.65 ps) conversion factor.
- * 1 uus = 512 / 499.2 µs and 1 µs = 499.2 * 128 dtu. */
-#define UUS_TO_DWT_TIME 65536
-
 /* Speed of light in air, in metres per second. */
 #define SPEED_OF_LIGHT 299702547
 
+/* The ToF is computed in DTU in Q16 fixed point (no floating point: the
+ * EVB1000 MCU has no FPU). Millimetres per DTU are c / (499.2 MHz * 128)
+ * scaled by 1000, in Q20. */
+#define TOF_Q           16
+#define MM_PER_DTU_Q    20
+#define MM_PER_DTU      ((((uint64_t)SPEED_OF_LIGHT << MM_PER_DTU_Q) + 63897600 / 2) / 63897600)
+/* Bound of the ToF (2^24 DTU, about 78 km) keeping the conversion in 64 bits */
+#define TOF_MAX         ((int64_t)1 << (24 + TOF_Q))
+
+/* A CIR sample is 1 / (2 * 499.2 MHz), i.e., 64 DTU */
+#define CIR_SAMPLE_DTU  64
+
+/* Concurrent ranging: a reply is looked for from this many CIR samples
+ * before the time it would arrive from a responder at zero distance (the
+ * responder transmits up to 8 ns early, see dw1000_rng_ok_cb()) */
+#define CONC_WIN_LEAD   16
+/* The first path of a reply is its first sample of at least a quarter of
+ * the peak amplitude (1/16 of the squared magnitude) */
+#define CONC_PEAK_SHIFT 4
+
+_Static_assert(DW1000_RNG_CONC_SHIFT % 8 == 0,
+               "DW1000_RNG_CONC_SHIFT must be a multiple of 8 CIR samples");
+_Static_assert(DW1000_RNG_CONC_SHIFT > CONC_WIN_LEAD,
+               "DW1000_RNG_CONC_SHIFT is too short");
+_Static_assert(DW1000_RNG_MAX_RESPONDERS * DW1000_RNG_CONC_SHIFT <= DW1000_CIR_LEN_PRF16,
+               "The concurrent replies do not fit in the CIR");
+
 process_event_t ranging_event;
 struct process *req_process;
 static ranging_data_t ranging_data;
+static ranging_data_t ranging_result; /* ranging_data while the queue goes on */
 static int err_status;
 static dw1000_rng_type_t rng_type;
 static dw1000_cir_sample_t* cir_buffer;
@@ -115,6 +140,15 @@ static bool acquire_diagnostics;
 static int16_t cir_s1;
 static uint16_t cir_idx_mode;
 static uint16_t cir_n_samples;
+static dw1000_cir_chunk_cb_t cir_cb;
+static void *cir_cb_arg;
+static uint16_t cir_fp;                 /* integer first path index */
+static dw1000_nlos_peaks_t cir_peaks;   /* early peaks before cir_fp */
+static dw1000_cir_sample_t* cir_window; /* window read in this exchange */
+
+/* Ranging queue: the request being served and the waiting ones */
+static dw1000_rng_req_t *cur_req;
+static dw1000_rng_req_t *rq_head, *rq_tail;
 
 typedef enum {
   S_WAIT_POLL,        /* 0 */
@@ -126,7 +160,12 @@ typedef enum {
   S_WAIT_DS3_DONE,    /* 6 */
   S_RANGING_DONE,     /* 7 */
   S_ABORT,            /* 8 */
-  S_RESET             /* 9 */
+  S_RESET,            /* 9 */
+  S_WAIT_MS1,         /* 10 */
+  S_WAIT_CONC1,       /* 11 */
+  S_WAIT_DT1,         /* 12 */
+  S_WAIT_DT2,         /* 13 */
+  S_WAIT_DT2_DONE     /* 14 */
 } state_t;
 
 static state_t state;
@@ -161,15 +200,34 @@ static const frame802154_t default_header = {
 #define PLD_LEN_DS2 13
 #define PLD_LEN_DS3 13
 
+/* Three-message DS: the poll and the final message are as DS0 and DS2,
+ * the reply may carry the report of the previous exchange */
+#define PLD_LEN_DT1 1
+#define PLD_LEN_DT1_REPORT 6
+
+/* One-to-many poll: type, number of responders and their addresses */
+#define PLD_LEN_MS0(n) (2 + (n) * LINKADDR_SIZE)
+
+/* Header lengths: FCF, seqn, PAN ID and the addresses (the one-to-many
+ * poll is sent to the short broadcast address) */
+#define HDR_LEN_UNICAST (3 + 2 + 2 * LINKADDR_SIZE)
+#define HDR_LEN_MS0     (3 + 2 + 2 + LINKADDR_SIZE)
+
 /* Packet types for different messages */
 #define MSG_TYPE_SS0 0xE0
 #define MSG_TYPE_SS1 0xE1
+#define MSG_TYPE_MS0 0xE2 /* one-to-many poll, the replies are SS1 */
+#define MSG_TYPE_CONC0 0xE3 /* concurrent poll, same format as MS0 */
 
 #define MSG_TYPE_DS0 0xD0
 #define MSG_TYPE_DS1 0xD1
 #define MSG_TYPE_DS2 0xD2
 #define MSG_TYPE_DS3 0xD3
 
+#define MSG_TYPE_DT0 0xD4 /* three-message DS */
+#define MSG_TYPE_DT1 0xD5
+#define MSG_TYPE_DT2 0xD6
+
 /* Indexes to access some of the fields in the frames defined above. */
 #define PLD_TYPE_OFS 0
 
@@ -186,22 +244,94 @@ static const frame802154_t default_header = {
 #define DISTANCE_MSG_RESP_TX_OFS 5
 #define DISTANCE_MSG_FINAL_RX_OFS 9
 
+#define REPORT_MSG_SEQN_OFS 1
+#define REPORT_MSG_DIST_OFS 2
+
+/*MS*/
+#define POLL_MSG_N_RESP_OFS 1
+#define POLL_MSG_RESP_ADDR_OFS 2
+
 static uint8_t my_seqn;
 static uint8_t recv_seqn;
 static linkaddr_t ranging_with; /* the current ranging peer */
+static bool rng_responder;      /* rng_type is that of an exchange we answer */
+
+/* Three-message DS: the reports kept for the initiators (responder side),
+ * the one received in the reply and the polls of the last exchanges
+ * completed with each responder, which the reports must refer to
+ * (initiator side) */
+typedef struct {
+  ranging_report_t r;
+  bool valid;
+} dt_report_t;
+static dt_report_t dt_reports[DW1000_RNG_REPORTS];
+static uint8_t dt_report_next;  /* entry to replace */
+static dt_report_t dt_last;     /* last report computed as responder */
+static bool dt_received;
+static uint8_t dt_received_seqn;
+static int32_t dt_received_mm;
+static dt_report_t dt_polls[DW1000_RNG_REPORTS]; /* r.raw_distance_mm unused */
+static uint8_t dt_poll_next;
+
+#if DW1000_RNG_PEERS
+_Static_assert((DW1000_RNG_PEERS & (DW1000_RNG_PEERS - 1)) == 0,
+               "DW1000_RNG_PEERS must be a power of two");
+_Static_assert(DW1000_RNG_PEER_WINDOW > 0 && DW1000_RNG_PEER_WINDOW <= 255,
+               "DW1000_RNG_PEER_WINDOW out of range");
+
+/* Peer table: open addressing with linear probing. Entries are never
+ * emptied but replaced in place (or all at once), so the probe sequences
+ * stay valid without tombstones. */
+typedef struct {
+  dw1000_rng_peer_t p;      /* state returned to the application */
+  int32_t dist[DW1000_RNG_PEER_WINDOW];
+  int32_t offset[DW1000_RNG_PEER_WINDOW];
+  uint8_t dist_next;        /* oldest distance, to be replaced */
+  uint8_t offset_next;
+  uint8_t n_offsets;
+  bool valid;
+#if DW1000_RNG_PEER_CIR
+  dw1000_cir_avg_t cir;     /* average of the CIR windows */
+#endif
+} peer_entry_t;
+static peer_entry_t peers[DW1000_RNG_PEERS];
+#endif
 
+#if HDR_LEN_MS0 + PLD_LEN_MS0(DW1000_RNG_MAX_RESPONDERS) > 36
+#define MAX_BUF_LEN (HDR_LEN_MS0 + PLD_LEN_MS0(DW1000_RNG_MAX_RESPONDERS))
+#else
 #define MAX_BUF_LEN 36
+#endif
 static uint8_t rtx_buf[MAX_BUF_LEN];
 
+/* One-to-many and concurrent exchanges (initiator side) */
+static ranging_multi_data_t ms_data;
+static int32_t ms_ci[DW1000_RNG_MAX_RESPONDERS]; /* carrier integrator of each reply */
+static uint8_t ms_n;      /* number of responders, 0 if not ranging with many */
+static uint8_t ms_slot;   /* reply slot being received */
+static bool ms_concurrent;  /* the responders reply concurrently */
+static uint8_t conc_decoded;  /* concurrent reply decoded by the radio */
+
+/* CIR window of a concurrent reply (plus the index slot of dw1000_read_cir()) */
+static dw1000_cir_sample_t conc_cir[DW1000_RNG_CONC_SHIFT + 1];
+
+/* One-to-many reply slots, in UWB microseconds */
+static uint32_t ms_slot_len;  /* distance between the replies */
+static uint16_t ms_rx_lead;   /* RX start w.r.t. the expected RMARKER */
+static uint16_t ms_rx_to;     /* RX timeout for each slot */
+
+/* Exchange timing, in UWB microseconds */
 typedef struct {
+  /* Reply delays (RMARKER to RMARKER), by received frame */
+  uint32_t a;       /* unicast poll */
+  uint32_t a_many[DW1000_RNG_MAX_RESPONDERS + 1]; /* one-to-many poll, by n */
+  uint32_t b;       /* DS1, DT1 without a report */
+  uint32_t b_rep;   /* DT1 with a report */
+
   /* SS and DS timeouts */
-  uint32_t a;
-  uint32_t rx_dly_a;
   uint16_t to_a;
 
 /* DS timeouts */
-  uint32_t rx_dly_b;
-  uint32_t b;
   uint16_t to_b;
   uint16_t to_c;
 
@@ -210,108 +340,122 @@ typedef struct {
 /*
 * tx: tx_ts
 *           ----------- DS0/SS0 ----------->
-* listen:  txdone + rx_dly_a
-* timeout: txdone + rx_dly_a + to_a         tx: rx_ts + a
+* listen:  txdone + turnaround
+* timeout: txdone + turnaround + to_a       tx: rx_ts + a
 *           <---------- DS1/SS1 ------------
-*                                           listen:  txdone + rx_dly_b
-* tx: rx_ts + b                             timeout: txdone + rx_dly_b + to_b
+*                                           listen:  txdone + turnaround
+* tx: rx_ts + b                             timeout: txdone + turnaround + to_b
 *           ------------- DS2 ------------->
 * timeout: txdone + to_c                    tx: asap
 *           <------------ DS3 --------------
 *
+* A reply is sent (RMARKER) the rest of the received frame (PHR and PSDU),
+* the CPU turnaround, the SHR of the reply and a guard after the RMARKER of
+* the received frame. The peer listens from a guard before the preamble of
+* the reply is expected, for the reply airtime plus two guards. Hence a
+* and b depend on the length of the poll and of the reply actually
+* received, while the RX after TX delay is always the turnaround. DS3 is
+* sent as soon as possible, a turnaround after DS2.
 *
-* NB: Timing of the ranging exchange depends on the data rate, preamble length,
-* and packet sizes. Consult tools/ranging_timing.py for calculations.
+* The values depend on the data rate, PRF, preamble and frame lengths.
+* They are computed for all the frames when the radio is configured, so
+* that the reception callback only looks them up.
 */
 
-#if DW1000_EXTREME_RNG_TIMING
-/* The following are tuned for 128us preamble, EVB1000, long addresses */
-const static ranging_conf_t ranging_conf_6M8 = {
-/* SS and DS timeouts */
-  .a = 350,
-  .rx_dly_a = 100,    // timeout starts after this
-  .to_a = 300,
+static ranging_conf_t ranging_conf;
+static dwt_config_t ranging_conf_cfg; /* configuration of ranging_conf */
+static uint32_t ranging_shr;          /* SHR duration */
+static uint32_t poll_dly;             /* a of the current poll (initiator) */
 
-/* DS timeouts */
-  .b = 450,
-  .rx_dly_b = 200,    // timeout starts after this
-  .to_b = 300,
-  .to_c = 400,        // longer as there's no rx after tx delay
-};
-#else
-/* The following are tuned for 128us preamble, DWM1001 with BLE enabled, long addresses */
-const static ranging_conf_t ranging_conf_6M8 = {
-/* SS and DS timeouts */
-  .a = 650,
-  .rx_dly_a = 400,    // timeout starts after this
-  .to_a = 300,
+/* Nanoseconds to UWB microseconds, rounded up (approx.) */
+static inline uint32_t
+ns_to_uus(uint32_t ns)
+{
+  return (ns + 1023) / 1024;
+}
 
-/* DS timeouts */
-  .b = 650,
-  .rx_dly_b = 400,    // timeout starts after this
-  .to_b = 300,
-  .to_c = 650,        // longer as there's no rx after tx delay
-};
-#endif
+/* Duration of the SHR (up to the RMARKER) of any frame */
+static uint32_t
+shr_uus(const dwt_config_t *cfg)
+{
+  return ns_to_uus(dw1000_estimate_tx_time(cfg, 0, true));
+}
 
-const static ranging_conf_t ranging_conf_850K = {
-/* SS and DS timeouts */
-  .a = 1500,
-  .rx_dly_a = 0,
-  .to_a = 2000,
+/* Duration of a frame of len bytes (CRC included), whole or after the SHR */
+static uint32_t
+frame_uus(const dwt_config_t *cfg, uint16_t len, bool after_shr)
+{
+  uint32_t full = dw1000_estimate_tx_time(cfg, len, false);
 
-/* DS timeouts */
-  .b = 1500,
-  .rx_dly_b = 0,
-  .to_b = 3000,
-  .to_c = 2500,
-};
+  if(after_shr) {
+    full -= dw1000_estimate_tx_time(cfg, len, true);
+  }
+  return ns_to_uus(full);
+}
 
-const static ranging_conf_t ranging_conf_110K = {
-/* SS and DS timeouts */
-  .a = 3000,
-  .rx_dly_a = 0,
-  .to_a = 4000,
+/* Update the one-to-many reply slots based on current radio config. The
+ * initiator and the responders compute the same values, as the replies
+ * (SS1) have a fixed length. */
+static void
+update_ms_slots(void)
+{
+  const dwt_config_t *cfg = &dw1000_cached_config.cfg;
+  uint16_t len = HDR_LEN_UNICAST + PLD_LEN_SS1 + DW1000_CRC_LEN;
+  uint32_t airtime = (dw1000_estimate_tx_time(cfg, len, false) + 1023) / 1024; // ns to uus, approx.
+  uint32_t rmarker = dw1000_estimate_tx_time(cfg, len, true) / 1024;
+
+  ms_slot_len = airtime + 2 * DW1000_RNG_SLOT_RX_MARGIN + DW1000_RNG_SLOT_GUARD;
+  ms_rx_lead = rmarker + DW1000_RNG_SLOT_RX_MARGIN;
+  ms_rx_to = airtime + 2 * DW1000_RNG_SLOT_RX_MARGIN;
+}
 
-/* DS timeouts */
-  .b = 3000,
-  .rx_dly_b = 0,
-  .to_b = 4500,
-  .to_c = 3500, /* 3000 kind of works, too */
-};
+/* Delay (RMARKER to RMARKER) of the reply to a frame of len bytes (CRC
+ * included). Both ends know the length of the frame, so no exchange pays
+ * for a longer one. */
+static uint32_t
+reply_dly(uint16_t len)
+{
+  return frame_uus(&ranging_conf_cfg, len, true) + DW1000_RNG_TURNAROUND
+         + ranging_shr + DW1000_RNG_GUARD;
+}
 
-static ranging_conf_t ranging_conf;
+/* Update ranging delays and slots based on current radio config */
+static void
+update_ranging_conf(void)
+{
+  const dwt_config_t *cfg = &dw1000_cached_config.cfg;
+  uint8_t n;
 
-/* Update ranging delays based on current radio config */
-static inline void update_ranging_conf(void) {
-  switch(dw1000_cached_config.cfg.dataRate) {
-  case DWT_BR_6M8:
-    ranging_conf = ranging_conf_6M8;
-    break;
-  case DWT_BR_850K:
-    ranging_conf = ranging_conf_850K;
-    break;
-  case DWT_BR_110K:
-    ranging_conf = ranging_conf_110K;
-    break;
+  if(memcmp(&ranging_conf_cfg, cfg, sizeof(*cfg)) == 0) {
+    return;
   }
-}
+  ranging_conf_cfg = *cfg;
+  ranging_shr = shr_uus(cfg);
+  update_ms_slots();
 
-/*---------------------------------------------------------------------------*/
-static inline uint64_t
-get_rx_timestamp_u64(void)
-{
-  uint64_t ts = 0;
-  dwt_readrxtimestamp((uint8_t*)&ts);
-  return ts;
+  ranging_conf.a = reply_dly(HDR_LEN_UNICAST + PLD_LEN_POLL + DW1000_CRC_LEN);
+  for(n = 0; n <= DW1000_RNG_MAX_RESPONDERS; n++) {
+    ranging_conf.a_many[n] = reply_dly(HDR_LEN_MS0 + PLD_LEN_MS0(n) + DW1000_CRC_LEN);
+  }
+  ranging_conf.b = reply_dly(HDR_LEN_UNICAST + PLD_LEN_DS1 + DW1000_CRC_LEN);
+  ranging_conf.b_rep = reply_dly(HDR_LEN_UNICAST + PLD_LEN_DT1_REPORT + DW1000_CRC_LEN);
+
+  /* the longest reply to a poll is SS1 */
+  ranging_conf.to_a = frame_uus(cfg, HDR_LEN_UNICAST + PLD_LEN_SS1 + DW1000_CRC_LEN, false)
+                      + 2 * DW1000_RNG_GUARD;
+  ranging_conf.to_b = frame_uus(cfg, HDR_LEN_UNICAST + PLD_LEN_DS2 + DW1000_CRC_LEN, false)
+                      + 2 * DW1000_RNG_GUARD;
+  ranging_conf.to_c = DW1000_RNG_TURNAROUND
+                      + frame_uus(cfg, HDR_LEN_UNICAST + PLD_LEN_DS3 + DW1000_CRC_LEN, false)
+                      + DW1000_RNG_GUARD;
 }
+
 /*---------------------------------------------------------------------------*/
-static inline uint64_t
-get_tx_timestamp_u64(void)
+/* Round-to-nearest arithmetic right shift */
+static inline int64_t
+rshift_round(int64_t x, int shift)
 {
-  uint64_t ts = 0;
-  dwt_readtxtimestamp((uint8_t*)&ts);
-  return ts;
+  return (x + ((int64_t)1 << (shift - 1))) >> shift;
 }
 /*---------------------------------------------------------------------------*/
 static inline void
@@ -354,6 +498,66 @@ dw1000_ranging_init(void)
   old_state = state;
 }
 /*---------------------------------------------------------------------------*/
+void
+dw1000_ranging_update_conf(void)
+{
+  update_ranging_conf();
+}
+/*---------------------------------------------------------------------------*/
+/* Start an SS or DS exchange, to be called with interrupts disabled while
+ * not ranging */
+static void
+start_twr(const linkaddr_t *lladdr, dw1000_rng_type_t type)
+{
+  frame802154_t frame = default_header;
+
+  dwt_forcetrxoff();
+  update_ranging_conf();
+
+  ranging_with = *lladdr;
+  ranging_data.status = 0;
+  ranging_data.distance_mm = 0;
+  ranging_data.raw_distance_mm = 0;
+  rng_type = type;
+  rng_responder = false;
+  dt_received = false;
+  ms_n = 0;
+
+  my_seqn++;
+
+  PRINTF_RNG("dwr: rng start %d type %d\n", my_seqn, rng_type);
+
+  /* fill in non-constant fields of the header */
+  frame.seq = my_seqn;
+  memcpy(frame.dest_addr, lladdr->u8, LINKADDR_SIZE);
+  memcpy(frame.src_addr, linkaddr_node_addr.u8, LINKADDR_SIZE);
+
+  /* create the header */
+  uint8_t hdr_len = frame802154_create(&frame, rtx_buf);
+  /* create the payload */
+  rtx_buf[hdr_len + PLD_TYPE_OFS] = (rng_type == DW1000_RNG_SS) ? MSG_TYPE_SS0
+                                   : (rng_type == DW1000_RNG_DS) ? MSG_TYPE_DS0 : MSG_TYPE_DT0;
+
+  /* Set expected response's delay and timeout.*/
+  poll_dly = ranging_conf.a;
+  dwt_setrxaftertxdelay(DW1000_RNG_TURNAROUND);
+  dwt_setrxtimeout(ranging_conf.to_a);
+
+  /* Write frame data to DW1000 and prepare transmission. */
+  dwt_writetxdata(hdr_len + PLD_LEN_POLL + DW1000_CRC_LEN, rtx_buf, 0); /* Zero offset in TX buffer. */
+  dwt_writetxfctrl(hdr_len + PLD_LEN_POLL + DW1000_CRC_LEN, 0, 1); /* Zero offset in TX buffer, ranging. */
+
+  /* Start transmission, indicating that a response is expected so that
+   * reception is enabled automatically after the frame is sent and the delay
+   * set by dwt_setrxaftertxdelay() has elapsed. */
+
+  dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED);
+
+  old_state = state;
+  state = (rng_type == DW1000_RNG_SS) ? S_WAIT_SS1
+          : (rng_type == DW1000_RNG_DS) ? S_WAIT_DS1 : S_WAIT_DT1;
+}
+/*---------------------------------------------------------------------------*/
 bool
 dw1000_range_with(linkaddr_t *lladdr, dw1000_rng_type_t type)
 {
@@ -362,15 +566,117 @@ dw1000_range_with(linkaddr_t *lladdr, dw1000_rng_type_t type)
 #if PROFILE_RANGING
   r_start = RTIMER_NOW();
 #endif
-  frame802154_t frame = default_header;
-  if(type != DW1000_RNG_SS && type != DW1000_RNG_DS) {
+  if(type != DW1000_RNG_SS && type != DW1000_RNG_DS && type != DW1000_RNG_DS_3MSG) {
+    return false;
+  }
+
+  if(!ranging_event) {
+    return false; /* first call the init function */
+  }
+  if(req_process != PROCESS_NONE || rq_head != NULL) {
+    PRINTF_RNG_FAILED("dwr: busy 1: ost %d st %d ss %d\n", old_state, state, err_status);
+    return false; /* already ranging */
+  }
+  irq_status = dw1000_disable_interrupt();
+
+  if(state != S_WAIT_POLL) {
+    PRINTF_RNG_FAILED("dwr: busy 2: ost %d st %d ss %d\n", old_state, state, err_status);
+    ret = false;
+    goto enable_interrupts;
+  }
+
+  start_twr(lladdr, type);
+  ret = true; /* the request is successful */
+  req_process = PROCESS_CURRENT();
+
+enable_interrupts:
+  dw1000_enable_interrupt(irq_status);
+  PRINTF_RNG("dwr: exit %d\n", my_seqn);
+  return ret;
+}
+/*---------------------------------------------------------------------------*/
+/* Start the first queued request, to be called with interrupts disabled
+ * while not ranging. If the radio is asleep, the queued requests fail. */
+static void
+rq_start_next(void)
+{
+  dw1000_rng_req_t *req;
+
+  while(rq_head != NULL) {
+    req = rq_head;
+    rq_head = req->next;
+    if(rq_head == NULL) {
+      rq_tail = NULL;
+    }
+    if(dw1000_is_sleeping) {
+      req->result.status = 0;
+      process_post(req->process, ranging_event, req);
+      continue;
+    }
+
+#if PROFILE_RANGING
+    r_start = RTIMER_NOW();
+#endif
+    dw1000_prepare_ranging();
+    start_twr(&req->addr, req->type);
+    cur_req = req;
+    req_process = req->process;
+    acquire_diagnostics = req->diagnostics;
+    cir_buffer = NULL;
+    return;
+  }
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_range_enqueue(dw1000_rng_req_t *req)
+{
+  int8_t irq_status;
+
+  if(req->type != DW1000_RNG_SS && req->type != DW1000_RNG_DS
+     && req->type != DW1000_RNG_DS_3MSG) {
     return false;
   }
+  if(!ranging_event) {
+    return false; /* first call the init function */
+  }
+
+  req->next = NULL;
+  req->process = PROCESS_CURRENT();
+  req->result.status = 0;
+
+  irq_status = dw1000_disable_interrupt();
+  if(rq_tail != NULL) {
+    rq_tail->next = req;
+  }
+  else {
+    rq_head = req;
+  }
+  rq_tail = req;
 
+  /* otherwise dw1000_rng_process starts it when the radio is done */
+  if(req_process == PROCESS_NONE && state == S_WAIT_POLL) {
+    rq_start_next();
+  }
+  dw1000_enable_interrupt(irq_status);
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+/* Start a one-to-many (MS0) or concurrent (CONC0) exchange */
+static bool
+range_with_many_type(const linkaddr_t *lladdrs, uint8_t n, uint8_t poll_type)
+{
+  int8_t irq_status;
+  bool ret;
+  frame802154_t frame = default_header;
+  uint8_t hdr_len, i;
+
+  if(n == 0 || n > DW1000_RNG_MAX_RESPONDERS) {
+    return false;
+  }
   if(!ranging_event) {
     return false; /* first call the init function */
   }
-  if(req_process != PROCESS_NONE) {
+  if(req_process != PROCESS_NONE || rq_head != NULL) {
     PRINTF_RNG_FAILED("dwr: busy 1: ost %d st %d ss %d\n", old_state, state, err_status);
     return false; /* already ranging */
   }
@@ -385,61 +691,160 @@ dw1000_range_with(linkaddr_t *lladdr, dw1000_rng_type_t type)
   dwt_forcetrxoff();
   update_ranging_conf();
 
-  ranging_with = *lladdr;
-  ranging_data.status = 0;
-  ranging_data.distance = 0;
-  ranging_data.raw_distance = 0;
-  rng_type = type;
+  memset(&ms_data, 0, sizeof(ms_data));
+  ms_data.n_responders = n;
+  memcpy(ms_data.addr, lladdrs, n * sizeof(linkaddr_t));
+  ms_n = n;
+  ms_slot = 0;
+  ms_concurrent = (poll_type == MSG_TYPE_CONC0);
+  rng_type = DW1000_RNG_SS;
+  rng_responder = false;
 
   my_seqn++;
 
-  PRINTF_RNG("dwr: rng start %d type %d\n", my_seqn, rng_type);
+  PRINTF_RNG("dwr: rng start %d many %d conc %d\n", my_seqn, n, ms_concurrent);
 
-  /* fill in non-constant fields of the header */
+  /* broadcast poll */
+  frame.fcf.dest_addr_mode = 2;
   frame.seq = my_seqn;
-  memcpy(frame.dest_addr, lladdr->u8, LINKADDR_SIZE);
+  frame.dest_addr[0] = 0xFF;
+  frame.dest_addr[1] = 0xFF;
   memcpy(frame.src_addr, linkaddr_node_addr.u8, LINKADDR_SIZE);
+  hdr_len = frame802154_create(&frame, rtx_buf);
+
+  /* the payload lists the responders in the order of their slots */
+  rtx_buf[hdr_len + PLD_TYPE_OFS] = poll_type;
+  rtx_buf[hdr_len + POLL_MSG_N_RESP_OFS] = n;
+  for(i = 0; i < n; i++) {
+    memcpy(&rtx_buf[hdr_len + POLL_MSG_RESP_ADDR_OFS + i * LINKADDR_SIZE],
+           lladdrs[i].u8, LINKADDR_SIZE);
+  }
 
-  /* create the header */
-  uint8_t hdr_len = frame802154_create(&frame, rtx_buf);
-  /* create the payload */
-  rtx_buf[hdr_len + PLD_TYPE_OFS] = (rng_type == DW1000_RNG_SS) ? MSG_TYPE_SS0 : MSG_TYPE_DS0;
-
-  /* Set expected response's delay and timeout.*/
-  dwt_setrxaftertxdelay(ranging_conf.rx_dly_a);
+  /* The first reply comes as in SS-TWR, the others are received with
+   * delayed RX (see ms_next_slot()). The concurrent replies are received
+   * as one. */
+  poll_dly = ranging_conf.a_many[n];
+  dwt_setrxaftertxdelay(DW1000_RNG_TURNAROUND);
   dwt_setrxtimeout(ranging_conf.to_a);
 
-  /* Write frame data to DW1000 and prepare transmission. */
-  dwt_writetxdata(hdr_len + PLD_LEN_POLL + DW1000_CRC_LEN, rtx_buf, 0); /* Zero offset in TX buffer. */
-  dwt_writetxfctrl(hdr_len + PLD_LEN_POLL + DW1000_CRC_LEN, 0, 1); /* Zero offset in TX buffer, ranging. */
-
-  /* Start transmission, indicating that a response is expected so that
-   * reception is enabled automatically after the frame is sent and the delay
-   * set by dwt_setrxaftertxdelay() has elapsed. */
-
+  dwt_writetxdata(hdr_len + PLD_LEN_MS0(n) + DW1000_CRC_LEN, rtx_buf, 0);
+  dwt_writetxfctrl(hdr_len + PLD_LEN_MS0(n) + DW1000_CRC_LEN, 0, 1);
   dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED);
 
-  ret = true; /* the request is successful */
+  ret = true;
   old_state = state;
-  state = (rng_type == DW1000_RNG_SS) ? S_WAIT_SS1 : S_WAIT_DS1;
+  state = ms_concurrent ? S_WAIT_CONC1 : S_WAIT_MS1;
   req_process = PROCESS_CURRENT();
 
 enable_interrupts:
   dw1000_enable_interrupt(irq_status);
-  PRINTF_RNG("dwr: exit %d\n", my_seqn);
   return ret;
 }
 /*---------------------------------------------------------------------------*/
+bool
+dw1000_range_with_many(const linkaddr_t *lladdrs, uint8_t n)
+{
+  return range_with_many_type(lladdrs, n, MSG_TYPE_MS0);
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_range_concurrently(const linkaddr_t *lladdrs, uint8_t n)
+{
+  return range_with_many_type(lladdrs, n, MSG_TYPE_CONC0);
+}
+/*---------------------------------------------------------------------------*/
 /* Timestamps needed for SS computations */
 static uint32_t ss_poll_tx_ts, ss_resp_rx_ts, ss_poll_rx_ts, ss_resp_tx_ts;
 /* Timestamps needed for DS computations */
 static uint32_t ds_poll_tx_ts, ds_resp_rx_ts, ds_final_tx_ts;
 static uint32_t ds_poll_rx_ts, ds_resp_tx_ts, ds_final_rx_ts;
 
-// clock frequency offset to compensate the distance bias in SS-TWR
-static double clockOffsetPPM;
+// clock frequency offset (Q40 ratio) to compensate the distance bias in SS-TWR
+static int64_t clock_offset_q40;
+
+/*---------------------------------------------------------------------------*/
+/* One-to-many initiator: after a reply, a timeout or an error in the current
+ * slot, listen in the next one. Responder i replies at
+ * poll_rx_ts + a + i * ms_slot_len, so its RMARKER is expected at about
+ * poll_tx_ts + a + i * ms_slot_len (the ToF and the clock offset are
+ * within the RX margin). Slots that are already over are skipped. */
+static void
+ms_next_slot(void)
+{
+  dw1000_time_t poll_tx_ts = dw1000_time_read_tx();
+  dw1000_time_t rx_time;
+
+  while(++ms_slot < ms_n) {
+    rx_time = dw1000_time_add(poll_tx_ts, (int64_t)(poll_dly + ms_slot * ms_slot_len - ms_rx_lead)
+                              * UUS_TO_DWT_TIME);
+    dwt_setdelayedtrxtime(dw1000_time_dly(rx_time));
+    dwt_setrxtimeout(ms_rx_to);
+    if(dwt_rxenable(DWT_START_RX_DELAYED | DWT_IDLE_ON_DLY_ERR) == DWT_SUCCESS) {
+      return;
+    }
+    PRINTF_INT("dwr: late for slot %u\n", ms_slot);
+  }
+
+  /* all the slots are over */
+  old_state = state;
+  state = S_RANGING_DONE;
+  process_poll(&dw1000_rng_process);
+}
 
+/*---------------------------------------------------------------------------*/
+/* Three-message DS: the entry of a peer in dt_reports (responder side,
+ * the pending report for an initiator) or dt_polls (initiator side) */
+static dt_report_t *
+dt_find(dt_report_t *table, const uint8_t *addr)
+{
+  uint8_t i;
+
+  for(i = 0; i < DW1000_RNG_REPORTS; i++) {
+    if(table[i].valid
+       && memcmp(table[i].r.peer.u8, addr, LINKADDR_SIZE) == 0) {
+      return &table[i];
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* Three-message DS, initiator side: check that the report received refers
+ * to the previous exchange completed with the responder, and take the poll
+ * of this one as the next reference */
+static bool
+dt_check_report(void)
+{
+  dt_report_t *e = dt_find(dt_polls, ranging_with.u8);
+  bool valid = dt_received && e != NULL && dt_received_seqn == e->r.seqn;
+
+  if(e == NULL) {
+    e = &dt_polls[dt_poll_next];
+    dt_poll_next = (dt_poll_next + 1) % DW1000_RNG_REPORTS;
+  }
+  e->r.peer = ranging_with;
+  e->r.seqn = my_seqn;
+  e->valid = true;
+  return valid;
+}
+/*---------------------------------------------------------------------------*/
+/* Keep the distance to the initiator of the exchange just completed, to be
+ * reported in the reply to its next poll. A previous report for the same
+ * initiator is replaced, otherwise the oldest entry. */
+static void
+dt_store_report(int32_t raw_distance_mm)
+{
+  dt_report_t *e = dt_find(dt_reports, ranging_with.u8);
 
+  if(e == NULL) {
+    e = &dt_reports[dt_report_next];
+    dt_report_next = (dt_report_next + 1) % DW1000_RNG_REPORTS;
+  }
+  e->r.peer = ranging_with;
+  e->r.seqn = recv_seqn;
+  e->r.raw_distance_mm = raw_distance_mm;
+  e->valid = true;
+  dt_last = *e;
+}
 /*---------------------------------------------------------------------------*/
 /* Callback to process ranging good frame events
  */
@@ -474,20 +879,55 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
   recv_seqn = rx_frame.seq;
 
   if(state == S_WAIT_POLL) {
-    if(pld_len != PLD_LEN_POLL) {
+    /* reply delay in DTU, longer for the later slots of a one-to-many poll */
+    uint64_t resp_dly = (uint64_t)ranging_conf.a * UUS_TO_DWT_TIME;
+
+    if(rx_type == MSG_TYPE_MS0 || rx_type == MSG_TYPE_CONC0) {
+      uint8_t n = pld[POLL_MSG_N_RESP_OFS];
+      uint8_t i;
+
+      if(pld_len < PLD_LEN_MS0(0) || pld_len != PLD_LEN_MS0(n)
+         || n > DW1000_RNG_MAX_RESPONDERS) {
+        err_status = 11;
+        goto abort;
+      }
+      for(i = 0; i < n; i++) {
+        if(memcmp(&pld[POLL_MSG_RESP_ADDR_OFS + i * LINKADDR_SIZE],
+                  linkaddr_node_addr.u8, LINKADDR_SIZE) == 0) {
+          break;
+        }
+      }
+      if(i == n) {
+        err_status = 12; /* not polled */
+        goto abort;
+      }
+      resp_dly = (uint64_t)ranging_conf.a_many[n] * UUS_TO_DWT_TIME;
+      if(rx_type == MSG_TYPE_MS0) {
+        resp_dly += (uint64_t)i * ms_slot_len * UUS_TO_DWT_TIME;
+      } else {
+        /* Concurrent reply: the delay is corrected by the clock offset
+         * w.r.t. the initiator, so that all the replies are shifted as
+         * expected in its time base, and by the TX antenna delay, so that
+         * the RMARKER leaves the antenna (up to 8 ns early) at the given
+         * time rather than after it. */
+        int64_t offset = dw1000_get_offset_q40(&dw1000_cached_config.cfg,
+                                               dwt_readcarrierintegrator());
+        resp_dly -= rshift_round((int64_t)resp_dly * offset, 40);
+        resp_dly += (uint64_t)i * DW1000_RNG_CONC_SHIFT * CIR_SAMPLE_DTU;
+        resp_dly -= dw1000_cached_config.tx_ant_dly;
+      }
+      rx_type = MSG_TYPE_SS0; /* reply as to a single-sided poll */
+    } else if(pld_len != PLD_LEN_POLL) {
       err_status = 11;
       goto abort;
     }
 
-    update_ranging_conf();
-
     if(rx_type == MSG_TYPE_SS0) {  /* --- Single-sided poll --- */
 
-      /* Timestamps of frames transmission/reception.
-       * As they are 40-bit wide, we need to define a 64-bit int type to handle them. */
-      uint64_t poll_rx_ts_64;
-      uint64_t resp_tx_ts_64;
-      uint32_t resp_tx_time;
+      /* Timestamps of frames transmission/reception */
+      dw1000_time_t poll_rx_ts;
+      dw1000_time_t resp_tx_ts;
+      dw1000_time_t resp_tx_time;
 
       PRINTF_INT("dwr: got SS0.\n");
       if (! (cb_data->status & SYS_STATUS_LDEDONE)) {
@@ -496,13 +936,13 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
         goto abort;
       }
       /* Retrieve poll reception timestamp. */
-      poll_rx_ts_64 = get_rx_timestamp_u64();
+      poll_rx_ts = dw1000_time_read_rx();
 
       /* Compute final message transmission time. */
-      resp_tx_time = (poll_rx_ts_64 + (ranging_conf.a * UUS_TO_DWT_TIME)) >> 8;
+      resp_tx_time = dw1000_time_add(poll_rx_ts, resp_dly);
 
       /* Request sending the delayed response */
-      dwt_setdelayedtrxtime(resp_tx_time); // TX delay
+      dwt_setdelayedtrxtime(dw1000_time_dly(resp_tx_time)); // TX delay
       dwt_setrxaftertxdelay(0);            // enable RX right after TX
       dwt_setrxtimeout(0);                 // RX without timeout
       dwt_write8bitoffsetreg(PMSC_ID, PMSC_CTRL0_OFFSET, PMSC_CTRL0_TXCLKS_125M); /* errata TX-1: force rx timeout */
@@ -518,8 +958,7 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
       dwt_write8bitoffsetreg(SYS_CTRL_ID, SYS_CTRL_OFFSET, SYS_CTRL_SFCST);
 
       /* Response TX timestamp is the transmission time we programmed plus the antenna delay. */
-      resp_tx_ts_64 = (((uint64_t)(resp_tx_time & 0xFFFFFFFEUL)) << 8) + 
-                          dw1000_cached_config.tx_ant_dly;
+      resp_tx_ts = dw1000_time_tx_ts(resp_tx_time, dw1000_cached_config.tx_ant_dly);
 
       /* Fill in the response header */
       tx_frame.seq = rx_frame.seq;
@@ -532,8 +971,8 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
 
       /* Fill in the SS1 payload */
       rtx_buf[tx_hdr_len + PLD_TYPE_OFS] = MSG_TYPE_SS1;
-      msg_set_u32(&rtx_buf[tx_hdr_len + RESP_MSG_POLL_RX_TS_OFS], (uint32_t)poll_rx_ts_64); // we send 4 least-significant bytes
-      msg_set_u32(&rtx_buf[tx_hdr_len + RESP_MSG_RESP_TX_TS_OFS], (uint32_t)resp_tx_ts_64); // of the 40-bit precise timestamps
+      msg_set_u32(&rtx_buf[tx_hdr_len + RESP_MSG_POLL_RX_TS_OFS], dw1000_time_lo32(poll_rx_ts)); // we send 4 least-significant bytes
+      msg_set_u32(&rtx_buf[tx_hdr_len + RESP_MSG_RESP_TX_TS_OFS], dw1000_time_lo32(resp_tx_ts)); // of the 40-bit precise timestamps
 
       /* Write the frame data */
       dwt_writetxdata(tx_hdr_len + PLD_LEN_SS1 + DW1000_CRC_LEN, rtx_buf, 0);
@@ -545,9 +984,11 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
       state = S_WAIT_SS1_DONE;
       return; // replied with SS1, now waiting for TX done event.
 
-    } else if(rx_type == MSG_TYPE_DS0) { /* --- Double-sided poll --- */
-      uint32_t resp_tx_time;
-      uint64_t poll_rx_ts_64;
+    } else if(rx_type == MSG_TYPE_DS0 || rx_type == MSG_TYPE_DT0) { /* --- Double-sided poll --- */
+      dw1000_time_t poll_rx_ts;
+      bool three = (rx_type == MSG_TYPE_DT0);
+      dt_report_t *report = three ? dt_find(dt_reports, rx_frame.src_addr) : NULL;
+      uint8_t resp_len = report ? PLD_LEN_DT1_REPORT : PLD_LEN_DS1;
 
       PRINTF_INT("dwr: got DS0.\n");
 
@@ -558,15 +999,14 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
       }
 
       /* Retrieve poll and store poll reception timestamp. */
-      poll_rx_ts_64 = get_rx_timestamp_u64();
-      ds_poll_rx_ts = (uint32_t)poll_rx_ts_64;
+      poll_rx_ts = dw1000_time_read_rx();
+      ds_poll_rx_ts = dw1000_time_lo32(poll_rx_ts);
 
       /* Set send time for response. */
-      resp_tx_time = (poll_rx_ts_64 + (ranging_conf.a * UUS_TO_DWT_TIME)) >> 8;
-      dwt_setdelayedtrxtime(resp_tx_time);
+      dwt_setdelayedtrxtime(dw1000_time_dly(dw1000_time_add(poll_rx_ts, resp_dly)));
 
       /* Set expected delay and timeout for message reception. */
-      dwt_setrxaftertxdelay(ranging_conf.rx_dly_b);
+      dwt_setrxaftertxdelay(DW1000_RNG_TURNAROUND);
       dwt_setrxtimeout(ranging_conf.to_b);
 
       /* Request sending the response */
@@ -591,19 +1031,28 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
       tx_hdr_len = frame802154_create(&tx_frame, rtx_buf);
 
       /* Set up the PHY header */
-      dwt_writetxfctrl(tx_hdr_len + PLD_LEN_DS1 + DW1000_CRC_LEN, 0, 1); /* Zero offset in TX buffer, ranging. */
-
-      /* Fill in the DS1 payload */
-      rtx_buf[tx_hdr_len + PLD_TYPE_OFS] = MSG_TYPE_DS1;
+      dwt_writetxfctrl(tx_hdr_len + resp_len + DW1000_CRC_LEN, 0, 1); /* Zero offset in TX buffer, ranging. */
+
+      /* Fill in the DS1 payload, with the report of the previous three-message
+       * exchange with this initiator, if any. It is kept until this exchange
+       * completes: the final message shows the initiator received it, and
+       * the new report replaces it. */
+      rtx_buf[tx_hdr_len + PLD_TYPE_OFS] = three ? MSG_TYPE_DT1 : MSG_TYPE_DS1;
+      if(report) {
+        rtx_buf[tx_hdr_len + REPORT_MSG_SEQN_OFS] = report->r.seqn;
+        msg_set_u32(&rtx_buf[tx_hdr_len + REPORT_MSG_DIST_OFS], (uint32_t)report->r.raw_distance_mm);
+      }
 
       /* Write the frame data. */
-      dwt_writetxdata(tx_hdr_len + PLD_LEN_DS1 + DW1000_CRC_LEN, rtx_buf, 0); /* Zero offset in TX buffer. */
+      dwt_writetxdata(tx_hdr_len + resp_len + DW1000_CRC_LEN, rtx_buf, 0); /* Zero offset in TX buffer. */
 
       /* Cancel disabling auto-FCS, if we are in time, the radio will include FCS */
       dwt_write8bitoffsetreg(SYS_CTRL_ID, SYS_CTRL_OFFSET, SYS_CTRL_CANSFCS);
 
+      rng_type = three ? DW1000_RNG_DS_3MSG : DW1000_RNG_DS;
+      rng_responder = true;
       old_state = state;
-      state = S_WAIT_DS2;
+      state = three ? S_WAIT_DT2 : S_WAIT_DS2;
       return; // Replied with DS1. Now waiting for incoming DS2.
     } else {
       err_status = 13;
@@ -633,14 +1082,81 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
     state = S_RANGING_DONE;
 
     goto poll_the_process; // ranging done, poll the process.
-  } else if(state == S_WAIT_DS1) { /* --- We are waiting for the DS1 response --- */
-    if(pld_len != PLD_LEN_DS1) {
+  } else if(state == S_WAIT_MS1) { /* --- One-to-many: a reply in the current slot --- */
+    uint8_t k;
+
+    /* Anything unexpected only spoils the current slot */
+    if(pld_len != PLD_LEN_SS1 || rx_type != MSG_TYPE_SS1 || rx_frame.seq != my_seqn) {
+      err_status = 71;
+      ms_next_slot();
+      return;
+    }
+    for(k = ms_slot; k < ms_n; k++) {
+      if(memcmp(rx_frame.src_addr, ms_data.addr[k].u8, LINKADDR_SIZE) == 0) {
+        break;
+      }
+    }
+    if(k == ms_n) {
+      err_status = 72;
+      ms_next_slot();
+      return;
+    }
+
+    ranging_data_t *d = &ms_data.rng[k];
+    d->poll_tx_ts = dwt_readtxtimestamplo32();
+    d->resp_rx_ts = dwt_readrxtimestamplo32();
+    msg_get_u32(&rtx_buf[rx_hdr_len + RESP_MSG_POLL_RX_TS_OFS], &d->poll_rx_ts);
+    msg_get_u32(&rtx_buf[rx_hdr_len + RESP_MSG_RESP_TX_TS_OFS], &d->resp_tx_ts);
+    /* per-reply registers, read them before the next reception */
+    ms_ci[k] = dwt_readcarrierintegrator();
+    if(acquire_diagnostics) {
+      dwt_readdiagnostics(&d->rxdiag);
+    }
+    d->status = 1;
+
+    ms_slot = k;
+    ms_next_slot();
+    return;
+  } else if(state == S_WAIT_CONC1) { /* --- Concurrent: the reply decoded --- */
+    uint8_t k;
+
+    if(pld_len != PLD_LEN_SS1 || rx_type != MSG_TYPE_SS1 || rx_frame.seq != my_seqn) {
+      err_status = 81;
+      goto abort;
+    }
+    for(k = 0; k < ms_n; k++) {
+      if(memcmp(rx_frame.src_addr, ms_data.addr[k].u8, LINKADDR_SIZE) == 0) {
+        break;
+      }
+    }
+    if(k == ms_n || !(cb_data->status & SYS_STATUS_LDEDONE)) {
+      err_status = 82;
+      goto abort;
+    }
+
+    /* The other replies are looked for in the CIR by the process */
+    ranging_data_t *d = &ms_data.rng[k];
+    d->poll_tx_ts = dwt_readtxtimestamplo32();
+    d->resp_rx_ts = dwt_readrxtimestamplo32();
+    msg_get_u32(&rtx_buf[rx_hdr_len + RESP_MSG_POLL_RX_TS_OFS], &d->poll_rx_ts);
+    msg_get_u32(&rtx_buf[rx_hdr_len + RESP_MSG_RESP_TX_TS_OFS], &d->resp_tx_ts);
+    ms_ci[k] = dwt_readcarrierintegrator();
+    d->status = 1;
+    conc_decoded = k;
+
+    old_state = state;
+    state = S_RANGING_DONE;
+    goto poll_the_process;
+  } else if(state == S_WAIT_DS1 || state == S_WAIT_DT1) { /* --- We are waiting for the DS1 response --- */
+    bool three = (state == S_WAIT_DT1);
+
+    if(three ? (pld_len != PLD_LEN_DT1 && pld_len != PLD_LEN_DT1_REPORT) : pld_len != PLD_LEN_DS1) {
       err_status = 41;
       goto abort;
     }
 
     /* Check that the frame is the expected response */
-    if(rx_type != MSG_TYPE_DS1) {
+    if(rx_type != (three ? MSG_TYPE_DT1 : MSG_TYPE_DS1)) {
       err_status = 44;
       goto abort;
     }
@@ -653,23 +1169,29 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
       goto abort;
     }
 
-    uint64_t final_tx_ts_64;
-    uint32_t final_tx_time;
-    uint64_t poll_tx_ts_64, resp_rx_ts_64;
+    dw1000_time_t final_tx_time;
+    dw1000_time_t poll_tx_ts, resp_rx_ts;
 
     /* Retrieve poll transmission and response reception timestamp. */
-    poll_tx_ts_64 = get_tx_timestamp_u64();
-    resp_rx_ts_64 = get_rx_timestamp_u64();
-
-    /* Compute final message transmission time. */
-    final_tx_time = (resp_rx_ts_64 + (ranging_conf.b * UUS_TO_DWT_TIME)) >> 8;
-    dwt_setdelayedtrxtime(final_tx_time);
-
-    dwt_setrxaftertxdelay(0);             // Enable RX right after TX
-    dwt_setrxtimeout(ranging_conf.to_c);  // Set the RX timeout
-    dwt_write8bitoffsetreg(PMSC_ID, PMSC_CTRL0_OFFSET, PMSC_CTRL0_TXCLKS_125M); /* errata TX-1: force rx timeout */
-    /* Request transmission of the response */
-    int ret = dwt_starttx(DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED);
+    poll_tx_ts = dw1000_time_read_tx();
+    resp_rx_ts = dw1000_time_read_rx();
+
+    /* Compute final message transmission time, after the reply received. */
+    uint32_t b = (pld_len == PLD_LEN_DT1_REPORT) ? ranging_conf.b_rep : ranging_conf.b;
+    final_tx_time = dw1000_time_add(resp_rx_ts, (uint64_t)b * UUS_TO_DWT_TIME);
+    dwt_setdelayedtrxtime(dw1000_time_dly(final_tx_time));
+
+    int ret;
+    if(three) {
+      /* the responder computes the distance, nothing to wait for */
+      ret = dwt_starttx(DWT_START_TX_DELAYED);
+    } else {
+      dwt_setrxaftertxdelay(0);             // Enable RX right after TX
+      dwt_setrxtimeout(ranging_conf.to_c);  // Set the RX timeout
+      dwt_write8bitoffsetreg(PMSC_ID, PMSC_CTRL0_OFFSET, PMSC_CTRL0_TXCLKS_125M); /* errata TX-1: force rx timeout */
+      /* Request transmission of the response */
+      ret = dwt_starttx(DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED);
+    }
 
     if(ret != DWT_SUCCESS) {
       err_status = 45;
@@ -682,12 +1204,19 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
     dwt_write8bitoffsetreg(SYS_CTRL_ID, SYS_CTRL_OFFSET, SYS_CTRL_SFCST);
 
     /* Final TX timestamp is the transmission time we programmed plus the TX antenna delay. */
-    final_tx_ts_64 = (((uint64_t)(final_tx_time & 0xFFFFFFFEUL)) << 8) +
-                          dw1000_cached_config.tx_ant_dly;
-
-    ds_poll_tx_ts  = (uint32_t)poll_tx_ts_64;    // we send 4 least-significant bytes   
-    ds_resp_rx_ts  = (uint32_t)resp_rx_ts_64;    // of the 40-bit precise timestamps
-    ds_final_tx_ts = (uint32_t)final_tx_ts_64;
+    ds_poll_tx_ts  = dw1000_time_lo32(poll_tx_ts);  // we send 4 least-significant bytes
+    ds_resp_rx_ts  = dw1000_time_lo32(resp_rx_ts);  // of the 40-bit precise timestamps
+    ds_final_tx_ts = dw1000_time_lo32(dw1000_time_tx_ts(final_tx_time, dw1000_cached_config.tx_ant_dly));
+
+    /* The report of the previous exchange must be read before the frame
+     * buffer is overwritten */
+    if(pld_len == PLD_LEN_DT1_REPORT) {
+      uint32_t mm;
+      msg_get_u32(&rtx_buf[rx_hdr_len + REPORT_MSG_DIST_OFS], &mm);
+      dt_received_seqn = rtx_buf[rx_hdr_len + REPORT_MSG_SEQN_OFS];
+      dt_received_mm = (int32_t)mm;
+      dt_received = true;
+    }
 
     /* Fill in the response header */
     // TODO: can we reuse it from the previous time (DS0) ?
@@ -700,7 +1229,7 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
     dwt_writetxfctrl(tx_hdr_len + PLD_LEN_DS2 + DW1000_CRC_LEN, 0, 1); /* Zero offset in TX buffer, ranging. */
 
     /* Fill in the DS2 payload */
-    rtx_buf[tx_hdr_len + PLD_TYPE_OFS] = MSG_TYPE_DS2;
+    rtx_buf[tx_hdr_len + PLD_TYPE_OFS] = three ? MSG_TYPE_DT2 : MSG_TYPE_DS2;
 
     msg_set_u32(&rtx_buf[tx_hdr_len + FINAL_MSG_POLL_TX_TS_OFS],  ds_poll_tx_ts);
     msg_set_u32(&rtx_buf[tx_hdr_len + FINAL_MSG_RESP_RX_TS_OFS],  ds_resp_rx_ts);
@@ -713,17 +1242,17 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
     dwt_write8bitoffsetreg(SYS_CTRL_ID, SYS_CTRL_OFFSET, SYS_CTRL_CANSFCS);
 
     old_state = state;
-    state = S_WAIT_DS3;
-    return; // Sent DS2, wait for incoming DS3 message.
+    state = three ? S_WAIT_DT2_DONE : S_WAIT_DS3;
+    return; // Sent DS2, wait for incoming DS3 message (or for TX done).
 
-  } else if(state == S_WAIT_DS2) { /* --- We are waiting for the DS2 response --- */
+  } else if(state == S_WAIT_DS2 || state == S_WAIT_DT2) { /* --- We are waiting for the DS2 response --- */
     if(pld_len != PLD_LEN_DS2) {
       err_status = 51;
       goto abort;
     }
 
     /* Check that the frame is the expected response */
-    if(rx_type != MSG_TYPE_DS2) {
+    if(rx_type != (state == S_WAIT_DT2 ? MSG_TYPE_DT2 : MSG_TYPE_DS2)) {
       err_status = 54;
       goto abort;
     }
@@ -737,14 +1266,21 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data)
 
     /* ds_poll_rx_ts was stored on the previous step */
     /* Retrieve response transmission and final reception timestamps. */
-    ds_resp_tx_ts =  (uint32_t)get_tx_timestamp_u64();
-    ds_final_rx_ts = (uint32_t)get_rx_timestamp_u64();
+    ds_resp_tx_ts = dwt_readtxtimestamplo32();
+    ds_final_rx_ts = dwt_readrxtimestamplo32();
 
     /* Get timestamps embedded in the final message. */
     msg_get_u32(&rtx_buf[rx_hdr_len + FINAL_MSG_POLL_TX_TS_OFS],  &ds_poll_tx_ts);
     msg_get_u32(&rtx_buf[rx_hdr_len + FINAL_MSG_RESP_RX_TS_OFS],  &ds_resp_rx_ts);
     msg_get_u32(&rtx_buf[rx_hdr_len + FINAL_MSG_FINAL_TX_TS_OFS], &ds_final_tx_ts);
 
+    if(state == S_WAIT_DT2) {
+      /* three-message DS: the process computes the distance to report */
+      old_state = state;
+      state = S_RANGING_DONE;
+      goto poll_the_process;
+    }
+
     /* Fill in the response header */
     // TODO: can we reuse it from the previous time (DS0) ?
     tx_frame.seq = rx_frame.seq;
@@ -822,7 +1358,7 @@ dw1000_rng_tx_conf_cb(const dwt_cb_data_t *cb_data) {
     // We responded to the ranging request, no need to notify the process.
     // The radio is ON as requested in dwt_starttx for SS1.
   }
-  else if (state == S_WAIT_DS3_DONE) {
+  else if (state == S_WAIT_DS3_DONE || state == S_WAIT_DT2_DONE) {
     old_state = state;
     state = S_RANGING_DONE;
     // The ranging exchange is done.
@@ -830,48 +1366,405 @@ dw1000_rng_tx_conf_cb(const dwt_cb_data_t *cb_data) {
     process_poll(&dw1000_rng_process);
   }
 }
+/*---------------------------------------------------------------------------*/
+/* Callback to process RX timeout and error events
+ */
+bool
+dw1000_rng_rx_fail_cb(const dwt_cb_data_t *cb_data)
+{
+  if(state != S_WAIT_MS1) {
+    return false;
+  }
+  /* a responder missed its slot: the radio is off, listen in the next one */
+  ms_next_slot();
+  return true;
+}
 
-static double retrieve_clock_offset(void)
+static int64_t
+retrieve_clock_offset(void)
 {
   /* Read and store carrier integrator value */
   int32 carrierIntegrator = dwt_readcarrierintegrator();
-  
-  double hertz_to_ppm_multiplier = dw1000_get_hz2ppm_multiplier(
-    &dw1000_cached_config.cfg);
 
-  return carrierIntegrator * hertz_to_ppm_multiplier;
+  return dw1000_get_offset_q40(&dw1000_cached_config.cfg, carrierIntegrator);
 }
-
-static double
-ss_tof_calc(void)
+/*---------------------------------------------------------------------------*/
+/* ToF in DTU, Q16 */
+static int64_t
+ss_tof_calc(uint32_t poll_tx_ts, uint32_t resp_rx_ts,
+            uint32_t poll_rx_ts, uint32_t resp_tx_ts, int64_t offset_q40)
 {
   int32_t rtd_init, rtd_resp;
-  /* Compute time of flight. */
-  rtd_init = ss_resp_rx_ts - ss_poll_tx_ts;
-  rtd_resp = ss_resp_tx_ts - ss_poll_rx_ts;
-
-  double clockOffsetRatio = clockOffsetPPM / 1.0e6;
-
-  return ((rtd_init - rtd_resp * (1 - clockOffsetRatio)) / 2.0) * DWT_TIME_UNITS; // with clock drift compensation
-  //return ((rtd_init - rtd_resp) / 2.0) * DWT_TIME_UNITS; // without the compensation
+  int64_t tof2;
+
+  /* Compute time of flight. The low 32 bits of the timestamps are enough,
+   * as the exchange is much shorter than their wrap period. */
+  rtd_init = dw1000_time32_diff(resp_rx_ts, poll_tx_ts);
+  rtd_resp = dw1000_time32_diff(resp_tx_ts, poll_rx_ts);
+
+  /* rtd_init - rtd_resp * (1 - clock offset), with clock drift compensation.
+   * The offset is below 2^31 in Q40 (the carrier integrator has 21 bits),
+   * so the product fits in 63 bits. */
+  tof2 = (((int64_t)rtd_init - rtd_resp) << TOF_Q)
+    + rshift_round((int64_t)rtd_resp * offset_q40, 40 - TOF_Q);
+  return tof2 / 2;
+  //return (((int64_t)rtd_init - rtd_resp) << TOF_Q) / 2; // without the compensation
 }
 /*---------------------------------------------------------------------------*/
-static double
+/* ToF in DTU, Q16 */
+static int64_t
 ds_tof_calc(void)
 {
-  double Ra, Rb, Da, Db;
-  int64_t tof_dtu;
+  uint32_t Ra, Rb, Da, Db;
+  uint64_t RaRb, DaDb, num, den, q, r;
+  int64_t tof;
 
   /* Compute time of flight.
    * 32-bit subtractions give correct answers even if clock has wrapped. */
-  Ra = (double)(ds_resp_rx_ts - ds_poll_tx_ts);
-  Rb = (double)(ds_final_rx_ts - ds_resp_tx_ts);
-  Da = (double)(ds_final_tx_ts - ds_resp_rx_ts);
-  Db = (double)(ds_resp_tx_ts - ds_poll_rx_ts);
-  tof_dtu = (int64_t)((Ra * Rb - Da * Db) / (Ra + Rb + Da + Db));
+  Ra = ds_resp_rx_ts - ds_poll_tx_ts;
+  Rb = ds_final_rx_ts - ds_resp_tx_ts;
+  Da = ds_final_tx_ts - ds_resp_rx_ts;
+  Db = ds_resp_tx_ts - ds_poll_rx_ts;
+
+  /* (Ra * Rb - Da * Db) / (Ra + Rb + Da + Db): the products are exact in
+   * 64 unsigned bits, the sign is handled apart */
+  RaRb = (uint64_t)Ra * Rb;
+  DaDb = (uint64_t)Da * Db;
+  num = RaRb >= DaDb ? RaRb - DaDb : DaDb - RaRb;
+  den = (uint64_t)Ra + Rb + Da + Db;
+  if(den == 0) {
+    return 0;
+  }
+  /* the quotient is bounded by the round-trip times, so it does not
+   * overflow when scaled to Q16 */
+  q = num / den;
+  r = num % den;
+  tof = (int64_t)((q << TOF_Q) + (((r << TOF_Q) + den / 2) / den));
+  return RaRb >= DaDb ? tof : -tof;
+}
+/*---------------------------------------------------------------------------*/
+/* Distance in mm from a ToF in DTU, Q16 */
+static int32_t
+tof_to_mm(int64_t tof)
+{
+  if(tof > TOF_MAX) {
+    tof = TOF_MAX;
+  } else if(tof < -TOF_MAX) {
+    tof = -TOF_MAX;
+  }
+  return (int32_t)rshift_round(tof * (int64_t)MM_PER_DTU, TOF_Q + MM_PER_DTU_Q);
+}
+/*---------------------------------------------------------------------------*/
+/* Fill in the distances and the clock offset of a ranging result */
+static void
+set_distance_mm(ranging_data_t *d, int32_t not_corrected, int64_t offset_q40)
+{
+  d->raw_distance_mm = not_corrected;
+  d->refined_distance_mm = not_corrected;
+  d->fp_refined = -1;
+#if DW1000_COMPENSATE_BIAS
+  d->distance_mm = not_corrected - dwt_getrangebias_mm(
+      dw1000_cached_config.cfg.chan,
+      not_corrected,
+      dw1000_cached_config.cfg.prf);
+#else
+  d->distance_mm = not_corrected;
+#endif
+  d->clock_offset_ppb = (int32_t)rshift_round(offset_q40 * 1000000000, 40);
+}
+/*---------------------------------------------------------------------------*/
+static void
+set_distance(ranging_data_t *d, int64_t tof, int64_t offset_q40)
+{
+  set_distance_mm(d, tof_to_mm(tof), offset_q40);
+}
+/*---------------------------------------------------------------------------*/
+/* Chunk of the CIR acquired after an exchange: store it, search the early
+ * peaks in the part before the first path and run the application analysis */
+static bool
+cir_chunk(const dw1000_cir_sample_t *samples, uint16_t idx, uint16_t n_samples, void *arg)
+{
+  if(cir_buffer) {
+    memcpy(&cir_buffer[1 + idx - cir_s1], samples, n_samples * DW1000_CIR_SAMPLE_SIZE);
+  }
+  if(idx < cir_fp) {
+    dw1000_nlos_peaks_chunk(samples, idx,
+                            (idx + n_samples <= cir_fp) ? n_samples : cir_fp - idx,
+                            &cir_peaks);
+  }
+  return cir_cb == NULL || cir_cb(samples, idx, n_samples, cir_cb_arg);
+}
+/*---------------------------------------------------------------------------*/
+#if DW1000_RNG_REFINE_FP
+/* Find the first path in the acquired CIR window with sub-sample resolution
+ * and correct the ToF of the exchange. The CIR is the one of the last frame
+ * received by the initiator, whose RX timestamp marks the first path found
+ * by the LDE: moving it by e DTU (1/64 sample) changes the SS-TWR ToF by
+ * about e/2. In DS-TWR the last frame is the report, whose timestamp is not
+ * part of the ToF, so only SS-TWR is refined. */
+static void
+refine_first_path(int64_t tof)
+{
+  uint32_t thr = cir_peaks.noise3 / 3;  /* stdNoise * ntm, the LDE threshold */
+  uint32_t fp;
+
+  thr = (thr < 0xFFFF) ? thr * thr : 0xFFFFFFFF;
+  if(dw1000_cir_first_path(&cir_buffer[1], cir_s1, ranging_data.cir_samples_acquired, thr, &fp)) {
+    int32_t e = (int32_t)fp - ranging_data.rxdiag.firstPath;
+
+    ranging_data.fp_refined = fp;
+    ranging_data.refined_distance_mm = tof_to_mm(tof + ((int64_t)e << TOF_Q) / 2);
+  }
+}
+#endif /* DW1000_RNG_REFINE_FP */
+/*---------------------------------------------------------------------------*/
+/* Concurrent ranging: read the CIR window of a reply, starting from sample
+ * x (not wrapped around the accumulator length), and find the index of
+ * its first path. Returns false if there is no reply above the noise. */
+static bool
+conc_first_path(int32_t x, uint16_t cir_len, uint32_t noise_thr, int32_t *fp)
+{
+  uint16_t s1 = ((x % cir_len) + cir_len) % cir_len;
+  uint16_t n, j;
+  uint32_t peak = 0, thr;
+
+  n = dw1000_read_cir(s1, DW1000_RNG_CONC_SHIFT, conc_cir);
+  if(n < DW1000_RNG_CONC_SHIFT) {
+    /* The window wraps around the end of the accumulator. The second read
+     * stores its start index over the last sample of the first one. */
+    dw1000_cir_sample_t last = conc_cir[n];
+    j = n;
+    n += dw1000_read_cir(0, DW1000_RNG_CONC_SHIFT - n, &conc_cir[j]);
+    conc_cir[j] = last;
+  }
+
+  for(j = 1; j <= n; j++) {
+    uint32_t m = dw1000_cir_magsq(&conc_cir[j]);
+    if(m > peak) {
+      peak = m;
+    }
+  }
+  if(peak < noise_thr) {
+    return false;
+  }
+  thr = peak >> CONC_PEAK_SHIFT;
+  if(thr < noise_thr) {
+    thr = noise_thr;
+  }
+  for(j = 1; dw1000_cir_magsq(&conc_cir[j]) < thr; j++);
+  *fp = x + j - 1;
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+/* Concurrent ranging: find the replies in the CIR and derive their ToF from
+ * the one of the decoded reply, known from SS-TWR. Responder i transmits
+ * i * DW1000_RNG_CONC_SHIFT samples after responder 0 (in the initiator
+ * time base), so its first path is that much plus the difference of the
+ * round-trip times later. The 8 ns resolution of the transmission time
+ * adds an error of up to 4 ns to each ToF. */
+static void
+conc_separate(int64_t tof_decoded)
+{
+  ranging_data_t *ref = &ms_data.rng[conc_decoded];
+  uint16_t cir_len = (dw1000_cached_config.cfg.prf == DWT_PRF_64M) ?
+                       DW1000_CIR_LEN_PRF64 : DW1000_CIR_LEN_PRF16;
+  dwt_rxdiag_t diag;
+  uint32_t noise_thr;
+  int32_t x0, fp_ref, fp;
+  int64_t tof;
+  uint8_t i;
+
+  dwt_readdiagnostics(&diag);
+  if(acquire_diagnostics) {
+    ref->rxdiag = diag;
+  }
+  noise_thr = (uint32_t)DW1000_RNG_CONC_NOISE_MULT * diag.stdNoise;
+  noise_thr = (noise_thr < 0xFFFF) ? noise_thr * noise_thr : 0xFFFFFFFF;
+
+  /* Sample s of the CIR is at resp_rx_ts + s * 64 - firstPath DTU. The
+   * window of responder 0 starts a bit before its reply would arrive from
+   * zero distance, i.e., at poll_tx_ts + a. */
+  x0 = (dw1000_time32_diff((uint32_t)(ref->poll_tx_ts + poll_dly * UUS_TO_DWT_TIME), ref->resp_rx_ts)
+        + diag.firstPath) / CIR_SAMPLE_DTU - CONC_WIN_LEAD;
+
+  if(!conc_first_path(x0 + conc_decoded * DW1000_RNG_CONC_SHIFT, cir_len, noise_thr, &fp_ref)) {
+    return; /* only the decoded reply has a distance */
+  }
+  for(i = 0; i < ms_n; i++) {
+    if(i == conc_decoded ||
+       !conc_first_path(x0 + i * DW1000_RNG_CONC_SHIFT, cir_len, noise_thr, &fp)) {
+      continue;
+    }
+    /* half the difference of the round-trip times */
+    tof = tof_decoded + (((int64_t)(fp - fp_ref - (i - conc_decoded) * DW1000_RNG_CONC_SHIFT)
+                          * CIR_SAMPLE_DTU) << TOF_Q) / 2;
+    set_distance(&ms_data.rng[i], tof, 0);
+    ms_data.rng[i].status = 1;
+    ms_data.status++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+#if DW1000_RNG_PEERS
+static uint8_t
+peer_hash(const linkaddr_t *addr)
+{
+  uint8_t i, h = 0;
 
-  return (double)(tof_dtu * DWT_TIME_UNITS);
+  for(i = 0; i < LINKADDR_SIZE; i++) {
+    h = h * 31 + addr->u8[i];
+  }
+  return h & (DW1000_RNG_PEERS - 1);
+}
+/*---------------------------------------------------------------------------*/
+/* The entry of a peer, NULL if it is not in the table */
+static peer_entry_t *
+peer_find(const linkaddr_t *addr)
+{
+  uint8_t i, h = peer_hash(addr);
+
+  for(i = 0; i < DW1000_RNG_PEERS; i++) {
+    peer_entry_t *e = &peers[(h + i) & (DW1000_RNG_PEERS - 1)];
+    if(!e->valid) {
+      return NULL; /* end of the probe sequence */
+    }
+    if(linkaddr_cmp(&e->p.addr, addr)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* The entry of a peer, a new one if it is not in the table. When the table
+ * is full, the least recently updated peer is replaced. */
+static peer_entry_t *
+peer_get(const linkaddr_t *addr)
+{
+  uint8_t i, h = peer_hash(addr);
+  peer_entry_t *e, *oldest = NULL;
+  clock_time_t now = clock_time(), age, max_age = 0;
+
+  for(i = 0; i < DW1000_RNG_PEERS; i++) {
+    e = &peers[(h + i) & (DW1000_RNG_PEERS - 1)];
+    if(!e->valid) {
+      break;
+    }
+    if(linkaddr_cmp(&e->p.addr, addr)) {
+      return e;
+    }
+    age = now - e->p.last_update;
+    if(oldest == NULL || age > max_age) {
+      oldest = e;
+      max_age = age;
+    }
+  }
+  if(i == DW1000_RNG_PEERS) {
+    e = oldest;
+  }
+  memset(e, 0, sizeof(*e));
+  e->p.addr = *addr;
+  e->p.los_pct = DW1000_RNG_LOS_UNKNOWN;
+  e->valid = true;
+  return e;
+}
+/*---------------------------------------------------------------------------*/
+/* Median of the distances in the window of a peer */
+static int32_t
+peer_median(const peer_entry_t *e)
+{
+  int32_t v[DW1000_RNG_PEER_WINDOW], x;
+  uint8_t i, j, n = e->p.n_samples;
+
+  /* insertion sort, the window is short */
+  for(i = 0; i < n; i++) {
+    x = e->dist[i];
+    for(j = i; j > 0 && v[j - 1] > x; j--) {
+      v[j] = v[j - 1];
+    }
+    v[j] = x;
+  }
+  return (n & 1) ? v[n / 2] : (int32_t)(((int64_t)v[n / 2 - 1] + v[n / 2]) / 2);
+}
+/*---------------------------------------------------------------------------*/
+/* Add a successful result to the state of the peer. The clock offset and
+ * the RX diagnostics are only taken if measured on a reply of the peer,
+ * cir is the CIR window acquired with them, if any. */
+static void
+peer_update(const linkaddr_t *addr, const ranging_data_t *d,
+            bool with_offset, bool with_diag, const dw1000_cir_sample_t *cir)
+{
+  peer_entry_t *e = peer_get(addr);
+  int64_t sum = 0;
+  uint8_t i;
+
+  e->dist[e->dist_next] = d->distance_mm;
+  e->dist_next = (e->dist_next + 1) % DW1000_RNG_PEER_WINDOW;
+  if(e->p.n_samples < DW1000_RNG_PEER_WINDOW) {
+    e->p.n_samples++;
+  }
+  e->p.distance_mm = peer_median(e);
+  e->p.last_distance_mm = d->distance_mm;
+  e->p.last_update = clock_time();
+
+  if(with_offset) {
+    e->offset[e->offset_next] = d->clock_offset_ppb;
+    e->offset_next = (e->offset_next + 1) % DW1000_RNG_PEER_WINDOW;
+    if(e->n_offsets < DW1000_RNG_PEER_WINDOW) {
+      e->n_offsets++;
+    }
+    for(i = 0; i < e->n_offsets; i++) {
+      sum += e->offset[i];
+    }
+    e->p.clock_offset_ppb = (int32_t)(sum / e->n_offsets);
+  }
+
+  if(with_diag) {
+    int32_t cl = d->los_cl;
+
+#if DW1000_RNG_PEER_CIR
+    if(cir != NULL) {
+      dw1000_cir_sample_t avg[DW1000_CIR_AVG_LEN];
+      uint32_t fp = d->fp_refined >= 0 ? (uint32_t)d->fp_refined : d->rxdiag.firstPath;
+
+      if(dw1000_cir_avg_add(&e->cir, &cir[1], cir[0].u32, d->cir_samples_acquired, fp)) {
+        dw1000_nlos_t nlos;
+
+        /* the early peaks stand out of the noise in the average */
+        dw1000_cir_avg_get(&e->cir, avg);
+        dw1000_nlos(&nlos, &d->rxdiag, avg, DW1000_CIR_AVG_PRE);
+        cl = nlos.cl;
+      }
+    }
+#endif
+    if(cl < 0) {
+      dw1000_nlos_t nlos;
+
+      dw1000_nlos(&nlos, &d->rxdiag, NULL, 0);
+      cl = nlos.cl;
+    }
+    e->p.los_pct = (uint8_t)((cl * 100 + DW1000_NLOS_ONE / 2) >> DW1000_NLOS_Q);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Update the peer table with the results of the exchange just completed */
+static void
+peers_update(bool with_diag, const dw1000_cir_sample_t *cir)
+{
+  uint8_t k;
+
+  if(ms_n > 0) {
+    for(k = 0; k < ms_n; k++) {
+      if(ms_data.rng[k].status) {
+        /* in concurrent ranging, only the decoded reply was measured */
+        bool measured = !ms_concurrent || k == conc_decoded;
+        peer_update(&ms_data.addr[k], &ms_data.rng[k], measured, measured && with_diag, NULL);
+      }
+    }
+  }
+  else if(ranging_data.status && !rng_responder) {
+    peer_update(&ranging_with, &ranging_data, true, with_diag, cir);
+  }
 }
+#endif /* DW1000_RNG_PEERS */
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(dw1000_rng_process, ev, data)
 {
@@ -892,6 +1785,10 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
     r_proc = RTIMER_NOW();
 #endif
     uint8_t irq_status = dw1000_disable_interrupt();
+#if DW1000_RNG_PEERS
+    bool with_diag = acquire_diagnostics;
+#endif
+    int64_t twr_tof = 0;  /* SS or DS-TWR result, for the first path refinement */
 
     PRINTF_RNG("dwr: process: my %d their %d, ost %d st %d ss %d\n", my_seqn, recv_seqn, old_state, state, err_status);
 #if DEBUG_RNG == 0
@@ -901,16 +1798,65 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
 #endif
     err_status = 0;
 
-    if(state == S_RANGING_DONE) {
-      double tof;
-      double not_corrected;
+    if(ms_n > 0) {
+      /* One-to-many: whatever the final state, compute the distances to
+       * the responders that replied */
+      uint8_t k;
+      int64_t offset, tof, tof_decoded = 0;
+
+      ms_data.status = 0;
+      for(k = 0; k < ms_n; k++) {
+        ranging_data_t *d = &ms_data.rng[k];
+        d->los_cl = -1;
+        if(!d->status) {
+          continue;
+        }
+        offset = dw1000_get_offset_q40(&dw1000_cached_config.cfg, ms_ci[k]);
+        tof = ss_tof_calc(d->poll_tx_ts, d->resp_rx_ts,
+                          d->poll_rx_ts, d->resp_tx_ts, offset);
+        set_distance(d, tof, offset);
+        ms_data.status++;
+        tof_decoded = tof;
+      }
+      if(ms_concurrent && state == S_RANGING_DONE) {
+        /* a single reply was decoded, the others are in its CIR */
+        conc_separate(tof_decoded);
+      }
+      cir_buffer = NULL;
+      acquire_diagnostics = false;
+    }
+    else if(state == S_RANGING_DONE && rng_responder) {
+      /* three-message DS: keep the distance for the initiator */
+      if(rng_type == DW1000_RNG_DS_3MSG) {
+        dt_store_report(tof_to_mm(ds_tof_calc()));
+      }
+      ranging_data.status = 0;
+    }
+    else if(state == S_RANGING_DONE && rng_type == DW1000_RNG_DS_3MSG) {
+      /* the distance is the one reported for the previous exchange */
+      clock_offset_q40 = retrieve_clock_offset();
+      ranging_data.poll_tx_ts = ds_poll_tx_ts;
+      ranging_data.resp_rx_ts = ds_resp_rx_ts;
+      ranging_data.poll_rx_ts = 0;
+      ranging_data.resp_tx_ts = 0;
+      ranging_data.ds_final_tx_ts = ds_final_tx_ts;
+      ranging_data.ds_final_rx_ts = 0;
+      ranging_data.report_seqn = dt_received_seqn;
+      ranging_data.status = dt_check_report();
+      if(ranging_data.status) {
+        set_distance_mm(&ranging_data, dt_received_mm, clock_offset_q40);
+      }
+    }
+    else if(state == S_RANGING_DONE) {
+      int64_t tof;
 
       /* Clock offset is strictly necessary for SS TWR, but we acquiring it also 
        * in case of DS just for the sake of completeness */
-      clockOffsetPPM = retrieve_clock_offset();
+      clock_offset_q40 = retrieve_clock_offset();
 
       if(rng_type == DW1000_RNG_SS) {
-        tof = ss_tof_calc();
+        tof = ss_tof_calc(ss_poll_tx_ts, ss_resp_rx_ts,
+                          ss_poll_rx_ts, ss_resp_tx_ts, clock_offset_q40);
         ranging_data.poll_tx_ts = ss_poll_tx_ts;
         ranging_data.resp_rx_ts = ss_resp_rx_ts;
         ranging_data.poll_rx_ts = ss_poll_rx_ts;
@@ -927,19 +1873,10 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
         ranging_data.ds_final_rx_ts = ds_final_rx_ts;
       }
 
-      not_corrected = tof * SPEED_OF_LIGHT;
-      ranging_data.raw_distance = not_corrected;
-#if DW1000_COMPENSATE_BIAS
-      ranging_data.distance = not_corrected - dwt_getrangebias(
-          dw1000_cached_config.cfg.chan, 
-          not_corrected, 
-          dw1000_cached_config.cfg.prf);
-#else
-      ranging_data.distance = not_corrected;
-#endif
-      ranging_data.clock_offset_ppm = clockOffsetPPM;
+      set_distance(&ranging_data, tof, clock_offset_q40);
+      twr_tof = tof;
 
-      //PRINTF_RNG("dwr: %d done %f, after bias %f\n", my_seqn, not_corrected, ranging_data.distance);
+      //PRINTF_RNG("dwr: %d done %ld, after bias %ld\n", my_seqn, ranging_data.raw_distance_mm, ranging_data.distance_mm);
       ranging_data.status = 1;
     }
     else {
@@ -951,17 +1888,37 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
 #endif
 
     ranging_data.cir_samples_acquired = 0;
-    if (state == S_RANGING_DONE && acquire_diagnostics) {
+    ranging_data.los_cl = -1;
+    cir_window = NULL;
+    if (state == S_RANGING_DONE && acquire_diagnostics && ms_n == 0 && !rng_responder) {
+      dw1000_nlos_t nlos;
+
       dwt_readdiagnostics(&ranging_data.rxdiag);
+      cir_fp = ranging_data.rxdiag.firstPath >> 6;
+      dw1000_nlos_peaks_init(&cir_peaks, &ranging_data.rxdiag);
 
       if (cir_idx_mode == DW1000_CIR_IDX_RELATIVE) {
         // take the integer part of the FP index and add the relative shift
-        cir_s1 = (ranging_data.rxdiag.firstPath >> 6) + cir_s1; 
+        cir_s1 = cir_fp + cir_s1;
       } 
       
-      if (cir_s1 >= 0 && cir_buffer) {
-        ranging_data.cir_samples_acquired = dw1000_read_cir(cir_s1, cir_n_samples, cir_buffer);
+      if (cir_s1 >= 0 && (cir_buffer || cir_cb)) {
+        // the early peaks are searched while the next chunk is read
+        ranging_data.cir_samples_acquired =
+          dw1000_read_cir_chunked(cir_s1, cir_n_samples, cir_chunk, NULL);
+        if (cir_buffer) {
+          cir_buffer[0].u32 = cir_s1;
+          // the window of the reply whose timestamp enters the ToF
+          cir_window = rng_type == DW1000_RNG_SS ? cir_buffer : NULL;
+        }
       }
+      dw1000_nlos_from_peaks(&nlos, &ranging_data.rxdiag, &cir_peaks);
+      ranging_data.los_cl = nlos.cl;
+#if DW1000_RNG_REFINE_FP
+      if (cir_buffer && rng_type == DW1000_RNG_SS) {
+        refine_first_path(twr_tof);
+      }
+#endif
       cir_buffer = NULL;
       acquire_diagnostics = false;
     }
@@ -970,17 +1927,40 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
     r_cir = RTIMER_NOW();
 #endif
 
-    if (state != S_RESET) {
-      // if no reset was requested, re-enable reception
-      dwt_setrxtimeout(0);
-      dwt_rxenable(DWT_START_RX_IMMEDIATE);
-    }
+#if DW1000_RNG_PEERS
+    peers_update(with_diag, cir_window);
+#endif
 
     struct process *process_to_poll = req_process;
+    void *result = ms_n > 0 ? (void *)&ms_data : (void *)&ranging_data;
+    if(cur_req != NULL) {
+      // the result of a queued request goes to its own buffer
+      cur_req->result = ranging_data;
+      result = cur_req;
+      cur_req = NULL;
+    }
+    else if(result == &ranging_data && rq_head != NULL) {
+      // the next queued request reuses ranging_data right away
+      ranging_result = ranging_data;
+      result = &ranging_result;
+    }
+    bool reset = (state == S_RESET);
     req_process = PROCESS_NONE;
+    ms_n = 0;
+    rng_responder = false;
     old_state = state;
     state = S_WAIT_POLL;
 
+    if(rq_head != NULL) {
+      // go on with the next queued request right away
+      rq_start_next();
+    }
+    else if(!reset) {
+      // if no reset was requested, re-enable reception
+      dwt_setrxtimeout(0);
+      dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    }
+
     dw1000_enable_interrupt(irq_status);
 
 #if PROFILE_RANGING
@@ -992,7 +1972,7 @@ PROCESS_THREAD(dw1000_rng_process, ev, data)
       // calling back the requesting process right now (synch)
       // otherwise another process might corrupt the ranging_data
       // if activated before the requesting process
-      process_post_synch(process_to_poll, ranging_event, &ranging_data);
+      process_post_synch(process_to_poll, ranging_event, result);
     }
 
   }
@@ -1034,6 +2014,55 @@ dw1000_range_reset(void)
   }
 }
 
+bool
+dw1000_ranging_get_report(ranging_report_t *report)
+{
+  int8_t irq_status = dw1000_disable_interrupt();
+  bool valid = dt_last.valid;
+
+  if(valid) {
+    *report = dt_last.r;
+  }
+  dw1000_enable_interrupt(irq_status);
+  return valid;
+}
+/*---------------------------------------------------------------------------*/
+/* The table is only written by the ranging process, no locking needed */
+uint16_t
+dw1000_ranging_get_peer_cir(const linkaddr_t *addr, dw1000_cir_sample_t *samples)
+{
+#if DW1000_RNG_PEERS && DW1000_RNG_PEER_CIR
+  peer_entry_t *e = peer_find(addr);
+
+  if(e != NULL && dw1000_cir_avg_get(&e->cir, samples) > 0) {
+    return e->cir.n_frames;
+  }
+#endif
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_ranging_get_peer(const linkaddr_t *addr, dw1000_rng_peer_t *peer)
+{
+#if DW1000_RNG_PEERS
+  peer_entry_t *e = peer_find(addr);
+
+  if(e != NULL) {
+    *peer = e->p;
+    return true;
+  }
+#endif
+  return false;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_ranging_clear_peers(void)
+{
+#if DW1000_RNG_PEERS
+  memset(peers, 0, sizeof(peers));
+#endif
+}
+/*---------------------------------------------------------------------------*/
 void dw1000_ranging_acquire_diagnostics(uint16_t idx_mode, int16_t s1, uint16_t n_samples, dw1000_cir_sample_t* samples) {
   acquire_diagnostics = true;
   cir_buffer = samples;
@@ -1042,4 +2071,11 @@ void dw1000_ranging_acquire_diagnostics(uint16_t idx_mode, int16_t s1, uint16_t
   cir_idx_mode = idx_mode;
 }
 /*---------------------------------------------------------------------------*/
+void
+dw1000_ranging_set_cir_analysis(dw1000_cir_chunk_cb_t cb, void *arg)
+{
+  cir_cb = cb;
+  cir_cb_arg = arg;
+}
+/*---------------------------------------------------------------------------*/
 #endif /* DW1000_RANGING_ENABLED */
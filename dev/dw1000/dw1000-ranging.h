@@ -42,6 +42,7 @@
 #include "dw1000-cir.h"
 #include "core/net/linkaddr.h"
 #include "contiki-conf.h"
+#include "sys/clock.h"
 
 #ifndef DW1000_RANGING_H
 #define DW1000_RANGING_H
@@ -54,10 +55,117 @@
 #define DW1000_COMPENSATE_BIAS 1
 #endif
 
+/* CPU turnaround (UWB microseconds): the time from the end of a received
+ * ranging frame to the delayed transmission of the reply being set up
+ * (interrupt latency, SPI transfers and processing). The reply delays and
+ * RX windows of the exchanges are derived from it and from the radio
+ * configuration. All the nodes must use the same value: the default is
+ * safe on all the platforms (also with BLE on the DWM1001), 150 can be set
+ * in the project configuration to optimise ranging among EVB1000 nodes. */
+#ifdef DW1000_CONF_RNG_TURNAROUND
+#define DW1000_RNG_TURNAROUND DW1000_CONF_RNG_TURNAROUND
+#else
+#define DW1000_RNG_TURNAROUND 400
+#endif
+
+/* Margin (UWB microseconds) added to the reply delays and around the
+ * expected replies in the RX windows */
+#ifdef DW1000_CONF_RNG_GUARD
+#define DW1000_RNG_GUARD DW1000_CONF_RNG_GUARD
+#else
+#define DW1000_RNG_GUARD 50
+#endif
+
 #ifdef DW1000_CONF_EXTREME_RNG_TIMING
-#define DW1000_EXTREME_RNG_TIMING DW1000_CONF_EXTREME_RNG_TIMING
+#warning "DW1000_CONF_EXTREME_RNG_TIMING is obsolete, set DW1000_CONF_RNG_TURNAROUND instead"
+#endif
+
+/* Maximum number of responders of a one-to-many SS-TWR exchange */
+#ifdef DW1000_CONF_RNG_MAX_RESPONDERS
+#define DW1000_RNG_MAX_RESPONDERS DW1000_CONF_RNG_MAX_RESPONDERS
+#else
+#define DW1000_RNG_MAX_RESPONDERS 4
+#endif
+
+/* In one-to-many SS-TWR, the responders reply in consecutive slots, one
+ * reply airtime plus twice the RX margin plus the guard apart. The guard
+ * (in UWB microseconds) must cover the initiator processing a reply and
+ * scheduling the reception of the next one. */
+#ifdef DW1000_CONF_RNG_SLOT_GUARD
+#define DW1000_RNG_SLOT_GUARD DW1000_CONF_RNG_SLOT_GUARD
+#else
+#define DW1000_RNG_SLOT_GUARD 300
+#endif
+
+/* The initiator listens from this long (UWB microseconds) before the
+ * expected start of each reply to this long after its end */
+#ifdef DW1000_CONF_RNG_SLOT_RX_MARGIN
+#define DW1000_RNG_SLOT_RX_MARGIN DW1000_CONF_RNG_SLOT_RX_MARGIN
+#else
+#define DW1000_RNG_SLOT_RX_MARGIN 10
+#endif
+
+/* In concurrent ranging, the responders reply at the same time, responder i
+ * delayed by i times this many CIR samples (about 1 ns each, a multiple of
+ * 8 as the DW1000 schedules transmissions with an 8 ns resolution). Each
+ * reply is looked for in its own CIR window, so the shift must exceed the
+ * round-trip time to the farthest responder plus the channel delay spread:
+ * 200 samples allow about 25 m. All the shifts must fit in the CIR. */
+#ifdef DW1000_CONF_RNG_CONC_SHIFT
+#define DW1000_RNG_CONC_SHIFT DW1000_CONF_RNG_CONC_SHIFT
+#else
+#define DW1000_RNG_CONC_SHIFT 200
+#endif
+
+/* A reply is detected in its CIR window if its peak exceeds this many times
+ * the noise standard deviation reported by the radio */
+#ifdef DW1000_CONF_RNG_CONC_NOISE_MULT
+#define DW1000_RNG_CONC_NOISE_MULT DW1000_CONF_RNG_CONC_NOISE_MULT
+#else
+#define DW1000_RNG_CONC_NOISE_MULT 8
+#endif
+
+/* Number of initiators whose three-message DS-TWR reports a responder
+ * keeps until their next poll, and of responders whose last poll an
+ * initiator keeps to check the reports */
+#ifdef DW1000_CONF_RNG_REPORTS
+#define DW1000_RNG_REPORTS DW1000_CONF_RNG_REPORTS
+#else
+#define DW1000_RNG_REPORTS 4
+#endif
+
+/* Number of peers whose smoothed state the initiator keeps (see
+ * dw1000_ranging_get_peer()), a power of two; 0 disables the table */
+#ifdef DW1000_CONF_RNG_PEERS
+#define DW1000_RNG_PEERS DW1000_CONF_RNG_PEERS
 #else
-#define DW1000_EXTREME_RNG_TIMING 0
+#define DW1000_RNG_PEERS 0
+#endif
+
+/* Number of last distances and clock offsets of each peer the smoothed
+ * values are computed from */
+#ifdef DW1000_CONF_RNG_PEER_WINDOW
+#define DW1000_RNG_PEER_WINDOW DW1000_CONF_RNG_PEER_WINDOW
+#else
+#define DW1000_RNG_PEER_WINDOW 5
+#endif
+
+/* Average the CIR windows acquired with each peer (see
+ * dw1000_ranging_get_peer_cir()). Each table entry grows by a
+ * dw1000_cir_avg_t, 260 bytes with the default DW1000_CIR_AVG_LEN. */
+#ifdef DW1000_CONF_RNG_PEER_CIR
+#define DW1000_RNG_PEER_CIR DW1000_CONF_RNG_PEER_CIR
+#else
+#define DW1000_RNG_PEER_CIR 0
+#endif
+
+/* Refine the first path of SS-TWR exchanges in the CIR window
+ * acquired with dw1000_ranging_acquire_diagnostics(), see
+ * dw1000_cir_first_path() and ranging_data_t */
+#ifdef DW1000_CONF_RNG_REFINE_FP
+#define DW1000_RNG_REFINE_FP DW1000_CONF_RNG_REFINE_FP
+#else
+#define DW1000_RNG_REFINE_FP 1
 #endif
 
 /* A flag indicating that the CIR index is provided as relative w.r.t. 
@@ -68,7 +176,8 @@
 #define DW1000_CIR_IDX_ABSOLUTE 1
 
 /* Call this function before every ranging request to enable acquiring RX diagnostics
- * and/or CIR of the last received message.
+ * and/or CIR of the last received message. The CIR is read in chunks, searching
+ * the early peaks of dw1000_nlos() in the part before the first path on the way.
  *
  * Params:
  *  - cir_idx_mode  DW1000_CIR_IDX_RELATIVE or DW1000_CIR_IDX_ABSOLUTE
@@ -76,7 +185,8 @@
  *                  absoulte or relative depending on cir_idx_mode
  *  - n_samples     Number of CIR samples to read to the buffer
  *  - samples       A buffer to read CIR samples to. It must be at least
- *                  (n_samples + 1) long. If NULL, CIR will not be read.
+ *                  (n_samples + 1) long. If NULL, CIR will not be read
+ *                  (unless dw1000_ranging_set_cir_analysis() set a function).
  *
  * After the ranging is done with a successful status, the diagnostics will be available
  * in the associated ranging_data_t structure and the CIR will be read in the specified 
@@ -84,21 +194,125 @@
  */
 void dw1000_ranging_acquire_diagnostics(uint16_t cir_idx_mode, int16_t cir_s1, uint16_t n_samples, dw1000_cir_sample_t* samples);
 
+/* Set a function to run on each chunk of the CIR acquired with
+ * dw1000_ranging_acquire_diagnostics(), while the next chunk is read
+ * (see dw1000_read_cir_chunked()). If it is set, the CIR is read even
+ * without a buffer. It applies to the following requests, until it is
+ * replaced or removed with NULL.
+ */
+void dw1000_ranging_set_cir_analysis(dw1000_cir_chunk_cb_t cb, void *arg);
+
 extern process_event_t ranging_event;
 
 typedef struct {
   int status;       /* 1=SUCCESS, 0=FAIL */
   uint16_t cir_samples_acquired;
-  double distance;
-  double raw_distance;
-  double clock_offset_ppm;
+  int32_t distance_mm;       /* bias-compensated distance (if enabled) */
+  int32_t raw_distance_mm;
+  int32_t clock_offset_ppb;  /* clock frequency offset w.r.t. the peer */
   dwt_rxdiag_t rxdiag;
+  /* LOS confidence of dw1000_nlos() (Q16, DW1000_NLOS_ONE -> LOS) if the
+   * RX diagnostics were acquired (with the early peaks searched in the
+   * acquired CIR before the first path), -1 otherwise */
+  int32_t los_cl;
+  /* First path found by upsampling the acquired CIR window (10.6 fixed
+   * point like rxdiag.firstPath, see DW1000_RNG_REFINE_FP) and the distance
+   * with the ToF corrected for its difference from rxdiag.firstPath (not
+   * bias-compensated). Only for SS-TWR: in DS-TWR the diagnostics are those
+   * of the last frame, whose timestamp is not part of the ToF. If not
+   * refined, -1 and raw_distance_mm. */
+  int32_t fp_refined;
+  int32_t refined_distance_mm;
   
-  /* Raw timestamps */
+  /* Raw timestamps (with DW1000_RNG_DS_3MSG only the initiator's ones, and
+   * the distances are those of the previous exchange, see dw1000.h) */
   uint32_t poll_tx_ts, resp_rx_ts, poll_rx_ts, resp_tx_ts;
   uint32_t ds_final_tx_ts, ds_final_rx_ts;  /* For Double-sided */
+  /* DW1000_RNG_DS_3MSG: sequence number of the poll of the exchange the
+   * reported distance was measured in. The result is successful only if it
+   * is the previous exchange completed with the responder. */
+  uint8_t report_seqn;
 } ranging_data_t;
 
+/* Result of a one-to-many SS-TWR exchange, posted with ranging_event to
+ * the process that called range_with_many(). The CIR is not acquired; the
+ * RX diagnostics of each reply are, if requested.
+ *
+ * The result of concurrent ranging (range_concurrently()) has the same
+ * form. Only the reply decoded by the radio has the raw timestamps, the
+ * clock offset and the RX diagnostics; the others have the distances
+ * derived from their position in the CIR. */
+typedef struct {
+  int status;       /* number of responders that replied, 0=FAIL */
+  uint8_t n_responders;
+  linkaddr_t addr[DW1000_RNG_MAX_RESPONDERS];
+  ranging_data_t rng[DW1000_RNG_MAX_RESPONDERS]; /* in the order of addr */
+} ranging_multi_data_t;
+
+/* Distance computed by the responder of a three-message DS-TWR exchange
+ * (DW1000_RNG_DS_3MSG). The initiator gets it as the result of its next
+ * exchange with the responder; the application of the responder can read
+ * the last one with dw1000_ranging_get_report(), e.g., to piggyback it on
+ * its own traffic. */
+typedef struct {
+  linkaddr_t peer;           /* initiator */
+  uint8_t seqn;              /* sequence number of the initiator's poll */
+  int32_t raw_distance_mm;   /* not bias-compensated */
+} ranging_report_t;
+
+/* Get the report of the last three-message DS-TWR exchange answered by
+ * this node. Returns false if there is none. */
+bool dw1000_ranging_get_report(ranging_report_t *report);
+
+/* LOS confidence of a peer never ranged with RX diagnostics */
+#define DW1000_RNG_LOS_UNKNOWN 0xFF
+
+/* Smoothed state of a peer, updated with each successful exchange this
+ * node initiated (single, queued, one-to-many and concurrent) if
+ * DW1000_RNG_PEERS is not 0. The median discards the outliers of the last
+ * DW1000_RNG_PEER_WINDOW distances. The LOS confidence is derived with
+ * dw1000_nlos() from the RX diagnostics, so only the exchanges that
+ * acquired them update it. */
+typedef struct {
+  linkaddr_t addr;
+  uint8_t n_samples;          /* distances in the window */
+  int32_t distance_mm;        /* median of the window (bias-compensated) */
+  int32_t last_distance_mm;   /* last distance (bias-compensated) */
+  int32_t clock_offset_ppb;   /* mean of the last clock offsets */
+  uint8_t los_pct;            /* 0 (NLOS) to 100 (LOS), or DW1000_RNG_LOS_UNKNOWN */
+  clock_time_t last_update;   /* clock_time() of the last distance */
+} dw1000_rng_peer_t;
+
+/* Get the smoothed state of a peer in constant time. Returns false if the
+ * peer is not in the table (never ranged with, or replaced by others). */
+bool dw1000_ranging_get_peer(const linkaddr_t *addr, dw1000_rng_peer_t *peer);
+
+/* Get the average of the CIR windows acquired with a peer: the
+ * DW1000_CIR_AVG_LEN samples of dw1000_cir_avg_get(), with the first path
+ * at DW1000_CIR_AVG_PRE. Only the SS-TWR exchanges whose window
+ * (dw1000_ranging_acquire_diagnostics()) covers the first path are
+ * averaged, and the LOS confidence of the peer is then computed on the
+ * average. Returns the number of averaged windows, 0 if there are none
+ * or DW1000_RNG_PEER_CIR is disabled. */
+uint16_t dw1000_ranging_get_peer_cir(const linkaddr_t *addr, dw1000_cir_sample_t *samples);
+
+/* Forget the state of all the peers, e.g., after the nodes moved */
+void dw1000_ranging_clear_peers(void);
+
+/* SS/DS-TWR request for the ranging queue (see range_enqueue()). The
+ * caller owns the request, which must stay valid until it is done: then
+ * ranging_event is posted to the process that queued it, with the request
+ * as data and the outcome in result. The queued exchanges run back to
+ * back, the next one starting as soon as the previous one is over. */
+typedef struct dw1000_rng_req {
+  struct dw1000_rng_req *next;  /* used by the driver */
+  struct process *process;      /* set by the driver */
+  linkaddr_t addr;              /* peer */
+  dw1000_rng_type_t type;
+  bool diagnostics;             /* read the RX diagnostics (no CIR) */
+  ranging_data_t result;
+} dw1000_rng_req_t;
+
 /*---------------------------------------------------------------------------*/
 /* Private functions for driver-level use only                               */
 /*---------------------------------------------------------------------------*/
@@ -106,6 +320,9 @@ typedef struct {
 /* (Re)initialise the ranging module */
 void dw1000_ranging_init(void);
 
+/* Update the ranging delays after the radio configuration has changed */
+void dw1000_ranging_update_conf(void);
+
 /* Callback to process ranging good frame events */
 void
 dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data);
@@ -114,7 +331,16 @@ dw1000_rng_ok_cb(const dwt_cb_data_t *cb_data);
 void
 dw1000_rng_tx_conf_cb(const dwt_cb_data_t *cb_data);
 
+/* Callback to process RX timeouts and errors. Returns true if the ranging
+ * module handled the event (the exchange goes on), false if the caller
+ * should reset the ranging module. */
+bool
+dw1000_rng_rx_fail_cb(const dwt_cb_data_t *cb_data);
+
 bool dw1000_range_with(linkaddr_t *lladdr, dw1000_rng_type_t type);
+bool dw1000_range_with_many(const linkaddr_t *lladdrs, uint8_t n);
+bool dw1000_range_concurrently(const linkaddr_t *lladdrs, uint8_t n);
+bool dw1000_range_enqueue(dw1000_rng_req_t *req);
 bool dw1000_is_ranging(void);
 void dw1000_range_reset(void);
 
@@ -10,4 +10,8 @@
 extern bool dw1000_is_sleeping; /* true when the radio is in DEEP SLEEP mode */
 extern struct dw1000_all_config dw1000_cached_config; /* current cached radio configuration */
 
+/* Stop the radio and set it up for a ranging exchange started by this node
+ * (single RX buffer, no pending frame) */
+void dw1000_prepare_ranging(void);
+
 #endif
@@ -39,6 +39,7 @@
 #include "dw1000-statetime.h"
 #include "dw1000-util.h"
 #include "dw1000-conv.h"
+#include "dw1000-time.h"
 #include "dw1000-config.h"
 #include <inttypes.h>
 #include <stdbool.h>
@@ -58,8 +59,6 @@
 
 #define ENERGY_LOG(...) PRINTF("[ENERGY]" __VA_ARGS__)
 
-#define TIME_LT32(T1, T2) ((int32_t)(T2-T1) >= 0)
-
 // the schedule can shift of +-4 ns due to the scheduling precision.
 #define STATETIME_SFD_SLACK_4NS     2 // 8ns
 
@@ -126,7 +125,7 @@ dw1000_statetime_schedule_txrx(const uint32_t schedule_tx_32hi, const uint32_t r
 
     context.is_rx_after_tx = true;
     context.schedule_32hi  = schedule_tx_32hi;
-    context.rx_delay_32hi  = rx_delay_uus * 1000 / DWT_TICK_TO_NS_32;
+    context.rx_delay_32hi  = DW1000_UUS_TO_4NS(rx_delay_uus);
     context.state = DW1000_SCHEDULED_TX;
 }
 /*---------------------------------------------------------------------------*/
@@ -155,15 +154,15 @@ dw1000_statetime_after_tx(const uint32_t sfd_tx_32hi, const uint16_t framelength
         // first transmission of the epoch. last idle is the time at the beginning
         // of preamble transmission.
         // NOTE: schedule reports the expected sfd time
-        dw1000_statetime_set_last_idle(sfd_tx_32hi - STATETIME_SFD_SLACK_4NS - (preamble_time_ns / DWT_TICK_TO_NS_32));
+        dw1000_statetime_set_last_idle(sfd_tx_32hi - STATETIME_SFD_SLACK_4NS - DW1000_NS_TO_4NS(preamble_time_ns));
         context.is_restarted = false;
     }
 
-    uint32_t idle_sfd_time_ns = (sfd_tx_32hi - context.last_idle_32hi) * DWT_TICK_TO_NS_32;
-    WARNIF(!TIME_LT32(context.last_idle_32hi, sfd_tx_32hi));
-    WARNIF(!TIME_LT32(preamble_time_ns, idle_sfd_time_ns));
+    uint32_t idle_sfd_time_ns = DW1000_4NS_TO_NS(sfd_tx_32hi - context.last_idle_32hi);
+    WARNIF(!dw1000_time32_le(context.last_idle_32hi, sfd_tx_32hi));
+    WARNIF(!dw1000_time32_le(preamble_time_ns, idle_sfd_time_ns));
     STATETIME_DBG(
-    if (!TIME_LT32(preamble_time_ns, idle_sfd_time_ns) || !TIME_LT32(preamble_time_ns, idle_sfd_time_ns)) {
+    if (!dw1000_time32_le(preamble_time_ns, idle_sfd_time_ns) || !dw1000_time32_le(preamble_time_ns, idle_sfd_time_ns)) {
         PRINTF("S %lu, SFD %lu, R %d\n", context.schedule_32hi, sfd_tx_32hi, restarted);
         PRINTF("P %lu, R %lu\n", preamble_time_ns, idle_sfd_time_ns);
     })
@@ -175,7 +174,7 @@ dw1000_statetime_after_tx(const uint32_t sfd_tx_32hi, const uint16_t framelength
 
     // the radio goes idle when tx done is issued, therefore
     // roughly at sfd + the time required to read the PHY payload
-    context.last_idle_32hi = sfd_tx_32hi + payload_time_ns / DWT_TICK_TO_NS_32;
+    context.last_idle_32hi = sfd_tx_32hi + DW1000_NS_TO_4NS(payload_time_ns);
 
     if (context.is_rx_after_tx) {
 
@@ -210,16 +209,16 @@ dw1000_statetime_after_rxerr(const uint32_t now_32hi)
         // context.schedule_32hi stores the timestamp the
         // radio switched to rx
         WARNIF(context.schedule_32hi == 0);
-        WARNIF(!TIME_LT32(context.schedule_32hi, now_32hi));
-        WARNIF(!TIME_LT32(context.last_idle_32hi, context.schedule_32hi));
+        WARNIF(!dw1000_time32_le(context.schedule_32hi, now_32hi));
+        WARNIF(!dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi));
 
         STATETIME_DBG(
-        if (!TIME_LT32(context.schedule_32hi, now_32hi) || !TIME_LT32(context.last_idle_32hi, context.schedule_32hi)) {
+        if (!dw1000_time32_le(context.schedule_32hi, now_32hi) || !dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi)) {
             printf("S %lu, N %lu, R %d\n", context.schedule_32hi, now_32hi, restarted);
         })
 
-        context.idle_time_us += (context.schedule_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
-        context.rx_preamble_hunting_time_us += (now_32hi - context.schedule_32hi) * DWT_TICK_TO_NS_32 / 1000;
+        context.idle_time_us += DW1000_4NS_TO_NS(context.schedule_32hi - context.last_idle_32hi) / 1000;
+        context.rx_preamble_hunting_time_us += DW1000_4NS_TO_NS(now_32hi - context.schedule_32hi) / 1000;
     }
 
     // radio switched to idle when rx_ok callback was issued
@@ -255,11 +254,11 @@ dw1000_statetime_after_rx(const uint32_t sfd_rx_32hi, const uint16_t framelength
         // context.schedule_32hi stores the timestamp the
         // radio switched to rx
         WARNIF(context.schedule_32hi == 0);
-        WARNIF(!TIME_LT32(context.schedule_32hi, sfd_rx_32hi));
-        WARNIF(!TIME_LT32(context.last_idle_32hi, context.schedule_32hi));
-        schedule_sfd_time_ns = (sfd_rx_32hi - context.schedule_32hi) * DWT_TICK_TO_NS_32;
+        WARNIF(!dw1000_time32_le(context.schedule_32hi, sfd_rx_32hi));
+        WARNIF(!dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi));
+        schedule_sfd_time_ns = DW1000_4NS_TO_NS(sfd_rx_32hi - context.schedule_32hi);
         STATETIME_DBG(
-        if (!TIME_LT32(context.schedule_32hi, sfd_rx_32hi) || !TIME_LT32(context.last_idle_32hi, context.schedule_32hi)) {
+        if (!dw1000_time32_le(context.schedule_32hi, sfd_rx_32hi) || !dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi)) {
             printf("S %lu, SFD %lu, R %d\n", context.schedule_32hi, sfd_rx_32hi, restarted);
         })
 
@@ -267,13 +266,13 @@ dw1000_statetime_after_rx(const uint32_t sfd_rx_32hi, const uint16_t framelength
         // not having received the entire preamble.
         // If this is the case, consider the time schedule_rx <-> sfd as
         // preamble_time
-        if (TIME_LT32(preamble_time_ns, schedule_sfd_time_ns)) {
+        if (dw1000_time32_le(preamble_time_ns, schedule_sfd_time_ns)) {
             ph_time_ns = schedule_sfd_time_ns - preamble_time_ns;
         } else  {
             preamble_time_ns = schedule_sfd_time_ns;
             ph_time_ns = 0;
         }
-        context.idle_time_us += (context.schedule_32hi - context.last_idle_32hi) * DWT_TICK_TO_NS_32 / 1000;
+        context.idle_time_us += DW1000_4NS_TO_NS(context.schedule_32hi - context.last_idle_32hi) / 1000;
         context.rx_preamble_hunting_time_us += ph_time_ns / 1000;
 
     } 
@@ -281,7 +280,7 @@ dw1000_statetime_after_rx(const uint32_t sfd_rx_32hi, const uint16_t framelength
     context.rx_data_time_us += payload_time_ns / 1000;
 
     // radio switched to idle when rx_ok callback was issued
-    context.last_idle_32hi = sfd_rx_32hi + payload_time_ns / DWT_TICK_TO_NS_32;
+    context.last_idle_32hi = sfd_rx_32hi + DW1000_NS_TO_4NS(payload_time_ns);
 
     context.state = DW1000_IDLE;
 }
@@ -322,34 +321,34 @@ dw1000_statetime_abort(const uint32_t now_32hi)
         // context.schedule_32hi stores the timestamp the
         // radio switched to rx
         WARNIF(context.schedule_32hi == 0);
-        WARNIF(!TIME_LT32(context.last_idle_32hi, context.schedule_32hi));
-        if (TIME_LT32(context.schedule_32hi, now_32hi)) {
-            context.idle_time_us += (context.schedule_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
-            context.rx_preamble_hunting_time_us += (now_32hi - context.schedule_32hi) * DWT_TICK_TO_NS_32 / 1000;
+        WARNIF(!dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi));
+        if (dw1000_time32_le(context.schedule_32hi, now_32hi)) {
+            context.idle_time_us += DW1000_4NS_TO_NS(context.schedule_32hi - context.last_idle_32hi) / 1000;
+            context.rx_preamble_hunting_time_us += DW1000_4NS_TO_NS(now_32hi - context.schedule_32hi) / 1000;
         }
         else {
             // radio operation interrupt before the radio was turned on.
             // this time is spent in idle
-            context.idle_time_us += (now_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
+            context.idle_time_us += DW1000_4NS_TO_NS(now_32hi - context.last_idle_32hi) / 1000;
         }
     }
     else if (context.state == DW1000_SCHEDULED_TX) {
         // consider this time to be spend TX the preamble
         WARNIF(context.schedule_32hi == 0);
-        WARNIF(!TIME_LT32(context.last_idle_32hi, context.schedule_32hi));
+        WARNIF(!dw1000_time32_le(context.last_idle_32hi, context.schedule_32hi));
 
-        if (TIME_LT32(context.schedule_32hi, now_32hi)) {
-            context.idle_time_us += (context.schedule_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
-            context.tx_preamble_time_us += (now_32hi - context.schedule_32hi) * DWT_TICK_TO_NS_32 / 1000;
+        if (dw1000_time32_le(context.schedule_32hi, now_32hi)) {
+            context.idle_time_us += DW1000_4NS_TO_NS(context.schedule_32hi - context.last_idle_32hi) / 1000;
+            context.tx_preamble_time_us += DW1000_4NS_TO_NS(now_32hi - context.schedule_32hi) / 1000;
         }
         else {
             // radio interrupted before being active.
-            context.idle_time_us += (now_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
+            context.idle_time_us += DW1000_4NS_TO_NS(now_32hi - context.last_idle_32hi) / 1000;
         }
     }
     else if (context.state == DW1000_IDLE){
-        WARNIF(!TIME_LT32(context.last_idle_32hi, now_32hi));
-        context.idle_time_us += (now_32hi - context.last_idle_32hi)  * DWT_TICK_TO_NS_32 / 1000;
+        WARNIF(!dw1000_time32_le(context.last_idle_32hi, now_32hi));
+        context.idle_time_us += DW1000_4NS_TO_NS(now_32hi - context.last_idle_32hi) / 1000;
     }
     else {
         // Error?
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * \file
+ *      DW1000 system time: 40-bit timestamps and wrap-safe arithmetic
+ */
+
+#ifndef DW1000_TIME_H
+#define DW1000_TIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "deca_device_api.h"
+#include "dw1000-conv.h"
+
+/*
+ * The DW1000 system counter and the TX/RX timestamps are 40-bit values in
+ * device time units (DTU, 1 / (128 * 499.2 MHz), about 15.65 ps), wrapping
+ * every ~17.2 s. Two narrower forms are common:
+ *
+ *  - the high 32 bits ("hi32", 256 DTU or about 4 ns), used for delayed
+ *    transmissions and receptions (dwt_setdelayedtrxtime()); they wrap
+ *    together with the full timestamp, so the 32-bit difference of two of
+ *    them is exact if they are less than ~8.6 s apart;
+ *  - the low 32 bits ("lo32", full resolution), as carried by the ranging
+ *    messages; their difference is exact if they are less than ~33 ms apart.
+ *
+ * The differences are taken modulo the counter range and sign-extended, so
+ * they are correct across a wrap.
+ */
+typedef uint64_t dw1000_time_t;
+
+#define DW1000_TIME_BITS  40
+#define DW1000_TIME_MASK  ((((dw1000_time_t)1) << DW1000_TIME_BITS) - 1)
+
+/* The delayed TX/RX time ignores the low 9 bits of the timestamp */
+#define DW1000_TIME_DLY_MASK  (~(dw1000_time_t)0x1FF)
+
+/* Conversions between DTU and the hi32 (~4 ns) unit */
+#define DW1000_DTU_TO_4NS(T)  ((T) >> 8)
+#define DW1000_4NS_TO_DTU(T)  ((dw1000_time_t)(T) << 8)
+
+/* A hi32 tick is exactly 625 / 156 ns */
+#define DW1000_4NS_TO_NS(T)   ((uint64_t)(T) * 625 / 156)
+#define DW1000_NS_TO_4NS(T)   ((uint64_t)(T) * 156 / 625)
+
+/* Convert between UWB microseconds and the hi32 (~4 ns) unit */
+#define DW1000_UUS_TO_4NS(T)  ((uint32_t)(T) * UUS_TO_DWT_TIME_32)
+#define DW1000_4NS_TO_UUS(T)  ((T) >> 8)
+
+/*---------------------------------------------------------------------------*/
+/* t + d, wrapped to 40 bits (d can be negative) */
+static inline dw1000_time_t
+dw1000_time_add(dw1000_time_t t, int64_t d)
+{
+  return (t + (dw1000_time_t)d) & DW1000_TIME_MASK;
+}
+/*---------------------------------------------------------------------------*/
+/* t1 - t2 in DTU, in the range [-2^39, 2^39) */
+static inline int64_t
+dw1000_time_diff(dw1000_time_t t1, dw1000_time_t t2)
+{
+  return (int64_t)((t1 - t2) << (64 - DW1000_TIME_BITS)) >> (64 - DW1000_TIME_BITS);
+}
+/*---------------------------------------------------------------------------*/
+/* True if t1 is strictly before t2 (they must be less than ~8.6 s apart) */
+static inline bool
+dw1000_time_lt(dw1000_time_t t1, dw1000_time_t t2)
+{
+  return dw1000_time_diff(t2, t1) > 0;
+}
+/*---------------------------------------------------------------------------*/
+/* t1 - t2 for hi32 (~4 ns) or lo32 (DTU) timestamps */
+static inline int32_t
+dw1000_time32_diff(uint32_t t1, uint32_t t2)
+{
+  return (int32_t)(t1 - t2);
+}
+/*---------------------------------------------------------------------------*/
+/* True if the 32-bit timestamp t1 is strictly before t2 */
+static inline bool
+dw1000_time32_lt(uint32_t t1, uint32_t t2)
+{
+  return dw1000_time32_diff(t2, t1) > 0;
+}
+/*---------------------------------------------------------------------------*/
+/* True if the 32-bit timestamp t1 is before t2 or equal */
+static inline bool
+dw1000_time32_le(uint32_t t1, uint32_t t2)
+{
+  return dw1000_time32_diff(t2, t1) >= 0;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint32_t
+dw1000_time_hi32(dw1000_time_t t)
+{
+  return (uint32_t)DW1000_DTU_TO_4NS(t);
+}
+/*---------------------------------------------------------------------------*/
+static inline uint32_t
+dw1000_time_lo32(dw1000_time_t t)
+{
+  return (uint32_t)t;
+}
+/*---------------------------------------------------------------------------*/
+/* Value for dwt_setdelayedtrxtime() to start a transmission or reception
+ * at time t (the radio ignores the low 9 bits) */
+static inline uint32_t
+dw1000_time_dly(dw1000_time_t t)
+{
+  return dw1000_time_hi32(t);
+}
+/*---------------------------------------------------------------------------*/
+/* TX timestamp of a transmission delayed to time t: the RMARKER leaves at
+ * t truncated to the 9-bit resolution of the delayed TX, plus the TX
+ * antenna delay */
+static inline dw1000_time_t
+dw1000_time_tx_ts(dw1000_time_t t, uint16_t tx_ant_dly)
+{
+  return dw1000_time_add(t & DW1000_TIME_DLY_MASK, tx_ant_dly);
+}
+/*---------------------------------------------------------------------------*/
+/* Timestamp from the 5 little-endian bytes read from the radio */
+static inline dw1000_time_t
+dw1000_time_from_bytes(const uint8_t *b)
+{
+  return b[0] | (dw1000_time_t)b[1] << 8 | (dw1000_time_t)b[2] << 16
+         | (dw1000_time_t)b[3] << 24 | (dw1000_time_t)b[4] << 32;
+}
+/*---------------------------------------------------------------------------*/
+/* Read the 40-bit timestamps of the last transmission and reception and
+ * the current system time. */
+static inline dw1000_time_t
+dw1000_time_read_tx(void)
+{
+  uint8_t b[5];
+
+  dwt_readtxtimestamp(b);
+  return dw1000_time_from_bytes(b);
+}
+/*---------------------------------------------------------------------------*/
+static inline dw1000_time_t
+dw1000_time_read_rx(void)
+{
+  uint8_t b[5];
+
+  dwt_readrxtimestamp(b);
+  return dw1000_time_from_bytes(b);
+}
+/*---------------------------------------------------------------------------*/
+static inline dw1000_time_t
+dw1000_time_read_sys(void)
+{
+  uint8_t b[5];
+
+  dwt_readsystime(b);
+  return dw1000_time_from_bytes(b);
+}
+/*---------------------------------------------------------------------------*/
+#endif /* DW1000_TIME_H */
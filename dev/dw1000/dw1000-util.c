@@ -184,6 +184,25 @@ dw1000_get_ppm_offset(const dwt_config_t *dwt_config)
     return ci * dw1000_get_hz2ppm_multiplier(dwt_config);
 }
 /*---------------------------------------------------------------------------*/
+int64_t
+dw1000_get_offset_q40(const dwt_config_t *dwt_config, int32_t ci)
+{
+    /* ci * FREQ_OFFSET_MULTIPLIER * HERTZ_TO_PPM_MULTIPLIER_CHAN_x / 1e6
+     * reduces to -ci * 2 / (k * 2^28), with k = 2 * f_c / 998.4 MHz,
+     * and it is 8 times smaller at 110 kbps */
+    int64_t num = -(int64_t)ci * (dwt_config->dataRate == DWT_BR_110K ? 1 << 10 : 1 << 13);
+    int k;
+
+    switch (dwt_config->chan) {
+        case 1:  k = 7; break;
+        case 2:  k = 8; break;
+        case 3:  k = 9; break;
+        case 4:  k = 8; break;
+        default: k = 13; /* channels 5 and 7 */
+    }
+    return (num >= 0 ? num + k/2 : num - k/2) / k;
+}
+/*---------------------------------------------------------------------------*/
 void
 dw1000_set_cfo_jitter_guard(double ppm)
 {
@@ -271,19 +290,133 @@ bool dw1000_rxpwr(dw1000_rxpwr_t *d, const dwt_rxdiag_t* rxdiag, const dwt_confi
   return true;
 }
 /*---------------------------------------------------------------------------*/
+/* NLOS thresholds, in the fixed point format of dw1000_nlos_t */
+#define NLOS_Q(x)             ((int32_t)((x) * DW1000_NLOS_ONE + 0.5))
+#define NLOS_PATH_DIFF_LOS    NLOS_Q(3.3)      /* below, pr_nlos is 0 */
+#define NLOS_PATH_DIFF_NLOS   NLOS_Q(6.0)      /* above, pr_nlos is 1 */
+#define NLOS_PR_SLOPE         NLOS_Q(0.39178)
+#define NLOS_PR_OFFSET        NLOS_Q(1.31719)
+#define NLOS_LUEP_THR         NLOS_Q(0.01)
+#define NLOS_PR_LOS_THR       NLOS_Q(0.001)
+
+/* Early-peak search of dw1000_nlos(), on a CIR window given in one or more
+ * chunks, see dw1000-util.h */
+void
+dw1000_nlos_peaks_init(dw1000_nlos_peaks_t *p, const dwt_rxdiag_t* rxdiag)
+{
+  /* The threshold is stdNoise * ntm * 0.6; the magnitudes are compared
+   * squared against it: magsq * 25 > (stdNoise * ntm * 3)^2 */
+  uint8_t ntm, pmult;
+  uint16_t prf_tune;
+  dw1000_get_current_lde_cfg(&ntm, &pmult, &prf_tune);
+  p->noise3 = (uint32_t)rxdiag->stdNoise * ntm * 3;
+  p->noise_sq25 = (uint64_t)p->noise3 * p->noise3;
+  p->m_prev = 0;
+  p->m = 0;
+  p->n_samples = 0;
+  p->num_early_peaks = 0;
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_nlos_peaks_chunk(const dw1000_cir_sample_t* samples, uint16_t idx, uint16_t n_samples, void* arg)
+{
+  dw1000_nlos_peaks_t *p = arg;
+
+  for(uint16_t i=0; i<n_samples; i++) {
+    uint32_t m_next = dw1000_cir_magsq(&samples[i]);
+
+    /* a candidate peak rises above the noise level and then decreases */
+    if(p->n_samples >= 2 &&
+       (uint64_t)p->m * 25 > p->noise_sq25 && p->m > p->m_prev && m_next < p->m) {
+      p->num_early_peaks++;
+    }
+    p->m_prev = p->m;
+    p->m = m_next;
+    p->n_samples++;
+  }
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_nlos_from_peaks(dw1000_nlos_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_nlos_peaks_t *p)
+{
+  /* --- Step 1: NLOS probability from the distance between the first path and peak path indexes */
+
+  /* firstPath is in 10.6 fixed point, peakPath has no fractional part */
+  int32_t diff_q6 = ((int32_t)rxdiag->peakPath << 6) - rxdiag->firstPath;
+  d->path_diff = (uint32_t)(diff_q6 < 0 ? -diff_q6 : diff_q6) << (DW1000_NLOS_Q - 6);
+
+  if(d->path_diff <= NLOS_PATH_DIFF_LOS)
+    d->pr_nlos = 0;
+  else if(d->path_diff < NLOS_PATH_DIFF_NLOS)
+    d->pr_nlos = (int32_t)(((int64_t)NLOS_PR_SLOPE * d->path_diff) >> DW1000_NLOS_Q) - NLOS_PR_OFFSET;
+  else
+    d->pr_nlos = DW1000_NLOS_ONE;
+
+  /* --- Step 2: likelihood of undetected early path */
+
+  d->low_noise = ((p->noise3 << DW1000_NLOS_NOISE_Q) + 2) / 5;
+  d->num_early_peaks = p->num_early_peaks;
+  if(p->n_samples > 2) {
+    d->luep = ((uint32_t)d->num_early_peaks * 2 << DW1000_NLOS_Q) / (p->n_samples - 1);
+  }
+  else {
+    d->luep = 0;
+  }
+
+  /* --- Step 3: detect accumulator saturation */
+
+  uint16_t firstPathAmp = rxdiag->firstPathAmp1;
+  if(rxdiag->firstPathAmp2 > firstPathAmp) firstPathAmp = rxdiag->firstPathAmp2;
+  if(rxdiag->firstPathAmp3 > firstPathAmp) firstPathAmp = rxdiag->firstPathAmp3;
+
+  d->mc = rxdiag->peakPathAmp ?
+    ((uint32_t)firstPathAmp << DW1000_NLOS_Q) / rxdiag->peakPathAmp : UINT32_MAX;
+
+  /* --- Step 4: combine metrics in a single indicator (CL = DW1000_NLOS_ONE -> LOS) */
+  /* mc >= 0.9 is tested exactly on the amplitudes */
+  if(d->luep > NLOS_LUEP_THR) {
+    d->cl = 0;
+  }
+  else if(d->pr_nlos < NLOS_PR_LOS_THR
+          || (uint32_t)firstPathAmp * 10 >= (uint32_t)rxdiag->peakPathAmp * 9) {
+    d->cl = DW1000_NLOS_ONE;
+  }
+  else {
+    d->cl = DW1000_NLOS_ONE - d->pr_nlos;
+  }
+}
+/*---------------------------------------------------------------------------*/
 /* Estimates the probability that the received signal is affected by NLOS,
+ * based on the analysis of DW1000 diagnostics data. Fixed-point version of
+ * dw1000_nlos_double(), see dw1000-util.h.
+ */
+void
+dw1000_nlos(dw1000_nlos_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_cir_sample_t* samples, uint16_t n_samples)
+{
+  dw1000_nlos_peaks_t p;
+
+  dw1000_nlos_peaks_init(&p, rxdiag);
+  if(samples != NULL) {
+    dw1000_nlos_peaks_chunk(samples, 0, n_samples, &p);
+  }
+  dw1000_nlos_from_peaks(d, rxdiag, &p);
+}
+/*---------------------------------------------------------------------------*/
+/* Floating-point version of dw1000_nlos(), the reference for the tests.
+ * Estimates the probability that the received signal is affected by NLOS,
  * based on the analysis of DW1000 diagnostics data. The methodology is
  * inspired by DecaWave's "APS006 PART 3 APPLICATION NOTE -
  * DW1000 Metrics for Estimation of Non Line Of SightOperating Conditions".
  * Params:
- *  - d [out]         results are stored in the dw1000_nlos_t structure.
+ *  - d [out]         results are stored in the dw1000_nlos_double_t structure.
  *  - rxdiag [in]     diagnostics for the acquired signal.
  *  - samples [in]    the CIR window to search for undetected paths.
  *                    The window must precede the detected first path.
  *  - n_samples [in]  length of the CIR window.
  *                    The recommended number of samples is 16.
  */
-void dw1000_nlos(dw1000_nlos_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_cir_sample_t* samples, uint16_t n_samples) {
+void dw1000_nlos_double(dw1000_nlos_double_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_cir_sample_t* samples, uint16_t n_samples) {
 
   /* --- Step 1: extract NLOS probability based on the distance between the first path and peak path indexes */
 
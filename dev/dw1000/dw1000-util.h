@@ -17,17 +17,34 @@ typedef struct {
   double rx_pwr; /* RX Power Level */
 } dw1000_rxpwr_t;
 
+/* Fixed point format of the NLOS analysis results: the fractional fields
+ * are in Q16 (value * 2^16), the noise threshold in Q8 */
+#define DW1000_NLOS_Q       16
+#define DW1000_NLOS_ONE     ((int32_t)1 << DW1000_NLOS_Q)
+#define DW1000_NLOS_NOISE_Q 8
+
 /* Structure for the NLOS analysis results */
 typedef struct {
-  double path_diff; /* Index difference between first and peak paths */
-  double pr_nlos; /* NLOS probability based on path_diff */
-  double low_noise; /* New noise threshold for early path detection */
+  uint32_t path_diff; /* Index difference between first and peak paths (Q16) */
+  int32_t pr_nlos; /* NLOS probability based on path_diff (Q16) */
+  uint32_t low_noise; /* New noise threshold for early path detection (Q8) */
   uint16_t num_early_peaks; /* Number of candidate early paths when low_noise is the threshold */
-  double luep; /* Likelihood of undetected early path given num_early_peaks (can overrule pr_nlos) */
-  double mc; /* Indicator for accumulator saturation in LOS conditions (can overrule pr_nlos) */
-  double cl; /* Overall confidence level (0.0 -> NLOS, 1.0 -> LOS) */
+  uint32_t luep; /* Likelihood of undetected early path given num_early_peaks (Q16, can overrule pr_nlos) */
+  uint32_t mc; /* Indicator for accumulator saturation in LOS conditions (Q16, can overrule pr_nlos) */
+  int32_t cl; /* Overall confidence level (0 -> NLOS, DW1000_NLOS_ONE -> LOS) */
 } dw1000_nlos_t;
 
+/* NLOS analysis results in floating point, see dw1000_nlos_double() */
+typedef struct {
+  double path_diff;
+  double pr_nlos;
+  double low_noise;
+  uint16_t num_early_peaks;
+  double luep;
+  double mc;
+  double cl;
+} dw1000_nlos_double_t;
+
 /**
  * Estimate the transmission time of a frame in nanoseconds
  * dwt_config_t   dwt_config  Configuration struct of the DW1000
@@ -78,6 +95,12 @@ double dw1000_get_hz2ppm_multiplier(const dwt_config_t *dwt_config);
  */
 double dw1000_get_ppm_offset(const dwt_config_t *dwt_config);
 
+/* Converts a carrier integrator value to the clock frequency offset w.r.t.
+ * the sender, as a ratio in Q40 fixed point (no floating point involved).
+ * The offset in ppm is offset_q40 * 1e6 / 2^40.
+ */
+int64_t dw1000_get_offset_q40(const dwt_config_t *dwt_config, int32_t ci);
+
 /* Returns the XTAL trim value that best compensates the frequency offset.
  *
  * Params:
@@ -104,6 +127,8 @@ bool dw1000_rxpwr(dw1000_rxpwr_t *d, const dwt_rxdiag_t* rxdiag, const dwt_confi
  * based on the analysis of DW1000 diagnostics data. The methodology is
  * inspired by DecaWave's "APS006 PART 3 APPLICATION NOTE -
  * DW1000 Metrics for Estimation of Non Line Of SightOperating Conditions".
+ * Only integer arithmetic is used: the CIR samples are compared by their
+ * squared magnitudes against the squared noise threshold.
  * Params:
  *  - d [out]         results are stored in the dw1000_nlos_t structure.
  *  - rxdiag [in]     diagnostics for the acquired signal.
@@ -114,5 +139,29 @@ bool dw1000_rxpwr(dw1000_rxpwr_t *d, const dwt_rxdiag_t* rxdiag, const dwt_confi
  */
 void dw1000_nlos(dw1000_nlos_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_cir_sample_t* samples, uint16_t n_samples);
 
+/* dw1000_nlos() in steps, to search the early peaks while the CIR window
+ * is read: initialise the search with the RX diagnostics, pass
+ * dw1000_nlos_peaks_chunk() with the dw1000_nlos_peaks_t to
+ * dw1000_read_cir_chunked() (or call it on each part of the window, in
+ * order) and get the results with dw1000_nlos_from_peaks().
+ */
+typedef struct {
+  uint32_t noise3;          /* stdNoise * ntm * 3 */
+  uint64_t noise_sq25;      /* noise3^2, the threshold of 25 * magsq */
+  uint32_t m_prev, m;       /* squared magnitudes of the last two samples */
+  uint16_t n_samples;
+  uint16_t num_early_peaks;
+} dw1000_nlos_peaks_t;
+
+void dw1000_nlos_peaks_init(dw1000_nlos_peaks_t *p, const dwt_rxdiag_t* rxdiag);
+bool dw1000_nlos_peaks_chunk(const dw1000_cir_sample_t* samples, uint16_t idx, uint16_t n_samples, void* arg);
+void dw1000_nlos_from_peaks(dw1000_nlos_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_nlos_peaks_t *p);
+
+/* The same analysis as dw1000_nlos() with floating point arithmetic.
+ * It is much slower on MCUs without FPU and kept as the reference the
+ * fixed-point version is validated against (see tests/nlos).
+ */
+void dw1000_nlos_double(dw1000_nlos_double_t *d, const dwt_rxdiag_t* rxdiag, const dw1000_cir_sample_t* samples, uint16_t n_samples);
+
 /*---------------------------------------------------------------------------*/
 #endif //DW1000_UTIL_H_
@@ -47,8 +47,10 @@
 #include "net/packetbuf.h"
 #include "net/rime/rimestats.h"
 #include "net/netstack.h"
+#include "sys/rtimer.h"
 #include "leds.h" /* To be removed after debugging */
 #include <stdbool.h>
+#include <string.h>
 #include "dev/watchdog.h"
 /*---------------------------------------------------------------------------*/
 #include "deca_device_api.h"
@@ -73,6 +75,42 @@
 /* Configuration constants */
 /*#define DW1000_RX_AFTER_TX_DELAY 60 */
 #define DW1000_RX_AFTER_TX_DELAY 0
+
+/* Time allowed for the TX done interrupt after the estimated end of the
+ * frame (TX startup, interrupt latency), in microseconds */
+#ifdef DW1000_CONF_TX_TIMEOUT_MARGIN
+#define DW1000_TX_TIMEOUT_MARGIN DW1000_CONF_TX_TIMEOUT_MARGIN
+#else
+#define DW1000_TX_TIMEOUT_MARGIN 500
+#endif
+
+/* Keep the DW1000 receiving into its second RX buffer while the host reads
+ * the first one. It cannot be used when the upper layers read the RX
+ * registers of the frame (DW1000_RXOFF_WHILE_PROCESSING). */
+#ifdef DW1000_CONF_RX_DBLBUFF
+#define DW1000_RX_DBLBUFF DW1000_CONF_RX_DBLBUFF
+#elif DW1000_RXOFF_WHILE_PROCESSING
+#define DW1000_RX_DBLBUFF 0
+#else
+#define DW1000_RX_DBLBUFF 1
+#endif
+
+#if DW1000_RX_DBLBUFF && DW1000_RXOFF_WHILE_PROCESSING
+#error "DW1000_CONF_RX_DBLBUFF cannot be used with DW1000_RXOFF_WHILE_PROCESSING"
+#endif
+
+/* Frames received by the interrupt handler and not yet read by the process */
+#ifdef DW1000_CONF_RX_QUEUE_LEN
+#define DW1000_RX_QUEUE_LEN DW1000_CONF_RX_QUEUE_LEN
+#else
+#define DW1000_RX_QUEUE_LEN 4
+#endif
+
+#if DW1000_RX_QUEUE_LEN < 1 || DW1000_RX_QUEUE_LEN > 128
+#error "DW1000_RX_QUEUE_LEN must be between 1 and 128"
+#endif
+
+#define DW1000_RX_FRAME_MAX (127 - DW1000_CRC_LEN)
 /*---------------------------------------------------------------------------*/
 
 #if DEBUG
@@ -87,9 +125,22 @@ static dw1000_event_t dw_dbg_event;
 static uint32_t int_radio_status; // radio status to be read in the interrupt
 static uint32_t saved_radio_status; // radio status saved for the process
 
+/* Received frames, filled in by the interrupt handler */
+typedef struct {
+  uint16_t len;     /* payload length (without CRC) */
+  uint32_t status;  /* radio status at the reception */
+  uint8_t data[DW1000_RX_FRAME_MAX];
+} rx_frame_t;
+
+static rx_frame_t rx_queue[DW1000_RX_QUEUE_LEN];
+static volatile uint8_t rx_queue_head; /* frames pushed by the ISR */
+static volatile uint8_t rx_queue_tail; /* frames read by the process */
+
+#define RX_QUEUE_COUNT() ((uint8_t)(rx_queue_head - rx_queue_tail))
+
 /* Static variables */
-static uint16_t data_len; /* received data length (payload without CRC) */
-static bool frame_pending;
+static bool rx_enabled; /* the upper layers want the receiver on */
+static bool rx_dblbuff_on; /* the DW1000 is in double-buffered RX mode */
 static bool frame_uploaded;
 static bool auto_ack_enabled;
 static bool wait_ack_txdone;
@@ -131,10 +182,25 @@ static radio_result_t dw1000_set_value(radio_param_t param, radio_value_t value)
 static radio_result_t dw1000_get_object(radio_param_t param, void *dest, size_t size);
 static radio_result_t dw1000_set_object(radio_param_t param, const void *src, size_t size);
 /*---------------------------------------------------------------------------*/
+/* Switch the double-buffered RX mode. The receiver must be off and, when
+ * enabling it, the buffer pointers aligned (dwt_forcetrxoff() or
+ * dwt_rxenable() do it). */
+static void
+rx_set_dblbuff(bool on)
+{
+  if(rx_dblbuff_on != on) {
+    dwt_setdblrxbuffmode(on);
+    rx_dblbuff_on = on;
+  }
+}
+/*---------------------------------------------------------------------------*/
 /* Callback to process RX good frame events */
 static void
 rx_ok_cb(const dwt_cb_data_t *cb_data)
 {
+  uint16_t len = cb_data->datalength - DW1000_CRC_LEN;
+  rx_frame_t *f;
+
   /*LEDS_TOGGLE(LEDS_GREEN); */
 #if DW1000_RANGING_ENABLED
   if(cb_data->rx_flags & DWT_CB_DATA_RX_FLAG_RNG) {
@@ -146,10 +212,27 @@ rx_ok_cb(const dwt_cb_data_t *cb_data)
   dw1000_range_reset();
 #endif
 
-  data_len = cb_data->datalength - DW1000_CRC_LEN;
-  /* Set the appropriate event flag */
-  frame_pending = true;
   int_radio_status = cb_data->status;
+
+#if !DW1000_RXOFF_WHILE_PROCESSING
+  if(rx_dblbuff_on && !(auto_ack_enabled && (cb_data->status & SYS_STATUS_AAT))) {
+    /* the receiver stops after each frame (automatic re-enabling is not
+     * supported): restart it in the other buffer while this one is read,
+     * without moving the host buffer pointer away from this frame */
+    dwt_rxenable(DWT_START_RX_IMMEDIATE | DWT_NO_SYNC_PTRS);
+  }
+#endif
+
+  /* Copy the frame out of the RX buffer right away, the process handles it
+   * later. Drop it if it does not fit or the queue is full. */
+  if(len <= DW1000_RX_FRAME_MAX && RX_QUEUE_COUNT() < DW1000_RX_QUEUE_LEN) {
+    f = &rx_queue[rx_queue_head % DW1000_RX_QUEUE_LEN];
+    dwt_readrxdata(f->data, len, 0);
+    f->len = len;
+    f->status = cb_data->status;
+    rx_queue_head++;
+  }
+
   /* if we have auto-ACKs enabled and an ACK was requested, */
   /* don't signal the reception until the TX done interrupt */
   if(auto_ack_enabled && (cb_data->status & SYS_STATUS_AAT)) {
@@ -157,6 +240,12 @@ rx_ok_cb(const dwt_cb_data_t *cb_data)
     wait_ack_txdone = true;
   } else {
     wait_ack_txdone = false;
+#if !DW1000_RXOFF_WHILE_PROCESSING
+    if(!rx_dblbuff_on) {
+      /* single buffer: the receiver stopped after the frame */
+      dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    }
+#endif
     process_poll(&dw1000_process);
   }
 }
@@ -166,6 +255,9 @@ static void
 rx_to_cb(const dwt_cb_data_t *cb_data)
 {
 #if DW1000_RANGING_ENABLED
+  if(dw1000_rng_rx_fail_cb(cb_data)) {
+    return; /* a one-to-many exchange goes on with the next reply */
+  }
   dw1000_range_reset();
 #endif
   int_radio_status = cb_data->status;
@@ -184,6 +276,9 @@ static void
 rx_err_cb(const dwt_cb_data_t *cb_data)
 {
 #if DW1000_RANGING_ENABLED
+  if(dw1000_rng_rx_fail_cb(cb_data)) {
+    return; /* a one-to-many exchange goes on with the next reply */
+  }
   dw1000_range_reset();
 #endif
   int_radio_status = cb_data->status;
@@ -215,6 +310,9 @@ tx_conf_cb(const dwt_cb_data_t *cb_data)
   /*if we are sending an auto ACK, signal the frame reception here */
   if(wait_ack_txdone) {
     wait_ack_txdone = false;
+#if !DW1000_RXOFF_WHILE_PROCESSING
+    dw1000_on();
+#endif
     process_poll(&dw1000_process);
   }
 }
@@ -243,6 +341,9 @@ dw1000_init(void)
 
   auto_ack_enabled = false;
 
+  dwt_setdblrxbuffmode(DW1000_RX_DBLBUFF);
+  rx_dblbuff_on = DW1000_RX_DBLBUFF;
+
 #if DW1000_FRAMEFILTER == 1
   dw1000_set_value(RADIO_PARAM_RX_MODE, RADIO_RX_MODE_ADDRESS_FILTER);
 #endif /* DW1000_FRAMEFILTER */
@@ -307,10 +408,22 @@ dw1000_prepare(const void *payload, unsigned short payload_len)
   return 0;
 }
 /*---------------------------------------------------------------------------*/
+/* Maximum time to wait for the TX done interrupt, in rtimer ticks */
+static rtimer_clock_t
+tx_timeout(unsigned short payload_len)
+{
+  uint32_t us = dw1000_estimate_tx_time(dw1000_get_current_cfg(),
+                                        payload_len + DW1000_CRC_LEN, false) / 1000
+                + DW1000_TX_TIMEOUT_MARGIN;
+
+  return (rtimer_clock_t)(((uint64_t)us * RTIMER_SECOND + 999999) / 1000000) + 1;
+}
+/*---------------------------------------------------------------------------*/
 static int
 dw1000_transmit(unsigned short transmit_len)
 {
   int ret;
+  rtimer_clock_t tx_deadline;
 
   if (dw1000_is_sleeping) {
     PRINTF("Err: transmit requested while sleeping\n");
@@ -331,6 +444,7 @@ dw1000_transmit(unsigned short transmit_len)
   /* Switch off radio before setting it to transmit
    * It also clears pending interrupts */
   dwt_forcetrxoff();
+  rx_set_dblbuff(DW1000_RX_DBLBUFF); /* in case we were ranging */
 
   /* Radio starts listening certain delay (in UWB microseconds) after TX */
   dwt_setrxaftertxdelay(DW1000_RX_AFTER_TX_DELAY);
@@ -348,11 +462,26 @@ dw1000_transmit(unsigned short transmit_len)
     return RADIO_TX_ERR;
   }
 
+  /* Sleep until the TX done interrupt; give up if it does not arrive
+   * some time after the expected end of the frame */
   watchdog_periodic();
+  tx_deadline = RTIMER_NOW() + tx_timeout(transmit_len);
   while(!tx_done) {
-    /* do nothing, could go to LPM mode */
-    asm("");
-    /* TODO: add a timeout */
+    if(!RTIMER_CLOCK_LT(RTIMER_NOW(), tx_deadline)) {
+      irq_status = dw1000_disable_interrupt();
+      if(!tx_done) {
+        /* TX done lost or transmission stuck: abort and listen again */
+        dwt_forcetrxoff();
+        frame_uploaded = 0;
+        dw1000_enable_interrupt(irq_status);
+        PRINTF("Err: TX timeout\n");
+        dw1000_on();
+        return RADIO_TX_ERR;
+      }
+      dw1000_enable_interrupt(irq_status);
+      break;
+    }
+    dw1000_arch_lpm_wait(&tx_done);
   }
   return RADIO_TX_OK;
 }
@@ -375,15 +504,17 @@ dw1000_send(const void *payload, unsigned short payload_len)
 static int
 dw1000_radio_read(void *buf, unsigned short buf_len)
 {
-  if (dw1000_is_sleeping)
-    return 0;
+  rx_frame_t *f;
+  uint16_t len;
 
-  if(!frame_pending) {
+  if(RX_QUEUE_COUNT() == 0) {
     return 0;
   }
-  dwt_readrxdata(buf, buf_len, 0);
-  frame_pending = false;
-  return buf_len;
+  f = &rx_queue[rx_queue_tail % DW1000_RX_QUEUE_LEN];
+  len = f->len < buf_len ? f->len : buf_len;
+  memcpy(buf, f->data, len);
+  rx_queue_tail++;
+  return len;
 }
 /*---------------------------------------------------------------------------*/
 static int
@@ -418,7 +549,7 @@ dw1000_receiving_packet(void)
 static int
 dw1000_pending_packet(void)
 {
-  return frame_pending;
+  return RX_QUEUE_COUNT() > 0;
 }
 /*---------------------------------------------------------------------------*/
 static int
@@ -430,8 +561,12 @@ dw1000_on(void)
   }
 
   /* Enable RX */
+  int8_t irq_status = dw1000_disable_interrupt();
+  rx_set_dblbuff(DW1000_RX_DBLBUFF);
   dwt_setrxtimeout(0);
   dwt_rxenable(DWT_START_RX_IMMEDIATE);
+  rx_enabled = true;
+  dw1000_enable_interrupt(irq_status);
   return 0;
 }
 /*---------------------------------------------------------------------------*/
@@ -450,6 +585,7 @@ dw1000_off(void)
 #endif
   dwt_forcetrxoff();
   wait_ack_txdone = 0;
+  rx_enabled = false;
   dw1000_enable_interrupt(irq_status);
 
   return 0;
@@ -540,8 +676,38 @@ dw1000_set_object(radio_param_t param, const void *src, size_t size)
   return RADIO_RESULT_NOT_SUPPORTED;
 }
 /*---------------------------------------------------------------------------*/
+#if DW1000_RX_DBLBUFF
+/* Restart the receiver if it is not in the double-buffered mode any more
+ * (after a ranging exchange) or stopped because both buffers were full */
+static void
+rx_check_dblbuff(void)
+{
+  int8_t irq_status;
+
+  if(!rx_enabled || dw1000_is_sleeping || wait_ack_txdone) {
+    return;
+  }
+#if DW1000_RANGING_ENABLED
+  if(dw1000_is_ranging()) {
+    return;
+  }
+#endif
+
+  irq_status = dw1000_disable_interrupt();
+  if(!rx_dblbuff_on || (dwt_read32bitreg(SYS_STATUS_ID) & SYS_STATUS_RXOVRR)) {
+    dwt_forcetrxoff();
+    dwt_rxreset();
+    dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXOVRR);
+    dw1000_on();
+  }
+  dw1000_enable_interrupt(irq_status);
+}
+#endif /* DW1000_RX_DBLBUFF */
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(dw1000_process, ev, data)
 {
+  rx_frame_t *f;
+
   PROCESS_BEGIN();
 
   /*PRINTF("dw1000_process: started\n"); */
@@ -556,38 +722,32 @@ PROCESS_THREAD(dw1000_process, ev, data)
            (uint8_t)(r1 >> 8), (uint8_t)r1);
 #endif
 
-    if(!frame_pending) {
-      /* received a frame but it was already read (e.g. ACK) */
-      /* re-enable rx */
-      dw1000_on();
-      continue;
-    }
+    while(RX_QUEUE_COUNT() > 0) {
+      f = &rx_queue[rx_queue_tail % DW1000_RX_QUEUE_LEN];
+      if(f->len > PACKETBUF_SIZE) {
+        rx_queue_tail++;
+        continue; /* packet is too big, drop it */
+      }
 
-    if(data_len > PACKETBUF_SIZE) {
-      frame_pending = false;
-      dw1000_on();
-      continue; /* packet is too big, drop it */
-    }
+      /* Clear packetbuf to avoid having leftovers from previous receptions */
+      packetbuf_clear();
 
-    /* Clear packetbuf to avoid having leftovers from previous receptions */
-    packetbuf_clear();
+      saved_radio_status = f->status; // store the RX status for the callback to access, if needed
+      /* Copy the received frame to packetbuf */
+      packetbuf_set_datalen(dw1000_radio_read(packetbuf_dataptr(), PACKETBUF_SIZE));
 
-    /* Copy the received frame to packetbuf */
-    dw1000_radio_read(packetbuf_dataptr(), data_len);
-    packetbuf_set_datalen(data_len);
-    saved_radio_status = int_radio_status; // store the RX status for the callback to access, if needed
+      NETSTACK_RDC.input();
+      saved_radio_status = 0;
+    }
 
 #if DW1000_RXOFF_WHILE_PROCESSING
     #warning RX is kept off while packet processing
     // This is not optimal but allows reading registers related to the 
     // received packet (e.g. CIR and RX diagnostics) in the callback
-    NETSTACK_RDC.input();
-    dw1000_on();
-#else
     dw1000_on();
-    NETSTACK_RDC.input();
+#elif DW1000_RX_DBLBUFF
+    rx_check_dblbuff();
 #endif
-    saved_radio_status = 0;
   }
 
   PROCESS_END();
@@ -629,9 +789,9 @@ dw1000_sleep(void)
   dw1000_range_reset(); /* In case we were ranging */
 #endif
 
-  frame_pending   = 0;
   frame_uploaded  = 0; // frame is not preserved during sleep
   wait_ack_txdone = 0;
+  rx_enabled      = false;
   dwt_entersleep();
   dw1000_is_sleeping = 1;
 }
@@ -677,6 +837,22 @@ dw1000_wakeup(void)
 }
 /*---------------------------------------------------------------------------*/
 
+#if DW1000_RANGING_ENABLED
+/* The ranging module reads the RX registers after the frame callbacks:
+ * use a single RX buffer until the exchange is over */
+void
+dw1000_prepare_ranging(void)
+{
+  int8_t irq_status = dw1000_disable_interrupt();
+  dwt_forcetrxoff(); /* also aligns the RX buffer pointers */
+  rx_set_dblbuff(false);
+  dw1000_enable_interrupt(irq_status);
+
+  wait_ack_txdone = 0;
+  frame_uploaded  = 0;
+}
+#endif
+/*---------------------------------------------------------------------------*/
 bool
 range_with(linkaddr_t *dst, dw1000_rng_type_t type)
 {
@@ -684,14 +860,64 @@ range_with(linkaddr_t *dst, dw1000_rng_type_t type)
   if (dw1000_is_sleeping)
     return false;
 
-  wait_ack_txdone = 0;
-  frame_pending   = 0;
-  frame_uploaded  = 0;
+  if(dw1000_is_ranging())
+    return false;
+
+  dw1000_prepare_ranging();
   return dw1000_range_with(dst, type);
 #else
   return false;
 #endif
 }
+/*---------------------------------------------------------------------------*/
+bool
+range_with_many(const linkaddr_t *dsts, uint8_t n)
+{
+#if DW1000_RANGING_ENABLED
+  if (dw1000_is_sleeping)
+    return false;
+
+  if(dw1000_is_ranging())
+    return false;
+
+  dw1000_prepare_ranging();
+  return dw1000_range_with_many(dsts, n);
+#else
+  return false;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+bool
+range_concurrently(const linkaddr_t *dsts, uint8_t n)
+{
+#if DW1000_RANGING_ENABLED
+  if (dw1000_is_sleeping)
+    return false;
+
+  if(dw1000_is_ranging())
+    return false;
+
+  dw1000_prepare_ranging();
+  return dw1000_range_concurrently(dsts, n);
+#else
+  return false;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+bool
+range_enqueue(struct dw1000_rng_req *req)
+{
+#if DW1000_RANGING_ENABLED
+  if (dw1000_is_sleeping)
+    return false;
+
+  /* the ranging module prepares the radio when it starts the request */
+  return dw1000_range_enqueue(req);
+#else
+  return false;
+#endif
+}
+/*---------------------------------------------------------------------------*/
 #if DEBUG
 PROCESS_THREAD(dw1000_dbg_process, ev, data)
 {
@@ -131,9 +131,31 @@ int dw1000_is_asleep(void);
  * Only returns a valid value if called within the stack reception callback.*/
 uint32_t dw1000_get_rx_status();
 /*---------------------------------------------------------------------------*/
-typedef enum {DW1000_RNG_SS, DW1000_RNG_DS} dw1000_rng_type_t;
+/* DW1000_RNG_DS_3MSG is DS-TWR with three frames: the responder computes
+ * the distance and reports it in its reply to the next poll of the same
+ * initiator, so the initiator gets the distance of the previous exchange
+ * (see dw1000_ranging_get_report() for the responder side) */
+typedef enum {DW1000_RNG_SS, DW1000_RNG_DS, DW1000_RNG_DS_3MSG} dw1000_rng_type_t;
 
 /* Ranging */
 bool range_with(linkaddr_t *dst, dw1000_rng_type_t type);
+
+/* One-to-many SS-TWR: a single broadcast poll, the n responders reply in
+ * the order of dsts at scheduled times. The result is a
+ * ranging_multi_data_t (see dw1000-ranging.h). */
+bool range_with_many(const linkaddr_t *dsts, uint8_t n);
+
+/* Concurrent ranging: a single broadcast poll, the n responders reply at
+ * the same time, shifted by a few hundred ns in the order of dsts, and the
+ * distances are derived from a single reception and its CIR. The result is
+ * a ranging_multi_data_t; it fails if no reply is decoded. */
+bool range_concurrently(const linkaddr_t *dsts, uint8_t n);
+
+/* Queue an SS/DS-TWR request (a dw1000_rng_req_t, see dw1000-ranging.h).
+ * It starts right away if the radio is not ranging, otherwise as soon as
+ * the exchanges before it are over. Requests can be queued while ranging;
+ * range_with() and the others fail until the queue is empty. */
+struct dw1000_rng_req;
+bool range_enqueue(struct dw1000_rng_req *req);
 /*---------------------------------------------------------------------------*/
 #endif /* DW1000_H */
@@ -43,6 +43,7 @@
 /*---------------------------------------------------------------------------*/
 #include "dw1000-config.h"
 #include "dw1000-util.h"
+#include "dw1000-time.h"
 #include "dw1000-arch.h"
 #include "dw1000.h"
 #ifdef CONTIKI_TARGET_EVB1000
@@ -51,9 +52,11 @@
 /*---------------------------------------------------------------------------*/
 #include "sys/node-id.h" // for node_id
 #include "net/mac/frame802154.h"
+#include "lib/crc16.h"
 /*---------------------------------------------------------------------------*/
 #include "sys/rtimer.h"
 /*---------------------------------------------------------------------------*/
+#include <stddef.h>
 #include <string.h>
 /*---------------------------------------------------------------------------*/
 
@@ -76,14 +79,18 @@
 
 #include <stdio.h>
 #include "leds.h"
+#include "logging-defer.h"
 #define PRINTF(...)     printf(__VA_ARGS__)
 #define LOG(label, ...) PRINTF("["label"]"__VA_ARGS__)
+/* Used from the radio callbacks: store the record, print it when idle */
+#define GLOSSY_LOG_DEFER(label, ...) LOG_DEFER("["label"]"__VA_ARGS__)
 
 #else
 
 #define GLOSSY_LOG_LEVEL       GLOSSY_LOG_NONE_LEVEL
 #define PRINTF(...)     do {} while(0)
 #define LOG(...)        PRINTF()
+#define GLOSSY_LOG_DEFER(...) PRINTF()
 
 #endif
 /*---------------------------------------------------------------------------*/
@@ -105,17 +112,17 @@
 #endif /* DEBUG */
 /*---------------------------------------------------------------------------*/
 #if GLOSSY_LOG_INFO_LEVEL <= GLOSSY_LOG_LEVEL
-    #define LOG_INFO(...)   LOG("GLOSSY_INFO", __VA_ARGS__)
+    #define LOG_INFO(...)   GLOSSY_LOG_DEFER("GLOSSY_INFO", __VA_ARGS__)
 #else
     #define LOG_INFO(...)   do {} while(0)
 #endif
 #if GLOSSY_LOG_DEBUG_LEVEL <= GLOSSY_LOG_LEVEL
-    #define LOG_DEBUG(...)  LOG("GLOSSY_DEBUG", __VA_ARGS__)
+    #define LOG_DEBUG(...)  GLOSSY_LOG_DEFER("GLOSSY_DEBUG", __VA_ARGS__)
 #else
     #define LOG_DEBUG(...)   do {} while(0)
 #endif
 #if GLOSSY_LOG_ERROR_LEVEL <= GLOSSY_LOG_LEVEL
-    #define LOG_ERROR(...)  LOG("GLOSSY_ERROR", __VA_ARGS__)
+    #define LOG_ERROR(...)  GLOSSY_LOG_DEFER("GLOSSY_ERROR", __VA_ARGS__)
 #else
     #define LOG_ERROR(...)   do {} while(0)
 #endif
@@ -177,6 +184,7 @@
 #define GLOSSY_PAYLOAD_OFFSET           (IEEE_HDR_LEN + sizeof(glossy_header_t))
 #define GLOSSY_PAYLOAD_LEN(psdu_len)    ((psdu_len) - IEEE_HDR_LEN - sizeof(glossy_header_t) - DW1000_CRC_LEN)
 #define GLOSSY_MAX_PAYLOAD_LEN          GLOSSY_PAYLOAD_LEN(GLOSSY_MAX_PSDU_LEN)
+#define GLOSSY_RELAY_CNT_OFFSET         (IEEE_HDR_LEN + offsetof(glossy_header_t, relay_cnt))
 
 #define GLOSSY_PSDU_NONE                0   // means that no packet was received or sent
 
@@ -312,26 +320,6 @@ typedef struct glossy_context_t {
 #endif
 
 
-/*---------------------------------------------------------------------------*/
-/**
- * \def Convert a ~4ns accurate time to a 1 UWB microsecond accurate time.
- *
- * Conversion assumes a ~4ns accurate time is given, taken by the 32 higher
- * order bits of the device's timestamp. To obtain the corresponding time
- * in UWB microseconds, just drop the 8 lower level bits of the 32 bit time value.
- *
- * from 4ns (2^8) to 1us (2^16)
- */
-#define GLOSSY_DTU_4NS_TO_UUS(NS4_ACCURATE_TIME)    ((NS4_ACCURATE_TIME) >> 8)
-
-/** \def Convert a 15.65ps accurate timedelta to a 4ns accurate timedelta.
- *
- * The conversion assues a ~15.65ps accurate time is given. To obtain the
- * corresponding time in UWB nanoseconds, just drop the 8 lower level bits.
- *
- * from 15.65ps (2^0) to ~4ns (2^8)
- */
-#define GLOSSY_DTU_15PS_TO_4NS(PS15_ACCURATE_TIME)  ((PS15_ACCURATE_TIME) >> 8)
 /*---------------------------------------------------------------------------*/
 static void glossy_context_init();
 /*---------------------------------------------------------------------------*/
@@ -360,6 +348,15 @@ static inline void add_slot(const uint32_t slot_duration);
  */
 static uint32_t calc_slot_duration(uint16_t psdu_len);
 /*---------------------------------------------------------------------------*/
+static uint32_t calc_rx_delay_uus(uint16_t psdu_len, uint32_t slot_duration);
+/*---------------------------------------------------------------------------*/
+static uint16_t calc_rx_timeout_uus(uint16_t psdu_len, uint32_t slot_duration);
+/*---------------------------------------------------------------------------*/
+/** \brief Slot duration (4ns), RX after TX delay and RX timeout (UWB
+ *  microseconds) for the given PSDU length, from the timing table.
+ */
+static inline uint32_t glossy_get_slot_duration_4ns(uint16_t psdu_len);
+/*---------------------------------------------------------------------------*/
 static inline uint32_t glossy_get_rx_delay_uus(uint16_t psdu_len);
 /*---------------------------------------------------------------------------*/
 static inline uint16_t glossy_get_rx_timeout_uus(uint16_t psdu_len);
@@ -379,6 +376,10 @@ static inline int glossy_resume_flood();
  */
 static inline glossy_status_t glossy_validate_header(const glossy_header_t* rcvd_header);
 
+static void glossy_fcs_init(uint16_t fcs, uint8_t relay_cnt);
+
+static inline uint16_t glossy_fcs_delta(uint8_t relay_cnt);
+
 static void glossy_isr(void);
 /*---------------------------------------------------------------------------*/
 /*                           GLOSSY FRAME HANDLING                           */
@@ -470,19 +471,42 @@ glossy_update_hdr(const glossy_header_t* g_header, uint8_t *buffer)
     memcpy(buffer + IEEE_HDR_LEN, g_header, sizeof(glossy_header_t));
 }
 /*---------------------------------------------------------------------------*/
+/** Update the relay counter of the frame already in the radio TX buffer,
+ *  the only field that changes from one transmission to the next
+ */
+static inline void
+glossy_update_tx_relay_cnt(uint8_t relay_cnt)
+{
+    dwt_write8bitoffsetreg(TX_BUFFER_ID, GLOSSY_RELAY_CNT_OFFSET, relay_cnt);
+}
+/*---------------------------------------------------------------------------*/
 /*                          STATIC VARIABLES                                 */
 /*---------------------------------------------------------------------------*/
 static uint32_t last_tx_cb = 0;
 static uint32_t last_cb = 0;
 
 // Packet buffer for storing a correct packet:
-//  - initiator: the last one transmitted
-//  - receiver:  the first one received and verified or the last one
-//               transmitted (if any)
+//  - initiator: the one transmitted
+//  - receiver:  the first one received and verified
+// Only the relay counter changes afterwards, directly in the radio TX buffer.
 static uint8_t clean_buffer[GLOSSY_MAX_PSDU_LEN];
 
-// Packet buffer for reading unverified received data
-static uint8_t dirty_buffer[GLOSSY_MAX_PSDU_LEN];
+// The frames of a flood only differ in the relay counter. The FCS (CRC-16,
+// zero initial value) is linear in the frame, so the FCS of the frame with
+// relay counter r is fcs_base ^ glossy_fcs_delta(r) and the following
+// receptions are verified reading only the header and the FCS.
+static uint16_t fcs_base;
+static uint16_t fcs_delta[8];   // FCS change of each relay counter bit
+
+// Timing of the slots for each PSDU length, computed from the radio
+// configuration by glossy_update_timing() so that the callbacks only look
+// it up
+typedef struct {
+    uint32_t slot_duration;     // 4ns
+    uint16_t rx_delay_uus;
+    uint16_t rx_timeout_uus;
+} glossy_timing_t;
+static glossy_timing_t timing[GLOSSY_MAX_PSDU_LEN - GLOSSY_MIN_PSDU_LEN + 1];
 
 static glossy_context_t g_context;
 static bool glossy_initialised = false;   // set to true upon glossy_init
@@ -497,12 +521,15 @@ static void glossy_rx_err_cb(const dwt_cb_data_t *cbdata);
 /*---------------------------------------------------------------------------*/
 /*                           DW1000 CALLBACK IMPLEMENTATION                  */
 /*---------------------------------------------------------------------------*/
-static char cb_msg[100]; // a message related to the last callback occurred
+// the last callback occurred and its status register, printed on failures
+static const char *last_cb_name;
+static uint32_t last_cb_status;
 static void
 glossy_tx_done_cb(const dwt_cb_data_t *cbdata)
 {
     uint32_t status_reg = cbdata->status;
-    snprintf(cb_msg, 100, "TX cb: R 0x%lx", status_reg);
+    last_cb_name = "TX";
+    last_cb_status = status_reg;
     /* NOTE:
      * don't go to rx state (explicitily) here. Instead use the appropriate
      * driver function to switch to rx right after finishing frame
@@ -551,10 +578,7 @@ glossy_tx_done_cb(const dwt_cb_data_t *cbdata)
         ts_tx_4ns = tx_time + g_context.slot_duration - tx_antenna_delay_4ns;
         // update the relay counter, prepare the new packet and TX later
         g_context.pkt_header.relay_cnt += 1;
-        glossy_update_hdr(&g_context.pkt_header, clean_buffer);
-
-        dwt_writetxdata(g_context.psdu_len, clean_buffer, 0);
-        dwt_writetxfctrl(g_context.psdu_len, 0, 0);
+        glossy_update_tx_relay_cnt(g_context.pkt_header.relay_cnt);
 
         //dwt_forcetrxoff();  // we can avoid this since the radio goes automatically to IDLE after TX
         dwt_setdelayedtrxtime(ts_tx_4ns);
@@ -583,11 +607,14 @@ static void
 glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
 {
     uint32_t status_reg = cbdata->status;
-    snprintf(cb_msg, 100, "RX cb: R 0x%lx", status_reg);
+    last_cb_name = "RX";
+    last_cb_status = status_reg;
     glossy_header_t rcvd_header;
     uint32_t ts_tx_4ns;
     int status;                    // hold intermediate radio functions' return value
     int frame_error;               // error while parsing the received frame
+    bool first_rx = g_context.psdu_len == GLOSSY_PSDU_NONE;
+    uint8_t fcs[DW1000_CRC_LEN];
 
     /*-----------------------------------------------------------------------*/
     // TODO:REFACTOR: force IDLE state
@@ -618,12 +645,17 @@ glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
     g_context.ppm_offset = dw1000_get_ppm_offset(dw1000_get_current_cfg()); // TODO: make optional?
 
     if (!frame_error) {
-        // if it is the first packet we see, use the clean buffer directly
-        uint8_t *dest_buffer = (g_context.psdu_len == GLOSSY_PSDU_NONE) ? clean_buffer : dirty_buffer;
         /*-----------------------------------------------------------------------*/
-        // read pkt from transceiver to local buffer
-        dwt_readrxdata(dest_buffer, cbdata->datalength - DW1000_CRC_LEN, 0);
-        memcpy(&rcvd_header, dest_buffer + IEEE_HDR_LEN, sizeof(glossy_header_t)); // retrieve glossy header
+        if (first_rx) {
+            // read the whole pkt, with the FCS, from transceiver to local buffer
+            dwt_readrxdata(clean_buffer, cbdata->datalength, 0);
+            memcpy(&rcvd_header, clean_buffer + IEEE_HDR_LEN, sizeof(glossy_header_t)); // retrieve glossy header
+        }
+        else {
+            // we already have the pkt, read the header and the FCS only
+            dwt_readrxdata((uint8_t *)&rcvd_header, sizeof(glossy_header_t), IEEE_HDR_LEN);
+            dwt_readrxdata(fcs, DW1000_CRC_LEN, cbdata->datalength - DW1000_CRC_LEN);
+        }
         /*-------------------------------------------------------------------*/
         // check header and payload
         if (glossy_validate_header(&rcvd_header) != GLOSSY_STATUS_SUCCESS) {
@@ -642,11 +674,10 @@ glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
         #endif /* GLOSSY_STATS */
         frame_error = 1;
     }
-    // check if the received payload matches the one we already have (if we do)
-    if (!frame_error && g_context.psdu_len != GLOSSY_PSDU_NONE) {
-        if (memcmp(dirty_buffer + GLOSSY_PAYLOAD_OFFSET,
-                   clean_buffer + GLOSSY_PAYLOAD_OFFSET,
-                   GLOSSY_PAYLOAD_LEN(cbdata->datalength)) != 0) {
+    // check if the received payload matches the one we already have (if we do):
+    // the header is the same but for the relay counter, compare the FCS
+    if (!frame_error && !first_rx) {
+        if ((fcs[0] | (fcs[1] << 8)) != (fcs_base ^ glossy_fcs_delta(rcvd_header.relay_cnt))) {
             // payloads do not match, reject
             LOG_DEBUG("Mismatching payload received. Packet ignored\n");
             #if GLOSSY_STATS
@@ -686,11 +717,15 @@ glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
 
     // update context pkt relay counter and the packet header
     g_context.pkt_header.relay_cnt += 1;
-    glossy_update_hdr(&g_context.pkt_header, clean_buffer);
-
-    // write the frame data to the radio
-    dwt_writetxdata(g_context.psdu_len, clean_buffer, 0);
-    dwt_writetxfctrl(g_context.psdu_len, 0, 0);
+    if (first_rx) {
+        // write the frame data to the radio
+        glossy_update_hdr(&g_context.pkt_header, clean_buffer);
+        dwt_writetxdata(g_context.psdu_len, clean_buffer, 0);
+        dwt_writetxfctrl(g_context.psdu_len, 0, 0);
+    }
+    else {
+        glossy_update_tx_relay_cnt(g_context.pkt_header.relay_cnt);
+    }
 
     #if GLOSSY_STATS
     // save the relay counter of the first glossy packet correctly rx
@@ -719,7 +754,7 @@ glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
     /* END OF SLOT ESTIMATION ALGORITHM -------------------------------------*/
 
     // calculate slot duration based on packet length
-    g_context.slot_duration = calc_slot_duration(g_context.psdu_len);
+    g_context.slot_duration = glossy_get_slot_duration_4ns(g_context.psdu_len);
     ts_tx_4ns = ts_rx_4ns + g_context.slot_duration - tx_antenna_delay_4ns;
 
     /*-----------------------------------------------------------------------*/
@@ -781,6 +816,12 @@ glossy_rx_ok_cb(const dwt_cb_data_t *cbdata)
                 STATETIME_MONITOR(dw1000_statetime_schedule_txrx(ts_tx_4ns, rx_delay_uus));
         }
     }
+    if (first_rx) {
+        // done after scheduling the TX, before the next reception
+        glossy_fcs_init(clean_buffer[g_context.psdu_len - 2] |
+                        (clean_buffer[g_context.psdu_len - 1] << 8),
+                        rcvd_header.relay_cnt);
+    }
     /*-----------------------------------------------------------------------*/
     // DEBUG FEEDBACK
     /*-----------------------------------------------------------------------*/
@@ -831,7 +872,8 @@ glossy_rx_to_cb(const dwt_cb_data_t *cbdata)
         }
     }
     leds_toggle(LEDS_YELLOW);
-    snprintf(cb_msg, 100, "TO cb: R 0x%lx", status_reg);
+    last_cb_name = "TO";
+    last_cb_status = status_reg;
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -886,7 +928,8 @@ glossy_rx_err_cb(const dwt_cb_data_t *cbdata)
         }
     }
     leds_toggle(LEDS_YELLOW);
-    snprintf(cb_msg, 100, "Err cb: R 0x%lx", status_reg);
+    last_cb_name = "Err";
+    last_cb_status = status_reg;
 }
 /*---------------------------------------------------------------------------*/
 /*                           GLOSSY API IMPLEMENTATION                       */
@@ -900,10 +943,7 @@ glossy_init(void)
 
     // Set interrupt handlers
     dw1000_set_isr(glossy_isr);
-    dwt_setcallbacks(&glossy_tx_done_cb,
-            &glossy_rx_ok_cb,
-            &glossy_rx_to_cb,
-            &glossy_rx_err_cb);
+    glossy_restore_callbacks();
     /* Enable wanted interrupts (TX confirmation, RX good frames, RX timeouts and RX errors). */
     dwt_setinterrupt(
             DWT_INT_TFRS  | DWT_INT_RFCG | DWT_INT_RFTO |
@@ -913,9 +953,12 @@ glossy_init(void)
     /* Make sure frame filtering is disabled */
     dwt_enableframefilter(DWT_FF_NOTYPE_EN);
 
+    /* Single RX buffer (the radio driver may have enabled the double one) */
+    dwt_setdblrxbuffmode(0);
+
     /* Convert the current antenna delay to 4ns for future use */
     dw1000_get_current_ant_dly(&rx_ant_dly, &tx_ant_dly);
-    tx_antenna_delay_4ns = GLOSSY_DTU_15PS_TO_4NS(tx_ant_dly);
+    tx_antenna_delay_4ns = DW1000_DTU_TO_4NS(tx_ant_dly);
 
     if (dw1000_get_current_cfg()->txPreambLength == DWT_PLEN_64) {
         // Use radio settings optimised for preamble length 64
@@ -930,6 +973,8 @@ glossy_init(void)
         */
 
     }
+    glossy_update_timing();
+
     #if GLOSSY_STATS
     glossy_stats_init();
     #endif /* GLOSSY_STATS */
@@ -937,6 +982,29 @@ glossy_init(void)
     return GLOSSY_STATUS_SUCCESS;
 }
 /*---------------------------------------------------------------------------*/
+void
+glossy_update_timing(void)
+{
+    uint16_t psdu_len;
+    glossy_timing_t *t;
+
+    for (psdu_len = GLOSSY_MIN_PSDU_LEN; psdu_len <= GLOSSY_MAX_PSDU_LEN; psdu_len++) {
+        t = &timing[psdu_len - GLOSSY_MIN_PSDU_LEN];
+        t->slot_duration  = calc_slot_duration(psdu_len);
+        t->rx_delay_uus   = calc_rx_delay_uus(psdu_len, t->slot_duration);
+        t->rx_timeout_uus = calc_rx_timeout_uus(psdu_len, t->slot_duration);
+    }
+}
+/*---------------------------------------------------------------------------*/
+void
+glossy_restore_callbacks(void)
+{
+    dwt_setcallbacks(&glossy_tx_done_cb,
+            &glossy_rx_ok_cb,
+            &glossy_rx_to_cb,
+            &glossy_rx_err_cb);
+}
+/*---------------------------------------------------------------------------*/
 glossy_status_t
 glossy_start(const uint16_t initiator_id,
         uint8_t* payload,
@@ -961,7 +1029,8 @@ glossy_start(const uint16_t initiator_id,
     // init state common to both initiator and receiver
     glossy_context_init();
     //STATETIME_MONITOR(dw1000_statetime_context_init(); dw1000_statetime_start(););
-    snprintf(cb_msg, 100, "NONE"); // set callback message no init state
+    last_cb_name = "NONE"; // no callback occurred yet
+    last_cb_status = 0;
 
     memset(clean_buffer, 0, sizeof(clean_buffer));
 
@@ -1004,9 +1073,10 @@ glossy_start(const uint16_t initiator_id,
         g_context.psdu_len = glossy_frame_new(&g_header, payload, payload_len, clean_buffer);
         dwt_writetxdata(g_context.psdu_len, clean_buffer, 0);
         dwt_writetxfctrl(g_context.psdu_len, 0, 0);
+        glossy_fcs_init(crc16_data(clean_buffer, g_context.psdu_len - DW1000_CRC_LEN, 0), 0);
 
         // calculate the slot duration based on the packet length
-        g_context.slot_duration = calc_slot_duration(g_context.psdu_len);
+        g_context.slot_duration = glossy_get_slot_duration_4ns(g_context.psdu_len);
 
         // set the reference (SFD) time for the initiator
         if (start_at_dtu_time) {
@@ -1283,10 +1353,10 @@ radio_to_rtimer_ts(uint32_t radio_ts)
 {
     uint32_t current_radio_ts = dwt_readsystimestamphi32();
     rtimer_clock_t current_rtimer_ts = RTIMER_NOW();
-    double elapsed_s;
+    uint64_t elapsed_ns;
 
-    elapsed_s = (double)(current_radio_ts - radio_ts) / 1000000000 * 4.0064102564;
-    return current_rtimer_ts - (elapsed_s * RTIMER_SECOND);
+    elapsed_ns = DW1000_4NS_TO_NS(current_radio_ts - radio_ts);
+    return current_rtimer_ts - (rtimer_clock_t)(elapsed_ns * RTIMER_SECOND / 1000000000);
 }
 /*---------------------------------------------------------------------------*/
 static inline bool is_glossy_initiator()
@@ -1306,9 +1376,7 @@ glossy_resume_flood()
         (g_context.slot_duration * 2) - tx_antenna_delay_4ns;
 
     g_context.pkt_header.relay_cnt += 2;
-    glossy_update_hdr(&g_context.pkt_header, clean_buffer);
-    dwt_writetxdata(g_context.psdu_len, clean_buffer, 0);
-    dwt_writetxfctrl(g_context.psdu_len, 0, 0);
+    glossy_update_tx_relay_cnt(g_context.pkt_header.relay_cnt);
 
     if (GLOSSY_GET_VERSION(g_context.pkt_header.config) ==
         GLOSSY_STANDARD_VERSION) {
@@ -1333,7 +1401,7 @@ glossy_resume_flood()
         else {
             glossy_stop();
             uint32_t now = dwt_readsystimestamphi32();
-            LOG_ERROR("Last cb: %s\n", cb_msg);
+            LOG_ERROR("Last cb: %s cb: R 0x%lx\n", last_cb_name, last_cb_status);
             LOG_ERROR("FAILP I %d, D %lu, TO %u, Lcb %lu, LTxcb %lu\n", is_glossy_initiator(), rx_delay_uus, rx_timeout_uus, last_cb, last_tx_cb);
             LOG_ERROR("FAILT W %lu, L %lu,  S %lu,  %lu\n", g_context.slot_duration, g_context.ts_last_tx, ts_tx_4ns, now);
         }
@@ -1451,8 +1519,8 @@ calc_slot_duration(uint16_t psdu_len)
            ) / 4; // we use ns instead of uwb ns here for speed, the actual slot duration will be slightly different
 }
 /*---------------------------------------------------------------------------*/
-static inline
-uint32_t glossy_get_rx_delay_uus(uint16_t psdu_len)
+static uint32_t
+calc_rx_delay_uus(uint16_t psdu_len, uint32_t slot_duration)
 {
 #if GLOSSY_RX_OPT
     // TODO: maybe it's better to check that the resulting value is not greater than the
@@ -1464,7 +1532,7 @@ uint32_t glossy_get_rx_delay_uus(uint16_t psdu_len)
     // duration and minus a guard time that accommodates various HW and SW delays
     // and clock inaccuracies.
 
-    return (GLOSSY_DTU_4NS_TO_UUS(g_context.slot_duration) -
+    return (DW1000_4NS_TO_UUS(slot_duration) -
               (dw1000_estimate_tx_time(dw1000_get_current_cfg(), psdu_len, false) / 1024   // ns to uus, approx.
               ) - GLOSSY_RX_OPT_GUARD_UUS);
 #else
@@ -1472,8 +1540,8 @@ uint32_t glossy_get_rx_delay_uus(uint16_t psdu_len)
 #endif
 }
 /*---------------------------------------------------------------------------*/
-static inline
-uint16_t glossy_get_rx_timeout_uus(uint16_t psdu_len)
+static uint16_t
+calc_rx_timeout_uus(uint16_t psdu_len, uint32_t slot_duration)
 {
     uint16_t timeout_uus = 0;
 #if GLOSSY_RX_OPT
@@ -1494,13 +1562,73 @@ uint16_t glossy_get_rx_timeout_uus(uint16_t psdu_len)
     // From that moment, we need wait for the entire slot duration plus a small
     // guard time at the end to compensate for the propagation time and clock
     // inaccuracies
-    timeout_uus = GLOSSY_DTU_4NS_TO_UUS(g_context.slot_duration) + GLOSSY_RX_TIMEOUT_GUARD_UUS;
+    timeout_uus = DW1000_4NS_TO_UUS(slot_duration) + GLOSSY_RX_TIMEOUT_GUARD_UUS;
 #endif
 
     return timeout_uus;
 
 }
 /*---------------------------------------------------------------------------*/
+/* Lookups in the timing table: psdu_len must be within
+ * [GLOSSY_MIN_PSDU_LEN, GLOSSY_MAX_PSDU_LEN], as checked on reception and
+ * in glossy_start(). */
+static inline uint32_t
+glossy_get_slot_duration_4ns(uint16_t psdu_len)
+{
+    return timing[psdu_len - GLOSSY_MIN_PSDU_LEN].slot_duration;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint32_t
+glossy_get_rx_delay_uus(uint16_t psdu_len)
+{
+    return timing[psdu_len - GLOSSY_MIN_PSDU_LEN].rx_delay_uus;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint16_t
+glossy_get_rx_timeout_uus(uint16_t psdu_len)
+{
+    return timing[psdu_len - GLOSSY_MIN_PSDU_LEN].rx_timeout_uus;
+}
+/*---------------------------------------------------------------------------*/
+/* Prepare the FCS check of the received frames, given the FCS of the frame
+ * of the current flood with the given relay counter.
+ *
+ * Flipping a bit of the relay counter flips the FCS by the CRC of that bit
+ * followed by the rest of the frame as zeros. A bit is sent one CRC step
+ * after the previous one, LSB first, so the changes of the lower bits are
+ * those of bit 7 advanced by one step per bit.
+ */
+static void
+glossy_fcs_init(uint16_t fcs, uint8_t relay_cnt)
+{
+    uint16_t acc = crc16_add(0x80, 0);
+    int i, n_after = g_context.psdu_len - DW1000_CRC_LEN - GLOSSY_RELAY_CNT_OFFSET - 1;
+
+    for (i = 0; i < n_after; i++) {
+        acc = crc16_add(0, acc);
+    }
+    for (i = 7; i >= 0; i--) {
+        fcs_delta[i] = acc;
+        acc = (acc & 1) ? (acc >> 1) ^ 0x8408 : acc >> 1;
+    }
+    fcs_base = fcs ^ glossy_fcs_delta(relay_cnt);
+}
+/*---------------------------------------------------------------------------*/
+/* FCS change from relay counter 0 to relay_cnt */
+static inline uint16_t
+glossy_fcs_delta(uint8_t relay_cnt)
+{
+    uint16_t delta = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        if (relay_cnt & (1 << i)) {
+            delta ^= fcs_delta[i];
+        }
+    }
+    return delta;
+}
+/*---------------------------------------------------------------------------*/
 static inline glossy_status_t
 glossy_validate_header(const glossy_header_t* rcvd_header)
 {
@@ -1568,7 +1696,12 @@ glossy_get_status_reg(void)
 uint32_t
 glossy_get_slot_duration(uint8_t payload_len) {
 
-    uint8_t psdu_len = sizeof(glossy_header_t) + payload_len + DW1000_CRC_LEN;
+    uint16_t psdu_len = IEEE_HDR_LEN + sizeof(glossy_header_t) + payload_len + DW1000_CRC_LEN;
+
+    // the table only covers the frames Glossy can send
+    if (glossy_initialised && psdu_len <= GLOSSY_MAX_PSDU_LEN) {
+        return glossy_get_slot_duration_4ns(psdu_len);
+    }
     return calc_slot_duration(psdu_len);
 }
 
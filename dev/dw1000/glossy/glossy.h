@@ -138,6 +138,25 @@ typedef struct {
  */
 glossy_status_t glossy_init(void);
 
+/**
+ * \brief  Recompute the slot timing for each packet length
+ *
+ * The slot duration and the RX guard times depend on the radio
+ * configuration. They are computed by glossy_init(); call this function
+ * before the next flood if the configuration changed afterwards.
+ */
+void glossy_update_timing(void);
+
+
+/**
+ * \brief  Reinstall the Glossy radio callbacks
+ *
+ * To be called before the next flood if, between floods, another module
+ * used the radio with its own callbacks (dwt_setcallbacks()). The Glossy
+ * interrupt handler, which dispatches the events to the callbacks, and the
+ * enabled interrupts are left in place.
+ */
+void glossy_restore_callbacks(void);
 
 /**
  * \brief       start Glossy
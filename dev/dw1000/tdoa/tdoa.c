@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * \file
+ *      Time-difference-of-arrival (TDoA) localisation service
+ */
+
+#include "tdoa.h"
+#include "glossy.h"
+#include "dw1000.h"
+#include "dw1000-util.h"
+#include "dw1000-time.h"
+#include "deca_device_api.h"
+#include "deca_regs.h"
+#include "net/netstack.h"
+#include <string.h>
+/*---------------------------------------------------------------------------*/
+/* ppm to Q40 ratio, 2^40 / 10^6 */
+#define PPM_TO_Q40      1099511.627776
+
+/* Local reference times kept to match those sent by the initiator */
+#define TDOA_REFS       4
+
+/* Largest plausible drift, in Q40 (200 ppm) */
+#define MAX_DRIFT_Q40   ((int64_t)(200 * PPM_TO_Q40))
+/*---------------------------------------------------------------------------*/
+static tdoa_blink_t blinks[TDOA_MAX_BLINKS];
+static uint8_t n_blinks;
+
+static bool synced;
+static uint16_t ref_id;
+static dw1000_time_t ref_ts;    /* reference time (local clock) */
+static int64_t ref_offset_q40;  /* offset of the initiator clock w.r.t. ours */
+
+/* Drift estimation (anchors) */
+static struct {
+    uint16_t id;
+    dw1000_time_t ts;
+} refs[TDOA_REFS];              /* last local reference times */
+static uint8_t n_refs;
+static bool have_init_ref;      /* init_ref_* hold the last matched reference */
+static uint16_t init_ref_id;
+static dw1000_time_t init_ref_ts;       /* in the initiator clock */
+static dw1000_time_t init_ref_local;    /* the same reference, local clock */
+static bool drift_valid;
+static int64_t drift_q40;       /* initiator clock rate w.r.t. ours - 1 */
+
+/* Reference of the initiator */
+static bool init_synced;
+/*---------------------------------------------------------------------------*/
+void
+tdoa_tag_blink(uint8_t seqn)
+{
+    uint8_t frame[TDOA_BLINK_LEN];
+
+    frame[0] = TDOA_BLINK_FC;
+    frame[1] = seqn;
+    memcpy(&frame[2], linkaddr_node_addr.u8, LINKADDR_SIZE);
+
+    NETSTACK_RADIO.send(frame, TDOA_BLINK_LEN);
+    NETSTACK_RADIO.off();
+}
+/*---------------------------------------------------------------------------*/
+void
+tdoa_sync_write(uint8_t *buf)
+{
+    int i;
+
+    memset(buf, 0, TDOA_SYNC_LEN);
+    if (!init_synced) {
+        return;
+    }
+    buf[0] = (uint8_t)ref_id;
+    buf[1] = (uint8_t)(ref_id >> 8);
+    for (i = 0; i < 5; i++) {
+        buf[2 + i] = (uint8_t)(ref_ts >> (8 * i));
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* Update the drift estimate with a reference time of the initiator */
+static void
+update_drift(const uint8_t *sync)
+{
+    uint16_t id = sync[0] | ((uint16_t)sync[1] << 8);
+    dw1000_time_t ts = 0, local;
+    int64_t d_init, d_local, drift;
+    int i;
+
+    for (i = 4; i >= 0; i--) {
+        ts = (ts << 8) | sync[2 + i];
+    }
+    if (ts == 0) {
+        return; // the initiator has no reference yet
+    }
+    // the same reference in the local clock
+    for (i = 0; i < n_refs && refs[i].id != id; i++);
+    if (i == n_refs) {
+        have_init_ref = false;
+        return;
+    }
+    local = refs[i].ts;
+
+    if (have_init_ref && init_ref_id != id) {
+        d_init = dw1000_time_diff(ts, init_ref_ts);
+        d_local = dw1000_time_diff(local, init_ref_local);
+        if (d_init > 0 && d_local > 0) {
+            // (d_init - d_local) / d_local in Q40: the difference is below
+            // 2^33 for plausible drifts, so shift it by 30 bits first
+            drift = ((d_init - d_local) * (1LL << 30) / d_local) * (1 << 10);
+            if (drift > -MAX_DRIFT_Q40 && drift < MAX_DRIFT_Q40) {
+                // smooth out the error of the reference times
+                drift_q40 = drift_valid ? drift_q40 + (drift - drift_q40) / 4 : drift;
+                drift_valid = true;
+            }
+        }
+    }
+    have_init_ref = true;
+    init_ref_id = id;
+    init_ref_ts = ts;
+    init_ref_local = local;
+}
+/*---------------------------------------------------------------------------*/
+void
+tdoa_anchor_sync(uint16_t id, bool is_initiator, const uint8_t *sync)
+{
+    ref_id = id;
+    ref_ts = DW1000_4NS_TO_DTU(glossy_get_t_ref_dtu());
+    synced = true;
+
+    if (is_initiator) {
+        // the initiator is the reference
+        ref_offset_q40 = 0;
+        init_synced = true;
+        return;
+    }
+
+    // keep the local reference times the initiator will send
+    if (n_refs == TDOA_REFS) {
+        memmove(refs, &refs[1], (TDOA_REFS - 1) * sizeof(refs[0]));
+        n_refs--;
+    }
+    refs[n_refs].id = id;
+    refs[n_refs].ts = ref_ts;
+    n_refs++;
+
+    if (sync != NULL) {
+        update_drift(sync);
+    }
+    // without an estimate, use the ppm offset of the last frame received,
+    // which is w.r.t. the neighbour that relayed it
+    ref_offset_q40 = drift_valid ? drift_q40 :
+        (int64_t)(glossy_get_ppm_offset() * PPM_TO_Q40);
+}
+/*---------------------------------------------------------------------------*/
+static void
+blink_rx_ok_cb(const dwt_cb_data_t *cbdata)
+{
+    uint8_t frame[TDOA_BLINK_LEN];
+    dw1000_time_t rx_ts;
+    int64_t dt;
+    tdoa_blink_t *b;
+
+    if (cbdata->datalength != TDOA_BLINK_LEN + DW1000_CRC_LEN ||
+            cbdata->fctrl[0] != TDOA_BLINK_FC ||
+            !(cbdata->status & SYS_STATUS_LDEDONE) ||
+            n_blinks == TDOA_MAX_BLINKS) {
+        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        return;
+    }
+
+    rx_ts = dw1000_time_read_rx();
+    dwt_readrxdata(frame, TDOA_BLINK_LEN, 0);
+    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+
+    // blinks are kept if received less than 2^39 DTU (about 8.6 s) after
+    // the reference, the wrap-safe range of the 40-bit timestamps
+    dt = dw1000_time_diff(rx_ts, ref_ts);
+    if (dt < 0) {
+        return; // the reference is too old
+    }
+
+    b = &blinks[n_blinks++];
+    memcpy(b->tag.u8, &frame[2], LINKADDR_SIZE);
+    b->seqn = frame[1];
+    b->ref_id = ref_id;
+    // convert the elapsed time to the initiator clock: dt * (1 + offset);
+    // dt >> 8 has 31 bits and the offset less than 32, so the product fits
+    b->rx_ts = dt + (((int64_t)(dt >> 8) * ref_offset_q40) >> 32);
+}
+/*---------------------------------------------------------------------------*/
+static void
+blink_rx_fail_cb(const dwt_cb_data_t *cbdata)
+{
+    // the radio is off after a timeout or an error, listen again
+    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+}
+/*---------------------------------------------------------------------------*/
+bool
+tdoa_anchor_listen_start(void)
+{
+    if (!synced) {
+        return false;
+    }
+    dwt_forcetrxoff();
+    dwt_setcallbacks(NULL, &blink_rx_ok_cb, &blink_rx_fail_cb, &blink_rx_fail_cb);
+    dwt_setrxtimeout(0);
+    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    return true;
+}
+/*---------------------------------------------------------------------------*/
+void
+tdoa_anchor_listen_stop(void)
+{
+    dwt_forcetrxoff();
+    glossy_restore_callbacks();
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+tdoa_anchor_get_blinks(tdoa_blink_t *out, uint8_t max)
+{
+    uint8_t n = n_blinks < max ? n_blinks : max;
+
+    memcpy(out, blinks, n * sizeof(tdoa_blink_t));
+    memmove(blinks, &blinks[n], (n_blinks - n) * sizeof(tdoa_blink_t));
+    n_blinks -= n;
+    return n;
+}
+/*---------------------------------------------------------------------------*/
+void
+tdoa_report_write(uint8_t *buf, const tdoa_blink_t *blink)
+{
+    int i;
+
+    memcpy(buf, blink->tag.u8, LINKADDR_SIZE);
+    buf += LINKADDR_SIZE;
+    *buf++ = blink->seqn;
+    *buf++ = (uint8_t)blink->ref_id;
+    *buf++ = (uint8_t)(blink->ref_id >> 8);
+    for (i = 0; i < 5; i++) {
+        *buf++ = (uint8_t)(blink->rx_ts >> (8 * i));
+    }
+}
+/*---------------------------------------------------------------------------*/
+void
+tdoa_report_read(const uint8_t *buf, tdoa_blink_t *blink)
+{
+    int i;
+
+    memcpy(blink->tag.u8, buf, LINKADDR_SIZE);
+    buf += LINKADDR_SIZE;
+    blink->seqn = *buf++;
+    blink->ref_id = buf[0] | ((uint16_t)buf[1] << 8);
+    buf += 2;
+    blink->rx_ts = 0;
+    for (i = 4; i >= 0; i--) {
+        blink->rx_ts = (blink->rx_ts << 8) | buf[i];
+    }
+}
+/*---------------------------------------------------------------------------*/
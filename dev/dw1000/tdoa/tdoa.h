@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * \file
+ *      Time-difference-of-arrival (TDoA) localisation service
+ *
+ * Tags only transmit short blink frames. Anchors share the DW1000 timebase
+ * of the Glossy initiator (the reference time of each flood and the clock
+ * drift w.r.t. the initiator) and timestamp the blinks they receive in
+ * it. The resulting (tag, seqn, rx_ts) tuples are reported to a sink by
+ * the application, e.g., in Crystal T slots, and the TDoA of a blink is
+ * the difference of its rx_ts at two anchors.
+ *
+ * The reference time of each anchor is the time it received the flood,
+ * i.e., it lags the initiator by the time of flight between them, which
+ * the localisation engine subtracts from rx_ts knowing the anchor
+ * positions. The resolution of the Glossy reference time is 4 ns.
+ *
+ * The drift is estimated comparing the interval between two floods in the
+ * local clock with the one in the initiator clock, which the initiator
+ * sends in the next flood (tdoa_sync_write()). The estimate is smoothed
+ * over the floods; its error is that of the two reference times (a few
+ * ns) over the interval, so a blink received dt after the reference is
+ * off by about that error times dt over the interval, i.e., a few ns
+ * within one interval. The references must be less than 2^39 DTU (about
+ * 8.6 s) apart. Until two consecutive floods are received, the clock
+ * offset Glossy measured on the last frame received is used instead: it
+ * is w.r.t. the node that relayed it, not the initiator, and the error can
+ * be tens of ppm, i.e., microseconds after a fraction of a second.
+ */
+
+#ifndef TDOA_H_
+#define TDOA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core/net/linkaddr.h"
+
+/* Number of blinks an anchor stores until they are reported */
+#ifdef TDOA_CONF_MAX_BLINKS
+#define TDOA_MAX_BLINKS TDOA_CONF_MAX_BLINKS
+#else
+#define TDOA_MAX_BLINKS 16
+#endif
+
+/* Blink frame: frame control, sequence number and the tag address
+ * (as the IEEE 802.15.4 / ISO/IEC 24730-62 blink, without the CRC) */
+#define TDOA_BLINK_FC   0xC5
+#define TDOA_BLINK_LEN  (2 + LINKADDR_SIZE)
+
+/* A blink received by an anchor */
+typedef struct {
+    linkaddr_t tag;
+    uint8_t seqn;       /* blink sequence number */
+    uint16_t ref_id;    /* reference time the blink is timestamped against */
+    uint64_t rx_ts;     /* RX time since the reference, 40-bit, in DTU of
+                           the Glossy initiator clock */
+} tdoa_blink_t;
+
+/* Length of the reference information of the initiator (tdoa_sync_write()) */
+#define TDOA_SYNC_LEN (2 + 5)
+
+/* Length of a blink in a report (tdoa_report_write()) */
+#define TDOA_REPORT_LEN (LINKADDR_SIZE + 1 + 2 + 5)
+
+/**
+ * \brief Tag: send a blink
+ *
+ * Sends a blink through the radio driver and turns the radio off.
+ */
+void tdoa_tag_blink(uint8_t seqn);
+
+/**
+ * \brief Initiator: write the identifier and the reference time of the
+ *        last flood, in TDOA_SYNC_LEN bytes
+ *
+ * To be sent in the payload of the next flood, for the anchors to estimate
+ * their drift (see tdoa_anchor_sync()). The buffer is zeroed (no reference)
+ * before the first tdoa_anchor_sync() of the initiator.
+ */
+void tdoa_sync_write(uint8_t *buf);
+
+/**
+ * \brief Anchor: take the reference time of the last Glossy flood
+ * \param ref_id       identifier of the reference (e.g., the Crystal epoch),
+ *                     copied to the blinks timestamped against it
+ * \param is_initiator whether this anchor initiated the flood
+ * \param sync         the tdoa_sync_write() information carried by the
+ *                     flood, NULL if not available
+ *
+ * To be called after each flood this anchor received (or initiated) that
+ * updated the reference time. Blinks are only timestamped after the first
+ * call.
+ */
+void tdoa_anchor_sync(uint16_t ref_id, bool is_initiator, const uint8_t *sync);
+
+/**
+ * \brief Anchor: listen for blinks until tdoa_anchor_listen_stop()
+ * \return false if the anchor is not synchronised yet
+ *
+ * Installs the TDoA radio callbacks in place of the Glossy ones, so it is
+ * meant to be called between the floods, e.g., from app_epoch_end().
+ */
+bool tdoa_anchor_listen_start(void);
+
+/**
+ * \brief Anchor: stop listening and give the radio back to Glossy
+ */
+void tdoa_anchor_listen_stop(void);
+
+/**
+ * \brief Anchor: take the blinks received so far
+ * \param blinks buffer for at most max blinks
+ * \return the number of blinks copied to the buffer and removed
+ *
+ * Not to be called while listening.
+ */
+uint8_t tdoa_anchor_get_blinks(tdoa_blink_t *blinks, uint8_t max);
+
+/**
+ * \brief Serialise a blink into TDOA_REPORT_LEN bytes
+ */
+void tdoa_report_write(uint8_t *buf, const tdoa_blink_t *blink);
+
+/**
+ * \brief Parse a blink serialised with tdoa_report_write()
+ */
+void tdoa_report_read(const uint8_t *buf, tdoa_blink_t *blink);
+
+#endif /* TDOA_H_ */
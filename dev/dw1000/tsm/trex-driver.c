@@ -46,6 +46,7 @@
 #include "dw1000.h"
 #include "dw1000-config.h"
 #include "dw1000-conv.h"
+#include "dw1000-time.h"
 #include "dw1000-arch.h"
 #include "dw1000-util.h"
 #include "dw1000-statetime.h"
@@ -74,29 +75,8 @@ static struct {
   uint16_t rx_slot_preambleto_pacs; // preamble detection timeout in PACs
 } context;
 
-/* Convert time from the ~4ns device time unit to UWB microseconds */
-#define DTU_4NS_TO_UUS(NS4_TIME)    ((NS4_TIME) >> 8)
-
-/* Convert time in the 15.65ps device time units to ~4ns units */
-#define DTU_15PS_TO_4NS(PS15_TIME)  ((PS15_TIME) >> 8)
-
 #define TREXD_FRAME_OVERHEAD (2)     // 2-byte CRC field
 
-
-/* Compare two 32-bit timestamps.
- *
- * Pre-condition: the actual difference between the two timestamps is less than
- * half of the timer overflow range. For DW1000, the timer overflows once in
- * ~17 seconds, therefore t1 and t2 timestamps must be taken within ~8 seconds.
- *
- * Returns 
- *   - true if t2 is strictly later than t1, 
- *   - false if t2 is before than t1 or equal.
- */
-static inline bool time32_lt(uint32_t t1, uint32_t t2) {
-  return (int32_t)(t2-t1) > 0;
-}
-
 /*----------------------------------------------------------------------------*/
 static trexd_stats_t stats;
 
@@ -233,13 +213,13 @@ int trexd_rx_slot(uint8_t *buffer, uint32_t expected_sfd_time_4ns, uint32_t dead
 
   DBG("RX at %lu till %lu now %lu", expected_sfd_time_4ns, deadline_4ns, dwt_readsystimestamphi32());
   // sanity check that the deadline is after the sfd time
-  WARNIF(!time32_lt(expected_sfd_time_4ns, deadline_4ns));
+  WARNIF(!dw1000_time32_lt(expected_sfd_time_4ns, deadline_4ns));
 
   context.slot.buffer = buffer;
   // schedule delayed reception with timeout
   uint32_t ts_rx_4ns = expected_sfd_time_4ns - context.preamble_duration_4ns;
   dwt_setdelayedtrxtime(ts_rx_4ns);
-  dwt_setrxtimeout(DTU_4NS_TO_UUS(deadline_4ns - ts_rx_4ns));
+  dwt_setrxtimeout(DW1000_4NS_TO_UUS(deadline_4ns - ts_rx_4ns));
   dwt_setpreambledetecttimeout(context.rx_slot_preambleto_pacs);
   int res = dwt_rxenable(DWT_START_RX_DELAYED | DWT_IDLE_ON_DLY_ERR);
   if (res != DWT_SUCCESS)
@@ -260,10 +240,10 @@ int trexd_rx_until(uint8_t *buffer, uint32_t deadline_4ns) {
   uint32_t now = dwt_readsystimestamphi32();
 
   // sanity check that the deadline is in the future
-  WARNIF(!time32_lt(now, deadline_4ns));
+  WARNIF(!dw1000_time32_lt(now, deadline_4ns));
 
   // enable reception with timeout
-  dwt_setrxtimeout(DTU_4NS_TO_UUS(deadline_4ns - now));
+  dwt_setrxtimeout(DW1000_4NS_TO_UUS(deadline_4ns - now));
   dwt_setpreambledetecttimeout(0);
   int res = dwt_rxenable(DWT_START_RX_IMMEDIATE);
   if (res != DWT_SUCCESS)
@@ -325,7 +305,7 @@ int trexd_set_timer(uint32_t deadline_4ns) {
   uint32_t now = dwt_readsystimestamphi32();
 
   // sanity check that the deadline is in the future
-  WARNIF(!time32_lt(now, deadline_4ns));
+  WARNIF(!dw1000_time32_lt(now, deadline_4ns));
 
   // enable a "fake" reception for 1 uus
   dwt_setrxtimeout(1);
@@ -361,10 +341,13 @@ void trexd_init()
   /* Make sure frame filtering is disabled */
   dwt_enableframefilter(DWT_FF_NOTYPE_EN);
 
+  /* Single RX buffer (the radio driver may have enabled the double one) */
+  dwt_setdblrxbuffmode(0);
+
   /* Convert the current antenna delay to 4ns for future use */
   dw1000_get_current_ant_dly(&rx_ant_dly, &tx_ant_dly);
-  context.tx_antenna_delay_4ns = DTU_15PS_TO_4NS(tx_ant_dly);
-  context.preamble_duration_4ns = dw1000_estimate_tx_time(dw1000_get_current_cfg(), 0, true) / 4.0064102564;
+  context.tx_antenna_delay_4ns = DW1000_DTU_TO_4NS(tx_ant_dly);
+  context.preamble_duration_4ns = DW1000_NS_TO_4NS(dw1000_estimate_tx_time(dw1000_get_current_cfg(), 0, true));
 
   if (dw1000_get_current_cfg()->txPreambLength == DWT_PLEN_64) {
     // Use radio settings optimised for preamble length 64
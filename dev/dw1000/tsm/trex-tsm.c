@@ -37,6 +37,7 @@
 
 #define LOG_PREFIX "tsm"
 #define LOG_LEVEL LOG_WARN
+#define LOG_DEFERRED 1 // logging from the slot callbacks (interrupt context)
 #include "logging.h"
 
 #define TSM_LOG_SLOTS 1
@@ -744,8 +744,8 @@ PROCESS_THREAD(cli_connectivity, ev, data)
               printf("-");
               print_addr(&linkaddr_node_addr);
               printf("]: %d bias %d\n",
-		     (int)(d->raw_distance*100),
-		     (int)(d->distance*100));
+		     (int)(d->raw_distance_mm / 10),
+		     (int)(d->distance_mm / 10));
 	    }
 	    else
 	      printf("range failed %d\n", ((ranging_data_t*)data)->status);
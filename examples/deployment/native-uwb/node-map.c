@@ -0,0 +1,22 @@
+#include "deployment.h"
+
+/* Nodes of the native-uwb platform: the address is made of the emulated
+ * DW1000 lot ID (0x2B1C0000) and part ID, which the simulator sets to the
+ * node ID (-n option). IDs 1 to 1000 are mapped. */
+#define NODE(i)      {(i), {0x2b, 0x1c, 0x00, 0x00, 0x00, 0x00, ((i) >> 8) & 0xff, (i) & 0xff}}
+#define NODES10(i)   NODE(i), NODE(i + 1), NODE(i + 2), NODE(i + 3), NODE(i + 4), \
+                     NODE(i + 5), NODE(i + 6), NODE(i + 7), NODE(i + 8), NODE(i + 9)
+#define NODES100(i)  NODES10(i), NODES10(i + 10), NODES10(i + 20), NODES10(i + 30), \
+                     NODES10(i + 40), NODES10(i + 50), NODES10(i + 60), \
+                     NODES10(i + 70), NODES10(i + 80), NODES10(i + 90)
+
+const struct id_addr deployment_id_addr_list[] = {
+
+    // Address-to-id mapping
+    //
+    // {node_id, {8-byte address}}
+    NODES100(1), NODES100(101), NODES100(201), NODES100(301), NODES100(401),
+    NODES100(501), NODES100(601), NODES100(701), NODES100(801), NODES100(901),
+};
+
+const unsigned int deployment_num_nodes = sizeof(deployment_id_addr_list)/sizeof(struct id_addr);
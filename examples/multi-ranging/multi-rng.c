@@ -68,12 +68,25 @@ linkaddr_t anchors[] = { // responders (a node can be both a tag and an anchor)
 /*-- Configuration ---------------------------------------------------------*/
 
 /* Ranging style and frequency */
-#define RANGING_STYLE  DW1000_RNG_SS      // single- or double-sided (DW1000_RNG_DS)
+#define RANGING_STYLE  DW1000_RNG_SS      // single- or double-sided (DW1000_RNG_DS, DW1000_RNG_DS_3MSG)
 #define ROUND_PERIOD   (CLOCK_SECOND/10)  // period of multi-ranging
 
+/* Range with all the anchors in a single one-to-many SS-TWR exchange
+ * (one broadcast poll, the anchors reply in turn) instead of one by one.
+ * CIR acquisition and RANGING_STYLE do not apply. */
+#define ONE_TO_MANY 0                     // 1 = enable one-to-many ranging
+
+/* With ONE_TO_MANY, let the anchors reply concurrently and separate the
+ * replies in the CIR (see range_concurrently()) */
+#define CONCURRENT 0                      // 1 = enable concurrent ranging
+
 /* Option to read and print CIR */
 #define ACQUIRE_CIR 0                     // 1 = enable CIR acquisition
 
+/* Print CIR as compressed binary frames instead of hex
+ * (decode the output with tools/cirdecode.py) */
+#define CIR_BINARY 1                      // 1 = binary CIR output
+
 /* Acquire CIR samples around the first path index */
 #define CIR_IDX_MODE DW1000_CIR_IDX_RELATIVE
 #define CIR_IDX_START (-16)
@@ -95,7 +108,10 @@ linkaddr_t anchors[] = { // responders (a node can be both a tag and an anchor)
 
 /*-- Printing time settings ------------------------------------------------*/
 
-#if ACQUIRE_CIR
+#if ACQUIRE_CIR && CIR_BINARY
+#define MAX_PRINTING_TIME (CLOCK_SECOND / 60)     // estimated time needed to print a full CIR in binary (about 3 times shorter)
+#define CIR_DUMP_DELAY    (CLOCK_SECOND / 500)    // a delay inserted after printing CIR to let the USB buffer get emptied
+#elif ACQUIRE_CIR
 #define MAX_PRINTING_TIME (CLOCK_SECOND / 20)     // estimated time needed to print a full CIR (depends on the platform)
 #define CIR_DUMP_DELAY    (CLOCK_SECOND / 200)    // a delay inserted after printing CIR to let the USB buffer get emptied
 #else
@@ -120,6 +136,11 @@ linkaddr_t anchors[] = { // responders (a node can be both a tag and an anchor)
 #define TAG_SLOT_DURATION (TOTAL_RANGING_TIME*NUM_ANCHORS)
 #define TOTAL_ROUND_DURATION (TAG_SLOT_DURATION*(NUM_OTHER_TAGS+1) + INIT_GUARD)
 
+#if ONE_TO_MANY
+_Static_assert (NUM_ANCHORS <= DW1000_RNG_MAX_RESPONDERS,
+                "Too many anchors, increase DW1000_CONF_RNG_MAX_RESPONDERS");
+#endif
+
 // sanity check that there is enough time for ranging
 _Static_assert (ROUND_PERIOD > TOTAL_ROUND_DURATION + CLOCK_SECOND/200, 
                 "Not enough time for ranging");
@@ -150,6 +171,48 @@ print_rxdiag(const dwt_rxdiag_t *d, const dw1000_rxpwr_t *p) {
 }
 #endif
 /*--------------------------------------------------------------------------*/
+/* Print the outcome of a ranging without CIR */
+static void
+print_result(uint32_t seqn, const linkaddr_t *dst, const ranging_data_t *d)
+{
+  printf("RNG [%lu/%lums] %02x%02x->%02x%02x: ",
+      seqn, (clock_time() * 1000UL / CLOCK_SECOND),
+      linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+      dst->u8[0], dst->u8[1]);
+  if(!d->status) {
+    printf("FAIL\n");
+    return;
+  }
+#if !PRINT_MINIMAL || PRINT_RXDIAG
+  dw1000_rxpwr_t rxpwr;
+  dw1000_rxpwr(&rxpwr, &d->rxdiag, dw1000_get_current_cfg());
+#endif
+#if PRINT_MINIMAL
+  printf("%d\n", (int)(d->raw_distance_mm / 10));
+#else
+  printf("SUCCESS %d bias %d fppwr %d rxpwr %d cifo %d\n",
+      (int)(d->raw_distance_mm / 10), (int)(d->distance_mm / 10),
+      (int)(1000*rxpwr.fp_pwr), (int)(1000*rxpwr.rx_pwr),
+      (int)d->clock_offset_ppb);
+#endif
+#if PRINT_TIMESTAMPS
+  printf("TS [%lu] %02x%02x->%02x%02x: %lu %lu %lu %lu %lu %lu\n",
+      seqn,
+      linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+      dst->u8[0], dst->u8[1],
+      d->poll_tx_ts, d->poll_rx_ts,
+      d->resp_tx_ts, d->resp_rx_ts,
+      d->ds_final_tx_ts, d->ds_final_rx_ts);
+#endif
+#if PRINT_RXDIAG
+  printf("DIAG [%lu] %02x%02x->%02x%02x ",
+      seqn,
+      linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+      dst->u8[0], dst->u8[1]);
+  print_rxdiag(&d->rxdiag, &rxpwr);
+#endif
+}
+/*--------------------------------------------------------------------------*/
 PROCESS(ranging_process, "Ranging process");
 AUTOSTART_PROCESSES(&ranging_process);
 /*--------------------------------------------------------------------------*/
@@ -246,7 +309,60 @@ PROCESS_THREAD(ranging_process, ev, data)
       static clock_time_t slot_start;
       slot_start = clock_time();
 
-      /* Range with each anchor */
+#if ONE_TO_MANY
+      /* Range with all the anchors at once */
+      static linkaddr_t dsts[NUM_ANCHORS];
+      static uint8_t n;
+      for(i=0, n=0; i<NUM_ANCHORS; i++) {
+        if(!linkaddr_cmp(&linkaddr_node_addr, &anchors[i])) {
+          dsts[n++] = anchors[i];
+        }
+      }
+      dw1000_ranging_acquire_diagnostics(0, 0, 0, NULL);
+#if CONCURRENT
+      status = n > 0 && range_concurrently(dsts, n);
+#else
+      status = n > 0 && range_with_many(dsts, n);
+#endif
+      if(!status) {
+        printf("RNG [%lu] REQ FAIL\n", seqn);
+      }
+      else {
+        PROCESS_YIELD_UNTIL(ev == ranging_event);
+        static ranging_multi_data_t *m;
+        m = data;
+        for(i=0; i<m->n_responders; i++) {
+          print_result(seqn, &m->addr[i], &m->rng[i]);
+        }
+      }
+#elif !ACQUIRE_CIR
+      /* Queue the rangings with all the anchors: the driver runs them back
+       * to back and posts each result as soon as it is ready */
+      static dw1000_rng_req_t reqs[NUM_ANCHORS];
+      static uint8_t n_req;
+      for(i=0, n_req=0; i<NUM_ANCHORS; i++) {
+        /* Skip self if the node is both tag and anchor */
+        if(linkaddr_cmp(&linkaddr_node_addr, &anchors[i])) continue;
+
+        reqs[n_req].addr = anchors[i];
+        reqs[n_req].type = RANGING_STYLE;
+        reqs[n_req].diagnostics = true;
+        status = range_enqueue(&reqs[n_req]);
+        if(!status) {
+          printf("RNG [%lu] REQ FAIL\n", seqn);
+          break;
+        }
+        n_req++;
+      }
+      while(n_req > 0) {
+        PROCESS_YIELD_UNTIL(ev == ranging_event);
+        static dw1000_rng_req_t *req;
+        req = data;
+        print_result(seqn, &req->addr, &req->result);
+        n_req--;
+      }
+#else
+      /* Range with each anchor, reading the CIR after each ranging */
       for(i=0; i<NUM_ANCHORS; i++) {
         static linkaddr_t dst;
         dst = anchors[i];
@@ -282,12 +398,12 @@ PROCESS_THREAD(ranging_process, ev, data)
             dw1000_rxpwr(&rxpwr, &d->rxdiag, dw1000_get_current_cfg());
 #endif
 #if PRINT_MINIMAL
-            printf("%d\n", (int)(100*d->raw_distance));
+            printf("%d\n", (int)(d->raw_distance_mm / 10));
 #else
             printf("SUCCESS %d bias %d fppwr %d rxpwr %d cifo %d\n",
-                (int)(100*d->raw_distance), (int)(100*d->distance),
+                (int)(d->raw_distance_mm / 10), (int)(d->distance_mm / 10),
                 (int)(1000*rxpwr.fp_pwr), (int)(1000*rxpwr.rx_pwr),
-                (int)(1000*d->clock_offset_ppm));
+                (int)d->clock_offset_ppb);
 #endif
 #if PRINT_TIMESTAMPS
             printf("TS [%lu] %02x%02x->%02x%02x: %lu %lu %lu %lu %lu %lu\n",
@@ -309,7 +425,11 @@ PROCESS_THREAD(ranging_process, ev, data)
                 linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
                 dst.u8[0], dst.u8[1],
                 cir_fp_int, cir_fp_frac, cir_start, d->cir_samples_acquired);
+#if CIR_BINARY
+            dw1000_print_cir_bin(cir_buf+1, cir_start, d->cir_samples_acquired);
+#else
             dw1000_print_cir_hex(cir_buf+1, d->cir_samples_acquired);
+#endif
             if (CIR_DUMP_DELAY != 0) {
               etimer_set(&et_slot, CIR_DUMP_DELAY);
               PROCESS_WAIT_UNTIL(etimer_expired(&et_slot));
@@ -334,6 +454,7 @@ PROCESS_THREAD(ranging_process, ev, data)
           PROCESS_WAIT_UNTIL(etimer_expired(&et_slot));
         }
       }
+#endif /* ONE_TO_MANY */
 
       if (clock_time() - slot_start > TAG_SLOT_DURATION) {
         printf("Error: tag slot duration exceeded, adjust the timing to avoid collisions!\n");
@@ -1,8 +1,9 @@
 #ifndef PROJECT_CONF_H_
 #define PROJECT_CONF_H_
 
-/* use the following to optimise ranging delays for EVB1000 */
-//#define DW1000_CONF_EXTREME_RNG_TIMING 1
+/* use the following to optimise ranging delays for EVB1000 (all the nodes
+ * must use the same value) */
+//#define DW1000_CONF_RNG_TURNAROUND 150
 
 #define APP_RADIO_CONF 3
 
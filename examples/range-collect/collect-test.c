@@ -262,8 +262,8 @@ PROCESS_THREAD(range_process, ev, data)
           if(etimer_expired(&timeout)) {
             printf("R TIMEOUT\n");
           } else if(((ranging_data_t *)data)->status) {
-            printf("R success %f\n", ((ranging_data_t *)data)->distance);
-            parent_distance = (int16_t)(((ranging_data_t *)data)->distance * 1000);
+            printf("R success %ld mm\n", (long)((ranging_data_t *)data)->distance_mm);
+            parent_distance = (int16_t)((ranging_data_t *)data)->distance_mm;
           } else {
             printf("R FAIL\n");
           }
@@ -5,8 +5,9 @@
 //#define LINKADDR_CONF_SIZE 8
 //#define DWM1001_USE_BT_ADDR_FOR_UWB 1
 
-/* use the following to optimise ranging delays for EVB1000 */
-//#define DW1000_CONF_EXTREME_RNG_TIMING 1
+/* use the following to optimise ranging delays for EVB1000 (all the nodes
+ * must use the same value) */
+//#define DW1000_CONF_RNG_TURNAROUND 150
 
 #define APP_RADIO_CONF 1
 
@@ -87,7 +87,7 @@ PROCESS_THREAD(range_process, ev, data)
           printf("R TIMEOUT\n");
         } else if(((ranging_data_t *)data)->status) {
           ranging_data_t *d = data;
-          printf("R success: %d bias %d\n", (int)(100*d->raw_distance), (int)(100*d->distance));
+          printf("R success: %d bias %d\n", (int)(d->raw_distance_mm / 10), (int)(d->distance_mm / 10));
         } else {
           printf("R FAIL\n");
         }
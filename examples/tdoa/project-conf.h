@@ -0,0 +1,18 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/*---------------------------------------------------------------------------*/
+/*                          CRYSTAL CONFIG                                   */
+/*---------------------------------------------------------------------------*/
+/* The anchors listen for blinks in the inactive part of each epoch */
+#define CRYSTAL_CONF_PERIOD_MS      250
+#define CRYSTAL_CONF_DUR_S_MS       5
+#define CRYSTAL_CONF_DUR_T_MS       4
+#define CRYSTAL_CONF_DUR_A_MS       4
+
+#define GLOSSY_LOG_LEVEL_CONF GLOSSY_LOG_ERROR_LEVEL
+
+#define ENERGEST_CONF_ON 0
+
+/*---------------------------------------------------------------------------*/
+#endif /* PROJECT_CONF_H_ */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/**
+ * \file
+ *      TDoA localisation test: blinking tags, Crystal-synchronised anchors
+ */
+
+#include "contiki.h"
+#include "crystal.h"
+#include "glossy.h"
+#include "tdoa.h"
+#include "node-id.h"
+#include "deployment.h"
+#include <stdio.h>
+
+/*-- Configuration ---------------------------------------------------------*/
+
+/* The Crystal sink, which is also an anchor, prints the reports */
+#define SINK_ID 1
+
+/* The anchors (node IDs, the sink included); the other nodes are tags */
+static const uint16_t anchors[] = {1, 2, 3, 4};
+
+/* Blink period of the tags */
+#define TAG_PERIOD (CLOCK_SECOND / 10)
+
+/* Blinks reported by an anchor in a single T slot */
+#define REPORTS_PER_PKT 4
+
+/*--------------------------------------------------------------------------*/
+#define NUM_ANCHORS (sizeof(anchors) / sizeof(anchors[0]))
+
+typedef struct {
+    uint8_t sync[TDOA_SYNC_LEN];    /* reference of the previous epoch */
+} __attribute__((packed)) app_s_payload;
+
+typedef struct {
+    crystal_addr_t src;
+    uint16_t seqn;
+    uint8_t n_reports;
+    uint8_t reports[REPORTS_PER_PKT * TDOA_REPORT_LEN];
+} __attribute__((packed)) app_t_payload;
+
+typedef struct {
+    crystal_addr_t src;
+    uint16_t seqn;
+} __attribute__((packed)) app_a_payload;
+
+static app_s_payload s_payload;
+static app_t_payload t_payload;
+static app_a_payload a_payload;
+static crystal_config_t conf;
+
+static int is_sink;
+static uint16_t app_seqn;
+static bool app_have_packet;    // t_payload waits to be acked
+
+/* Blinks received by the sink in the current epoch */
+#define SINK_MAX_REPORTS 32
+static struct {
+    crystal_addr_t anchor;
+    tdoa_blink_t blink;
+} sink_reports[SINK_MAX_REPORTS];
+static uint8_t n_sink_reports;
+
+static process_event_t EPOCH_END_EV;
+
+PROCESS(tdoa_test, "TDoA test");
+AUTOSTART_PROCESSES(&tdoa_test);
+/*--------------------------------------------------------------------------*/
+/* Crystal callbacks, called in the interrupt context (see crystal.h) */
+uint8_t* app_pre_S() {
+    tdoa_blink_t blinks[REPORTS_PER_PKT];
+    uint8_t i, n;
+
+    n_sink_reports = 0;
+    if (is_sink) {
+        tdoa_sync_write(s_payload.sync);
+        /* the blinks received by the sink itself */
+        do {
+            n = tdoa_anchor_get_blinks(blinks, REPORTS_PER_PKT);
+            for (i = 0; i < n && n_sink_reports < SINK_MAX_REPORTS; i++) {
+                sink_reports[n_sink_reports].anchor = node_id;
+                sink_reports[n_sink_reports].blink = blinks[i];
+                n_sink_reports++;
+            }
+        } while (n > 0);
+        return (uint8_t *)&s_payload;
+    }
+    return NULL;
+}
+
+void app_post_S(int received, uint8_t* payload) {
+    if (is_sink || (received && glossy_is_t_ref_updated())) {
+        tdoa_anchor_sync(crystal_info.epoch, is_sink,
+                         received ? ((app_s_payload *)payload)->sync : NULL);
+    }
+}
+
+uint8_t* app_pre_T() {
+    tdoa_blink_t blinks[REPORTS_PER_PKT];
+    uint8_t i;
+
+    if (!app_have_packet) {
+        t_payload.n_reports = tdoa_anchor_get_blinks(blinks, REPORTS_PER_PKT);
+        if (t_payload.n_reports == 0) {
+            return NULL;
+        }
+        for (i = 0; i < t_payload.n_reports; i++) {
+            tdoa_report_write(&t_payload.reports[i * TDOA_REPORT_LEN], &blinks[i]);
+        }
+        t_payload.src = node_id;
+        t_payload.seqn = ++app_seqn;
+        app_have_packet = true;
+    }
+    return (uint8_t*)&t_payload;
+}
+
+uint8_t* app_between_TA(int received, uint8_t* payload) {
+    app_t_payload *p = (app_t_payload*)payload;
+    uint8_t i;
+
+    a_payload.src = 0;
+    a_payload.seqn = 0;
+    if (received && is_sink) {
+        for (i = 0; i < p->n_reports && i < REPORTS_PER_PKT &&
+                n_sink_reports < SINK_MAX_REPORTS; i++) {
+            sink_reports[n_sink_reports].anchor = p->src;
+            tdoa_report_read(&p->reports[i * TDOA_REPORT_LEN],
+                             &sink_reports[n_sink_reports].blink);
+            n_sink_reports++;
+        }
+        a_payload.src = p->src;
+        a_payload.seqn = p->seqn;
+    }
+    return (uint8_t*)&a_payload;
+}
+
+void app_post_A(int received, uint8_t* payload) {
+    app_a_payload *p = (app_a_payload*)payload;
+
+    if (app_have_packet && received &&
+            p->src == node_id && p->seqn == t_payload.seqn) {
+        app_have_packet = false;
+    }
+}
+
+void app_epoch_end() {
+    tdoa_anchor_listen_start();
+    process_post(&tdoa_test, EPOCH_END_EV, NULL);
+}
+
+void app_pre_epoch() {
+    tdoa_anchor_listen_stop();
+}
+
+void app_crystal_start_done(bool success) {}
+/*--------------------------------------------------------------------------*/
+static bool
+is_anchor(void)
+{
+    int i;
+    for (i = 0; i < NUM_ANCHORS; i++) {
+        if (anchors[i] == node_id) {
+            return true;
+        }
+    }
+    return false;
+}
+/*--------------------------------------------------------------------------*/
+PROCESS_THREAD(tdoa_test, ev, data)
+{
+    static struct etimer et;
+    static uint8_t blink_seqn;
+    int i;
+
+    PROCESS_BEGIN();
+
+    EPOCH_END_EV = process_alloc_event();
+    deployment_set_node_id_ieee_addr();
+    is_sink = (node_id == SINK_ID);
+
+    if (!is_anchor()) {
+        /* Tag: blink periodically, with the radio off in between */
+        printf("TDoA tag %u\n", node_id);
+        NETSTACK_RADIO.off();
+        etimer_set(&et, TAG_PERIOD);
+        while (1) {
+            PROCESS_WAIT_UNTIL(etimer_expired(&et));
+            etimer_reset(&et);
+            tdoa_tag_blink(blink_seqn++);
+        }
+    }
+
+    printf("TDoA anchor %u%s\n", node_id, is_sink ? " (sink)" : "");
+    crystal_init();
+    conf = crystal_get_config();
+    conf.plds_S  = sizeof(app_s_payload);
+    conf.plds_T  = sizeof(app_t_payload);
+    conf.plds_A  = sizeof(app_a_payload);
+    conf.is_sink = is_sink;
+    if (!crystal_start(&conf)) {
+        printf("Crystal failed to start\n");
+    }
+
+    while (1) {
+        PROCESS_WAIT_EVENT_UNTIL(ev == EPOCH_END_EV);
+        /* TDOA <epoch> <anchor> <tag> <blink seqn> <ref. epoch> <rx_ts, hex> */
+        for (i = 0; i < n_sink_reports; i++) {
+            tdoa_blink_t *b = &sink_reports[i].blink;
+            printf("TDOA %u %u %02x%02x %u %u %02x%08lx\n",
+                   crystal_info.epoch, sink_reports[i].anchor,
+                   b->tag.u8[0], b->tag.u8[1], b->seqn, b->ref_id,
+                   (unsigned int)(b->rx_ts >> 32), (unsigned long)(uint32_t)b->rx_ts);
+        }
+    }
+
+    PROCESS_END();
+}
@@ -60,6 +60,7 @@
 #include "dev/serial-line.h"
 #include "dev/uart0.h"
 #include "dev/lpm.h"
+#include "logging-defer.h"
 /*---------------------------------------------------------------------------*/
 #include "deca_device_api.h"
 #include "dw1000-arch.h"
@@ -303,6 +304,7 @@ main(void)
 #endif //NRF_SHOW_RESETREASON
 
   process_start(&etimer_process, NULL);
+  logging_init(); /* Start draining the deferred log records */
   ctimer_init();
 
 #if ENERGEST_CONF_ON
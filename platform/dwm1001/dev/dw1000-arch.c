@@ -41,6 +41,10 @@
 #include "nrf_delay.h"
 #include "app_util_platform.h"
 #include "app_error.h"
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_sdh.h"
+#include "nrf_soc.h"
+#endif /* SOFTDEVICE_PRESENT */
 /*---------------------------------------------------------------------------*/
 #include "sys/clock.h"
 /*---------------------------------------------------------------------------*/
@@ -65,30 +69,31 @@
 #define LEDS_TOGGLE(x)
 #endif
 /*---------------------------------------------------------------------------*/
-#define NRFX_SPIM_DEFAULT_CONFIG_2M			     \
-  {                                                          \
-   .sck_pin      = DW1000_SPI_CLK_PIN,			     \
-   .mosi_pin     = DW1000_SPI_MOSI_PIN,			     \
-   .miso_pin     = DW1000_SPI_MISO_PIN,			     \
-   .ss_pin       = NRFX_SPIM_PIN_NOT_USED,		     \
-   .ss_active_high = false,			             \
-   .irq_priority = (APP_IRQ_PRIORITY_MID - 2),		     \
-   .orc          = 0xFF,				     \
-   .frequency    = NRF_SPIM_FREQ_2M,			     \
-   .mode         = NRF_SPIM_MODE_0,			     \
-   .bit_order    = NRF_SPIM_BIT_ORDER_MSB_FIRST,	     \
-  }
+/* SPI clock during the DW1000 init (must be below 3 MHz) and afterwards */
+#ifdef DW1000_CONF_SPI_SLOW
+#define DW1000_SPI_SLOW DW1000_CONF_SPI_SLOW
+#else
+#define DW1000_SPI_SLOW NRF_SPIM_FREQ_2M
+#endif
 
-#define NRFX_SPIM_DEFAULT_CONFIG_8M			     \
+#ifdef DW1000_CONF_SPI_FAST
+#define DW1000_SPI_FAST DW1000_CONF_SPI_FAST
+#else
+#define DW1000_SPI_FAST NRF_SPIM_FREQ_8M
+#endif
+
+/* The SPIM is initialised once, at the slow rate; switching the rate only
+ * reprograms its FREQUENCY register */
+#define NRFX_SPIM_DW1000_CONFIG			     \
   {                                                          \
    .sck_pin      = DW1000_SPI_CLK_PIN,			     \
    .mosi_pin     = DW1000_SPI_MOSI_PIN,			     \
    .miso_pin     = DW1000_SPI_MISO_PIN,			     \
    .ss_pin       = NRFX_SPIM_PIN_NOT_USED,		     \
-   .ss_active_high = false,		    	             \
+   .ss_active_high = false,			             \
    .irq_priority = (APP_IRQ_PRIORITY_MID - 2),		     \
    .orc          = 0xFF,				     \
-   .frequency    = NRF_SPIM_FREQ_8M,			     \
+   .frequency    = DW1000_SPI_SLOW,			     \
    .mode         = NRF_SPIM_MODE_0,			     \
    .bit_order    = NRF_SPIM_BIT_ORDER_MSB_FIRST,	     \
   }
@@ -145,19 +150,22 @@ dw1000_enable_interrupt(int previous_irqn_status)
 }
 /*---------------------------------------------------------------------------*/
 void
+dw1000_set_spi_bit_rate(uint32_t frequency)
+{
+  /* Safe between transactions, no need to re-initialise the driver */
+  nrf_spim_frequency_set(spim.p_reg, (nrf_spim_frequency_t)frequency);
+}
+/*---------------------------------------------------------------------------*/
+void
 dw1000_spi_set_slow_rate(void)
 {
-  nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG_2M;
-  nrfx_spim_uninit(&spim);
-  APP_ERROR_CHECK(nrfx_spim_init(&spim, &spi_config, NULL, NULL));
+  dw1000_set_spi_bit_rate(DW1000_SPI_SLOW);
 }
 /*---------------------------------------------------------------------------*/
 void
 dw1000_spi_set_fast_rate(void)
 {
-  nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG_8M;
-  nrfx_spim_uninit(&spim);
-  APP_ERROR_CHECK(nrfx_spim_init(&spim, &spi_config, NULL, NULL));
+  dw1000_set_spi_bit_rate(DW1000_SPI_FAST);
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -176,124 +184,91 @@ dw1000_spi_close(void)
 {
 }
 /*---------------------------------------------------------------------------*/
-// maximum header+body length to join in a single SPI transfer 
-#define BUF_JOIN_THR 50
-int
-dw1000_spi_read(uint16_t  headerLength,
-                const uint8_t   *headerBuffer,
-                uint32_t  readLength,
-                uint8_t   *readBuffer)
+/* Maximum EasyDMA transaction length of the nRF52832 SPIM (8-bit MAXCNT) */
+#define SPIM_MAX_XFER 255
+/* Chunk size when the TX data is not in RAM and has to be bounced */
+#define SPIM_BOUNCE_LEN 32
+/*---------------------------------------------------------------------------*/
+/* Run one SPIM transaction with the current buffer pointers and wait for
+ * its end. In ArrayList mode, the pointers advance by MAXCNT at the end. */
+static inline void
+spim_run(NRF_SPIM_Type *p_reg, uint8_t tx_len, uint8_t rx_len)
 {
-  nrf_gpio_pin_clear(DW1000_SPI_CS_PIN);
-  if (headerLength + readLength <= BUF_JOIN_THR) {  // combine header and body for short xfers
-    uint8_t buf[headerLength + readLength];
-    nrfx_spim_xfer_desc_t const xfer_desc =
-    {
-      .p_tx_buffer = headerBuffer,
-      .tx_length = headerLength,
-      .p_rx_buffer = buf,
-      .rx_length = headerLength + readLength,
-    };
-    APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_desc, 0));
-    for (int i=0; i<readLength; i++) readBuffer[i] = buf[headerLength+i];
-  }
-  else { // split header and body transfers
-    nrfx_spim_xfer_desc_t const xfer_hdr_desc =
-      {
-        .p_tx_buffer = headerBuffer,
-        .tx_length = headerLength,
-        .p_rx_buffer = NULL,
-        .rx_length = 0,
-      };
-    nrfx_spim_xfer_desc_t xfer_data_desc =
-      {
-        .p_tx_buffer = NULL,
-        .tx_length = 0,
-        .p_rx_buffer = NULL, // fill later
-        .rx_length = 0,      // fill later
-      };
-
-    uint32_t bytes_read = 0;
-    uint32_t bytes_to_read = readLength;
+  p_reg->TXD.MAXCNT = tx_len;
+  p_reg->RXD.MAXCNT = rx_len;
+  nrf_spim_event_clear(p_reg, NRF_SPIM_EVENT_END);
+  nrf_spim_task_trigger(p_reg, NRF_SPIM_TASK_START);
+  while(!nrf_spim_event_check(p_reg, NRF_SPIM_EVENT_END));
+}
+/*---------------------------------------------------------------------------*/
+/* Send the header and then transfer the body straight from/to the caller's
+ * buffer (tx for writes, rx for reads), in as many back-to-back
+ * transactions as needed, within a single chip select. */
+static void
+spim_xfer(uint16_t hdr_len, const uint8_t *hdr,
+          uint32_t len, const uint8_t *tx, uint8_t *rx)
+{
+  NRF_SPIM_Type *p_reg = spim.p_reg;
+  uint8_t bounce[SPIM_BOUNCE_LEN];
+  uint8_t n;
 
-    APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_hdr_desc, 0));
+  nrf_gpio_pin_clear(DW1000_SPI_CS_PIN);
 
-    while (bytes_to_read) {
-      xfer_data_desc.p_rx_buffer = readBuffer + bytes_read;
-      xfer_data_desc.rx_length = bytes_to_read > 255 ? 255 : bytes_to_read; // DMA can handle max 255 bytes at a time
+  nrf_spim_tx_list_disable(p_reg);
+  nrf_spim_rx_list_disable(p_reg);
+  nrf_spim_tx_buffer_set(p_reg, hdr, hdr_len);
+  nrf_spim_rx_buffer_set(p_reg, NULL, 0);
+  spim_run(p_reg, hdr_len, 0);
 
-      APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_data_desc, 0));
-      bytes_read += xfer_data_desc.rx_length;
-      bytes_to_read -= xfer_data_desc.rx_length;
+  if(tx != NULL && !nrfx_is_in_ram(tx)) {
+    /* EasyDMA only reads from RAM */
+    nrf_spim_tx_buffer_set(p_reg, bounce, 0);
+    while(len > 0) {
+      n = len > SPIM_BOUNCE_LEN ? SPIM_BOUNCE_LEN : len;
+      memcpy(bounce, tx, n);
+      spim_run(p_reg, n, 0);
+      tx += n;
+      len -= n;
     }
+  } else if(len > 0) {
+    if(tx != NULL) {
+      nrf_spim_tx_buffer_set(p_reg, tx, 0);
+      nrf_spim_tx_list_enable(p_reg);
+    } else {
+      /* NOTE: a 1-byte read clocks an extra byte (nRF52832 anomaly 58),
+       * which is harmless for a DW1000 read */
+      nrf_spim_rx_buffer_set(p_reg, rx, 0);
+      nrf_spim_rx_list_enable(p_reg);
+    }
+    while(len > 0) {
+      n = len > SPIM_MAX_XFER ? SPIM_MAX_XFER : len;
+      spim_run(p_reg, tx != NULL ? n : 0, tx != NULL ? 0 : n);
+      len -= n;
+    }
+    nrf_spim_tx_list_disable(p_reg);
+    nrf_spim_rx_list_disable(p_reg);
   }
 
   nrf_gpio_pin_set(DW1000_SPI_CS_PIN);
-
+}
+/*---------------------------------------------------------------------------*/
+int
+dw1000_spi_read(uint16_t  headerLength,
+                const uint8_t   *headerBuffer,
+                uint32_t  readLength,
+                uint8_t   *readBuffer)
+{
+  spim_xfer(headerLength, headerBuffer, readLength, NULL, readBuffer);
   return 0;
 }
 /*---------------------------------------------------------------------------*/
-
 int
 dw1000_spi_write(uint16_t       headerLength,
                  const uint8_t  *headerBuffer,
                  uint32_t       bodyLength,
                  const uint8_t  *bodyBuffer)
 {
-  nrf_gpio_pin_clear(DW1000_SPI_CS_PIN);
-
-  if (!bodyLength) { // no body, send only the header
-    nrfx_spim_xfer_desc_t const xfer_hdr_desc =
-    {
-      .p_tx_buffer = headerBuffer,
-      .tx_length = headerLength,
-      .p_rx_buffer = NULL,
-      .rx_length = 0,
-    };
-    APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_hdr_desc, 0));
-  }
-  else {
-    if (headerLength + bodyLength <= BUF_JOIN_THR) {   // combine header and body for short xfers
-      uint8_t buf[headerLength + bodyLength];
-      
-      for (int i=0; i<headerLength; i++) buf[i] = headerBuffer[i];
-      for (int i=0; i<bodyLength; i++) buf[headerLength+i] = bodyBuffer[i];
-
-      nrfx_spim_xfer_desc_t const xfer_desc =
-      {
-        .p_tx_buffer = buf,
-        .tx_length = headerLength + bodyLength,
-        .p_rx_buffer = NULL,
-        .rx_length = 0,
-      };
-      APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_desc, 0));
-    }
-    else { // split header and body transfers
-      {
-        nrfx_spim_xfer_desc_t const xfer_desc =
-        {
-          .p_tx_buffer = headerBuffer,
-          .tx_length = headerLength,
-          .p_rx_buffer = NULL,
-          .rx_length = 0,
-        };
-        APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_desc, 0));
-      }
-      {
-        nrfx_spim_xfer_desc_t const xfer_desc =
-        {
-          .p_tx_buffer = bodyBuffer,
-          .tx_length = bodyLength,
-          .p_rx_buffer = NULL,
-          .rx_length = 0,
-        };
-        APP_ERROR_CHECK(nrfx_spim_xfer(&spim, &xfer_desc, 0));
-      }
-    }
-  }
-  nrf_gpio_pin_set(DW1000_SPI_CS_PIN);
-
-  // TODO XXX implement writing of more than 255 bytes (see the read function above)
+  spim_xfer(headerLength, headerBuffer, bodyLength, bodyBuffer, NULL);
   return 0;
 }
 /*---------------------------------------------------------------------------*/
@@ -309,7 +284,7 @@ dw1000_arch_init()
   /* For initialisation, DW1000 clocks must be temporarily set to crystal speed.
    * After initialisation SPI rate can be increased for optimum performance.
    */
-  nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG_2M;
+  nrfx_spim_config_t spi_config = NRFX_SPIM_DW1000_CONFIG;
   APP_ERROR_CHECK(nrfx_spim_init(&spim, &spi_config, NULL, NULL));
 
   if (dwt_readdevid() != DWT_DEVICE_ID) {
@@ -360,6 +335,23 @@ dw1000_arch_reset()
   nrf_delay_ms(2);
 }
 /*---------------------------------------------------------------------------*/
+void
+dw1000_arch_lpm_wait(volatile bool *done)
+{
+  /* An interrupt taken after the check sets the event register, so the
+   * wait-for-event returns right away and the wake-up is not missed */
+  if(*done) {
+    return;
+  }
+#ifdef SOFTDEVICE_PRESENT
+  if(nrf_sdh_is_enabled()) {
+    sd_app_evt_wait();
+    return;
+  }
+#endif /* SOFTDEVICE_PRESENT */
+  __WFE();
+}
+/*---------------------------------------------------------------------------*/
 /* Note that after calling this function you need to wait 5ms for XTAL to
  * start and stabilise (or wait for PLL lock IRQ status bit: in SLOW SPI mode)
  */
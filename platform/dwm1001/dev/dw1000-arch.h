@@ -39,6 +39,7 @@
 #include "contiki.h"
 #include "deca_types.h"
 #include "nrf_delay.h"
+#include <stdbool.h>
 /*---------------------------------------------------------------------------*/
 /* DW1000 IRQ (EXTI9_5_IRQ) handler type. */
 typedef void (*dw1000_isr_t)(void);
@@ -52,10 +53,14 @@ void dw1000_spi_open(void);
 void dw1000_spi_close(void);
 int dw1000_spi_read(uint16 hdrlen, const uint8 *hdrbuf, uint32 len, uint8 *buf);
 int dw1000_spi_write(uint16 hdrlen, const uint8 *hdrbuf, uint32 len, const uint8 *buf);
+void dw1000_set_spi_bit_rate(uint32_t frequency); /* NRF_SPIM_FREQ_x */
 void dw1000_spi_set_slow_rate(void);
 void dw1000_spi_set_fast_rate(void);
 int dw1000_disable_interrupt(void);
 void dw1000_enable_interrupt(int irqn_status);
+/* Sleep in low-power mode until an interrupt occurs, unless *done is set.
+ * The check and the sleep are atomic w.r.t. interrupts. */
+void dw1000_arch_lpm_wait(volatile bool *done);
 /*---------------------------------------------------------------------------*/
 /* Platform-specific bindings for the DW1000 driver */
 #define writetospi(cnt, header, length, buffer) dw1000_spi_write(cnt, header, length, buffer)
@@ -52,6 +52,7 @@
 #include "lib/random.h"
 #include "net/netstack.h"
 #include "serial-line.h"
+#include "logging-defer.h"
 /*---------------------------------------------------------------------------*/
 /* For IPv6 Stack */
 #include "net/queuebuf.h"
@@ -150,6 +151,9 @@ main(void)
   process_init();
 
   process_start(&etimer_process, NULL);
+
+  /* Start draining the deferred log records */
+  logging_init();
   
   ctimer_init();
 
@@ -28,6 +28,20 @@ static inline void dw1000_deselect(void);
 /* Set the DW1000 ISR to NULL by default */
 static dw1000_isr_t dw1000_isr = NULL;
 /*---------------------------------------------------------------------------*/
+/* Bodies of at least this many bytes are transferred by DMA */
+#ifdef DW1000_CONF_SPI_DMA_MIN_LEN
+#define DW1000_SPI_DMA_MIN_LEN DW1000_CONF_SPI_DMA_MIN_LEN
+#else
+#define DW1000_SPI_DMA_MIN_LEN 16
+#endif
+
+#define DW1000_SPI_DMA_IRQN DMA1_Channel2_IRQn /* SPI1 RX channel */
+
+/* Asynchronous transfer in progress */
+static volatile bool spi_async_busy;
+static dw1000_spi_cb_t spi_async_cb;
+static int8_t spi_async_irqn_status;
+/*---------------------------------------------------------------------------*/
 /* DW1000 Interrupt pin handler */
 void
 EXTI9_5_IRQHandler(void)
@@ -66,40 +80,96 @@ dw1000_set_isr(dw1000_isr_t new_dw1000_isr)
   dw1000_enable_interrupt(irqn_status);
 }
 /*---------------------------------------------------------------------------*/
+/* Polled transfer of the header and of the short bodies */
+static inline void
+spi_write_polled(const uint8_t *buf, uint32_t len)
+{
+  const uint8_t *end = buf + len;
+  while(buf != end) {
+    SPI1->DR = *(buf++); //SPI_I2S_SendData(SPI1, buf[i]);
+    /* Wait for the RX Buffer to be filled */
+    while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
+    /* Clear Flags */
+    SPI1->DR; //SPI_I2S_ReceiveData(SPI1);
+    // TODO the above is intended to be a read operation, make sure it is not optimised away!
+  }
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+spi_read_polled(uint8_t *buf, uint32_t len)
+{
+  const uint8_t *end = buf + len;
+  while(buf != end) {
+    /* Send dummy data */
+    SPI1->DR = 0xFF; //SPI_I2S_SendData(SPI1, 0xFF);
+    /* Wait for the RX Buffer to be filled */
+    while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
+    /* Receive data */
+    *(buf++) = SPI1->DR; //buf[i] = SPI_I2S_ReceiveData(SPI1);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Complete the asynchronous transfer: release the bus and notify */
+static void
+spi_async_complete(void)
+{
+  dw1000_spi_cb_t cb = spi_async_cb;
+
+  spix_dma_stop(DW1000_SPI);
+  dw1000_deselect();
+  spi_async_busy = false;
+  dw1000_enable_interrupt(spi_async_irqn_status);
+  if(cb != NULL) {
+    cb();
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Wait for the asynchronous transfer in progress, if any */
+static void
+spi_async_wait(void)
+{
+  if(!spi_async_busy) {
+    return;
+  }
+  NVIC_DisableIRQ(DW1000_SPI_DMA_IRQN);
+  if(spi_async_busy) {
+    while(!spix_dma_done(DW1000_SPI));
+    spi_async_complete();
+  }
+  NVIC_EnableIRQ(DW1000_SPI_DMA_IRQN);
+}
+/*---------------------------------------------------------------------------*/
+/* SPI RX DMA channel: end of an asynchronous transfer */
+void
+DMA1_Channel2_IRQHandler(void)
+{
+  ENERGEST_ON(ENERGEST_TYPE_IRQ);
+
+  if(spi_async_busy && spix_dma_done(DW1000_SPI)) {
+    spi_async_complete();
+  }
+
+  ENERGEST_OFF(ENERGEST_TYPE_IRQ);
+}
+/*---------------------------------------------------------------------------*/
 void
 dw1000_spi_read(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, uint8_t *buf)
 {
   int8_t irqn_status;
 
+  spi_async_wait();
+
   /* Disable DW1000 EXT Interrupt */
   irqn_status = dw1000_disable_interrupt();
 
   /* Clear SPI1 Chip Select */
   dw1000_select();
 
-  {
-    /* Write Header */
-    const uint8_t *end = hdrbuf + hdrlen;
-    while(hdrbuf != end) {
-      SPI1->DR = *(hdrbuf++); //SPI_I2S_SendData(SPI1, hdrbuf[i]);
-      /* Wait for the RX Buffer to be filled */
-      while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
-      /* Clear Flags */
-      SPI1->DR; //SPI_I2S_ReceiveData(SPI1);
-      // TODO the above is intended to be a read operation, make sure it is not optimised away!
-    }
-  }
-  {
-    /* Read body */
-    const uint8_t *end = buf + len;
-    while(buf != end) {
-      /* Send dummy data */
-      SPI1->DR = 0xFF; //SPI_I2S_SendData(SPI1, 0xFF);
-      /* Wait for the RX Buffer to be filled */
-      while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
-      /* Receive data */
-      *(buf++) = SPI1->DR; //buf[i] = SPI_I2S_ReceiveData(SPI1);
-    }
+  spi_write_polled(hdrbuf, hdrlen);
+  if(len >= DW1000_SPI_DMA_MIN_LEN) {
+    spix_dma_transfer(DW1000_SPI, NULL, buf, len);
+  } else {
+    spi_read_polled(buf, len);
   }
 
   /* Set SPI1 Chip Select */
@@ -112,40 +182,21 @@ dw1000_spi_read(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, uint8_t *b
 void
 dw1000_spi_write(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, const uint8_t *buf)
 {
-  //uint32_t i;
   int8_t irqn_status;
 
+  spi_async_wait();
+
   /* Disable DW1000 EXT Interrupt */
   irqn_status = dw1000_disable_interrupt();
 
   /* Clear SPI1 Chip Select */
   dw1000_select();
 
-  {
-    /* Write Header */
-    const uint8_t *end = hdrbuf + hdrlen;
-    /* Write Header */
-    while(hdrbuf != end) {
-      SPI1->DR = *(hdrbuf++); //SPI_I2S_SendData(SPI1, hdrbuf[i]);
-      /* Wait for the RX Buffer to be filled */
-      while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
-      /* Clear Flags */
-      SPI1->DR; //SPI_I2S_ReceiveData(SPI1);
-      // TODO the above is intended to be a read operation, make sure it is not optimised away!
-    }
-  }
-
-  {
-    /* Write body */
-    const uint8_t *end = buf + len;
-    while (buf != end) {
-      SPI1->DR = (*buf++); //SPI_I2S_SendData(SPI1, buf[i]);
-      /* Wait for the RX Buffer to be filled */
-      while(!(SPI1->SR & SPI_I2S_FLAG_RXNE)); //while(SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE) == RESET);
-      /* Clear Flags */
-      SPI1->DR; //SPI_I2S_ReceiveData(SPI1);
-      // TODO the above is intended to be a read operation, make sure it is not optimised away!
-    }
+  spi_write_polled(hdrbuf, hdrlen);
+  if(len >= DW1000_SPI_DMA_MIN_LEN) {
+    spix_dma_transfer(DW1000_SPI, buf, NULL, len);
+  } else {
+    spi_write_polled(buf, len);
   }
 
   /* Set SPI1 Chip Select */
@@ -155,6 +206,51 @@ dw1000_spi_write(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, const uin
   dw1000_enable_interrupt(irqn_status);
 }
 /*---------------------------------------------------------------------------*/
+int
+dw1000_spi_read_async(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len,
+                      uint8_t *buf, dw1000_spi_cb_t cb)
+{
+  if(len == 0 || len > 0xFFFF) {
+    return DWT_ERROR;
+  }
+  spi_async_wait();
+
+  /* The DW1000 interrupt stays disabled until the end of the transfer */
+  spi_async_irqn_status = dw1000_disable_interrupt();
+  spi_async_cb = cb;
+  spi_async_busy = true;
+
+  dw1000_select();
+  spi_write_polled(hdrbuf, hdrlen);
+  spix_dma_start(DW1000_SPI, NULL, buf, len, true);
+  return DWT_SUCCESS;
+}
+/*---------------------------------------------------------------------------*/
+int
+dw1000_spi_write_async(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len,
+                       const uint8_t *buf, dw1000_spi_cb_t cb)
+{
+  if(len == 0 || len > 0xFFFF) {
+    return DWT_ERROR;
+  }
+  spi_async_wait();
+
+  spi_async_irqn_status = dw1000_disable_interrupt();
+  spi_async_cb = cb;
+  spi_async_busy = true;
+
+  dw1000_select();
+  spi_write_polled(hdrbuf, hdrlen);
+  spix_dma_start(DW1000_SPI, buf, NULL, len, true);
+  return DWT_SUCCESS;
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_spi_busy(void)
+{
+  return spi_async_busy;
+}
+/*---------------------------------------------------------------------------*/
 void
 dw1000_set_spi_bit_rate(uint16_t brate)
 {
@@ -198,6 +294,14 @@ dw1000_arch_init()
   /* Disable SPI1 SS Output -- is this required? */
   SPI_SSOutputCmd(SPI1, DISABLE);
 
+  /* DMA channels for the long transfers */
+  spix_dma_init(DW1000_SPI);
+  nvic_conf.NVIC_IRQChannel = DW1000_SPI_DMA_IRQN;
+  nvic_conf.NVIC_IRQChannelPreemptionPriority = 14; /* just above the DW1000 IRQ */
+  nvic_conf.NVIC_IRQChannelSubPriority = 0;
+  nvic_conf.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&nvic_conf);
+
   /* DW1000 CS Pin Configuration */
   gpio_conf.GPIO_Pin = DW1000_CS_PIN;
   gpio_conf.GPIO_Mode = GPIO_Mode_Out_PP;
@@ -292,12 +396,30 @@ dw1000_arch_reset()
   clock_wait(2);
 }
 /*---------------------------------------------------------------------------*/
+void
+dw1000_arch_lpm_wait(volatile bool *done)
+{
+  /* WFI wakes up on a pending interrupt even if PRIMASK is set, so an
+   * interrupt arriving after the check is served right after waking up */
+  __disable_irq();
+  if(!*done) {
+    __WFI();
+  }
+  __enable_irq();
+}
+/*---------------------------------------------------------------------------*/
 /* Note that after calling this function you need to wait 5ms for XTAL to 
  * start and stabilise (or wait for PLL lock IRQ status bit: in SLOW SPI mode)
  */
 void dw1000_arch_wakeup_nowait() {
-    /* To wake up the DW1000 we keep the SPI CS line low for (at least) 500us.
-     * This can be achieved with a long read SPI transaction.*/
-  uint8_t wakeup_buffer[600];
-  dwt_readfromdevice(0x0, 0x0, 600, wakeup_buffer);
+  /* To wake up the DW1000 we keep the SPI CS line low for (at least) 500us.
+   * A long read SPI transaction is too short with DMA, hold the line. */
+  int8_t irqn_status;
+
+  spi_async_wait();
+  irqn_status = dw1000_disable_interrupt();
+  dw1000_select();
+  clock_delay_usec(600);
+  dw1000_deselect();
+  dw1000_enable_interrupt(irqn_status);
 }
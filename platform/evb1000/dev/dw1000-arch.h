@@ -10,6 +10,7 @@
 #include "contiki.h"
 #include "stm32f10x.h"
 #include "board.h"
+#include <stdbool.h>
 /*---------------------------------------------------------------------------*/
 #define DW1000_SPI_OPEN_ERROR  0
 #define DW1000_SPI_OPEN_OK     1
@@ -30,9 +31,23 @@ void dw1000_spi_open(void);
 void dw1000_spi_close(void);
 void dw1000_spi_read(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, uint8_t *buf);
 void dw1000_spi_write(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, const uint8_t *buf);
+/* Asynchronous variants: the header is sent right away, the body is
+ * transferred by DMA and cb is called at the end, from the DMA interrupt
+ * (or from the next SPI call, which waits for the transfer to complete).
+ * The buffer must stay valid until then; the DW1000 interrupt is disabled
+ * in the meantime. Return DWT_SUCCESS or DWT_ERROR (len 0 or > 65535). */
+typedef void (*dw1000_spi_cb_t)(void);
+int dw1000_spi_read_async(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len,
+                          uint8_t *buf, dw1000_spi_cb_t cb);
+int dw1000_spi_write_async(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len,
+                           const uint8_t *buf, dw1000_spi_cb_t cb);
+bool dw1000_spi_busy(void);
 void dw1000_set_spi_bit_rate(uint16_t brate);
 void dw1000_spi_set_slow_rate(void);
 void dw1000_spi_set_fast_rate(void);
+/* Sleep in low-power mode until an interrupt occurs, unless *done is set.
+ * The check and the sleep are atomic w.r.t. interrupts. */
+void dw1000_arch_lpm_wait(volatile bool *done);
 /*---------------------------------------------------------------------------*/
 /* Platform-specific bindings for the DW1000 driver */
 #define writetospi(cnt, header, length, buffer) dw1000_spi_write(cnt, header, length, buffer)
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * \file
+ *		native-uwb Contiki Platform Main
+ *
+ *		Usage: <app>.native-uwb [-n node_id] [-d drift_ppm] [-r seed]
+ *		                        [-t seconds] [-s] [-S fd]
+ *
+ *		-n  node ID, used as the DW1000 part ID (and so as link address)
+ *		-d  crystal offset of the emulated DW1000, in ppm
+ *		-r  seed of the emulated radio noise
+ *		-t  stop after the given number of seconds
+ *		-s  print the SPI/ISR/radio statistics at exit
+ *		-S  run in virtual time under the multi-node simulator, attached
+ *		    to the given socket (set by tools/uwb-sim)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "deca_device_api.h"
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+#include "sys/clock.h"
+#include "sys/rtimer.h"
+#include "dev/watchdog.h"
+#include "dev/radio.h"
+#include "lib/random.h"
+#include "net/netstack.h"
+#include "serial-line.h"
+#include "logging-defer.h"
+/*---------------------------------------------------------------------------*/
+/* For IPv6 Stack */
+#include "net/queuebuf.h"
+#include "net/ip/tcpip.h"
+#include "net/ip/uip.h"
+/*---------------------------------------------------------------------------*/
+#include "leds.h"
+#include "native-irq.h"
+#include "dw1000-arch.h"
+#include "dw1000-emu.h"
+#include "dw1000-config.h"
+#include "uwb-sim-client.h"
+/*---------------------------------------------------------------------------*/
+#define DEFAULT_LOT_ID 0x2B1C0000
+/*---------------------------------------------------------------------------*/
+static volatile sig_atomic_t stop;
+static uint64_t stop_at = NATIVE_TIME_NEVER;
+static int print_stats;
+/*---------------------------------------------------------------------------*/
+static void
+on_signal(int sig)
+{
+  stop = 1;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+stop_deadline(void)
+{
+  return stop ? NATIVE_TIME_NEVER : stop_at;
+}
+/*---------------------------------------------------------------------------*/
+static void
+stop_service(void)
+{
+  stop = 1;
+}
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source stop_source = {
+  NULL, stop_deadline, stop_service, 0
+};
+/*---------------------------------------------------------------------------*/
+static void
+at_exit(void)
+{
+  logging_flush();
+  if(print_stats) {
+    dw1000_arch_print_stats();
+  }
+  fflush(stdout);
+}
+/*---------------------------------------------------------------------------*/
+/* This function must be called after initializing the DW1000 radio */
+static void
+configure_addresses(void)
+{
+  uint8_t ext_addr[8];
+  uint32_t part_id, lot_id;
+
+  /* Read from the DW1000 OTP memory the DW1000 PART and LOT IDs */
+  part_id = dwt_getpartid();
+  lot_id = dwt_getlotid();
+
+  /* Compute the Link Layer addresses depending on the PART and LOT IDs */
+  ext_addr[0] = (lot_id  & 0xFF000000) >> 24;
+  ext_addr[1] = (lot_id  & 0x00FF0000) >> 16;
+  ext_addr[2] = (lot_id  & 0x0000FF00) >> 8;
+  ext_addr[3] = (lot_id  & 0x000000FF);
+  ext_addr[4] = (part_id & 0xFF000000) >> 24;
+  ext_addr[5] = (part_id & 0x00FF0000) >> 16;
+  ext_addr[6] = (part_id & 0x0000FF00) >> 8;
+  ext_addr[7] = (part_id & 0x000000FF);
+
+  /* Populate linkaddr_node_addr (big-endian) */
+  memcpy(&linkaddr_node_addr, &ext_addr[8 - LINKADDR_SIZE], LINKADDR_SIZE);
+
+  NETSTACK_RADIO.set_value(RADIO_PARAM_PAN_ID, IEEE802154_PANID);
+  NETSTACK_RADIO.set_object(RADIO_PARAM_64BIT_ADDR, ext_addr, 8);
+  NETSTACK_RADIO.set_value(RADIO_PARAM_16BIT_ADDR,
+      (ext_addr[6]) << 8 | (ext_addr[7])); // converting from big-endian format
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief Main function for the native-uwb platform
+ */
+int
+main(int argc, char **argv)
+{
+  dw1000_emu_params_t params;
+  int opt;
+  unsigned long duration = 0;
+  int sim_fd = -1;
+
+  memset(&params, 0, sizeof(params));
+  params.part_id = 1;
+  params.lot_id = DEFAULT_LOT_ID;
+  params.tx_ant_dly = DW1000_CONF_TX_ANT_DLY;
+  params.rx_ant_dly = DW1000_CONF_RX_ANT_DLY;
+
+  while((opt = getopt(argc, argv, "n:d:r:t:sS:")) != -1) {
+    switch(opt) {
+    case 'n':
+      params.part_id = strtoul(optarg, NULL, 0);
+      break;
+    case 'd':
+      params.drift_ppb = (int32_t)(atof(optarg) * 1000);
+      break;
+    case 'r':
+      params.seed = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      duration = strtoul(optarg, NULL, 0);
+      break;
+    case 's':
+      print_stats = 1;
+      break;
+    case 'S':
+      sim_fd = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n node_id] [-d drift_ppm] [-r seed] "
+              "[-t seconds] [-s] [-S fd]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(params.seed == 0) {
+    params.seed = params.part_id;
+  }
+  params.sys_time_init = (uint64_t)params.seed * 0x9E3779B97ULL & 0xFFFFFFFFFFULL;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  /* Power up the emulated radio before the driver looks for it */
+  if(sim_fd >= 0) {
+    dw1000_emu_init(&params, &uwb_sim_medium);
+    uwb_sim_client_init(sim_fd);
+  } else {
+    dw1000_emu_init(&params, NULL);
+  }
+  atexit(at_exit);
+
+  /* Init Contiki Clock module */
+  clock_init();
+  if(duration > 0) {
+    stop_at = native_time_ps() + duration * 1000000000000ULL;
+  }
+  native_irq_add(&stop_source);
+
+  leds_init();
+
+  /* Init rtimer */
+  rtimer_init();
+
+  watchdog_init();
+
+  process_init();
+
+  process_start(&etimer_process, NULL);
+
+  /* Start draining the deferred log records */
+  logging_init();
+
+  ctimer_init();
+
+  energest_init();
+  ENERGEST_ON(ENERGEST_TYPE_CPU);
+
+  /* Init network stack */
+  netstack_init();
+
+  /* Set the link layer addresses and the PAN ID */
+  configure_addresses();
+
+#if NETSTACK_CONF_WITH_IPV6
+  memcpy(&uip_lladdr.addr, &linkaddr_node_addr, sizeof(uip_lladdr.addr));
+  queuebuf_init();
+  process_start(&tcpip_process, NULL);
+#endif /* NETSTACK_CONF_WITH_IPV6 */
+
+  /* Init pseudo-random generator with a chip-id based seed */
+  random_init(0xFFFF & dwt_getpartid());
+
+  serial_line_init();
+
+  /* Start application processes */
+  autostart_start(autostart_processes);
+
+  watchdog_start();
+
+  while(!stop) {
+    uint8_t r;
+    do {
+      r = process_run();
+      watchdog_periodic();
+    } while(r > 0 && !stop);
+
+    /* Wait for the next interrupt */
+    clock_update();
+    native_irq_idle();
+  }
+
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
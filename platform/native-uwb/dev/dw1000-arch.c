@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      DW1000 architecture bindings for the native-uwb platform
+ */
+
+#include "contiki.h"
+#include "sys/clock.h"
+#include "dw1000-arch.h"
+#include "dw1000-emu.h"
+#include "deca_device_api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+/*---------------------------------------------------------------------------*/
+/* SPI clock as on the EVB1000: 2.25 MHz while the chip runs on the
+ * crystal, 18 MHz afterwards. Used to account for the transaction time
+ * in virtual time. */
+#define SPI_SLOW_BIT_PS     444444
+#define SPI_FAST_BIT_PS     55556
+#define SPI_OVERHEAD_PS     (1 * NATIVE_PS_PER_US)
+/*---------------------------------------------------------------------------*/
+/* Set the DW1000 ISR to NULL by default */
+static dw1000_isr_t dw1000_isr = NULL;
+volatile int8_t dw1000_irq_enabled = 0;
+static dw1000_arch_stats_t stats;
+static uint64_t spi_bit_ps = SPI_SLOW_BIT_PS;
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* Radio state machine: runs even when the interrupts are masked */
+static uint64_t
+dw1000_emu_deadline(void)
+{
+  return dw1000_emu_next_event();
+}
+/*---------------------------------------------------------------------------*/
+static void
+dw1000_emu_service(void)
+{
+  dw1000_emu_run(native_time_peek());
+}
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source dw1000_emu_source = {
+  NULL, dw1000_emu_deadline, dw1000_emu_service, 1
+};
+/*---------------------------------------------------------------------------*/
+static uint64_t
+dw1000_irq_deadline(void)
+{
+  if(dw1000_irq_enabled && dw1000_isr != NULL && dw1000_emu_irq()) {
+    return 0;
+  }
+  return NATIVE_TIME_NEVER;
+}
+/*---------------------------------------------------------------------------*/
+/* DW1000 Interrupt pin handler */
+static void
+dw1000_irq_service(void)
+{
+  while(dw1000_irq_enabled && dw1000_isr != NULL && dw1000_emu_irq()) {
+    uint64_t t0 = now_ns();
+    uint64_t dt;
+
+    dw1000_isr();
+
+    dt = now_ns() - t0;
+    stats.isr_count++;
+    stats.isr_time_ns += dt;
+    if(dt > stats.isr_max_ns) {
+      stats.isr_max_ns = dt;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static struct native_irq_source dw1000_irq_source = {
+  NULL, dw1000_irq_deadline, dw1000_irq_service, 0
+};
+/*---------------------------------------------------------------------------*/
+void
+dw1000_set_isr(dw1000_isr_t new_dw1000_isr)
+{
+  int8_t irqn_status;
+
+  irqn_status = dw1000_disable_interrupt();
+  dw1000_isr = new_dw1000_isr;
+  dw1000_enable_interrupt(irqn_status);
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_read(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, uint8_t *buf)
+{
+  int state = native_irq_disable();
+
+  dw1000_emu_run(native_time_peek());
+  dw1000_emu_read(hdrlen, hdrbuf, len, buf);
+  stats.spi_transactions++;
+  stats.spi_bytes += hdrlen + len;
+  native_time_consume(SPI_OVERHEAD_PS + (hdrlen + len) * 8 * spi_bit_ps);
+
+  /* the transaction may have changed the next chip event */
+  native_irq_update();
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_write(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, const uint8_t *buf)
+{
+  int state = native_irq_disable();
+
+  dw1000_emu_run(native_time_peek());
+  dw1000_emu_write(hdrlen, hdrbuf, len, buf);
+  stats.spi_transactions++;
+  stats.spi_bytes += hdrlen + len;
+  native_time_consume(SPI_OVERHEAD_PS + (hdrlen + len) * 8 * spi_bit_ps);
+
+  native_irq_update();
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_open(void)
+{
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_close(void)
+{
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_set_spi_bit_rate(uint16_t brate)
+{
+  /* Only the slow and fast rates used by the driver are modelled */
+  spi_bit_ps = SPI_FAST_BIT_PS;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_set_slow_rate(void)
+{
+  spi_bit_ps = SPI_SLOW_BIT_PS;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_spi_set_fast_rate(void)
+{
+  spi_bit_ps = SPI_FAST_BIT_PS;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_arch_init()
+{
+  dw1000_arch_reset();
+
+  if(dwt_readdevid() != DWT_DEVICE_ID) {
+    printf("Radio sleeping?\n");
+    dw1000_arch_wakeup_nowait();
+    clock_wait(5);
+    dw1000_arch_reset();
+  }
+
+  if(dwt_initialise(DWT_LOADUCODE | DWT_READ_OTP_PID | DWT_READ_OTP_LID |
+                    DWT_READ_OTP_BAT | DWT_READ_OTP_TMP)
+          == DWT_ERROR) {
+    printf("DW1000 INIT FAILED\n");
+    exit(EXIT_FAILURE);
+  }
+  dw1000_spi_set_fast_rate();
+
+  native_irq_add(&dw1000_irq_source);
+  native_irq_add(&dw1000_emu_source);
+  dw1000_irq_enabled = 1;
+  native_irq_update();
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_arch_reset()
+{
+  int state;
+
+  dw1000_spi_set_slow_rate();
+
+  state = native_irq_disable();
+  dw1000_emu_run(native_time_peek());
+  dw1000_emu_reset();
+  native_irq_restore(state);
+
+  /* Sleep 2 ms to get the DW1000 restarted */
+  clock_wait(2);
+}
+/*---------------------------------------------------------------------------*/
+/* Note that after calling this function you need to wait 5ms for XTAL to
+ * start and stabilise (or wait for PLL lock IRQ status bit: in SLOW SPI mode)
+ */
+void
+dw1000_arch_wakeup_nowait()
+{
+  int state = native_irq_disable();
+
+  dw1000_emu_run(native_time_peek());
+  dw1000_emu_wakeup();
+  native_irq_update();
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_arch_lpm_wait(volatile bool *done)
+{
+  int state = native_irq_disable();
+
+  if(!*done) {
+    native_irq_wait();
+  }
+  native_irq_restore(state);
+}
+/*---------------------------------------------------------------------------*/
+const dw1000_arch_stats_t *
+dw1000_arch_get_stats(void)
+{
+  return &stats;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_arch_print_stats(void)
+{
+  const dw1000_emu_stats_t *es = dw1000_emu_get_stats();
+  uint32_t frames = es->n_tx + es->n_rx_ok;
+
+  printf("DW1000 stats: spi_trans %lu spi_bytes %llu spi_bytes_per_frame %llu "
+         "isr %lu isr_avg_ns %llu isr_max_ns %llu "
+         "tx %lu rx_ok %lu rx_err %lu rx_to %lu late %lu "
+         "tx_us %llu rx_us %llu\n",
+         (unsigned long)stats.spi_transactions,
+         (unsigned long long)stats.spi_bytes,
+         (unsigned long long)(frames ? stats.spi_bytes / frames : 0),
+         (unsigned long)stats.isr_count,
+         (unsigned long long)(stats.isr_count ? stats.isr_time_ns / stats.isr_count : 0),
+         (unsigned long long)stats.isr_max_ns,
+         (unsigned long)es->n_tx, (unsigned long)es->n_rx_ok,
+         (unsigned long)es->n_rx_err, (unsigned long)es->n_rx_to,
+         (unsigned long)es->n_late,
+         (unsigned long long)(es->tx_time / DW1000_EMU_PS_PER_US),
+         (unsigned long long)(es->rx_time / DW1000_EMU_PS_PER_US));
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      DW1000 architecture bindings for the native-uwb platform.
+ *
+ *      The SPI functions forward the transactions to the DW1000 emulator;
+ *      the IRQ line is an emulated interrupt source (see native-irq.h).
+ */
+
+#ifndef DW1000_ARCH_H_
+#define DW1000_ARCH_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+#include "native-irq.h"
+#include <stdbool.h>
+/*---------------------------------------------------------------------------*/
+#define DW1000_SPI_OPEN_ERROR  0
+#define DW1000_SPI_OPEN_OK     1
+/*---------------------------------------------------------------------------*/
+typedef void (*dw1000_isr_t)(void);
+/*---------------------------------------------------------------------------*/
+/* Counters collected for CI and profiling */
+typedef struct {
+  uint32_t spi_transactions;
+  uint64_t spi_bytes;           /* header and body */
+  uint32_t isr_count;
+  uint64_t isr_time_ns;         /* total time spent in the DW1000 ISR */
+  uint64_t isr_max_ns;
+} dw1000_arch_stats_t;
+/*---------------------------------------------------------------------------*/
+void dw1000_set_isr(dw1000_isr_t new_dw1000_isr);
+
+void dw1000_arch_init();
+void dw1000_arch_reset();
+void dw1000_arch_wakeup_nowait();
+void dw1000_spi_open(void);
+void dw1000_spi_close(void);
+void dw1000_spi_read(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, uint8_t *buf);
+void dw1000_spi_write(uint16_t hdrlen, const uint8_t *hdrbuf, uint32_t len, const uint8_t *buf);
+void dw1000_set_spi_bit_rate(uint16_t brate);
+void dw1000_spi_set_slow_rate(void);
+void dw1000_spi_set_fast_rate(void);
+/* Sleep in low-power mode until an interrupt occurs, unless *done is set.
+ * The check and the sleep are atomic w.r.t. interrupts. */
+void dw1000_arch_lpm_wait(volatile bool *done);
+
+const dw1000_arch_stats_t *dw1000_arch_get_stats(void);
+/* Print the SPI, ISR and radio statistics on one line */
+void dw1000_arch_print_stats(void);
+/*---------------------------------------------------------------------------*/
+/* Platform-specific bindings for the DW1000 driver */
+#define writetospi(cnt, header, length, buffer) dw1000_spi_write(cnt, header, length, buffer)
+#define readfromspi(cnt, header, length, buffer) dw1000_spi_read(cnt, header, length, buffer)
+#define decamutexon() dw1000_disable_interrupt()
+#define decamutexoff(stat) dw1000_enable_interrupt(stat)
+#define deca_sleep(t) clock_wait(t) // XXX assumes 1ms tick !!!
+/*---------------------------------------------------------------------------*/
+extern volatile int8_t dw1000_irq_enabled;
+/*---------------------------------------------------------------------------*/
+static inline int8_t
+dw1000_disable_interrupt(void)
+{
+  int8_t irqn_status = dw1000_irq_enabled;
+
+  dw1000_irq_enabled = 0;
+  return irqn_status;
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+dw1000_enable_interrupt(int8_t irqn_status)
+{
+  if(irqn_status != 0) {
+    dw1000_irq_enabled = 1;
+    /* serve the line if it was asserted in the meantime */
+    native_irq_update();
+  }
+}
+/*---------------------------------------------------------------------------*/
+#endif /* DW1000_ARCH_H_ */
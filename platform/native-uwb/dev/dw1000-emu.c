@@ -0,0 +1,1295 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Register-level DW1000 emulator.
+ *
+ *      Only the parts of the chip used by the DecaWave driver and by the
+ *      Contiki-UWB modules are modelled: register file, OTP reads,
+ *      immediate and delayed TX/RX, wait-for-response, frame wait and
+ *      preamble timeouts, double RX buffering, frame filtering, the FCS
+ *      suppression trick used by the ranging module, sleep/wakeup and
+ *      the RX diagnostics/CIR. Auto-ACK, sniff mode and the AON sleep
+ *      counter are not emulated.
+ */
+
+#include "dw1000-emu.h"
+#include "deca_regs.h"
+#include "deca_device_api.h"
+#include <string.h>
+#include <math.h>
+/*---------------------------------------------------------------------------*/
+#define N_REGS              0x40
+#define REG_SIZE            64
+#define LDE_IF_SIZE         (LDE_REPC_OFFSET + 2)
+#define ACC_SAMPLES_PRF16   992
+#define ACC_SAMPLES_PRF64   1016
+
+#define DTU_MASK            0xFFFFFFFFFFULL
+#define DTU_HALF_PERIOD     0x8000000000ULL
+#define SYS_TIME_RES_MASK   (~0x1FFULL)   /* SYS_TIME/DX_TIME resolution: 512 DTU */
+
+/* 1 UWB microsecond (512/499.2 us) in ps */
+#define UUS_PS              1025641ULL
+
+/* Preamble symbols the receiver needs before the SFD to acquire a frame */
+#define ACQ_MIN_SYMBOLS     16
+
+/* Delay between the wakeup request and the chip being accessible */
+#define WAKEUP_TIME_PS      (3000ULL * DW1000_EMU_PS_PER_US)
+
+/* Doubly-buffered register set */
+#define RX_FINFO_SIZE       4
+#define RX_TIME_SIZE        14
+#define RX_TTCKO_SIZE       5
+/*---------------------------------------------------------------------------*/
+enum {
+  S_IDLE,
+  S_TX_WAIT,     /* delayed TX programmed */
+  S_TX,          /* transmitting */
+  S_RX_WAIT,     /* delayed RX or wait-for-response delay */
+  S_RX,          /* listening or receiving */
+  S_SLEEP,
+  S_WAKING,
+};
+
+typedef struct {
+  uint8_t finfo[RX_FINFO_SIZE];
+  uint8_t buffer[RX_BUFFER_LEN];
+  uint8_t fqual[RX_FQUAL_LEN];
+  uint8_t ttcki[RX_TTCKI_LEN];
+  uint8_t ttcko[RX_TTCKO_SIZE];
+  uint8_t time[RX_TIME_SIZE];
+  bool full;
+  /* parameters of the CIR synthesised on ACC_MEM reads */
+  uint32_t cir_seed;
+  double cir_fp;          /* first path, in samples */
+  double cir_amp;         /* first path amplitude */
+  double cir_noise;       /* noise standard deviation */
+} rx_set_t;
+
+typedef struct {
+  bool used;
+  bool arrived;
+  dw1000_emu_frame_t frame;
+  dw1000_emu_time_t arrival;     /* preamble start at the RX antenna */
+  dw1000_emu_time_t rmarker;     /* RMARKER at the RX antenna */
+  dw1000_emu_time_t end;
+  dw1000_emu_time_t acq_deadline;
+  double power_dbm;
+  dw1000_emu_rx_outcome_t outcome;
+} rx_slot_t;
+
+static struct {
+  dw1000_emu_params_t params;
+  const dw1000_emu_medium_t *medium;
+  dw1000_emu_time_t now;
+  uint8_t state;
+
+  uint8_t regs[N_REGS][REG_SIZE];
+  uint8_t tx_buffer[TX_BUFFER_LEN];
+  uint8_t lde_if[LDE_IF_SIZE];
+  rx_set_t rx_set[2];
+  uint8_t hsrbp, icrbp;
+  uint64_t sys_status;            /* 40-bit SYS_STATUS */
+  bool sfcst;                     /* FCS suppression requested */
+
+  /* clock model: local = anchor_local + (t - anchor_t) * rate */
+  dw1000_emu_time_t anchor_t;
+  uint64_t anchor_local;
+  int32_t drift_ppb;
+
+  /* pending state transitions */
+  dw1000_emu_time_t tx_start_at;
+  dw1000_emu_time_t tx_end_at;
+  dw1000_emu_time_t rx_on_at;
+  dw1000_emu_time_t rx_to_at;
+  dw1000_emu_time_t pto_at;
+  dw1000_emu_time_t wake_at;
+  dw1000_emu_time_t rx_since;
+  bool w4r;
+  uint64_t tx_rmarker_dtu;       /* digital TX time of the RMARKER (local, unbounded) */
+
+  dw1000_emu_frame_t tx_frame;
+  uint32_t tx_count;
+
+  rx_slot_t rx[DW1000_EMU_RX_QUEUE_LEN];
+  int8_t lock;
+
+  dw1000_emu_stats_t stats;
+} emu;
+/*---------------------------------------------------------------------------*/
+/* Little-endian register helpers */
+static inline uint32_t
+get_u32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint16_t
+get_u16(const uint8_t *p)
+{
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+static inline uint64_t
+get_u40(const uint8_t *p)
+{
+  return get_u32(p) | ((uint64_t)p[4] << 32);
+}
+static inline void
+put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = v; p[1] = v >> 8;
+}
+static inline void
+put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+static inline void
+put_u40(uint8_t *p, uint64_t v)
+{
+  put_u32(p, (uint32_t)v);
+  p[4] = (uint8_t)(v >> 32);
+}
+/*---------------------------------------------------------------------------*/
+/* Clock model                                                               */
+/*---------------------------------------------------------------------------*/
+/* The DW1000 counter runs at 499.2 MHz * 128 = 63.8976 GHz, i.e.
+ * 638976 DTU every 10^7 ps at the nominal frequency. */
+uint64_t
+dw1000_emu_local_time(dw1000_emu_time_t t)
+{
+  __int128 dt = (__int128)t - (__int128)emu.anchor_t;
+  __int128 num = dt * 638976 * (1000000000LL + emu.drift_ppb);
+  __int128 den = (__int128)10000000LL * 1000000000LL;
+  return emu.anchor_local + (int64_t)(num / den);
+}
+/*---------------------------------------------------------------------------*/
+dw1000_emu_time_t
+dw1000_emu_global_time(uint64_t local_dtu)
+{
+  __int128 dl = (__int128)local_dtu - (__int128)emu.anchor_local;
+  __int128 num = dl * 10000000LL * 1000000000LL;
+  __int128 den = (__int128)638976 * (1000000000LL + emu.drift_ppb);
+  /* round up so that local_time(global_time(x)) >= x */
+  __int128 q = num / den;
+  if(q * den < num) {
+    q++;
+  }
+  return emu.anchor_t + (int64_t)q;
+}
+/*---------------------------------------------------------------------------*/
+/* Unwrap a 40-bit counter value to the unbounded local time closest to now,
+ * looking forward up to half a period. */
+static uint64_t
+unwrap_future(uint64_t v40, bool *late)
+{
+  uint64_t now_local = dw1000_emu_local_time(emu.now);
+  uint64_t delta = (v40 - now_local) & DTU_MASK;
+  if(late != NULL) {
+    *late = delta >= DTU_HALF_PERIOD;
+  }
+  return now_local + delta;
+}
+/*---------------------------------------------------------------------------*/
+static void
+update_drift(void)
+{
+  /* ~1.45 ppm per XTAL trim step, higher code -> lower frequency */
+  int trim = emu.regs[FS_CTRL_ID][FS_XTALT_OFFSET] & FS_XTALT_MASK;
+  int32_t drift = emu.params.drift_ppb - (trim - 0x10) * 1450;
+
+  if(drift != emu.drift_ppb) {
+    emu.anchor_local = dw1000_emu_local_time(emu.now);
+    emu.anchor_t = emu.now;
+    emu.drift_ppb = drift;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* PHY timing                                                                */
+/*---------------------------------------------------------------------------*/
+static uint16_t
+plen_symbols(uint8_t pe_psr)
+{
+  switch(pe_psr & 0xF) {
+  case 0x1: return 64;
+  case 0x5: return 128;
+  case 0x9: return 256;
+  case 0xD: return 512;
+  case 0x2: return 1024;
+  case 0x6: return 1536;
+  case 0xA: return 2048;
+  case 0x3: return 4096;
+  default:  return 16;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+plen_code(uint16_t plen)
+{
+  switch(plen) {
+  case 64:   return 0x1;
+  case 128:  return 0x5;
+  case 256:  return 0x9;
+  case 512:  return 0xD;
+  case 1024: return 0x2;
+  case 1536: return 0x6;
+  case 2048: return 0xA;
+  case 4096: return 0x3;
+  default:   return 0x0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t
+preamble_symbol_ps(uint8_t prf)
+{
+  return prf == DWT_PRF_16M ? 993590 : 1017630;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+sfd_symbols(uint8_t rate)
+{
+  bool dwsfd = (get_u32(emu.regs[CHAN_CTRL_ID]) & CHAN_CTRL_DWSFD) != 0;
+  if(rate == DWT_BR_110K) {
+    return 64;
+  }
+  if(rate == DWT_BR_850K && dwsfd) {
+    return 16;
+  }
+  return 8;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+shr_ps(const dw1000_emu_frame_t *f)
+{
+  return (uint64_t)(f->plen + sfd_symbols(f->data_rate)) * preamble_symbol_ps(f->prf);
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+phr_data_ps(const dw1000_emu_frame_t *f)
+{
+  uint64_t phr_bit = f->data_rate == DWT_BR_110K ? 8205130 : 1025640;
+  uint64_t data_bit;
+  uint32_t bits = f->len * 8;
+
+  switch(f->data_rate) {
+  case DWT_BR_110K: data_bit = 8205130; break;
+  case DWT_BR_850K: data_bit = 1025640; break;
+  default:          data_bit = 128210; break;
+  }
+  /* Reed-Solomon parity: 48 bits every 330 data bits */
+  bits += 48 * ((bits + 329) / 330);
+  return 21 * phr_bit + bits * data_bit;
+}
+/*---------------------------------------------------------------------------*/
+/* IEEE 802.15.4 FCS (CRC-16/KERMIT) */
+static uint16_t
+crc16(const uint8_t *data, uint16_t len)
+{
+  uint16_t crc = 0;
+  uint16_t i;
+  int b;
+
+  for(i = 0; i < len; i++) {
+    crc ^= data[i];
+    for(b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+  }
+  return crc;
+}
+/*---------------------------------------------------------------------------*/
+/* Register file                                                             */
+/*---------------------------------------------------------------------------*/
+static void
+reset_registers(void)
+{
+  memset(emu.regs, 0, sizeof(emu.regs));
+  memset(emu.tx_buffer, 0, sizeof(emu.tx_buffer));
+  memset(emu.lde_if, 0, sizeof(emu.lde_if));
+  memset(emu.rx_set, 0, sizeof(emu.rx_set));
+  emu.hsrbp = emu.icrbp = 0;
+
+  put_u32(emu.regs[DEV_ID_ID], DWT_DEVICE_ID);
+  memset(emu.regs[EUI_64_ID], 0xFF, EUI_64_LEN);
+  put_u32(emu.regs[PANADR_ID], 0xFFFFFFFF);
+  put_u32(emu.regs[SYS_CFG_ID], SYS_CFG_HIRQ_POL | SYS_CFG_DIS_DRXB);
+  put_u32(emu.regs[TX_FCTRL_ID], 0x0015400C);
+  emu.regs[TX_FCTRL_ID][4] = 0;
+  put_u32(emu.regs[CHAN_CTRL_ID], 0x00000055);
+  put_u32(emu.regs[RF_CONF_ID] + LDOTUNE, LDOTUNE_DEFAULT);
+  emu.regs[FS_CTRL_ID][FS_XTALT_OFFSET] = 0x60 | 0x10;
+  put_u32(emu.regs[PMSC_ID], 0xF0300200);
+  put_u32(emu.regs[DRX_CONF_ID] + DRX_TUNE2_OFFSET, DRX_TUNE2_PRF16_PAC8);
+
+  emu.sys_status = SYS_STATUS_CPLOCK;
+  emu.sfcst = false;
+  update_drift();
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the storage backing [off, off+len) of a register, NULL if the
+ * register is not emulated. *size is set to the accessible length. */
+static uint8_t *
+reg_ptr(uint8_t id, uint16_t off, uint32_t *size, bool host)
+{
+  rx_set_t *set = &emu.rx_set[host ? emu.hsrbp : emu.icrbp];
+  uint8_t *base;
+  uint32_t cap;
+
+  switch(id) {
+  case TX_BUFFER_ID: base = emu.tx_buffer; cap = sizeof(emu.tx_buffer); break;
+  case RX_FINFO_ID:  base = set->finfo;  cap = sizeof(set->finfo); break;
+  case RX_BUFFER_ID: base = set->buffer; cap = sizeof(set->buffer); break;
+  case RX_FQUAL_ID:  base = set->fqual;  cap = sizeof(set->fqual); break;
+  case RX_TTCKI_ID:  base = set->ttcki;  cap = sizeof(set->ttcki); break;
+  case RX_TTCKO_ID:  base = set->ttcko;  cap = sizeof(set->ttcko); break;
+  case RX_TIME_ID:   base = set->time;   cap = sizeof(set->time); break;
+  case LDE_IF_ID:    base = emu.lde_if;  cap = sizeof(emu.lde_if); break;
+  default:
+    if(id >= N_REGS) {
+      return NULL;
+    }
+    base = emu.regs[id];
+    cap = REG_SIZE;
+  }
+  if(off >= cap) {
+    *size = 0;
+    return NULL;
+  }
+  *size = cap - off;
+  return base + off;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint32_t
+sys_mask(void)
+{
+  return get_u32(emu.regs[SYS_MASK_ID]);
+}
+/*---------------------------------------------------------------------------*/
+bool
+dw1000_emu_irq(void)
+{
+  if(emu.state == S_SLEEP || emu.state == S_WAKING) {
+    return false;
+  }
+  return ((uint32_t)emu.sys_status & sys_mask() & ~SYS_STATUS_IRQS) != 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Radio state transitions                                                   */
+/*---------------------------------------------------------------------------*/
+static void
+rx_stop(void)
+{
+  if(emu.state == S_RX) {
+    emu.stats.rx_time += emu.now - emu.rx_since;
+  }
+  emu.rx_to_at = DW1000_EMU_TIME_NEVER;
+  emu.pto_at = DW1000_EMU_TIME_NEVER;
+  emu.rx_on_at = DW1000_EMU_TIME_NEVER;
+  emu.lock = -1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+trx_off(void)
+{
+  rx_stop();
+  if(emu.state == S_TX) {
+    /* the frame is cut, the medium keeps its view of the transmission */
+    emu.stats.tx_time += emu.now - emu.tx_frame.start;
+  }
+  emu.tx_start_at = DW1000_EMU_TIME_NEVER;
+  emu.tx_end_at = DW1000_EMU_TIME_NEVER;
+  emu.w4r = false;
+  if(emu.state != S_SLEEP && emu.state != S_WAKING) {
+    emu.state = S_IDLE;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static bool
+frame_matches_rx(const dw1000_emu_frame_t *f)
+{
+  uint32_t chan_ctrl = get_u32(emu.regs[CHAN_CTRL_ID]);
+  uint8_t rx_chan = (chan_ctrl & CHAN_CTRL_RX_CHAN_MASK) >> CHAN_CTRL_RX_CHAN_SHIFT;
+  uint8_t rx_prf = (chan_ctrl & CHAN_CTRL_RXFPRF_MASK) >> CHAN_CTRL_RXFPRF_SHIFT;
+  uint8_t rx_code = (chan_ctrl & CHAN_CTRL_RX_PCOD_MASK) >> CHAN_CTRL_RX_PCOD_SHIFT;
+
+  return f->channel == rx_chan && f->prf == rx_prf && f->preamble_code == rx_code;
+}
+/*---------------------------------------------------------------------------*/
+/* Try to acquire a frame already on the air (receiver just turned on) */
+static void
+rx_try_acquire(void)
+{
+  int i, best = -1;
+
+  if(emu.state != S_RX || emu.lock >= 0) {
+    return;
+  }
+  for(i = 0; i < DW1000_EMU_RX_QUEUE_LEN; i++) {
+    rx_slot_t *s = &emu.rx[i];
+    if(s->used && s->arrived && emu.now <= s->acq_deadline &&
+       s->outcome != DW1000_EMU_RX_LOST && frame_matches_rx(&s->frame)) {
+      if(best < 0 || s->arrival < emu.rx[best].arrival) {
+        best = i;
+      }
+    }
+  }
+  if(best >= 0) {
+    emu.lock = best;
+    emu.sys_status |= SYS_STATUS_RXPRD;
+    emu.pto_at = DW1000_EMU_TIME_NEVER;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_on(void)
+{
+  uint32_t sys_cfg = get_u32(emu.regs[SYS_CFG_ID]);
+  uint16_t fwto = get_u16(emu.regs[RX_FWTO_ID]);
+  uint16_t pretoc = get_u16(emu.regs[DRX_CONF_ID] + DRX_PRETOC_OFFSET);
+
+  emu.state = S_RX;
+  emu.rx_since = emu.now;
+  emu.rx_on_at = DW1000_EMU_TIME_NEVER;
+  emu.lock = -1;
+  emu.rx_to_at = DW1000_EMU_TIME_NEVER;
+  emu.pto_at = DW1000_EMU_TIME_NEVER;
+
+  if((sys_cfg & SYS_CFG_RXWTOE) && fwto != 0) {
+    emu.rx_to_at = emu.now + fwto * UUS_PS;
+  }
+  if(pretoc != 0) {
+    /* the PAC size is encoded in DRX_TUNE2 */
+    uint32_t tune2 = get_u32(emu.regs[DRX_CONF_ID] + DRX_TUNE2_OFFSET);
+    uint8_t pac = 8 << ((tune2 >> 25) & 0x3);
+    uint8_t prf = (get_u32(emu.regs[CHAN_CTRL_ID]) & CHAN_CTRL_RXFPRF_MASK) >> CHAN_CTRL_RXFPRF_SHIFT;
+    emu.pto_at = emu.now + (uint64_t)pretoc * pac * preamble_symbol_ps(prf);
+  }
+  rx_try_acquire();
+}
+/*---------------------------------------------------------------------------*/
+/* Fill tx_frame from the TX registers and schedule its start */
+static void
+tx_prepare(bool delayed)
+{
+  dw1000_emu_frame_t *f = &emu.tx_frame;
+  uint64_t fctrl = get_u40(emu.regs[TX_FCTRL_ID]);
+  uint32_t chan_ctrl = get_u32(emu.regs[CHAN_CTRL_ID]);
+  uint16_t tx_ant_dly = get_u16(emu.regs[TX_ANTD_ID]);
+  uint64_t shr;
+  uint64_t now_local = dw1000_emu_local_time(emu.now);
+  bool late = false;
+
+  f->src = emu.params.part_id;
+  f->id = ++emu.tx_count;
+  f->channel = (chan_ctrl & CHAN_CTRL_TX_CHAN_MASK) >> CHAN_CTRL_TX_CHAN_SHIFT;
+  f->preamble_code = (chan_ctrl & CHAN_CTRL_TX_PCOD_MASK) >> CHAN_CTRL_TX_PCOD_SHIFT;
+  f->prf = (fctrl & TX_FCTRL_TXPRF_MASK) >> TX_FCTRL_TXPRF_SHFT;
+  f->data_rate = (fctrl & TX_FCTRL_TXBR_MASK) >> TX_FCTRL_TXBR_SHFT;
+  f->plen = plen_symbols((fctrl & TX_FCTRL_TXPSR_PE_MASK) >> TX_FCTRL_TXPSR_SHFT);
+  f->ranging = (fctrl & TX_FCTRL_TR) ? 1 : 0;
+  f->len = fctrl & TX_FCTRL_FLE_MASK;
+  f->drift_ppb = emu.drift_ppb;
+  shr = shr_ps(f);
+
+  if(delayed) {
+    uint64_t dx = get_u40(emu.regs[DX_TIME_ID]) & SYS_TIME_RES_MASK;
+    emu.tx_rmarker_dtu = unwrap_future(dx, &late);
+    if(late) {
+      emu.sys_status |= SYS_STATUS_HPDWARN;
+      emu.stats.n_late++;
+    } else if(dw1000_emu_global_time(emu.tx_rmarker_dtu) < emu.now + shr) {
+      /* not enough time to send the preamble */
+      emu.sys_status |= SYS_STATUS_TXPUTE;
+      emu.stats.n_late++;
+    }
+  } else {
+    /* start on the next system clock edge */
+    uint64_t start = (now_local + 0x1FF) & SYS_TIME_RES_MASK;
+    emu.tx_rmarker_dtu = dw1000_emu_local_time(dw1000_emu_global_time(start) + shr);
+  }
+
+  f->rmarker = dw1000_emu_global_time(emu.tx_rmarker_dtu + emu.params.tx_ant_dly);
+  f->start = f->rmarker - shr;
+  f->end = f->rmarker + phr_data_ps(f);
+  if(f->start < emu.now) {
+    f->start = emu.now;
+  }
+
+  /* TX_TIME: adjusted stamp (offset 0) and raw stamp (offset 5) */
+  put_u40(emu.regs[TX_TIME_ID], (emu.tx_rmarker_dtu + tx_ant_dly) & DTU_MASK);
+  put_u40(emu.regs[TX_TIME_ID] + 5, emu.tx_rmarker_dtu & DTU_MASK & SYS_TIME_RES_MASK);
+
+  emu.tx_start_at = f->start;
+  emu.state = S_TX_WAIT;
+}
+/*---------------------------------------------------------------------------*/
+static void
+tx_start(void)
+{
+  dw1000_emu_frame_t *f = &emu.tx_frame;
+  uint16_t offs = (get_u32(emu.regs[TX_FCTRL_ID]) & TX_FCTRL_TXBOFFS_MASK) >> TX_FCTRL_TXBOFFS_SHFT;
+  uint16_t len = f->len;
+
+  /* frame data and FCS suppression are latched when the frame starts */
+  if(len > DW1000_EMU_MAX_PSDU) {
+    len = DW1000_EMU_MAX_PSDU;
+  }
+  if(offs + len > TX_BUFFER_LEN) {
+    len = TX_BUFFER_LEN - offs;
+  }
+  f->len = len;
+  memcpy(f->psdu, emu.tx_buffer + offs, len);
+  f->fcs_ok = !emu.sfcst;
+  if(len >= 2) {
+    uint16_t fcs = crc16(f->psdu, len - 2);
+    if(!f->fcs_ok) {
+      fcs = ~fcs;
+    }
+    put_u16(f->psdu + len - 2, fcs);
+  }
+
+  emu.state = S_TX;
+  emu.tx_start_at = DW1000_EMU_TIME_NEVER;
+  emu.tx_end_at = f->end;
+  emu.sys_status |= SYS_STATUS_TXFRB;
+  emu.stats.n_tx++;
+
+  if(emu.medium != NULL && emu.medium->tx != NULL) {
+    emu.medium->tx(f);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+tx_end(void)
+{
+  emu.stats.tx_time += emu.tx_frame.end - emu.tx_frame.start;
+  emu.tx_end_at = DW1000_EMU_TIME_NEVER;
+  emu.sys_status |= SYS_STATUS_TXPRS | SYS_STATUS_TXPHS | SYS_STATUS_TXFRS;
+  emu.state = S_IDLE;
+
+  if(emu.w4r) {
+    uint32_t w4r = get_u32(emu.regs[ACK_RESP_T_ID]) & ACK_RESP_T_W4R_TIM_MASK;
+    emu.w4r = false;
+    emu.state = S_RX_WAIT;
+    emu.rx_on_at = emu.now + w4r * UUS_PS;
+    if(w4r == 0) {
+      rx_on();
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_enable(bool delayed)
+{
+  if(delayed) {
+    bool late;
+    uint64_t dx = get_u40(emu.regs[DX_TIME_ID]) & SYS_TIME_RES_MASK;
+    uint64_t t = unwrap_future(dx, &late);
+    if(late) {
+      emu.sys_status |= SYS_STATUS_HPDWARN;
+      emu.stats.n_late++;
+    }
+    emu.state = S_RX_WAIT;
+    emu.rx_on_at = dw1000_emu_global_time(t);
+  } else {
+    rx_on();
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Reception                                                                 */
+/*---------------------------------------------------------------------------*/
+/* IEEE 802.15.4 frame filtering, as configured in SYS_CFG */
+static bool
+frame_accepted(const uint8_t *psdu, uint16_t len)
+{
+  uint32_t sys_cfg = get_u32(emu.regs[SYS_CFG_ID]);
+  uint8_t type, dst_mode;
+  uint16_t pan, my_pan, my_short;
+  const uint8_t *p;
+
+  if(!(sys_cfg & SYS_CFG_FFE)) {
+    return true;
+  }
+  if(len < 3) {
+    return false;
+  }
+  type = psdu[0] & 0x07;
+  switch(type) {
+  case 0: if(!(sys_cfg & SYS_CFG_FFAB)) return false; break;
+  case 1: if(!(sys_cfg & SYS_CFG_FFAD)) return false; break;
+  case 2: return (sys_cfg & SYS_CFG_FFAA) != 0;
+  case 3: if(!(sys_cfg & SYS_CFG_FFAM)) return false; break;
+  default: return (sys_cfg & SYS_CFG_FFAR) != 0;
+  }
+
+  dst_mode = (psdu[1] >> 2) & 0x3;
+  if(dst_mode == 0) {
+    /* no destination: beacons, or frames to the coordinator */
+    return type == 0 || (sys_cfg & SYS_CFG_FFBC);
+  }
+  if(len < 5 + (dst_mode == 3 ? 8 : 2)) {
+    return false;
+  }
+  my_short = get_u16(emu.regs[PANADR_ID] + PANADR_SHORT_ADDR_OFFSET);
+  my_pan = get_u16(emu.regs[PANADR_ID] + PANADR_PAN_ID_OFFSET);
+  pan = get_u16(psdu + 3);
+  if(pan != 0xFFFF && pan != my_pan) {
+    return false;
+  }
+  p = psdu + 5;
+  if(dst_mode == 2) {
+    uint16_t dst = get_u16(p);
+    return dst == 0xFFFF || dst == my_short;
+  }
+  return memcmp(p, emu.regs[EUI_64_ID], 8) == 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Deterministic pseudo-random numbers for the CIR/diagnostics */
+static uint32_t
+hash32(uint32_t x)
+{
+  x ^= x >> 16; x *= 0x7feb352d;
+  x ^= x >> 15; x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+/*---------------------------------------------------------------------------*/
+static double
+gauss(uint32_t seed)
+{
+  /* sum of uniforms, good enough for noise */
+  double s = 0;
+  int i;
+  for(i = 0; i < 4; i++) {
+    s += (hash32(seed * 4 + i) & 0xFFFF) / 65536.0;
+  }
+  return (s - 2.0) * 1.732;
+}
+/*---------------------------------------------------------------------------*/
+/* Write the RX diagnostics registers of the given set. The amplitudes are
+ * derived from the received power following the DW1000 User Manual 4.7. */
+static void
+fill_diagnostics(rx_set_t *set, const rx_slot_t *s, uint64_t raw_dtu)
+{
+  const dw1000_emu_frame_t *f = &s->frame;
+  double a = f->prf == DWT_PRF_16M ? 113.77 : 121.74;
+  uint16_t n = f->plen > 16 ? f->plen - 8 : f->plen;
+  double cir_pwr = pow(10, (s->power_dbm + a) / 10) * n * n / 131072.0;
+  double fp_pwr = pow(10, (s->power_dbm - 1.5 + a) / 10) * n * n;
+  /* F1:F2:F3 = 0.6:1.0:0.8 */
+  double f2 = sqrt(fp_pwr / (0.36 + 1.0 + 0.64));
+  uint32_t seed = hash32(emu.params.seed ^ (f->src * 2654435761u) ^ f->id);
+  double noise = 30 + (hash32(seed) & 0xF);
+  uint16_t fp_index = 745 * 64 + (raw_dtu & 0x3F);
+
+  if(cir_pwr > 65535) {
+    cir_pwr = 65535;
+  }
+  if(f2 > 65535) {
+    f2 = 65535;
+  }
+
+  put_u16(set->time + RX_TIME_FP_INDEX_OFFSET, fp_index);
+  put_u16(set->time + RX_TIME_FP_AMPL1_OFFSET, (uint16_t)(0.6 * f2));
+  put_u16(set->fqual + 0, (uint16_t)noise);               /* STD_NOISE */
+  put_u16(set->fqual + 2, (uint16_t)f2);                  /* FP_AMPL2 */
+  put_u16(set->fqual + 4, (uint16_t)(0.8 * f2));          /* FP_AMPL3 */
+  put_u16(set->fqual + 6, (uint16_t)cir_pwr);             /* CIR_PWR */
+
+  put_u16(emu.lde_if + LDE_THRESH_OFFSET, (uint16_t)(noise * 11));
+  put_u16(emu.lde_if + LDE_PPINDX_OFFSET, fp_index / 64 + 1);
+  put_u16(emu.lde_if + LDE_PPAMPL_OFFSET, (uint16_t)f2);
+  put_u16(emu.regs[DRX_CONF_ID] + 0x2C, n);               /* RXPACC_NOSAT */
+
+  set->cir_seed = seed;
+  set->cir_fp = fp_index / 64.0;
+  set->cir_amp = f2;
+  set->cir_noise = noise;
+}
+/*---------------------------------------------------------------------------*/
+/* Carrier integrator and time tracking w.r.t. the transmitter */
+static void
+fill_clock_offset(rx_set_t *set, const dw1000_emu_frame_t *f)
+{
+  static const double fc_mhz[] = { 0, 3494.4, 3993.6, 4492.8, 3993.6, 6489.6, 0, 6489.6 };
+  double freq_offs = f->data_rate == DWT_BR_110K ?
+    FREQ_OFFSET_MULTIPLIER_110KB : FREQ_OFFSET_MULTIPLIER;
+  double ppm = (f->drift_ppb - emu.drift_ppb) / 1000.0;
+  double fc = fc_mhz[f->channel & 0x7];
+  int32_t ci = (int32_t)lround(-ppm * fc / freq_offs);
+  uint32_t ttcki = f->prf == DWT_PRF_16M ? 0x01F00000 : 0x01FC0000;
+  int32_t ttcko = (int32_t)lround(ppm * ttcki / 1e6);
+
+  emu.regs[DRX_CONF_ID][DRX_CARRIER_INT_OFFSET] = ci;
+  emu.regs[DRX_CONF_ID][DRX_CARRIER_INT_OFFSET + 1] = ci >> 8;
+  emu.regs[DRX_CONF_ID][DRX_CARRIER_INT_OFFSET + 2] = (ci >> 16) & 0x1F;
+  put_u32(set->ttcki, ttcki);
+  put_u40(set->ttcko, (uint64_t)ttcko & 0x7FFFF);
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_finish(rx_slot_t *s)
+{
+  uint32_t sys_cfg = get_u32(emu.regs[SYS_CFG_ID]);
+  const dw1000_emu_frame_t *f = &s->frame;
+  dw1000_emu_rx_outcome_t outcome = s->outcome;
+  bool dblbuff = !(sys_cfg & SYS_CFG_DIS_DRXB);
+  bool keep_listening = (sys_cfg & SYS_CFG_RXAUTR) != 0;
+  rx_set_t *set;
+
+  emu.lock = -1;
+
+  if(outcome == DW1000_EMU_RX_OK && !f->fcs_ok) {
+    outcome = DW1000_EMU_RX_FCS_ERROR;
+  }
+
+  switch(outcome) {
+  case DW1000_EMU_RX_LOST:
+    emu.sys_status &= ~SYS_STATUS_RXPRD;
+    return;
+  case DW1000_EMU_RX_SFD_TIMEOUT:
+    emu.sys_status |= SYS_STATUS_RXSFDTO;
+    break;
+  case DW1000_EMU_RX_PHR_ERROR:
+    emu.sys_status |= SYS_STATUS_RXSFDD | SYS_STATUS_RXPHE;
+    break;
+  default:
+    set = &emu.rx_set[emu.icrbp];
+    if(set->full) {
+      emu.sys_status |= SYS_STATUS_RXOVRR;
+      emu.stats.n_rx_err++;
+      rx_stop();
+      emu.state = S_IDLE;
+      return;
+    }
+    if(outcome == DW1000_EMU_RX_OK && !frame_accepted(f->psdu, f->len)) {
+      /* the receiver is re-enabled after a rejection */
+      emu.sys_status |= SYS_STATUS_AFFREJ;
+      emu.sys_status &= ~SYS_STATUS_RXPRD;
+      return;
+    }
+    {
+      uint64_t raw = dw1000_emu_local_time(s->rmarker) + emu.params.rx_ant_dly;
+      uint16_t rx_ant_dly = get_u16(emu.lde_if + LDE_RXANTD_OFFSET);
+      uint32_t finfo;
+      uint8_t code = plen_code(f->plen);
+
+      memcpy(set->buffer, f->psdu, f->len);
+      finfo = (f->len & RX_FINFO_RXFL_MASK_1023)
+        | ((uint32_t)(code >> 2) << 11)
+        | ((uint32_t)f->data_rate << RX_FINFO_RXBR_SHIFT)
+        | ((uint32_t)f->ranging << RX_FINFO_RNG_SHIFT)
+        | ((uint32_t)f->prf << RX_FINFO_RXPRF_SHIFT)
+        | ((uint32_t)(code & 0x3) << 18);
+      fill_diagnostics(set, s, raw);
+      finfo |= (uint32_t)get_u16(emu.regs[DRX_CONF_ID] + 0x2C) << RX_FINFO_RXPACC_SHIFT;
+      put_u32(set->finfo, finfo);
+      put_u40(set->time + RX_TIME_RX_STAMP_OFFSET, (raw - rx_ant_dly) & DTU_MASK);
+      put_u40(set->time + RX_TIME_FP_RAWST_OFFSET, raw & DTU_MASK);
+      fill_clock_offset(set, f);
+    }
+    emu.sys_status |= SYS_STATUS_RXSFDD | SYS_STATUS_RXPHD | SYS_STATUS_LDEDONE | SYS_STATUS_RXDFR;
+    if(outcome == DW1000_EMU_RX_OK) {
+      emu.sys_status |= SYS_STATUS_RXFCG;
+      emu.stats.n_rx_ok++;
+      if(dblbuff) {
+        /* the receiver stops like in single buffer mode (without
+         * RXAUTR), the host re-enables it in the other buffer */
+        set->full = true;
+        emu.icrbp ^= 1;
+      }
+      if(!keep_listening) {
+        rx_stop();
+        emu.state = S_IDLE;
+      }
+      return;
+    }
+    emu.sys_status |= SYS_STATUS_RXFCE;
+    break;
+  }
+
+  emu.stats.n_rx_err++;
+  if(!keep_listening) {
+    rx_stop();
+    emu.state = S_IDLE;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Events                                                                    */
+/*---------------------------------------------------------------------------*/
+enum {
+  EV_NONE, EV_WAKE, EV_TX_START, EV_TX_END, EV_RX_ON, EV_RX_TO, EV_PTO,
+  EV_ARRIVAL, EV_FRAME_END,
+};
+/*---------------------------------------------------------------------------*/
+static dw1000_emu_time_t
+next_event(int *kind, int *slot)
+{
+  dw1000_emu_time_t t = DW1000_EMU_TIME_NEVER;
+  int i;
+
+#define CONSIDER(time, k) if((time) < t) { t = (time); *kind = (k); }
+  *kind = EV_NONE;
+  *slot = -1;
+  CONSIDER(emu.wake_at, EV_WAKE);
+  CONSIDER(emu.tx_start_at, EV_TX_START);
+  CONSIDER(emu.tx_end_at, EV_TX_END);
+  CONSIDER(emu.rx_on_at, EV_RX_ON);
+  for(i = 0; i < DW1000_EMU_RX_QUEUE_LEN; i++) {
+    if(emu.rx[i].used) {
+      dw1000_emu_time_t te = emu.rx[i].arrived ? emu.rx[i].end : emu.rx[i].arrival;
+      if(te < t) {
+        t = te;
+        *kind = emu.rx[i].arrived ? EV_FRAME_END : EV_ARRIVAL;
+        *slot = i;
+      }
+    }
+  }
+  /* timeouts lose ties with frame events */
+  CONSIDER(emu.rx_to_at, EV_RX_TO);
+  CONSIDER(emu.pto_at, EV_PTO);
+#undef CONSIDER
+  return t;
+}
+/*---------------------------------------------------------------------------*/
+dw1000_emu_time_t
+dw1000_emu_next_event(void)
+{
+  int kind, slot;
+  return next_event(&kind, &slot);
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_run(dw1000_emu_time_t now)
+{
+  int kind, slot;
+  dw1000_emu_time_t t;
+
+  while((t = next_event(&kind, &slot)) <= now) {
+    if(t > emu.now) {
+      emu.now = t;
+    }
+    switch(kind) {
+    case EV_WAKE:
+      emu.wake_at = DW1000_EMU_TIME_NEVER;
+      emu.state = S_IDLE;
+      emu.sys_status |= SYS_STATUS_SLP2INIT | SYS_STATUS_CPLOCK;
+      break;
+    case EV_TX_START:
+      tx_start();
+      break;
+    case EV_TX_END:
+      tx_end();
+      break;
+    case EV_RX_ON:
+      rx_on();
+      break;
+    case EV_RX_TO:
+      rx_stop();
+      emu.state = S_IDLE;
+      emu.sys_status |= SYS_STATUS_RXRFTO;
+      emu.stats.n_rx_to++;
+      break;
+    case EV_PTO:
+      rx_stop();
+      emu.state = S_IDLE;
+      emu.sys_status |= SYS_STATUS_RXPTO;
+      emu.stats.n_rx_to++;
+      break;
+    case EV_ARRIVAL:
+      emu.rx[slot].arrived = true;
+      rx_try_acquire();
+      break;
+    case EV_FRAME_END:
+      if(emu.lock == slot && emu.state == S_RX) {
+        rx_finish(&emu.rx[slot]);
+      }
+      emu.rx[slot].used = false;
+      if(emu.lock == slot) {
+        emu.lock = -1;
+      }
+      /* another frame may still be acquirable */
+      rx_try_acquire();
+      break;
+    }
+  }
+  if(now > emu.now) {
+    emu.now = now;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Medium interface                                                          */
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_rx_begin(const dw1000_emu_frame_t *frame,
+                    dw1000_emu_time_t arrival, double rx_power_dbm)
+{
+  int i;
+  for(i = 0; i < DW1000_EMU_RX_QUEUE_LEN; i++) {
+    rx_slot_t *s = &emu.rx[i];
+    if(!s->used) {
+      s->used = true;
+      s->arrived = false;
+      s->frame = *frame;
+      s->arrival = arrival;
+      s->rmarker = arrival + (frame->rmarker - frame->start);
+      s->end = arrival + (frame->end - frame->start);
+      s->acq_deadline = s->rmarker -
+        (uint64_t)(sfd_symbols(frame->data_rate) + ACQ_MIN_SYMBOLS) * preamble_symbol_ps(frame->prf);
+      s->power_dbm = rx_power_dbm;
+      s->outcome = DW1000_EMU_RX_OK;
+      return;
+    }
+  }
+  /* too many overlapping frames: the newest one is not seen */
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_rx_end(uint32_t src, uint32_t frame_id, dw1000_emu_rx_outcome_t outcome)
+{
+  int i;
+  for(i = 0; i < DW1000_EMU_RX_QUEUE_LEN; i++) {
+    rx_slot_t *s = &emu.rx[i];
+    if(s->used && s->frame.src == src && s->frame.id == frame_id) {
+      s->outcome = outcome;
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* SPI                                                                       */
+/*---------------------------------------------------------------------------*/
+static void
+decode_header(uint16_t hdrlen, const uint8_t *hdr, uint8_t *id, uint16_t *off)
+{
+  *id = hdr[0] & 0x3F;
+  *off = 0;
+  if(hdrlen > 1 && (hdr[0] & 0x40)) {
+    *off = hdr[1] & 0x7F;
+    if(hdrlen > 2 && (hdr[1] & 0x80)) {
+      *off |= (uint16_t)hdr[2] << 7;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sleep_access(void)
+{
+  /* any SPI access wakes the chip up if configured to do so */
+  if(emu.state == S_SLEEP &&
+     (emu.regs[AON_ID][AON_CFG0_OFFSET] & AON_CFG0_WAKE_SPI)) {
+    emu.state = S_WAKING;
+    emu.wake_at = emu.now + WAKEUP_TIME_PS;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Synthesise the accumulator: a first path at cir_fp followed by a few
+ * decaying reflections, plus Gaussian noise. */
+static void
+read_acc(uint16_t off, uint32_t len, uint8_t *buf)
+{
+  const rx_set_t *set = &emu.rx_set[emu.hsrbp];
+  static const double taps[][2] = { { 0, 1.0 }, { 3.1, 0.5 }, { 7.4, 0.3 }, { 15.2, 0.15 } };
+  uint32_t i;
+  uint16_t n_samples = ACC_SAMPLES_PRF64;
+
+  if(((get_u32(emu.regs[CHAN_CTRL_ID]) & CHAN_CTRL_RXFPRF_MASK) >> CHAN_CTRL_RXFPRF_SHIFT) == DWT_PRF_16M) {
+    n_samples = ACC_SAMPLES_PRF16;
+  }
+
+  /* the first octet of an accumulator read is a dummy one */
+  if(len > 0) {
+    buf[0] = 0;
+  }
+  for(i = 1; i < len; i++) {
+    uint32_t byte = off + i - 1;
+    uint32_t idx = byte / 4;
+    double re = 0, im = 0;
+    int16_t v;
+    unsigned k;
+
+    if(idx < n_samples && set->cir_amp > 0) {
+      re = set->cir_noise * gauss(set->cir_seed + idx * 2);
+      im = set->cir_noise * gauss(set->cir_seed + idx * 2 + 1);
+      for(k = 0; k < sizeof(taps) / sizeof(taps[0]); k++) {
+        double x = idx - (set->cir_fp + taps[k][0]);
+        if(x > -2 && x < 2) {
+          double ph = (hash32(set->cir_seed + k) & 0xFFFF) / 65536.0 * 2 * M_PI;
+          double a = set->cir_amp * taps[k][1] * 0.5 * (1 + cos(M_PI * x / 2));
+          re += a * cos(ph);
+          im += a * sin(ph);
+        }
+      }
+    }
+    v = (byte & 2) ? (int16_t)lround(im) : (int16_t)lround(re);
+    buf[i] = (byte & 1) ? (uint8_t)((uint16_t)v >> 8) : (uint8_t)v;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_read(uint16_t hdrlen, const uint8_t *hdr, uint32_t len, uint8_t *buf)
+{
+  uint8_t id;
+  uint16_t off;
+  uint8_t *p;
+  uint32_t size;
+
+  if(emu.state == S_SLEEP || emu.state == S_WAKING) {
+    sleep_access();
+    memset(buf, 0, len);
+    return;
+  }
+
+  decode_header(hdrlen, hdr, &id, &off);
+
+  /* registers computed on read */
+  switch(id) {
+  case SYS_TIME_ID:
+    put_u40(emu.regs[SYS_TIME_ID],
+            dw1000_emu_local_time(emu.now) & DTU_MASK & SYS_TIME_RES_MASK);
+    break;
+  case SYS_STATUS_ID: {
+    uint64_t st = emu.sys_status & ~(uint64_t)(SYS_STATUS_IRQS | SYS_STATUS_HSRBP | SYS_STATUS_ICRBP);
+    if(dw1000_emu_irq()) {
+      st |= SYS_STATUS_IRQS;
+    }
+    if(emu.hsrbp) {
+      st |= SYS_STATUS_HSRBP;
+    }
+    if(emu.icrbp) {
+      st |= SYS_STATUS_ICRBP;
+    }
+    put_u40(emu.regs[SYS_STATUS_ID], st);
+    break;
+  }
+  case SYS_STATE_ID: {
+    static const uint8_t pmsc_state[] = {
+      [S_IDLE] = 0x01, [S_TX_WAIT] = 0x02, [S_TX] = 0x02,
+      [S_RX_WAIT] = 0x03, [S_RX] = 0x03, [S_SLEEP] = 0x00, [S_WAKING] = 0x00 };
+    put_u32(emu.regs[SYS_STATE_ID], (uint32_t)pmsc_state[emu.state] << 16);
+    break;
+  }
+  case OTP_IF_ID:
+    emu.regs[OTP_IF_ID][OTP_STAT] |= 0x01; /* programming done */
+    break;
+  case ACC_MEM_ID:
+    read_acc(off, len, buf);
+    return;
+  default:
+    break;
+  }
+
+  p = reg_ptr(id, off, &size, true);
+  if(p == NULL) {
+    memset(buf, 0, len);
+    return;
+  }
+  if(len <= size) {
+    memcpy(buf, p, len);
+  } else {
+    memcpy(buf, p, size);
+    memset(buf + size, 0, len - size);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+otp_read(void)
+{
+  uint16_t addr = get_u16(emu.regs[OTP_IF_ID] + OTP_ADDR) & 0x7FF;
+  uint32_t v = 0;
+
+  switch(addr) {
+  case 0x06: v = emu.params.part_id; break;
+  case 0x07: v = emu.params.lot_id; break;
+  case 0x08: v = 0x9A; break;       /* VBAT @ 3.3 V */
+  case 0x09: v = 0x7C; break;       /* VTEMP @ 23 C */
+  default: break;                   /* not programmed (LDOTUNE, XTRIM, ...) */
+  }
+  put_u32(emu.regs[OTP_IF_ID] + OTP_RDAT, v);
+}
+/*---------------------------------------------------------------------------*/
+static void
+sys_ctrl(uint32_t cmd)
+{
+  if(cmd & SYS_CTRL_SFCST) {
+    emu.sfcst = true;
+  }
+  if(cmd & SYS_CTRL_CANSFCS) {
+    emu.sfcst = false;
+  }
+  if(cmd & SYS_CTRL_HRBT) {
+    bool dblbuff = !(get_u32(emu.regs[SYS_CFG_ID]) & SYS_CFG_DIS_DRXB);
+    emu.rx_set[emu.hsrbp].full = false;
+    emu.hsrbp ^= 1;
+    if(dblbuff && emu.rx_set[emu.hsrbp].full) {
+      /* the status mirrors the frame in the new host-side buffer */
+      emu.sys_status |= SYS_STATUS_ALL_RX_GOOD;
+    }
+  }
+  if(cmd & SYS_CTRL_TRXOFF) {
+    trx_off();
+    return;
+  }
+  if(cmd & SYS_CTRL_TXSTRT) {
+    trx_off();
+    emu.w4r = (cmd & SYS_CTRL_WAIT4RESP) != 0;
+    tx_prepare((cmd & SYS_CTRL_TXDLYS) != 0);
+  } else if(cmd & SYS_CTRL_RXENAB) {
+    trx_off();
+    rx_enable((cmd & SYS_CTRL_RXDLYE) != 0);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_write(uint16_t hdrlen, const uint8_t *hdr, uint32_t len, const uint8_t *buf)
+{
+  uint8_t id;
+  uint16_t off;
+  uint8_t *p;
+  uint32_t size, i;
+
+  if(emu.state == S_SLEEP || emu.state == S_WAKING) {
+    sleep_access();
+    return;
+  }
+
+  decode_header(hdrlen, hdr, &id, &off);
+
+  switch(id) {
+  case SYS_CTRL_ID: {
+    uint32_t cmd = 0;
+    for(i = 0; i < len && off + i < SYS_CTRL_LEN; i++) {
+      cmd |= (uint32_t)buf[i] << (8 * (off + i));
+    }
+    sys_ctrl(cmd);
+    return; /* self-clearing */
+  }
+  case SYS_STATUS_ID: {
+    uint64_t clr = 0;
+    for(i = 0; i < len && off + i < SYS_STATUS_LEN; i++) {
+      clr |= (uint64_t)buf[i] << (8 * (off + i));
+    }
+    emu.sys_status &= ~clr;
+    return; /* write one to clear */
+  }
+  case SYS_TIME_ID:
+  case SYS_STATE_ID:
+  case ACC_MEM_ID:
+    return; /* read only */
+  default:
+    break;
+  }
+
+  p = reg_ptr(id, off, &size, true);
+  if(p != NULL) {
+    memcpy(p, buf, len <= size ? len : size);
+  }
+
+  switch(id) {
+  case OTP_IF_ID:
+    if(off <= OTP_CTRL && off + len > OTP_CTRL &&
+       (buf[OTP_CTRL - off] & OTP_CTRL_OTPREAD)) {
+      otp_read();
+    }
+    break;
+  case PMSC_ID:
+    if(off <= PMSC_CTRL0_SOFTRESET_OFFSET && off + len > PMSC_CTRL0_SOFTRESET_OFFSET) {
+      uint8_t rst = buf[PMSC_CTRL0_SOFTRESET_OFFSET - off] & 0xF0;
+      if(rst == PMSC_CTRL0_RESET_ALL) {
+        trx_off();
+        reset_registers();
+      } else if(rst == PMSC_CTRL0_RESET_RX) {
+        if(emu.state == S_RX || emu.state == S_RX_WAIT) {
+          trx_off();
+        }
+      }
+      emu.regs[PMSC_ID][PMSC_CTRL0_SOFTRESET_OFFSET] |= 0xF0;
+    }
+    break;
+  case AON_ID:
+    if(off <= AON_CTRL_OFFSET && off + len > AON_CTRL_OFFSET &&
+       (buf[AON_CTRL_OFFSET - off] & AON_CTRL_SAVE) &&
+       (emu.regs[AON_ID][AON_CFG0_OFFSET] & AON_CFG0_SLEEP_EN)) {
+      trx_off();
+      emu.state = S_SLEEP;
+    }
+    break;
+  case FS_CTRL_ID:
+    update_drift();
+    break;
+  default:
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_wakeup(void)
+{
+  if(emu.state == S_SLEEP) {
+    emu.state = S_WAKING;
+    emu.wake_at = emu.now + WAKEUP_TIME_PS;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_reset(void)
+{
+  trx_off();
+  emu.state = S_IDLE;
+  emu.wake_at = DW1000_EMU_TIME_NEVER;
+  reset_registers();
+}
+/*---------------------------------------------------------------------------*/
+const dw1000_emu_stats_t *
+dw1000_emu_get_stats(void)
+{
+  return &emu.stats;
+}
+/*---------------------------------------------------------------------------*/
+void
+dw1000_emu_init(const dw1000_emu_params_t *params, const dw1000_emu_medium_t *medium)
+{
+  memset(&emu, 0, sizeof(emu));
+  emu.params = *params;
+  emu.medium = medium;
+  emu.now = 0;
+  emu.anchor_t = 0;
+  emu.anchor_local = params->sys_time_init;
+  emu.drift_ppb = params->drift_ppb;
+  emu.lock = -1;
+  emu.tx_start_at = emu.tx_end_at = DW1000_EMU_TIME_NEVER;
+  emu.rx_on_at = emu.rx_to_at = emu.pto_at = DW1000_EMU_TIME_NEVER;
+  emu.wake_at = DW1000_EMU_TIME_NEVER;
+  dw1000_emu_reset();
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Register-level DW1000 emulator.
+ *
+ *      The emulator decodes the SPI transactions issued by the DecaWave
+ *      driver, keeps the register file, the TX/RX buffers (including the
+ *      double-buffered RX set) and the 40-bit system counter, and drives
+ *      the IRQ line from SYS_STATUS & SYS_MASK.
+ *
+ *      The emulator is passive: the platform advances it to the current
+ *      time with dw1000_emu_run() and asks for the next internal event
+ *      with dw1000_emu_next_event(). Frames leave the chip through the
+ *      medium hook and enter it through dw1000_emu_rx_begin() and
+ *      dw1000_emu_rx_end().
+ */
+
+#ifndef DW1000_EMU_H_
+#define DW1000_EMU_H_
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+/*---------------------------------------------------------------------------*/
+/* Emulator time, in picoseconds of the global (reference) time base */
+typedef uint64_t dw1000_emu_time_t;
+
+#define DW1000_EMU_TIME_NEVER     UINT64_MAX
+#define DW1000_EMU_PS_PER_US      1000000ULL
+/*---------------------------------------------------------------------------*/
+#ifdef DW1000_EMU_CONF_MAX_PSDU
+#define DW1000_EMU_MAX_PSDU DW1000_EMU_CONF_MAX_PSDU
+#else
+#define DW1000_EMU_MAX_PSDU 127
+#endif
+
+/* Number of frames that can be on the air at the same time at a receiver */
+#ifdef DW1000_EMU_CONF_RX_QUEUE_LEN
+#define DW1000_EMU_RX_QUEUE_LEN DW1000_EMU_CONF_RX_QUEUE_LEN
+#else
+#define DW1000_EMU_RX_QUEUE_LEN 8
+#endif
+/*---------------------------------------------------------------------------*/
+typedef struct {
+  uint32_t part_id;         /* OTP part ID (the platform derives addresses from it) */
+  uint32_t lot_id;          /* OTP lot ID */
+  int32_t drift_ppb;        /* crystal offset w.r.t. the global time base at trim 0x10 */
+  uint64_t sys_time_init;   /* value of the 40-bit system counter at time 0 (DTU) */
+  uint16_t tx_ant_dly;      /* true TX antenna delay (DTU) */
+  uint16_t rx_ant_dly;      /* true RX antenna delay (DTU) */
+  uint32_t seed;            /* seed of the CIR noise generator */
+} dw1000_emu_params_t;
+
+/* A frame on the air, as handed to the medium. The time instants refer to
+ * the transmitter antenna and to the global time base. */
+typedef struct {
+  uint32_t id;              /* unique per transmitter */
+  uint32_t src;             /* transmitter part ID */
+  dw1000_emu_time_t start;  /* first preamble symbol */
+  dw1000_emu_time_t rmarker;
+  dw1000_emu_time_t end;    /* last data bit */
+  int32_t drift_ppb;        /* transmitter crystal offset */
+  uint8_t channel;
+  uint8_t prf;              /* 1 = 16 MHz, 2 = 64 MHz (as in CHAN_CTRL) */
+  uint8_t preamble_code;
+  uint8_t data_rate;        /* 0 = 110k, 1 = 850k, 2 = 6M8 (as in TX_FCTRL) */
+  uint16_t plen;            /* preamble length in symbols */
+  uint8_t ranging;          /* ranging bit of the PHR */
+  uint8_t fcs_ok;           /* 0 if the FCS was suppressed */
+  uint16_t len;             /* PSDU length, FCS included */
+  uint8_t psdu[DW1000_EMU_MAX_PSDU];
+} dw1000_emu_frame_t;
+
+/* Reception outcome, decided by the medium */
+typedef enum {
+  DW1000_EMU_RX_OK = 0,
+  DW1000_EMU_RX_PHR_ERROR,
+  DW1000_EMU_RX_FCS_ERROR,
+  DW1000_EMU_RX_SFD_TIMEOUT,
+  DW1000_EMU_RX_LOST,       /* nothing is reported to the host */
+} dw1000_emu_rx_outcome_t;
+
+typedef struct {
+  /* A frame starts leaving the antenna */
+  void (*tx)(const dw1000_emu_frame_t *frame);
+} dw1000_emu_medium_t;
+
+typedef struct {
+  uint32_t n_tx;            /* frames transmitted */
+  uint32_t n_rx_ok;         /* good frames delivered to the host */
+  uint32_t n_rx_err;        /* PHR/FCS/SFD errors and overruns */
+  uint32_t n_rx_to;         /* frame wait and preamble timeouts */
+  uint32_t n_late;          /* delayed TX/RX commands issued too late */
+  dw1000_emu_time_t tx_time;  /* time spent transmitting */
+  dw1000_emu_time_t rx_time;  /* time spent with the receiver on */
+} dw1000_emu_stats_t;
+/*---------------------------------------------------------------------------*/
+/* Power up the emulated chip. The medium can be NULL (no other node). */
+void dw1000_emu_init(const dw1000_emu_params_t *params,
+                     const dw1000_emu_medium_t *medium);
+
+/* Hard reset (RSTn pin) */
+void dw1000_emu_reset(void);
+
+/* WAKEUP pin or a long chip-select assertion */
+void dw1000_emu_wakeup(void);
+
+/* SPI transactions; hdr is the 1 to 3 octet DW1000 transaction header */
+void dw1000_emu_read(uint16_t hdrlen, const uint8_t *hdr, uint32_t len, uint8_t *buf);
+void dw1000_emu_write(uint16_t hdrlen, const uint8_t *hdr, uint32_t len, const uint8_t *buf);
+
+/* Advance the chip to the given time, processing all the events due */
+void dw1000_emu_run(dw1000_emu_time_t now);
+
+/* Time of the next internal event, DW1000_EMU_TIME_NEVER if none */
+dw1000_emu_time_t dw1000_emu_next_event(void);
+
+/* State of the IRQ line (active high) */
+bool dw1000_emu_irq(void);
+
+/* Medium side: a frame reaches the antenna at the given time (start of the
+ * preamble). Can be called in advance; the frame is acquired only if the
+ * receiver is listening on the same channel, PRF and preamble code. */
+void dw1000_emu_rx_begin(const dw1000_emu_frame_t *frame,
+                         dw1000_emu_time_t arrival, double rx_power_dbm);
+
+/* Medium side: final outcome of a frame previously passed to
+ * dw1000_emu_rx_begin(). If it is not given before the end of the frame,
+ * the frame is considered received correctly. */
+void dw1000_emu_rx_end(uint32_t src, uint32_t frame_id,
+                       dw1000_emu_rx_outcome_t outcome);
+
+const dw1000_emu_stats_t *dw1000_emu_get_stats(void);
+
+/* Convert between the global time base and the local 40-bit counter */
+uint64_t dw1000_emu_local_time(dw1000_emu_time_t t);
+dw1000_emu_time_t dw1000_emu_global_time(uint64_t local_dtu);
+/*---------------------------------------------------------------------------*/
+#endif /* DW1000_EMU_H_ */
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Node side of the multi-node UWB simulator
+ */
+
+#define _GNU_SOURCE
+#include "contiki.h"
+#include "uwb-sim-client.h"
+#include "uwb-sim-proto.h"
+#include "native-irq.h"
+#include "dw1000-arch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+/*---------------------------------------------------------------------------*/
+static int sim_fd = -1;
+/*---------------------------------------------------------------------------*/
+static void
+sim_send(uwb_sim_msg_t *m, size_t payload)
+{
+  if(send(sim_fd, m, UWB_SIM_MSG_HDR_LEN + payload, 0) < 0) {
+    /* the simulator is gone */
+    _exit(EXIT_FAILURE);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sim_recv(uwb_sim_msg_t *m)
+{
+  if(recv(sim_fd, m, sizeof(*m), 0) <= 0) {
+    _exit(EXIT_FAILURE);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+reply_deadline(uint64_t deadline, int preemptible)
+{
+  uwb_sim_msg_t m;
+  uint64_t d = native_irq_next_deadline(preemptible);
+
+  if(d < deadline) {
+    deadline = d;
+  }
+  m.type = UWB_SIM_DEADLINE;
+  m.t = deadline;
+  sim_send(&m, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* Wait for the GO message, serving the frames handed in the meantime */
+static uint64_t
+wait_go(uint64_t deadline, int preemptible, uint64_t *horizon)
+{
+  uwb_sim_msg_t m;
+
+  for(;;) {
+    sim_recv(&m);
+    switch(m.type) {
+    case UWB_SIM_RX_BEGIN:
+      dw1000_emu_rx_begin(&m.u.frame, m.t, m.power);
+      reply_deadline(deadline, preemptible);
+      break;
+    case UWB_SIM_RX_END:
+      dw1000_emu_rx_end((uint32_t)(m.h >> 32), (uint32_t)m.h, m.arg);
+      reply_deadline(deadline, preemptible);
+      break;
+    case UWB_SIM_GO:
+      *horizon = m.h;
+      return m.t;
+    case UWB_SIM_STOP:
+      exit(EXIT_SUCCESS);
+    default:
+      break;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+sim_yield(uint64_t deadline, int preemptible, uint64_t *horizon)
+{
+  uwb_sim_msg_t m;
+  uint64_t now = native_time_peek();
+  uint64_t t;
+
+  fflush(stdout);
+  m.type = UWB_SIM_YIELD;
+  m.t = deadline;
+  sim_send(&m, 0);
+  t = wait_go(deadline, preemptible, horizon);
+  return t > now ? t : now;
+}
+/*---------------------------------------------------------------------------*/
+static const struct native_irq_scheduler sim_scheduler = { sim_yield };
+/*---------------------------------------------------------------------------*/
+static void
+sim_tx(const dw1000_emu_frame_t *frame)
+{
+  uwb_sim_msg_t m;
+
+  m.type = UWB_SIM_TX;
+  m.t = native_time_peek();
+  memcpy(&m.u.frame, frame, sizeof(*frame));
+  sim_send(&m, sizeof(m.u.frame));
+
+  /* the frame may wake other nodes up before our horizon */
+  do {
+    sim_recv(&m);
+  } while(m.type != UWB_SIM_TX_ACK);
+  native_irq_set_horizon(m.h);
+}
+/*---------------------------------------------------------------------------*/
+const dw1000_emu_medium_t uwb_sim_medium = { sim_tx };
+/*---------------------------------------------------------------------------*/
+static ssize_t
+log_write(void *cookie, const char *buf, size_t size)
+{
+  uwb_sim_msg_t m;
+  size_t done = 0;
+
+  while(done < size) {
+    size_t n = size - done;
+    if(n > UWB_SIM_LOG_MAX) {
+      n = UWB_SIM_LOG_MAX;
+    }
+    m.type = UWB_SIM_LOG;
+    m.t = native_time_peek();
+    m.arg = n;
+    memcpy(m.u.text, buf + done, n);
+    sim_send(&m, n);
+    done += n;
+  }
+  return size;
+}
+/*---------------------------------------------------------------------------*/
+static void
+at_exit(void)
+{
+  uwb_sim_msg_t m;
+  const dw1000_arch_stats_t *as = dw1000_arch_get_stats();
+
+  fflush(stdout);
+  memset(&m, 0, sizeof(m));
+  m.type = UWB_SIM_STATS;
+  m.t = native_time_peek();
+  m.u.stats.radio = *dw1000_emu_get_stats();
+  m.u.stats.spi_transactions = as->spi_transactions;
+  m.u.stats.spi_bytes = as->spi_bytes;
+  m.u.stats.isr_count = as->isr_count;
+  sim_send(&m, sizeof(m.u.stats));
+}
+/*---------------------------------------------------------------------------*/
+void
+uwb_sim_client_init(int fd)
+{
+  static const cookie_io_functions_t log_io = { NULL, log_write, NULL, NULL };
+  uwb_sim_msg_t m;
+  uint64_t now, horizon;
+  FILE *out;
+
+  sim_fd = fd;
+
+  out = fopencookie(NULL, "w", log_io);
+  if(out != NULL) {
+    setvbuf(out, NULL, _IOLBF, BUFSIZ);
+    stdout = out;
+  }
+  atexit(at_exit);
+
+  m.type = UWB_SIM_HELLO;
+  m.t = 0;
+  sim_send(&m, 0);
+  now = wait_go(NATIVE_TIME_NEVER, 0, &horizon);
+  native_irq_set_scheduler(&sim_scheduler, now, horizon);
+}
+/*---------------------------------------------------------------------------*/
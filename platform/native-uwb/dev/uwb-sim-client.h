@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Node side of the multi-node UWB simulator.
+ *
+ *      The node is attached to the simulator through an inherited socket.
+ *      It runs in virtual time (see native-irq.h), hands its transmitted
+ *      frames to the simulator and receives the frames of the other
+ *      nodes. The standard output is forwarded to the simulator, which
+ *      time-stamps and merges the logs of all the nodes.
+ */
+
+#ifndef UWB_SIM_CLIENT_H_
+#define UWB_SIM_CLIENT_H_
+/*---------------------------------------------------------------------------*/
+#include "dw1000-emu.h"
+/*---------------------------------------------------------------------------*/
+/* Medium to pass to dw1000_emu_init() */
+extern const dw1000_emu_medium_t uwb_sim_medium;
+
+/* Attach to the simulator and wait to be started. Call before any
+ * other initialisation. */
+void uwb_sim_client_init(int fd);
+/*---------------------------------------------------------------------------*/
+#endif /* UWB_SIM_CLIENT_H_ */
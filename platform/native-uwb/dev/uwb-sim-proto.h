@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Messages exchanged between a native-uwb node and the multi-node
+ *      simulator (tools/uwb-sim) over a SOCK_SEQPACKET socket.
+ *
+ *      The simulator runs one node at a time. A node runs after a GO
+ *      message and may advance its virtual time up to (excluding) the
+ *      horizon; it then sends YIELD with the time it wants to be resumed
+ *      at. While a node is blocked, the simulator can hand it frames
+ *      (RX_BEGIN, RX_END) and the node replies with its new deadline.
+ *      A transmission (TX) is acknowledged with a possibly shorter
+ *      horizon, as the frame can wake other nodes up.
+ */
+
+#ifndef UWB_SIM_PROTO_H_
+#define UWB_SIM_PROTO_H_
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "dw1000-emu.h"
+/*---------------------------------------------------------------------------*/
+#define UWB_SIM_LOG_MAX 256
+
+enum {
+  UWB_SIM_HELLO = 1,    /* node -> sim: ready, t = boot time */
+  UWB_SIM_GO,           /* sim -> node: t = now, h = horizon */
+  UWB_SIM_YIELD,        /* node -> sim: t = deadline */
+  UWB_SIM_TX,           /* node -> sim: frame */
+  UWB_SIM_TX_ACK,       /* sim -> node: h = horizon */
+  UWB_SIM_RX_BEGIN,     /* sim -> node: t = arrival, power, frame */
+  UWB_SIM_RX_END,       /* sim -> node: h = src << 32 | id, arg = outcome */
+  UWB_SIM_DEADLINE,     /* node -> sim: t = deadline */
+  UWB_SIM_LOG,          /* node -> sim: t = time, arg = length, text */
+  UWB_SIM_STOP,         /* sim -> node: exit */
+  UWB_SIM_STATS,        /* node -> sim: final statistics */
+};
+
+typedef struct {
+  dw1000_emu_stats_t radio;
+  uint32_t spi_transactions;
+  uint64_t spi_bytes;
+  uint32_t isr_count;
+} uwb_sim_stats_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t arg;
+  uint64_t t;
+  uint64_t h;
+  double power;
+  union {
+    dw1000_emu_frame_t frame;
+    uwb_sim_stats_t stats;
+    char text[UWB_SIM_LOG_MAX];
+  } u;
+} uwb_sim_msg_t;
+
+#define UWB_SIM_MSG_HDR_LEN   offsetof(uwb_sim_msg_t, u)
+/*---------------------------------------------------------------------------*/
+#endif /* UWB_SIM_PROTO_H_ */
@@ -44,7 +44,15 @@
 
 #define PRF(str, f) printf(str ": %d.%03d\n", (int)(f), (int)(((f)-(int)(f))*1000))
 
-static void print_nlos(const dw1000_nlos_t *nl) {
+/* Fixed-point results are accepted if within this much of the double ones */
+#define MAX_ERR 0.001
+
+/* Runs of each version for the timing */
+#define N_TIMING_RUNS 1000
+
+static int n_mismatches;
+
+static void print_nlos(const dw1000_nlos_double_t *nl) {
   PRF("path_diff", nl->path_diff);
   PRF("pr_nlos", nl->pr_nlos);
   PRF("low_noise", nl->low_noise);
@@ -54,12 +62,72 @@ static void print_nlos(const dw1000_nlos_t *nl) {
   PRF("cl", nl->cl);
 }
 
+static bool close_enough(const char *name, double fixed, double ref) {
+  double err = fixed - ref;
+
+  if (err < 0) err = -err;
+  if (ref < 0) ref = -ref;
+  if (err > MAX_ERR * (1 + ref)) {
+    printf("MISMATCH %s\n", name);
+    PRF("  fixed", fixed);
+    return false;
+  }
+  return true;
+}
+
+/* Run the fixed-point and the double version, print the results and check
+ * that they agree */
+static void check_nlos(const dwt_rxdiag_t *rxdiag, const dw1000_cir_sample_t *samples, uint16_t n_samples) {
+  dw1000_nlos_t out;
+  dw1000_nlos_double_t ref;
+  bool ok = true;
+
+  dw1000_nlos(&out, rxdiag, samples, n_samples);
+  dw1000_nlos_double(&ref, rxdiag, samples, n_samples);
+  print_nlos(&ref);
+
+  ok &= close_enough("path_diff", (double)out.path_diff / DW1000_NLOS_ONE, ref.path_diff);
+  ok &= close_enough("pr_nlos", (double)out.pr_nlos / DW1000_NLOS_ONE, ref.pr_nlos);
+  ok &= close_enough("low_noise", (double)out.low_noise / (1 << DW1000_NLOS_NOISE_Q), ref.low_noise);
+  ok &= close_enough("luep", (double)out.luep / DW1000_NLOS_ONE, ref.luep);
+  ok &= close_enough("mc", (double)out.mc / DW1000_NLOS_ONE, ref.mc);
+  ok &= close_enough("cl", (double)out.cl / DW1000_NLOS_ONE, ref.cl);
+  if (out.num_early_peaks != ref.num_early_peaks) {
+    printf("MISMATCH num_early_peaks %d\n", out.num_early_peaks);
+    ok = false;
+  }
+  if (!ok) {
+    n_mismatches++;
+  }
+}
+
+/* Time both versions on a 16-sample window */
+static void time_nlos(const dwt_rxdiag_t *rxdiag, const dw1000_cir_sample_t *samples) {
+  dw1000_nlos_t out;
+  dw1000_nlos_double_t ref;
+  rtimer_clock_t t0, t1, t2;
+  int i;
+
+  t0 = RTIMER_NOW();
+  for (i = 0; i < N_TIMING_RUNS; i++) {
+    dw1000_nlos(&out, rxdiag, samples, 16);
+  }
+  t1 = RTIMER_NOW();
+  for (i = 0; i < N_TIMING_RUNS; i++) {
+    dw1000_nlos_double(&ref, rxdiag, samples, 16);
+  }
+  t2 = RTIMER_NOW();
+
+  printf("--- Timing, %d runs (rtimer ticks, %lu per second) --- \n",
+         N_TIMING_RUNS, (unsigned long)RTIMER_SECOND);
+  printf("fixed: %lu\n", (unsigned long)(t1 - t0));
+  printf("double: %lu\n", (unsigned long)(t2 - t1));
+}
 
 static void nlos_test() {
 
   dw1000_cir_sample_t zero_snippet[16] = {0};
-  dw1000_nlos_t out;
-  
+
   {
     dwt_rxdiag_t rxdiag = {
       .maxNoise      = 100,
@@ -75,10 +143,9 @@ static void nlos_test() {
       .peakPathAmp   = 3000  
     };
 
-    dw1000_nlos(&out, &rxdiag, zero_snippet, 16);
 
     printf("--- Peak path close to the first path, saturation --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, zero_snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -95,10 +162,9 @@ static void nlos_test() {
       .peakPathAmp   = 3000  
     };
 
-    dw1000_nlos(&out, &rxdiag, zero_snippet, 16);
 
     printf("--- Peak path within 3.3 and 6 later than first path, saturation  --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, zero_snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -115,10 +181,9 @@ static void nlos_test() {
       .peakPathAmp   = 3000  
     };
 
-    dw1000_nlos(&out, &rxdiag, zero_snippet, 16);
 
     printf("--- Peak path 7 later than first path, saturation  --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, zero_snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -135,10 +200,9 @@ static void nlos_test() {
       .peakPathAmp   = 30000
     };
 
-    dw1000_nlos(&out, &rxdiag, zero_snippet, 16);
 
     printf("--- Peak path 7 later than first path, no saturation  --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, zero_snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -156,10 +220,9 @@ static void nlos_test() {
     };
 
     uint32_t snippet[16] = {0,10,0,10,0,10,0,10,0,10,0,10,0,10,0,10};
-    dw1000_nlos(&out, &rxdiag, (dw1000_cir_sample_t*)snippet, 16);
 
     printf("--- Peak path close to the first path, saturation, 7 low early peaks --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, (dw1000_cir_sample_t*)snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -177,10 +240,9 @@ static void nlos_test() {
     };
 
     uint32_t snippet[16] = {0,100,0,100,0,100,0,100,0,100,0,100,0,100,0,100};
-    dw1000_nlos(&out, &rxdiag, (dw1000_cir_sample_t*)snippet, 16);
 
     printf("--- Peak path close to the first path, saturation, 7 early peaks --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, (dw1000_cir_sample_t*)snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -198,10 +260,9 @@ static void nlos_test() {
     };
 
     uint32_t snippet[16] = {100,0,0,0,0,0,100,100,0,0,0,0,0,0,0,100};
-    dw1000_nlos(&out, &rxdiag, (dw1000_cir_sample_t*)snippet, 16);
 
     printf("--- Peak path close to the first path, saturation, early quasi peaks --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, (dw1000_cir_sample_t*)snippet, 16);
   }
   {
     dwt_rxdiag_t rxdiag = {
@@ -219,12 +280,14 @@ static void nlos_test() {
     };
 
     uint32_t snippet[16] = {100,100,0,0,0,0,100,101,100,0,0,0,0,0,100,100};
-    dw1000_nlos(&out, &rxdiag, (dw1000_cir_sample_t*)snippet, 16);
 
     printf("--- Peak path close to the first path, saturation, 1 early peak --- \n");
-    print_nlos(&out);
+    check_nlos(&rxdiag, (dw1000_cir_sample_t*)snippet, 16);
+
+    time_nlos(&rxdiag, (dw1000_cir_sample_t*)snippet);
   }
 
+  printf("--- %d mismatches between the fixed-point and the double version --- \n", n_mismatches);
 }
 
 
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+Decoder of the binary CIR frames (dw1000_print_cir_bin()).
+
+    ./cirdecode.py < /dev/ttyACM0
+    ./cirdecode.py capture.bin > capture.txt
+
+A frame is ESC 'C', the frame sequence number, the CIR start index and the
+number of samples (16-bit little-endian), the samples and the CRC-16 of
+everything after the sync. The real and imaginary parts of each sample are
+zigzag-encoded differences from the previous sample, in 7-bit varints.
+
+Each frame is replaced by the hex string dw1000_print_cir_hex() would have
+printed, so the existing log parsers can be used on the output. Any other
+byte is copied unchanged. CRC errors and lost frames (gaps in the sequence
+numbers) are reported on stderr.
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = b"\x1bC"
+HDR_LEN = 6
+MAX_VARINT = 3  # 16-bit differences take up to 17 bits
+MAX_SAMPLES = 1016  # DW1000_CIR_MAX_LEN
+
+
+def crc16_add(b, acc):
+    """Contiki lib/crc16.c (CRC-16/CCITT, reflected)"""
+    acc ^= b
+    acc = ((acc >> 8) | (acc << 8)) & 0xFFFF
+    acc ^= (acc & 0xFF00) << 4
+    acc &= 0xFFFF
+    acc ^= (acc >> 8) >> 4
+    acc ^= (acc & 0xFF00) >> 5
+    return acc
+
+
+def crc16(data):
+    acc = 0
+    for b in data:
+        acc = crc16_add(b, acc)
+    return acc
+
+
+def parse_frame(buf):
+    """Parse the frame at the start of buf (after the sync bytes).
+
+    Returns (length, seqn, s1, samples), None if buf is too short, or
+    (length, None, ...) if the frame is corrupted.
+    """
+    if len(buf) < HDR_LEN:
+        return None
+    seqn, s1, n = struct.unpack_from("<HHH", buf, 0)
+    if n > MAX_SAMPLES:
+        return (HDR_LEN, None, None, None)
+    pos = HDR_LEN
+    samples = []
+    prev = [0, 0]
+    for i in range(2 * n):
+        z = 0
+        shift = 0
+        while True:
+            if pos >= len(buf):
+                return None
+            b = buf[pos]
+            pos += 1
+            z |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+            if shift >= 7 * MAX_VARINT:
+                return (pos, None, None, None)
+        prev[i & 1] += (z >> 1) ^ -(z & 1)
+        samples.append(prev[i & 1] & 0xFFFF)
+    if len(buf) < pos + 2:
+        return None
+    crc, = struct.unpack_from("<H", buf, pos)
+    if crc != crc16(buf[:pos]):
+        return (pos + 2, None, None, None)
+    return (pos + 2, seqn, s1, samples)
+
+
+def to_hex(values):
+    """16-bit values (real and imaginary parts) as printed by dw1000_print_cir_hex()"""
+    return b"".join(b"%02x%02x" % (v & 0xFF, v >> 8) for v in values)
+
+
+def decode(inp, out, stats):
+    buf = b""
+    last_seqn = None
+    while True:
+        chunk = inp.read1(4096) if hasattr(inp, "read1") else inp.read(4096)
+        if not chunk:
+            break
+        buf += chunk
+        while True:
+            i = buf.find(SYNC)
+            if i < 0:
+                # keep a possible partial sync sequence
+                keep = 1 if buf.endswith(SYNC[:1]) else 0
+                out.write(buf[:len(buf) - keep])
+                buf = buf[len(buf) - keep:]
+                break
+            out.write(buf[:i])
+            buf = buf[i:]
+            frame = parse_frame(buf[len(SYNC):])
+            if frame is None:
+                break
+            size, seqn, s1, samples = frame
+            if seqn is None:
+                # skip the sync only, the frame may have been cut short
+                stats["errors"] += 1
+                print("cirdecode: corrupted frame", file=sys.stderr)
+                out.write(b"\n")
+                buf = buf[len(SYNC):]
+                continue
+            buf = buf[len(SYNC) + size:]
+            if last_seqn is not None and seqn != (last_seqn + 1) & 0xFFFF:
+                lost = (seqn - last_seqn - 1) & 0xFFFF
+                stats["lost"] += lost
+                print("cirdecode: %d frames lost before %d" % (lost, seqn), file=sys.stderr)
+            last_seqn = seqn
+            stats["frames"] += 1
+            out.write(to_hex(samples) + b"\n")
+        out.flush()
+    out.write(buf)
+    out.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", nargs="?", help="binary capture (default stdin)")
+    args = ap.parse_args()
+
+    stats = {"frames": 0, "errors": 0, "lost": 0}
+    inp = open(args.input, "rb") if args.input else sys.stdin.buffer
+    try:
+        decode(inp, sys.stdout.buffer, stats)
+    except KeyboardInterrupt:
+        pass
+    print("cirdecode: %(frames)d frames, %(errors)d corrupted, %(lost)d lost" % stats,
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
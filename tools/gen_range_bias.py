@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""
+Generator of the direct-index range bias tables (deca_range_bias.h).
+
+    ./gen_range_bias.py deca_range_tables.c > deca_range_bias.h
+
+The DecaWave tables in deca_range_tables.c list, for each bias step of
+1 cm, the upper range bound of the step in units of 25 cm, and
+dwt_getrangebias() used to scan them at every ranging. This script inverts
+them: entry r of each output row is the bias in cm for a range of r units
+of 25 cm, i.e., what the scan returned for r. It is run at build time by
+Makefile.uwb.
+"""
+
+import re
+import sys
+
+TABLES = [
+    ("range25cm16PRFnb", "rangebias16PRFnb", "CM_OFFSET_16M_NB"),
+    ("range25cm16PRFwb", "rangebias16PRFwb", "CM_OFFSET_16M_WB"),
+    ("range25cm64PRFnb", "rangebias64PRFnb", "CM_OFFSET_64M_NB"),
+    ("range25cm64PRFwb", "rangebias64PRFwb", "CM_OFFSET_64M_WB"),
+]
+
+N_ENTRIES = 256  # 8-bit range in units of 25 cm
+
+
+def parse_rows(src, name):
+    m = re.search(r"const\s+uint8\s+%s\s*\[\s*\d+\s*\]\s*\[\s*\w+\s*\]\s*=\s*\{(.*?)\}\s*;"
+                  % name, src, re.S)
+    if m is None:
+        sys.exit("table %s not found" % name)
+    body = re.sub(r"//[^\n]*", "", m.group(1))
+    rows = [[int(v) for v in re.findall(r"\d+", r)]
+            for r in re.findall(r"\{([^{}]*)\}", body)]
+    for r in rows:
+        if r[-1] != 255:
+            sys.exit("table %s does not end in 255" % name)
+    return rows
+
+
+def parse_offset(src, name):
+    m = re.search(r"#define\s+%s\s+\(\s*(-?\d+)\s*\)" % name, src)
+    if m is None:
+        sys.exit("offset %s not found" % name)
+    return int(m.group(1))
+
+
+def invert(row, cm_offset):
+    out = []
+    for r in range(N_ENTRIES):
+        i = 0
+        while r > row[i]:
+            i += 1
+        out.append(i + cm_offset)
+    return out
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        src = f.read()
+
+    print("/* Generated by tools/gen_range_bias.py from deca_range_tables.c, do not edit */")
+    print("#ifndef DECA_RANGE_BIAS_H")
+    print("#define DECA_RANGE_BIAS_H")
+    print()
+    print("/* Bias correction in cm, indexed by the range in units of 25 cm */")
+    print("#define RANGE_BIAS_ENTRIES %d" % N_ENTRIES)
+    for src_name, name, offset in TABLES:
+        rows = parse_rows(src, src_name)
+        cm_offset = parse_offset(src, offset)
+        print()
+        print("static const int8 %s[%d][RANGE_BIAS_ENTRIES] =" % (name, len(rows)))
+        print("{")
+        for row in rows:
+            values = invert(row, cm_offset)
+            print("    {")
+            for i in range(0, N_ENTRIES, 16):
+                print("        " + " ".join("%3d," % v for v in values[i:i + 16]))
+            print("    },")
+        print("};")
+    print()
+    print("#endif /* DECA_RANGE_BIAS_H */")
+
+
+if __name__ == "__main__":
+    main()
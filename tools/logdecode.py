@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Decoder of the binary deferred log records (LOGGING_CONF_BINARY=1).
+
+    ./logdecode.py app.evb1000 < /dev/ttyACM0
+    ./logdecode.py app.evb1000 capture.bin > capture.txt
+
+A record is ESC 'L', the number of arguments (0xFF: count of dropped
+records), the address of the format string and the arguments, all 32-bit
+little-endian words. The format strings (and the constant strings passed as
+%s arguments) are read from the ELF file of the application. Any other byte
+is copied to the output, so plain printf output passes through unchanged.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SYNC = b"\x1bL"
+DROPPED = 0xFF
+CONV = re.compile(rb"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXcspf%])")
+
+
+class Elf:
+    """Loadable sections of a 32 or 64-bit little-endian ELF file."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[5] != 1:
+            raise ValueError(f"{path}: not a little-endian ELF file")
+        if data[4] == 1:
+            shoff, = struct.unpack_from("<I", data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+            fmt, fields = "<IIIIIIIIII", (3, 4, 5)
+        else:
+            shoff, = struct.unpack_from("<Q", data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", data, 0x3A)
+            fmt, fields = "<IIQQQQIIQQ", (3, 4, 5)
+        self.sections = []
+        for i in range(shnum):
+            sh = struct.unpack_from(fmt, data, shoff + i * shentsize)
+            sh_type, flags = sh[1], sh[2]
+            addr, offset, size = (sh[k] for k in fields)
+            if flags & 0x2 and sh_type != 8 and size > 0:   # SHF_ALLOC, not NOBITS
+                self.sections.append((addr, data[offset:offset + size]))
+
+    def string(self, addr):
+        for base, content in self.sections:
+            if base <= addr < base + len(content):
+                end = content.find(b"\0", addr - base)
+                return content[addr - base:end if end >= 0 else None]
+        return None
+
+
+def c_format(elf, fmt, args):
+    """printf() with 32-bit arguments, as done on the target"""
+    out = []
+    pos = 0
+    args = list(args)
+    for m in CONV.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == b"%":
+            out.append(b"%")
+            continue
+        if width == b"*":
+            width = str(args.pop(0) if args else 0).encode()
+        if prec == b"*":
+            prec = str(args.pop(0) if args else 0).encode()
+        arg = args.pop(0) if args else 0
+        spec = b"%" + flags + (width or b"") + (b"." + prec if prec is not None else b"")
+        if conv in b"di":
+            value = arg - (1 << 32) if arg & 0x80000000 else arg
+            out.append((spec + b"d") % value)
+        elif conv in b"ouxX":
+            out.append((spec + (b"d" if conv == b"u" else conv)) % arg)
+        elif conv == b"p":
+            out.append(b"0x%x" % arg)
+        elif conv == b"c":
+            out.append((spec + b"c") % (arg & 0xFF))
+        elif conv == b"s":
+            s = elf.string(arg)
+            out.append((spec + b"s") % (s if s is not None else b"<0x%08x>" % arg))
+        else:
+            out.append(b"<%" + conv + b" unsupported>")
+    out.append(fmt[pos:])
+    return b"".join(out)
+
+
+def decode(elf, inp, out):
+    buf = b""
+    while True:
+        chunk = inp.read1(4096) if hasattr(inp, "read1") else inp.read(4096)
+        if not chunk:
+            break
+        buf += chunk
+        while True:
+            i = buf.find(SYNC)
+            if i < 0:
+                # keep a possible partial sync sequence
+                keep = 1 if buf.endswith(SYNC[:1]) else 0
+                out.write(buf[:len(buf) - keep])
+                buf = buf[len(buf) - keep:]
+                break
+            out.write(buf[:i])
+            buf = buf[i:]
+            if len(buf) < 3:
+                break
+            n = buf[2]
+            size = 3 + 4 if n == DROPPED else 3 + 4 * (n + 1)
+            if len(buf) < size:
+                break
+            words = struct.unpack_from("<%dI" % ((size - 3) // 4), buf, 3)
+            buf = buf[size:]
+            if n == DROPPED:
+                out.write(b"[logging]WARN:%d records dropped\n" % words[0])
+                continue
+            fmt = elf.string(words[0])
+            if fmt is None:
+                out.write(b"[logging]unknown format 0x%08x\n" % words[0])
+                continue
+            out.write(c_format(elf, fmt, words[1:]))
+        out.flush()
+    out.write(buf)
+    out.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("elf", help="application ELF file")
+    ap.add_argument("input", nargs="?", help="binary log (default stdin)")
+    args = ap.parse_args()
+
+    elf = Elf(args.elf)
+    inp = open(args.input, "rb") if args.input else sys.stdin.buffer
+    try:
+        decode(elf, inp, sys.stdout.buffer)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""
+Reliability, latency and radio-on time of a Glossy Test run in uwb-sim.
+
+    ./uwb-sim -n 100 -o glossy.log -R nodes.csv <glossy_test.native-uwb>
+    ./glossy_stats.py glossy.log nodes.csv
+
+The log is the merged output of the simulator ("time_us<TAB>node<TAB>line").
+Reliability is the fraction of the floods sent by the initiator that each
+node received; latency is the relay counter at the first reception (hops),
+also converted to time with the given slot duration.
+"""
+
+import argparse
+import csv
+import re
+import statistics
+from collections import defaultdict
+
+SENT = re.compile(r"\[GLOSSY_BROADCAST\]sent_seq (\d+)")
+RCVD = re.compile(r"\[GLOSSY_PAYLOAD\]rcvd_seq (\d+)")
+STATS = re.compile(r"\[APP_STATS\]n_rx (\d+), n_tx (\d+), f_relay_cnt (\d+)")
+
+
+def parse_log(path):
+    sent = {}                       # seq -> initiator
+    rcvd = defaultdict(set)         # node -> seqs
+    hops = defaultdict(list)        # node -> relay counter at first rx
+    last_rcvd = {}
+    with open(path) as f:
+        for line in f:
+            parts = line.rstrip("\n").split("\t", 2)
+            if len(parts) < 3:
+                continue
+            node, text = int(parts[1]), parts[2]
+            m = SENT.search(text)
+            if m:
+                sent[int(m.group(1))] = node
+                continue
+            m = RCVD.search(text)
+            if m:
+                rcvd[node].add(int(m.group(1)))
+                last_rcvd[node] = True
+                continue
+            m = STATS.search(text)
+            if m and last_rcvd.pop(node, False) and int(m.group(1)) > 0:
+                hops[node].append(int(m.group(3)))
+    return sent, rcvd, hops
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("log")
+    ap.add_argument("csv", nargs="?", help="per-node statistics of uwb-sim (-R)")
+    ap.add_argument("--slot-us", type=float, default=0,
+                    help="Glossy slot duration, to convert hops to time")
+    ap.add_argument("--skip", type=int, default=1,
+                    help="floods ignored at the beginning (bootstrap)")
+    args = ap.parse_args()
+
+    sent, rcvd, hops = parse_log(args.log)
+    seqs = sorted(sent)[args.skip:]
+    if not seqs:
+        print("No floods found")
+        return
+    initiators = set(sent.values())
+    radio_on = {}
+    if args.csv:
+        with open(args.csv) as f:
+            for row in csv.DictReader(f):
+                radio_on[int(row["node"])] = float(row["radio_on_pct"])
+
+    nodes = sorted((set(rcvd) | set(radio_on)) - initiators)
+    print("node,reliability_pct,hops_avg,radio_on_pct")
+    rel_all, hops_all = [], []
+    for n in nodes:
+        got = sum(1 for s in seqs if s in rcvd[n])
+        rel = 100.0 * got / len(seqs)
+        h = statistics.mean(hops[n]) if hops[n] else float("nan")
+        rel_all.append(rel)
+        hops_all.extend(hops[n])
+        print(f"{n},{rel:.2f},{h:.2f},{radio_on.get(n, float('nan')):.3f}")
+
+    print(f"# floods {len(seqs)}, nodes {len(nodes)}")
+    print(f"# reliability avg {statistics.mean(rel_all):.2f}% min {min(rel_all):.2f}%")
+    if hops_all:
+        h = statistics.mean(hops_all)
+        line = f"# latency avg {h:.2f} hops, max {max(hops_all)} hops"
+        if args.slot_us > 0:
+            line += f" ({(h + 1) * args.slot_us:.1f} us avg)"
+        print(line)
+    if radio_on:
+        print(f"# radio-on avg {statistics.mean(radio_on.values()):.3f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,992 @@
+/*
+ * Copyright (c) 2021, University of Trento.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *      Deterministic multi-node simulator for native-uwb nodes.
+ *
+ *      Every node is a native-uwb process running the real application,
+ *      protocol and driver code on top of the DW1000 emulator, in virtual
+ *      time. The simulator executes the nodes one at a time in timestamp
+ *      order (conservative synchronisation): the node with the earliest
+ *      deadline runs until the next deadline of any other node or of the
+ *      channel. Ties are broken by node index, so two runs with the same
+ *      arguments produce the same log.
+ *
+ *      Channel model:
+ *      - log-distance path loss with optional per-link shadowing;
+ *      - propagation delay;
+ *      - identical frames (same PSDU and PHY settings) whose arrivals are
+ *        within the merge window add up, as in concurrent transmissions
+ *        (Glossy, Crystal, Weaver);
+ *      - other overlapping frames are interference: a frame is received
+ *        if its power exceeds both the sensitivity and the interference
+ *        plus the capture threshold, with a logistic transition of the
+ *        given width around the threshold;
+ *      - interference during the preamble/SFD causes an SFD timeout, during
+ *        the payload an FCS error.
+ *
+ *      The log lines of all the nodes are merged, prefixed by the virtual
+ *      time (us) and the node ID. At the end, per-node radio statistics
+ *      (including radio-on time) and channel statistics are reported.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "uwb-sim-proto.h"
+/*---------------------------------------------------------------------------*/
+#define NEVER             UINT64_MAX
+#define PS_PER_US         1000000ULL
+#define PS_PER_S          1000000000000ULL
+#define SPEED_OF_LIGHT    299792458.0
+#define PRUNE_AGE_PS      (20 * 1000 * PS_PER_US)
+#define MAX_EXTRA_ARGS    32
+/*---------------------------------------------------------------------------*/
+typedef struct {
+  int refs;
+  uint32_t tx_node;
+  dw1000_emu_frame_t f;
+} frame_rec_t;
+
+typedef struct arrival {
+  struct arrival *next;
+  frame_rec_t *fr;
+  uint64_t start;       /* first preamble symbol at the receiver antenna */
+  uint64_t shr_end;     /* RMARKER at the receiver antenna */
+  uint64_t end;
+  double power;         /* dBm */
+  int pending;          /* outcome event not processed yet */
+} arrival_t;
+
+typedef struct {
+  uint32_t to;
+  float power;          /* dBm */
+  uint64_t delay;       /* ps */
+} link_t;
+
+typedef struct {
+  uint32_t id;
+  double x, y, z;
+  double drift_ppm;
+  uint64_t boot;
+  pid_t pid;
+  int fd;
+  int alive;
+  int booted;
+  uint64_t key;         /* next deadline */
+  int heap_idx;
+  link_t *links;
+  int n_links;
+  arrival_t *arrivals;
+  char line[1024];
+  int line_len;
+  int has_stats;
+  uwb_sim_stats_t stats;
+} node_t;
+
+typedef struct {
+  uint64_t time;
+  uint64_t seq;
+  uint32_t rx;
+  arrival_t *a;
+} medium_ev_t;
+/*---------------------------------------------------------------------------*/
+/* Configuration */
+static struct {
+  const char *binary;
+  char *extra_args[MAX_EXTRA_ARGS];
+  int n_extra_args;
+  const char *topology;
+  int n_nodes;
+  double spacing;
+  double max_drift_ppm;
+  double max_boot_ms;
+  uint64_t duration;
+  uint32_t seed;
+  double tx_power;
+  double pl0;
+  double ple;
+  double shadowing;
+  double sensitivity;
+  double capture_db;
+  double transition_db;
+  double merge_window_ns;
+  const char *log_path;
+  const char *report_path;
+} cfg = {
+  .n_nodes = 0,
+  .spacing = 10,
+  .max_drift_ppm = 10,
+  .max_boot_ms = 100,
+  .duration = 60 * PS_PER_S,
+  .seed = 1,
+  .tx_power = -14.3,
+  .pl0 = 48.7,
+  .ple = 2.0,
+  .shadowing = 0,
+  .sensitivity = -93,
+  .capture_db = 6,
+  .transition_db = 1,
+  .merge_window_ns = 100,
+};
+
+static node_t *nodes;
+static int n_nodes;
+static FILE *log_out;
+static int stopping;
+
+/* Node heap (by key, then index) */
+static int *nheap;
+static int nheap_len;
+
+/* Channel event heap (by time, then sequence) */
+static medium_ev_t *mheap;
+static int mheap_len, mheap_cap;
+static uint64_t mseq;
+
+static struct {
+  uint64_t frames;
+  uint64_t deliveries;
+  uint64_t merged;
+  uint64_t ok;
+  uint64_t weak;
+  uint64_t collisions;
+  uint64_t events;
+} chan;
+/*---------------------------------------------------------------------------*/
+/* Deterministic random numbers */
+static uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+/*---------------------------------------------------------------------------*/
+static double
+uniform(uint64_t a, uint64_t b, uint64_t c)
+{
+  uint64_t h = mix64(mix64(mix64(cfg.seed ^ a) ^ b) ^ c);
+  return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+/*---------------------------------------------------------------------------*/
+static double
+gaussian(uint64_t a, uint64_t b, uint64_t c)
+{
+  double u1 = uniform(a, b, c * 2 + 1);
+  double u2 = uniform(a, b, c * 2 + 2);
+  if(u1 < 1e-300) {
+    u1 = 1e-300;
+  }
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+/*---------------------------------------------------------------------------*/
+static inline double
+dbm_to_mw(double dbm)
+{
+  return pow(10, dbm / 10);
+}
+/*---------------------------------------------------------------------------*/
+static inline double
+mw_to_dbm(double mw)
+{
+  return 10 * log10(mw);
+}
+/*---------------------------------------------------------------------------*/
+/* Heaps                                                                     */
+/*---------------------------------------------------------------------------*/
+static inline int
+nless(int a, int b)
+{
+  return nodes[a].key < nodes[b].key || (nodes[a].key == nodes[b].key && a < b);
+}
+/*---------------------------------------------------------------------------*/
+static void
+nswap(int i, int j)
+{
+  int t = nheap[i];
+  nheap[i] = nheap[j];
+  nheap[j] = t;
+  nodes[nheap[i]].heap_idx = i;
+  nodes[nheap[j]].heap_idx = j;
+}
+/*---------------------------------------------------------------------------*/
+static void
+nsift(int i)
+{
+  while(i > 0 && nless(nheap[i], nheap[(i - 1) / 2])) {
+    nswap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  for(;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if(l < nheap_len && nless(nheap[l], nheap[m])) {
+      m = l;
+    }
+    if(r < nheap_len && nless(nheap[r], nheap[m])) {
+      m = r;
+    }
+    if(m == i) {
+      break;
+    }
+    nswap(i, m);
+    i = m;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+set_key(int n, uint64_t key)
+{
+  nodes[n].key = key;
+  if(nodes[n].heap_idx >= 0) {
+    nsift(nodes[n].heap_idx);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+npush(int n)
+{
+  nheap[nheap_len] = n;
+  nodes[n].heap_idx = nheap_len++;
+  nsift(nodes[n].heap_idx);
+}
+/*---------------------------------------------------------------------------*/
+static int
+npop(void)
+{
+  int n = nheap[0];
+  nswap(0, --nheap_len);
+  nodes[n].heap_idx = -1;
+  if(nheap_len > 0) {
+    nsift(0);
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static inline int
+mless(const medium_ev_t *a, const medium_ev_t *b)
+{
+  return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+/*---------------------------------------------------------------------------*/
+static void
+mpush(uint64_t time, uint32_t rx, arrival_t *a)
+{
+  int i;
+
+  if(mheap_len == mheap_cap) {
+    mheap_cap = mheap_cap ? 2 * mheap_cap : 1024;
+    mheap = realloc(mheap, mheap_cap * sizeof(*mheap));
+  }
+  i = mheap_len++;
+  mheap[i].time = time;
+  mheap[i].seq = mseq++;
+  mheap[i].rx = rx;
+  mheap[i].a = a;
+  while(i > 0 && mless(&mheap[i], &mheap[(i - 1) / 2])) {
+    medium_ev_t t = mheap[i];
+    mheap[i] = mheap[(i - 1) / 2];
+    mheap[(i - 1) / 2] = t;
+    i = (i - 1) / 2;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static medium_ev_t
+mpop(void)
+{
+  medium_ev_t top = mheap[0];
+  int i = 0;
+
+  mheap[0] = mheap[--mheap_len];
+  for(;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if(l < mheap_len && mless(&mheap[l], &mheap[m])) {
+      m = l;
+    }
+    if(r < mheap_len && mless(&mheap[r], &mheap[m])) {
+      m = r;
+    }
+    if(m == i) {
+      break;
+    }
+    medium_ev_t t = mheap[i];
+    mheap[i] = mheap[m];
+    mheap[m] = t;
+    i = m;
+  }
+  return top;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+horizon(void)
+{
+  uint64_t h = nheap_len > 0 ? nodes[nheap[0]].key : NEVER;
+  if(mheap_len > 0 && mheap[0].time < h) {
+    h = mheap[0].time;
+  }
+  return h;
+}
+/*---------------------------------------------------------------------------*/
+/* Node communication                                                        */
+/*---------------------------------------------------------------------------*/
+static void
+node_dead(int n)
+{
+  node_t *nd = &nodes[n];
+
+  if(nd->alive) {
+    if(!stopping) {
+      fprintf(stderr, "uwb-sim: node %u terminated\n", nd->id);
+    }
+    nd->alive = 0;
+    close(nd->fd);
+    set_key(n, NEVER);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+node_send(int n, uwb_sim_msg_t *m, size_t payload)
+{
+  if(!nodes[n].alive) {
+    return -1;
+  }
+  if(send(nodes[n].fd, m, UWB_SIM_MSG_HDR_LEN + payload, MSG_NOSIGNAL) < 0) {
+    node_dead(n);
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+node_log(int n, uint64_t t, const char *text, size_t len)
+{
+  node_t *nd = &nodes[n];
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    if(text[i] == '\n' || nd->line_len == sizeof(nd->line) - 1) {
+      nd->line[nd->line_len] = '\0';
+      fprintf(log_out, "%llu\t%u\t%s\n",
+              (unsigned long long)(t / PS_PER_US), nd->id, nd->line);
+      nd->line_len = 0;
+      if(text[i] == '\n') {
+        continue;
+      }
+    }
+    if(text[i] != '\r') {
+      nd->line[nd->line_len++] = text[i];
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Receive a message from a node, handling the log output */
+static int
+node_recv(int n, uwb_sim_msg_t *m)
+{
+  for(;;) {
+    ssize_t r = recv(nodes[n].fd, m, sizeof(*m), 0);
+    if(r <= 0) {
+      node_dead(n);
+      return -1;
+    }
+    if(m->type == UWB_SIM_LOG) {
+      node_log(n, m->t, m->u.text, m->arg);
+      continue;
+    }
+    if(m->type == UWB_SIM_STATS) {
+      nodes[n].stats = m->u.stats;
+      nodes[n].has_stats = 1;
+      continue;
+    }
+    return 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Hand a message to a blocked node and update its deadline */
+static void
+node_deliver(int n, uwb_sim_msg_t *m, size_t payload)
+{
+  uwb_sim_msg_t r;
+
+  if(node_send(n, m, payload) < 0) {
+    return;
+  }
+  do {
+    if(node_recv(n, &r) < 0) {
+      return;
+    }
+  } while(r.type != UWB_SIM_DEADLINE);
+  set_key(n, r.t);
+}
+/*---------------------------------------------------------------------------*/
+/* Channel                                                                   */
+/*---------------------------------------------------------------------------*/
+static uint64_t
+shr_duration(const dw1000_emu_frame_t *f)
+{
+  return f->rmarker - f->start;
+}
+/*---------------------------------------------------------------------------*/
+static int
+same_frame(const dw1000_emu_frame_t *a, const dw1000_emu_frame_t *b)
+{
+  return a->len == b->len && a->channel == b->channel && a->prf == b->prf &&
+         a->preamble_code == b->preamble_code && a->data_rate == b->data_rate &&
+         a->plen == b->plen && a->fcs_ok == b->fcs_ok &&
+         memcmp(a->psdu, b->psdu, a->len) == 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+prune_arrivals(node_t *nd, uint64_t now)
+{
+  arrival_t **p = &nd->arrivals;
+
+  while(*p != NULL) {
+    arrival_t *a = *p;
+    if(!a->pending && a->end + PRUNE_AGE_PS < now) {
+      *p = a->next;
+      if(--a->fr->refs == 0) {
+        free(a->fr);
+      }
+      free(a);
+    } else {
+      p = &a->next;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+channel_tx(int k, const dw1000_emu_frame_t *f)
+{
+  node_t *tx = &nodes[k];
+  frame_rec_t *fr = malloc(sizeof(*fr));
+  double deliver_thr = cfg.sensitivity - 6 * cfg.transition_db;
+  int i;
+
+  fr->refs = 1;
+  fr->tx_node = k;
+  fr->f = *f;
+  chan.frames++;
+
+  for(i = 0; i < tx->n_links; i++) {
+    const link_t *l = &tx->links[i];
+    node_t *rx = &nodes[l->to];
+    arrival_t *a;
+
+    if(!rx->alive) {
+      continue;
+    }
+    prune_arrivals(rx, f->start);
+    a = malloc(sizeof(*a));
+    a->fr = fr;
+    fr->refs++;
+    a->start = f->start + l->delay;
+    a->shr_end = a->start + shr_duration(f);
+    a->end = a->start + (f->end - f->start);
+    a->power = l->power;
+    a->pending = 0;
+    a->next = rx->arrivals;
+    rx->arrivals = a;
+
+    /* the radio of a node that has not booted yet is off */
+    if(l->power >= deliver_thr && rx->booted) {
+      uwb_sim_msg_t m;
+      m.type = UWB_SIM_RX_BEGIN;
+      m.t = a->start;
+      m.power = l->power;
+      m.u.frame = *f;
+      node_deliver(l->to, &m, sizeof(m.u.frame));
+      a->pending = 1;
+      mpush(a->end, l->to, a);
+      chan.deliveries++;
+    }
+  }
+  if(--fr->refs == 0) {
+    free(fr);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static dw1000_emu_rx_outcome_t
+channel_outcome(uint32_t rx, const arrival_t *a)
+{
+  const node_t *nd = &nodes[rx];
+  const dw1000_emu_frame_t *f = &a->fr->f;
+  double sig = dbm_to_mw(a->power);
+  double intf = 0;
+  double thr, p;
+  int shr_hit = 0, merged = 0;
+  const arrival_t *b;
+
+  for(b = nd->arrivals; b != NULL; b = b->next) {
+    const dw1000_emu_frame_t *g = &b->fr->f;
+    if(b == a || b->end <= a->start || b->start >= a->end ||
+       g->channel != f->channel) {
+      continue;
+    }
+    if(same_frame(f, g) &&
+       llabs((long long)b->start - (long long)a->start) <= cfg.merge_window_ns * 1000) {
+      sig += dbm_to_mw(b->power);
+      merged = 1;
+      continue;
+    }
+    intf += dbm_to_mw(b->power);
+    if(b->start < a->shr_end) {
+      shr_hit = 1;
+    }
+  }
+  if(merged) {
+    chan.merged++;
+  }
+
+  thr = cfg.sensitivity;
+  if(intf > 0 && mw_to_dbm(intf) + cfg.capture_db > thr) {
+    thr = mw_to_dbm(intf) + cfg.capture_db;
+  }
+  p = 1 / (1 + exp(-(mw_to_dbm(sig) - thr) / cfg.transition_db));
+  if(uniform(((uint64_t)f->src << 32) | f->id, rx, 0x5EED) < p) {
+    chan.ok++;
+    return DW1000_EMU_RX_OK;
+  }
+  if(intf > 0 && thr > cfg.sensitivity) {
+    chan.collisions++;
+    return shr_hit ? DW1000_EMU_RX_SFD_TIMEOUT : DW1000_EMU_RX_FCS_ERROR;
+  }
+  chan.weak++;
+  return DW1000_EMU_RX_LOST;
+}
+/*---------------------------------------------------------------------------*/
+static void
+channel_event(const medium_ev_t *ev)
+{
+  arrival_t *a = ev->a;
+  dw1000_emu_rx_outcome_t outcome = channel_outcome(ev->rx, a);
+
+  a->pending = 0;
+  if(outcome != DW1000_EMU_RX_OK) {
+    uwb_sim_msg_t m;
+    m.type = UWB_SIM_RX_END;
+    m.h = ((uint64_t)a->fr->f.src << 32) | a->fr->f.id;
+    m.arg = outcome;
+    node_deliver(ev->rx, &m, 0);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Run node n until it yields */
+static void
+run_node(int n, uint64_t now)
+{
+  uwb_sim_msg_t m;
+
+  nodes[n].booted = 1;
+  m.type = UWB_SIM_GO;
+  m.t = now;
+  m.h = horizon();
+  if(node_send(n, &m, 0) < 0) {
+    return;
+  }
+  for(;;) {
+    if(node_recv(n, &m) < 0) {
+      return;
+    }
+    switch(m.type) {
+    case UWB_SIM_TX:
+      channel_tx(n, &m.u.frame);
+      m.type = UWB_SIM_TX_ACK;
+      m.h = horizon();
+      if(node_send(n, &m, 0) < 0) {
+        return;
+      }
+      break;
+    case UWB_SIM_YIELD:
+      nodes[n].key = m.t;
+      return;
+    default:
+      fprintf(stderr, "uwb-sim: unexpected message %u from node %u\n",
+              m.type, nodes[n].id);
+      break;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Setup                                                                     */
+/*---------------------------------------------------------------------------*/
+static void
+load_topology(void)
+{
+  int i, cap = 0;
+
+  if(cfg.topology != NULL) {
+    FILE *fp = fopen(cfg.topology, "r");
+    char line[256];
+    if(fp == NULL) {
+      perror(cfg.topology);
+      exit(EXIT_FAILURE);
+    }
+    while(fgets(line, sizeof(line), fp) != NULL) {
+      node_t nd;
+      int r;
+      memset(&nd, 0, sizeof(nd));
+      nd.drift_ppm = NAN;
+      if(line[0] == '#') {
+        continue;
+      }
+      r = sscanf(line, "%u %lf %lf %lf %lf", &nd.id, &nd.x, &nd.y, &nd.z, &nd.drift_ppm);
+      if(r < 3) {
+        continue;
+      }
+      if(r < 4) {
+        nd.z = 0;
+      }
+      if(n_nodes == cap) {
+        cap = cap ? 2 * cap : 64;
+        nodes = realloc(nodes, cap * sizeof(*nodes));
+      }
+      nodes[n_nodes++] = nd;
+      if(cfg.n_nodes > 0 && n_nodes == cfg.n_nodes) {
+        break;
+      }
+    }
+    fclose(fp);
+  } else {
+    int side;
+    if(cfg.n_nodes <= 0) {
+      cfg.n_nodes = 2;
+    }
+    side = (int)ceil(sqrt(cfg.n_nodes));
+    nodes = calloc(cfg.n_nodes, sizeof(*nodes));
+    for(i = 0; i < cfg.n_nodes; i++) {
+      nodes[i].id = i + 1;
+      nodes[i].x = (i % side) * cfg.spacing;
+      nodes[i].y = (i / side) * cfg.spacing;
+      nodes[i].drift_ppm = NAN;
+    }
+    n_nodes = cfg.n_nodes;
+  }
+
+  for(i = 0; i < n_nodes; i++) {
+    node_t *nd = &nodes[i];
+    if(isnan(nd->drift_ppm)) {
+      nd->drift_ppm = (2 * uniform(nd->id, 0xD1F7, 0) - 1) * cfg.max_drift_ppm;
+    }
+    nd->boot = (uint64_t)(uniform(nd->id, 0xB007, 0) * cfg.max_boot_ms * 1e9);
+    nd->heap_idx = -1;
+    nd->fd = -1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+compute_links(void)
+{
+  double floor_dbm = cfg.sensitivity - 20;
+  int i, j;
+
+  for(i = 0; i < n_nodes; i++) {
+    int cap = 0;
+    for(j = 0; j < n_nodes; j++) {
+      double dx, dy, dz, d, pl, prx;
+      if(i == j) {
+        continue;
+      }
+      dx = nodes[i].x - nodes[j].x;
+      dy = nodes[i].y - nodes[j].y;
+      dz = nodes[i].z - nodes[j].z;
+      d = sqrt(dx * dx + dy * dy + dz * dz);
+      pl = cfg.pl0 + 10 * cfg.ple * log10(d > 1 ? d : 1);
+      if(cfg.shadowing > 0) {
+        /* symmetric link shadowing */
+        uint32_t lo = nodes[i].id < nodes[j].id ? nodes[i].id : nodes[j].id;
+        uint32_t hi = nodes[i].id < nodes[j].id ? nodes[j].id : nodes[i].id;
+        pl += cfg.shadowing * gaussian(lo, hi, 0x5AD0);
+      }
+      prx = cfg.tx_power - pl;
+      if(prx < floor_dbm) {
+        continue;
+      }
+      if(nodes[i].n_links == cap) {
+        cap = cap ? 2 * cap : 16;
+        nodes[i].links = realloc(nodes[i].links, cap * sizeof(link_t));
+      }
+      nodes[i].links[nodes[i].n_links].to = j;
+      nodes[i].links[nodes[i].n_links].power = prx;
+      nodes[i].links[nodes[i].n_links].delay = (uint64_t)llround(d / SPEED_OF_LIGHT * 1e12);
+      nodes[i].n_links++;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+spawn_nodes(void)
+{
+  struct rlimit rl;
+  int i;
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  for(i = 0; i < n_nodes; i++) {
+    node_t *nd = &nodes[i];
+    int sv[2];
+    uwb_sim_msg_t m;
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+      perror("socketpair");
+      exit(EXIT_FAILURE);
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    nd->pid = fork();
+    if(nd->pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if(nd->pid == 0) {
+      char id[16], drift[32], seed[16], fd[16];
+      char *argv[10 + MAX_EXTRA_ARGS];
+      int a = 0, k;
+      snprintf(id, sizeof(id), "%u", nd->id);
+      snprintf(drift, sizeof(drift), "%.4f", nd->drift_ppm);
+      snprintf(seed, sizeof(seed), "%u", (unsigned)mix64(cfg.seed ^ nd->id) | 1);
+      snprintf(fd, sizeof(fd), "%d", sv[1]);
+      argv[a++] = (char *)cfg.binary;
+      argv[a++] = "-n"; argv[a++] = id;
+      argv[a++] = "-d"; argv[a++] = drift;
+      argv[a++] = "-r"; argv[a++] = seed;
+      argv[a++] = "-S"; argv[a++] = fd;
+      for(k = 0; k < cfg.n_extra_args; k++) {
+        argv[a++] = cfg.extra_args[k];
+      }
+      argv[a] = NULL;
+      execv(cfg.binary, argv);
+      perror(cfg.binary);
+      _exit(EXIT_FAILURE);
+    }
+    close(sv[1]);
+    nd->fd = sv[0];
+    nd->alive = 1;
+    if(node_recv(i, &m) < 0 || m.type != UWB_SIM_HELLO) {
+      fprintf(stderr, "uwb-sim: node %u did not start\n", nd->id);
+      exit(EXIT_FAILURE);
+    }
+    nd->key = nd->boot;
+    npush(i);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+stop_nodes(void)
+{
+  int i;
+
+  stopping = 1;
+  for(i = 0; i < n_nodes; i++) {
+    uwb_sim_msg_t m;
+    if(!nodes[i].alive) {
+      continue;
+    }
+    m.type = UWB_SIM_STOP;
+    if(node_send(i, &m, 0) == 0) {
+      /* collect the last log lines and the statistics until EOF */
+      while(node_recv(i, &m) == 0);
+    }
+    waitpid(nodes[i].pid, NULL, 0);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(double wall_s)
+{
+  FILE *fp = stderr;
+  double sim_s = (double)cfg.duration / PS_PER_S;
+  double on_sum = 0;
+  int i, n_stats = 0;
+
+  if(cfg.report_path != NULL) {
+    fp = fopen(cfg.report_path, "w");
+    if(fp == NULL) {
+      perror(cfg.report_path);
+      fp = stderr;
+    }
+  }
+  fprintf(fp, "node,x,y,drift_ppm,tx,rx_ok,rx_err,rx_to,late,tx_ms,rx_ms,radio_on_pct,spi_bytes,isr\n");
+  for(i = 0; i < n_nodes; i++) {
+    const node_t *nd = &nodes[i];
+    const dw1000_emu_stats_t *r = &nd->stats.radio;
+    double on_ms;
+    if(!nd->has_stats) {
+      continue;
+    }
+    on_ms = (r->tx_time + r->rx_time) / 1e9;
+    on_sum += on_ms;
+    n_stats++;
+    fprintf(fp, "%u,%.2f,%.2f,%.3f,%u,%u,%u,%u,%u,%.3f,%.3f,%.3f,%llu,%u\n",
+            nd->id, nd->x, nd->y, nd->drift_ppm,
+            r->n_tx, r->n_rx_ok, r->n_rx_err, r->n_rx_to, r->n_late,
+            r->tx_time / 1e9, r->rx_time / 1e9, on_ms / (sim_s * 1e3) * 100,
+            (unsigned long long)nd->stats.spi_bytes, nd->stats.isr_count);
+  }
+  if(fp != stderr) {
+    fclose(fp);
+  }
+  fprintf(stderr, "uwb-sim: %d nodes, %.1f s simulated in %.1f s, %llu events\n",
+          n_nodes, sim_s, wall_s, (unsigned long long)chan.events);
+  fprintf(stderr, "uwb-sim: channel frames %llu deliveries %llu ok %llu merged %llu "
+          "collisions %llu weak %llu\n",
+          (unsigned long long)chan.frames, (unsigned long long)chan.deliveries,
+          (unsigned long long)chan.ok, (unsigned long long)chan.merged,
+          (unsigned long long)chan.collisions, (unsigned long long)chan.weak);
+  if(n_stats > 0) {
+    fprintf(stderr, "uwb-sim: average radio-on %.3f%%\n",
+            on_sum / n_stats / (sim_s * 1e3) * 100);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+    "Usage: %s [options] <node binary> [-- node options]\n"
+    "  -n N       number of nodes (grid, or first N of the topology)\n"
+    "  -T file    topology: lines \"id x y [z [drift_ppm]]\" (m, ppm)\n"
+    "  -g m       grid spacing (default %.1f)\n"
+    "  -t s       simulated time (default 60)\n"
+    "  -s seed    random seed (default 1)\n"
+    "  -d ppm     max crystal offset, uniform (default %.1f)\n"
+    "  -b ms      max boot time offset, uniform (default %.1f)\n"
+    "  -P dBm     TX power (default %.1f)\n"
+    "  -L dB      path loss at 1 m (default %.1f)\n"
+    "  -e n       path loss exponent (default %.1f)\n"
+    "  -w dB      shadowing standard deviation (default %.1f)\n"
+    "  -r dBm     sensitivity (default %.1f)\n"
+    "  -c dB      capture threshold (default %.1f)\n"
+    "  -k dB      width of the reception transition (default %.1f)\n"
+    "  -m ns      merge window of identical concurrent frames (default %.1f)\n"
+    "  -o file    log output (default stdout)\n"
+    "  -R file    per-node statistics CSV (default stderr)\n",
+    prog, cfg.spacing, cfg.max_drift_ppm, cfg.max_boot_ms, cfg.tx_power,
+    cfg.pl0, cfg.ple, cfg.shadowing, cfg.sensitivity, cfg.capture_db,
+    cfg.transition_db, cfg.merge_window_ns);
+  exit(EXIT_FAILURE);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  int opt;
+  struct timespec t0, t1;
+
+  while((opt = getopt(argc, argv, "+n:T:g:t:s:d:b:P:L:e:w:r:c:k:m:o:R:h")) != -1) {
+    switch(opt) {
+    case 'n': cfg.n_nodes = atoi(optarg); break;
+    case 'T': cfg.topology = optarg; break;
+    case 'g': cfg.spacing = atof(optarg); break;
+    case 't': cfg.duration = (uint64_t)(atof(optarg) * PS_PER_S); break;
+    case 's': cfg.seed = strtoul(optarg, NULL, 0); break;
+    case 'd': cfg.max_drift_ppm = atof(optarg); break;
+    case 'b': cfg.max_boot_ms = atof(optarg); break;
+    case 'P': cfg.tx_power = atof(optarg); break;
+    case 'L': cfg.pl0 = atof(optarg); break;
+    case 'e': cfg.ple = atof(optarg); break;
+    case 'w': cfg.shadowing = atof(optarg); break;
+    case 'r': cfg.sensitivity = atof(optarg); break;
+    case 'c': cfg.capture_db = atof(optarg); break;
+    case 'k': cfg.transition_db = atof(optarg); break;
+    case 'm': cfg.merge_window_ns = atof(optarg); break;
+    case 'o': cfg.log_path = optarg; break;
+    case 'R': cfg.report_path = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if(optind >= argc) {
+    usage(argv[0]);
+  }
+  cfg.binary = argv[optind++];
+  if(optind < argc && strcmp(argv[optind], "--") == 0) {
+    optind++;
+  }
+  while(optind < argc && cfg.n_extra_args < MAX_EXTRA_ARGS) {
+    cfg.extra_args[cfg.n_extra_args++] = argv[optind++];
+  }
+
+  log_out = stdout;
+  if(cfg.log_path != NULL && (log_out = fopen(cfg.log_path, "w")) == NULL) {
+    perror(cfg.log_path);
+    return EXIT_FAILURE;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  load_topology();
+  compute_links();
+  nheap = calloc(n_nodes, sizeof(*nheap));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  spawn_nodes();
+
+  for(;;) {
+    uint64_t tn = nheap_len > 0 ? nodes[nheap[0]].key : NEVER;
+    uint64_t tm = mheap_len > 0 ? mheap[0].time : NEVER;
+
+    if(tn >= cfg.duration && tm >= cfg.duration) {
+      break;
+    }
+    chan.events++;
+    /* at the same time, the channel goes first */
+    if(tm <= tn) {
+      medium_ev_t ev = mpop();
+      channel_event(&ev);
+    } else {
+      int n = npop();
+      run_node(n, tn);
+      npush(n);
+    }
+  }
+
+  stop_nodes();
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  fflush(log_out);
+  report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  return EXIT_SUCCESS;
+}
+/*---------------------------------------------------------------------------*/